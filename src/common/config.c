@@ -80,6 +80,11 @@ struct nla_policy joolnl_session_entry_policy[JNLASE_COUNT] = {
 	[JNLASE_EXPIRATION] = { .type = NLA_U32 },
 };
 
+struct nla_policy joolnl_filter_policy[JNLAF_COUNT] = {
+	[JNLAF_SRC6] = { .type = NLA_NESTED },
+	[JNLAF_SRC4] = { .type = NLA_NESTED },
+};
+
 struct nla_policy siit_globals_policy[JNLAG_COUNT] = {
 	[JNLAG_ENABLED] = { .type = NLA_U8 },
 	[JNLAG_POOL6] = { .type = NLA_NESTED },
@@ -108,6 +113,7 @@ struct nla_policy nat64_globals_policy[JNLAG_COUNT] = {
 	[JNLAG_DROP_ICMP6_INFO] = { .type = NLA_U8 },
 	[JNLAG_SRC_ICMP6_BETTER] = { .type = NLA_U8 },
 	[JNLAG_F_ARGS] = { .type = NLA_U8 },
+	[JNLAG_F_HASH] = { .type = NLA_U8 },
 	[JNLAG_HANDLE_RST] = { .type = NLA_U8 },
 	[JNLAG_TTL_TCP_EST] = { .type = NLA_U32 },
 	[JNLAG_TTL_TCP_TRANS] = { .type = NLA_U32 },
@@ -118,6 +124,17 @@ struct nla_policy nat64_globals_policy[JNLAG_COUNT] = {
 	[JNLAG_DROP_BY_ADDR] = { .type = NLA_U8 },
 	[JNLAG_DROP_EXTERNAL_TCP] = { .type = NLA_U8 },
 	[JNLAG_MAX_STORED_PKTS] = { .type = NLA_U32 },
+	[JNLAG_REFRESH_GRANULARITY] = { .type = NLA_U32 },
+	[JNLAG_DET_PREFIX] = { .type = NLA_NESTED },
+	[JNLAG_DET_SUBSCRIBER_LEN] = { .type = NLA_U8 },
+	[JNLAG_DET_BLOCK_SIZE] = { .type = NLA_U32 },
+	[JNLAG_PBA_BLOCK_SIZE] = { .type = NLA_U32 },
+	[JNLAG_BINARY_LOGGING] = { .type = NLA_U8 },
+	[JNLAG_QUOTA_SUBSCRIBER_LEN] = { .type = NLA_U8 },
+	[JNLAG_MAX_BIBS_PER_SUBSCRIBER] = { .type = NLA_U32 },
+	[JNLAG_MAX_SESSIONS_PER_SUBSCRIBER] = { .type = NLA_U32 },
+	[JNLAG_MAX_SESSIONS] = { .type = NLA_U32 },
+	[JNLAG_PRESSURE_TIMEOUTS] = { .type = NLA_U8 },
 	[JNLAG_JOOLD_ENABLED] = { .type = NLA_U8 },
 	[JNLAG_JOOLD_FLUSH_ASAP] = { .type = NLA_U8 },
 	[JNLAG_JOOLD_FLUSH_DEADLINE] = { .type = NLA_U32 },
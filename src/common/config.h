@@ -61,6 +61,13 @@ enum joolnl_operation {
 	JNLOP_JOOLD_ADD,
 	JNLOP_JOOLD_ADVERTISE,
 	JNLOP_JOOLD_ACK,
+
+	JNLOP_BIB_DUMP,
+	JNLOP_SESSION_DUMP,
+	JNLOP_BIB_FIND,
+	JNLOP_SESSION_FIND,
+	JNLOP_SESSION_STATS,
+	JNLOP_SESSION_IMPORT,
 };
 
 enum joolnl_attr_root {
@@ -77,6 +84,14 @@ enum joolnl_attr_root {
 	JNLAR_PROTO,
 	JNLAR_ATOMIC_INIT,
 	JNLAR_ATOMIC_END,
+	JNLAR_EVENTS,
+	JNLAR_BIB_RECS,
+	JNLAR_SESSION_RECS,
+	JNLAR_FILTER,
+	JNLAR_SESSION_STATS,
+	JNLAR_ADDR_STATS,
+	JNLAR_SUBSCRIBER_LEN,
+	JNLAR_IMPORTED,
 	JNLAR_COUNT,
 #define JNLAR_MAX (JNLAR_COUNT - 1)
 };
@@ -151,6 +166,7 @@ enum joolnl_attr_instance_status {
 enum joolnl_attr_instance_add {
 	JNLAIA_XF = 1,
 	JNLAIA_POOL6,
+	JNLAIA_BIB_HASH,
 	JNLAIA_COUNT,
 #define JNLAIA_MAX (JNLAIA_COUNT - 1)
 };
@@ -205,6 +221,16 @@ enum joolnl_attr_session {
 
 extern struct nla_policy joolnl_session_entry_policy[JNLASE_COUNT];
 
+/* Restricts the BIB and session dumps. (See struct bib_filter.) */
+enum joolnl_attr_filter {
+	JNLAF_SRC6 = 1,
+	JNLAF_SRC4,
+	JNLAF_COUNT,
+#define JNLAF_MAX (JNLAF_COUNT - 1)
+};
+
+extern struct nla_policy joolnl_filter_policy[JNLAF_COUNT];
+
 enum joolnl_attr_address_query {
 	JNLAAQ_ADDR6 = 1,
 	JNLAAQ_ADDR4,
@@ -238,6 +264,7 @@ enum joolnl_attr_global {
 	JNLAG_DROP_ICMP6_INFO,
 	JNLAG_SRC_ICMP6_BETTER,
 	JNLAG_F_ARGS,
+	JNLAG_F_HASH,
 	JNLAG_HANDLE_RST,
 	JNLAG_TTL_TCP_EST,
 	JNLAG_TTL_TCP_TRANS,
@@ -246,6 +273,17 @@ enum joolnl_attr_global {
 	JNLAG_BIB_LOGGING,
 	JNLAG_SESSION_LOGGING,
 	JNLAG_MAX_STORED_PKTS,
+	JNLAG_REFRESH_GRANULARITY,
+	JNLAG_DET_PREFIX,
+	JNLAG_DET_SUBSCRIBER_LEN,
+	JNLAG_DET_BLOCK_SIZE,
+	JNLAG_PBA_BLOCK_SIZE,
+	JNLAG_BINARY_LOGGING,
+	JNLAG_QUOTA_SUBSCRIBER_LEN,
+	JNLAG_MAX_BIBS_PER_SUBSCRIBER,
+	JNLAG_MAX_SESSIONS_PER_SUBSCRIBER,
+	JNLAG_MAX_SESSIONS,
+	JNLAG_PRESSURE_TIMEOUTS,
 
 	/* joold */
 	JNLAG_JOOLD_ENABLED,
@@ -397,6 +435,12 @@ enum f_args {
 	F_ARGS_DST_PORT = (1 << 0),
 };
 
+/** Implementations of F(). (RFC 6056 algorithm 3.) */
+enum f_hash {
+	F_HASH_MD5 = 0,
+	F_HASH_SIPHASH = 1,
+};
+
 struct bib_config {
 	/* These values are always measured in milliseconds. */
 	struct {
@@ -408,6 +452,12 @@ struct bib_config {
 
 	bool bib_logging;
 	bool session_logging;
+	/**
+	 * Send the BIB and session log (as selected by the two fields above)
+	 * through the events multicast group, in binary form, instead of the
+	 * kernel log.
+	 */
+	bool binary_logging;
 
 	/** Use Address-Dependent Filtering? */
 	bool drop_by_addr;
@@ -415,6 +465,53 @@ struct bib_config {
 	bool drop_external_tcp;
 
 	__u32 max_stored_pkts;
+
+	/**
+	 * Sessions refreshed less than this many milliseconds after they were
+	 * last queued in their expiration list only get their timestamp
+	 * updated; they are not moved.
+	 */
+	__u32 refresh_granularity;
+
+	/**
+	 * Number of pool4 transport addresses each IPv6 source address gets
+	 * reserved at a time, while it has BIB entries. Block allocation and
+	 * release replace the BIB entry log. Zero disables port blocks.
+	 */
+	__u32 pba_block_size;
+
+	/*
+	 * Per-subscriber quotas. A subscriber is a /@quota_subscriber_len of
+	 * IPv6 source addresses. Zero means no limit. (See quota.h.)
+	 */
+	__u8 quota_subscriber_len;
+	__u32 max_bibs_per_subscriber;
+	__u32 max_sessions_per_subscriber;
+
+	/**
+	 * Maximum number of sessions the instance can hold, across all
+	 * protocols. Zero means no limit. Reaching it evicts old sessions to
+	 * make room for new ones.
+	 */
+	__u32 max_sessions;
+	/**
+	 * Shorten the session timeouts as the session count approaches
+	 * @max_sessions?
+	 */
+	bool pressure_timeouts;
+};
+
+/** Deterministic NAT64 (RFC 7422). */
+struct det_config {
+	/**
+	 * The prefix that contains all the subscribers.
+	 * Deterministic mode is disabled while this is unset.
+	 */
+	struct config_prefix6 prefix;
+	/** Length of each subscriber's prefix. */
+	__u8 subscriber_len;
+	/** Number of pool4 transport addresses each subscriber gets. */
+	__u32 block_size;
 };
 
 #define JOOLD_MAX_PAYLOAD 2048
@@ -566,6 +663,11 @@ struct jool_globals {
 			 * See "enum f_args".
 			 */
 			__u8 f_args;
+			/**
+			 * Function F() hashes @f_args with.
+			 * See "enum f_hash".
+			 */
+			__u8 f_hash;
 			/**
 			 * Decrease timer when a FIN packet is received during the
 			 * `V4 FIN RCV` or `V6 FIN RCV` states?
@@ -574,6 +676,7 @@ struct jool_globals {
 			bool handle_rst_during_fin_rcv;
 
 			struct bib_config bib;
+			struct det_config det;
 			struct joold_config joold;
 		} nat64;
 	};
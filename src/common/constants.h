@@ -67,11 +67,22 @@
 #define DEFAULT_FILTER_ICMPV6_INFO false
 #define DEFAULT_DROP_EXTERNAL_CONNECTIONS false
 #define DEFAULT_MAX_STORED_PKTS 10
+#define DEFAULT_REFRESH_GRANULARITY 1
+#define DEFAULT_DET_SUBSCRIBER_LEN 56
+#define DEFAULT_DET_BLOCK_SIZE 2048
+#define DEFAULT_PBA_BLOCK_SIZE 0
+#define DEFAULT_QUOTA_SUBSCRIBER_LEN 128
+#define DEFAULT_MAX_BIBS_PER_SUBSCRIBER 0
+#define DEFAULT_MAX_SESSIONS_PER_SUBSCRIBER 0
+#define DEFAULT_MAX_SESSIONS 0
+#define DEFAULT_PRESSURE_TIMEOUTS false
 #define DEFAULT_SRC_ICMP6ERRS_BETTER true
 #define DEFAULT_F_ARGS 0b1011
+#define DEFAULT_F_HASH F_HASH_SIPHASH
 #define DEFAULT_HANDLE_FIN_RCV_RST false
 #define DEFAULT_BIB_LOGGING false
 #define DEFAULT_SESSION_LOGGING false
+#define DEFAULT_BINARY_LOGGING false
 
 #define DEFAULT_INSTANCE_ENABLED true
 #define DEFAULT_RESET_TRAFFIC_CLASS false
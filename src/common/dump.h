@@ -0,0 +1,44 @@
+#ifndef SRC_COMMON_DUMP_H_
+#define SRC_COMMON_DUMP_H_
+
+/**
+ * @file
+ * Compact BIB and session records, for the table dumps. (JNLOP_BIB_DUMP and
+ * JNLOP_SESSION_DUMP.)
+ *
+ * Each message of a dump carries an array of them in its JNLAR_BIB_RECS or
+ * JNLAR_SESSION_RECS attribute. They replace the nested attributes of the
+ * foreach operations, which spend more bytes on headers than on addresses.
+ * Every field is in network byte order.
+ */
+
+#include "common/types.h"
+
+struct jool_bib_rec {
+	struct in6_addr src6;
+	struct in_addr src4;
+	__be16 src6_port;
+	__be16 src4_port;
+	__u8 proto; /** enum l4_protocol */
+	__u8 is_static;
+	__u8 reserved[2];
+};
+
+struct jool_session_rec {
+	struct in6_addr src6;
+	struct in6_addr dst6;
+	struct in_addr src4;
+	struct in_addr dst4;
+	/** Milliseconds until the session expires. */
+	__be32 expiration;
+	__be16 src6_port;
+	__be16 dst6_port;
+	__be16 src4_port;
+	__be16 dst4_port;
+	__u8 proto; /** enum l4_protocol */
+	__u8 state; /** enum tcp_state */
+	__u8 timer; /** session_timer_type */
+	__u8 reserved;
+};
+
+#endif /* SRC_COMMON_DUMP_H_ */
@@ -0,0 +1,58 @@
+#ifndef SRC_COMMON_EVENT_H_
+#define SRC_COMMON_EVENT_H_
+
+/**
+ * @file
+ * Binary NAT event log records. (See logging-binary.)
+ *
+ * These are what the kernel module multicasts through the events group, in
+ * place of the BIB and session log's printk()s. Each Netlink message carries
+ * an array of them in its JNLAR_EVENTS attribute. Every field is in network
+ * byte order, so the array can be written to disk as is.
+ */
+
+#include "common/types.h"
+
+#define JOOLNL_EVENTS_GRP_NAME "jool-events"
+
+enum jool_event_type {
+	JEV_BIB_ADD = 1,
+	JEV_BIB_RM,
+	JEV_SESSION_ADD,
+	JEV_SESSION_RM,
+	/** A TCP session changed state; see jool_event.state. */
+	JEV_SESSION_STATE,
+	/** A port block was reserved; see pba-block-size. */
+	JEV_BLOCK_ADD,
+	JEV_BLOCK_RM,
+};
+
+struct jool_event {
+	/** Milliseconds since the Unix epoch. */
+	__be64 time;
+
+	struct in6_addr src6;
+	/**
+	 * BIB and session events: The IPv4 transport address that masks
+	 * src6#src6_port.
+	 * Block events: The first transport address of the block.
+	 */
+	struct in_addr src4;
+	/**
+	 * Session events: The IPv4 node's address.
+	 * Block events: The last transport address of the block.
+	 * BIB events: Zero.
+	 */
+	struct in_addr dst4;
+
+	__be16 src6_port;
+	__be16 src4_port;
+	__be16 dst4_port;
+
+	__u8 type; /** enum jool_event_type */
+	__u8 proto; /** enum l4_protocol */
+	__u8 state; /** enum tcp_state; sessions only */
+	__u8 reserved[7];
+};
+
+#endif /* SRC_COMMON_EVENT_H_ */
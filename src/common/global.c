@@ -270,6 +270,77 @@ static int nl2raw_ttl_tcp_trans(struct nlattr *attr, void *raw, bool force)
 	return error;
 }
 
+static int nl2raw_det_prefix(struct nlattr *attr, void *raw, bool force)
+{
+	struct config_prefix6 *prefix = raw;
+	int error;
+
+	error = jnla_get_prefix6_optional(attr, "det-prefix", prefix);
+	if (error)
+		return error;
+
+	return prefix->set ? prefix6_validate(&prefix->prefix) : 0;
+}
+
+static int nl2raw_det_subscriber_len(struct nlattr *attr, void *raw, bool force)
+{
+	__u8 len;
+
+	len = nla_get_u8(attr);
+	if (len > 128) {
+		log_err("det-subscriber-length (%u) is out of range. (0-128)",
+				len);
+		return -EINVAL;
+	}
+
+	*((__u8 *)raw) = len;
+	return 0;
+}
+
+static int nl2raw_det_block_size(struct nlattr *attr, void *raw, bool force)
+{
+	__u32 size;
+
+	size = nla_get_u32(attr);
+	if (size < 1 || size > 65536) {
+		log_err("det-block-size (%u) is out of range. (1-65536)", size);
+		return -EINVAL;
+	}
+
+	*((__u32 *)raw) = size;
+	return 0;
+}
+
+static int nl2raw_pba_block_size(struct nlattr *attr, void *raw, bool force)
+{
+	__u32 size;
+
+	size = nla_get_u32(attr);
+	if (size > 65536) {
+		log_err("pba-block-size (%u) is out of range. (0-65536)", size);
+		return -EINVAL;
+	}
+
+	*((__u32 *)raw) = size;
+	return 0;
+}
+
+static int nl2raw_quota_subscriber_len(struct nlattr *attr, void *raw,
+		bool force)
+{
+	__u8 len;
+
+	len = nla_get_u8(attr);
+	if (len > 128) {
+		log_err("quota-subscriber-length (%u) is out of range. (0-128)",
+				len);
+		return -EINVAL;
+	}
+
+	*((__u8 *)raw) = len;
+	return 0;
+}
+
 static int nl2raw_f_args(struct nlattr *attr, void *raw, bool force)
 {
 	__u8 f_args;
@@ -284,6 +355,20 @@ static int nl2raw_f_args(struct nlattr *attr, void *raw, bool force)
 	return 0;
 }
 
+static int nl2raw_f_hash(struct nlattr *attr, void *raw, bool force)
+{
+	__u8 hash;
+
+	hash = nla_get_u8(attr);
+	if (hash != F_HASH_MD5 && hash != F_HASH_SIPHASH) {
+		log_err("Unknown F() hash: %u", hash);
+		return -EINVAL;
+	}
+
+	*((__u8 *)raw) = hash;
+	return 0;
+}
+
 #else
 
 static void print_bool(void *value, bool csv)
@@ -385,6 +470,20 @@ static void print_hairpin_mode(void *value, bool csv)
 	printf("unknown");
 }
 
+static void print_f_hash(void *value, bool csv)
+{
+	switch (*((__u8 *)value)) {
+	case F_HASH_MD5:
+		printf("md5");
+		return;
+	case F_HASH_SIPHASH:
+		printf("siphash");
+		return;
+	}
+
+	printf("unknown");
+}
+
 static void print_fargs(void *value, bool csv)
 {
 	__u8 uvalue = *((__u8 *)value);
@@ -599,6 +698,26 @@ static struct jool_result str2nl_hairpin_mode(enum joolnl_attr_global id,
 			: result_success();
 }
 
+static struct jool_result str2nl_f_hash(enum joolnl_attr_global id,
+		char const *str, struct nl_msg *msg)
+{
+	__u8 hash;
+
+	if (strcmp(str, "md5") == 0)
+		hash = F_HASH_MD5;
+	else if (strcmp(str, "siphash") == 0)
+		hash = F_HASH_SIPHASH;
+	else return result_from_error(
+		-EINVAL,
+		"'%s' cannot be parsed as an F() hash.\n"
+		"Available options: siphash, md5", str
+	);
+
+	return (nla_put_u8(msg, id, hash) < 0)
+			? joolnl_err_msgsize()
+			: result_success();
+}
+
 static struct jool_result json2nl_bool(struct joolnl_global_meta const *meta,
 		cJSON *json, struct nl_msg *msg)
 {
@@ -752,6 +871,13 @@ static struct joolnl_global_type gt_hairpin_mode = {
 	USERSPACE_FUNCTIONS(print_hairpin_mode, str2nl_hairpin_mode, json2nl_string, nl2raw_u8)
 };
 
+static struct joolnl_global_type gt_f_hash = {
+	.name = "F() Hash",
+	.candidates = "siphash md5",
+	KERNEL_FUNCTIONS(raw2nl_u8, nl2raw_f_hash)
+	USERSPACE_FUNCTIONS(print_f_hash, str2nl_f_hash, json2nl_string, nl2raw_u8)
+};
+
 static const struct joolnl_global_meta globals_metadata[] = {
 	{
 		.id = JNLAG_ENABLED,
@@ -903,6 +1029,14 @@ static const struct joolnl_global_meta globals_metadata[] = {
 #else
 		.print = print_fargs,
 #endif
+	}, {
+		.id = JNLAG_F_HASH,
+		.name = "f-hash",
+		.type = &gt_f_hash,
+		.doc = "Defines the hash function F() uses.\n"
+			"(F() is defined by algorithm 3 of RFC 6056.)",
+		.offset = offsetof(struct jool_globals, nat64.f_hash),
+		.xt = XT_NAT64,
 	}, {
 		.id = JNLAG_HANDLE_RST,
 		.name = "handle-rst-during-fin-rcv",
@@ -968,6 +1102,98 @@ static const struct joolnl_global_meta globals_metadata[] = {
 		.doc = "Set the maximum allowable 'simultaneous' Simultaneos Opens of TCP connections.",
 		.offset = offsetof(struct jool_globals, nat64.bib.max_stored_pkts),
 		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_REFRESH_GRANULARITY,
+		.name = "session-refresh-granularity",
+		.type = &gt_timeout,
+		.doc = "Set the precision of session expiration timestamps (HH:MM:SS.mmm).",
+		.offset = offsetof(struct jool_globals, nat64.bib.refresh_granularity),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_DET_PREFIX,
+		.name = "det-prefix",
+		.type = &gt_prefix6,
+		.doc = "IPv6 prefix that contains the subscribers of deterministic NAT64. (Unset disables deterministic mode.)",
+		.offset = offsetof(struct jool_globals, nat64.det.prefix),
+		.xt = XT_NAT64,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_det_prefix,
+#endif
+	}, {
+		.id = JNLAG_DET_SUBSCRIBER_LEN,
+		.name = "det-subscriber-length",
+		.type = &gt_uint8,
+		.doc = "Prefix length of each deterministic NAT64 subscriber.",
+		.offset = offsetof(struct jool_globals, nat64.det.subscriber_len),
+		.xt = XT_NAT64,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_det_subscriber_len,
+#endif
+	}, {
+		.id = JNLAG_DET_BLOCK_SIZE,
+		.name = "det-block-size",
+		.type = &gt_uint32,
+		.doc = "Number of pool4 transport addresses reserved for each deterministic NAT64 subscriber.",
+		.offset = offsetof(struct jool_globals, nat64.det.block_size),
+		.xt = XT_NAT64,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_det_block_size,
+#endif
+	}, {
+		.id = JNLAG_PBA_BLOCK_SIZE,
+		.name = "pba-block-size",
+		.type = &gt_uint32,
+		.doc = "Number of pool4 transport addresses reserved at a time for each IPv6 source address. (Zero disables port block allocation.)",
+		.offset = offsetof(struct jool_globals, nat64.bib.pba_block_size),
+		.xt = XT_NAT64,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_pba_block_size,
+#endif
+	}, {
+		.id = JNLAG_BINARY_LOGGING,
+		.name = "logging-binary",
+		.type = &gt_bool,
+		.doc = "Send the BIB and session logs to the events multicast group (in binary) instead of the kernel log?",
+		.offset = offsetof(struct jool_globals, nat64.bib.binary_logging),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_QUOTA_SUBSCRIBER_LEN,
+		.name = "quota-subscriber-length",
+		.type = &gt_uint8,
+		.doc = "Prefix length of the IPv6 source addresses that share a quota.",
+		.offset = offsetof(struct jool_globals, nat64.bib.quota_subscriber_len),
+		.xt = XT_NAT64,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_quota_subscriber_len,
+#endif
+	}, {
+		.id = JNLAG_MAX_BIBS_PER_SUBSCRIBER,
+		.name = "max-bibs-per-subscriber",
+		.type = &gt_uint32,
+		.doc = "Maximum number of dynamic BIB entries per subscriber and protocol. (Zero means no limit.)",
+		.offset = offsetof(struct jool_globals, nat64.bib.max_bibs_per_subscriber),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_MAX_SESSIONS_PER_SUBSCRIBER,
+		.name = "max-sessions-per-subscriber",
+		.type = &gt_uint32,
+		.doc = "Maximum number of sessions per subscriber and protocol. (Zero means no limit.)",
+		.offset = offsetof(struct jool_globals, nat64.bib.max_sessions_per_subscriber),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_MAX_SESSIONS,
+		.name = "max-sessions",
+		.type = &gt_uint32,
+		.doc = "Maximum number of sessions the instance can hold. Old sessions are evicted to make room for new ones. (Zero means no limit.)",
+		.offset = offsetof(struct jool_globals, nat64.bib.max_sessions),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_PRESSURE_TIMEOUTS,
+		.name = "pressure-timeouts",
+		.type = &gt_bool,
+		.doc = "Shorten the session timeouts as the session count approaches max-sessions?",
+		.offset = offsetof(struct jool_globals, nat64.bib.pressure_timeouts),
+		.xt = XT_NAT64,
 	}, {
 		.id = JNLAG_JOOLD_ENABLED,
 		.name = "ss-enabled",
@@ -6,10 +6,18 @@
 #define IPTABLES_SIIT_MODULE_NAME "JOOL_SIIT"
 #define IPTABLES_NAT64_MODULE_NAME "JOOL"
 
+struct jool_target;
+
 /* Mind alignment on this structure. */
 struct target_info {
 	char iname[INAME_MAX_SIZE];
 	__u8 type; /* xlator_type */
+
+	/*
+	 * Kernel-only; shortcut to the instance. Userspace should neither
+	 * read nor write it.
+	 */
+	struct jool_target *cache __attribute__((aligned(8)));
 };
 
 #endif /* SRC_COMMON_IPTABLES_H_ */
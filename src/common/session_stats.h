@@ -0,0 +1,73 @@
+#ifndef SRC_COMMON_SESSION_STATS_H_
+#define SRC_COMMON_SESSION_STATS_H_
+
+/**
+ * @file
+ * Aggregate numbers of a session table. (JNLOP_SESSION_STATS.)
+ *
+ * The reply carries one struct jool_session_stats in its JNLAR_SESSION_STATS
+ * attribute, and an array of struct jool_addr_stats (one per pool4 address
+ * that has ever been used) in JNLAR_ADDR_STATS. Every field is in network
+ * byte order.
+ */
+
+#include "common/types.h"
+
+/* tcp_state has this many values. */
+#define JSS_STATES 7
+/* session_timer_type has this many values. */
+#define JSS_TIMERS 3
+
+/*
+ * Upper bounds (in seconds, exclusive) of the idle time histogram's buckets.
+ * The last bucket has no upper bound.
+ */
+#define JSS_IDLE_BOUNDS { 1, 10, 60, 300, 1800, 7200, 14400 }
+#define JSS_IDLE_BUCKETS 8
+
+/*
+ * Bucket i of the subscriber histogram counts the subscribers that have
+ * [2^i, 2^(i + 1)) sessions. The last bucket has no upper bound.
+ */
+#define JSS_SUBSCRIBER_BUCKETS 12
+
+struct jool_session_stats {
+	/* Maintained as the table changes. */
+
+	/** Sessions per TCP state. (enum tcp_state; always ESTABLISHED in UDP and ICMP.) */
+	__be32 states[JSS_STATES];
+	/** Sessions per expiration list. (session_timer_type) */
+	__be32 timers[JSS_TIMERS];
+
+	/* Computed on demand. */
+
+	/** Sessions per time since their last packet. (See JSS_IDLE_BOUNDS.) */
+	__be32 idle[JSS_IDLE_BUCKETS];
+	/** Subscribers per session count. (See JSS_SUBSCRIBER_BUCKETS.) */
+	__be32 subscribers[JSS_SUBSCRIBER_BUCKETS];
+	/** Number of subscribers that have at least one session. */
+	__be32 subscriber_count;
+	/** Length of the IPv6 prefix that identifies a subscriber. */
+	__u8 subscriber_len;
+	/**
+	 * Zero if the subscriber histogram could not be computed. (Because
+	 * the table is hashed.)
+	 */
+	__u8 has_subscribers;
+	__u8 reserved[2];
+
+	/* Constant for a given table. */
+
+	/** Bytes of kernel memory each BIB entry takes. */
+	__be32 bib_bytes;
+	/** Bytes of kernel memory each session takes. */
+	__be32 session_bytes;
+};
+
+struct jool_addr_stats {
+	struct in_addr addr;
+	/** BIB entries that are currently masking with @addr. */
+	__be32 bibs;
+};
+
+#endif /* SRC_COMMON_SESSION_STATS_H_ */
@@ -18,6 +18,8 @@ enum jool_stat_id {
 
 	JSTAT_BIB_ENTRIES,
 	JSTAT_SESSIONS,
+	JSTAT_BIB_BYTES,
+	JSTAT_SESSION_BYTES,
 
 	JSTAT_ENOMEM,
 
@@ -45,6 +47,8 @@ enum jool_stat_id {
 	JSTAT_UNTRANSLATABLE_DST4,
 	JSTAT_6056_F,
 	JSTAT_MASK_DOMAIN_NOT_FOUND,
+	JSTAT_DET_NOT_SUBSCRIBER,
+	JSTAT_DET_NO_BLOCK,
 	JSTAT_BIB6_NOT_FOUND,
 	JSTAT_BIB4_NOT_FOUND,
 	JSTAT_SESSION_NOT_FOUND,
@@ -93,6 +97,32 @@ enum jool_stat_id {
 
 	JSTAT_ICMPEXT_BIG,
 
+	JSTAT64_IN_PLACE,
+	JSTAT64_COPY,
+	JSTAT46_IN_PLACE,
+	JSTAT46_COPY,
+
+	JSTAT_BIB_ALLOC_AVOIDED,
+	JSTAT_SESSION_ALLOC_AVOIDED,
+
+	JSTAT_PBA_ALLOCATED,
+	JSTAT_PBA_RELEASED,
+	JSTAT_PBA_EXHAUSTED,
+
+	JSTAT_BIB_QUOTA,
+	JSTAT_SESSION_QUOTA,
+	JSTAT_SESSION_EVICTED,
+	JSTAT_SESSION_LIMIT,
+
+	JSTAT_EVLOG_QUEUED,
+	JSTAT_EVLOG_DROPPED,
+
+	JSTAT_EXPIRE_HOLD_10US,
+	JSTAT_EXPIRE_HOLD_100US,
+	JSTAT_EXPIRE_HOLD_1MS,
+	JSTAT_EXPIRE_HOLD_10MS,
+	JSTAT_EXPIRE_HOLD_SLOW,
+
 	JSTAT_JOOLD_EMPTY,
 	JSTAT_JOOLD_TIMEOUT,
 	JSTAT_JOOLD_MISSING_ACK,
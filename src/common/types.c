@@ -93,3 +93,85 @@ bool ipv4_range_touches(struct ipv4_range const *r1, struct ipv4_range const *r2
 			&& r1->prefix.len == r2->prefix.len
 			&& port_range_touches(&r1->ports, &r2->ports);
 }
+
+/* Returns the @len (max 32) bits of @addr that start at bit @offset. */
+static __u32 addr6_get_bits(struct in6_addr const *addr, unsigned int offset,
+		unsigned int len)
+{
+	unsigned int word = offset >> 5;
+	__u64 window;
+
+	if (len == 0)
+		return 0;
+
+	window = ((__u64)ntohl(addr->s6_addr32[word])) << 32;
+	if (word < 3)
+		window |= ntohl(addr->s6_addr32[word + 1]);
+
+	return (window << (offset & 31)) >> (64 - len);
+}
+
+/* Overrides the @len (max 32) bits of @addr that start at bit @offset. */
+static void addr6_set_bits(struct in6_addr *addr, unsigned int offset,
+		unsigned int len, __u32 value)
+{
+	unsigned int i;
+	unsigned int bit;
+
+	for (i = 0; i < len; i++) {
+		bit = offset + i;
+		if ((value >> (len - i - 1)) & 1U)
+			addr->s6_addr[bit >> 3] |= 0x80U >> (bit & 7);
+		else
+			addr->s6_addr[bit >> 3] &= ~(0x80U >> (bit & 7));
+	}
+}
+
+bool det_validate(struct ipv6_prefix const *space, __u8 subscriber_len)
+{
+	return space->len <= subscriber_len
+			&& subscriber_len <= 128
+			&& subscriber_len - space->len <= 32;
+}
+
+/**
+ * Returns false if @addr does not belong to any subscriber.
+ */
+bool det_subscriber_index(struct ipv6_prefix const *space, __u8 subscriber_len,
+		struct in6_addr const *addr, __u32 *result)
+{
+	unsigned int i;
+	unsigned int len;
+
+	if (!det_validate(space, subscriber_len))
+		return false;
+
+	for (i = 0; i < space->len; i += len) {
+		len = space->len - i;
+		if (len > 32)
+			len = 32;
+		if (addr6_get_bits(addr, i, len) != addr6_get_bits(&space->addr, i, len))
+			return false;
+	}
+
+	*result = addr6_get_bits(addr, space->len, subscriber_len - space->len);
+	return true;
+}
+
+/**
+ * Inverse of det_subscriber_index(). Assumes det_validate() and that @index
+ * fits.
+ */
+void det_subscriber_prefix(struct ipv6_prefix const *space,
+		__u8 subscriber_len, __u32 index, struct ipv6_prefix *result)
+{
+	unsigned int i;
+
+	memset(&result->addr, 0, sizeof(result->addr));
+	for (i = 0; i < space->len; i++)
+		if (space->addr.s6_addr[i >> 3] & (0x80U >> (i & 7)))
+			result->addr.s6_addr[i >> 3] |= 0x80U >> (i & 7);
+	addr6_set_bits(&result->addr, space->len, subscriber_len - space->len,
+			index);
+	result->len = subscriber_len;
+}
@@ -33,6 +33,12 @@ typedef unsigned int xlator_framework; /** Bitwise or'd XF_* constants below. */
 #define XF_NETFILTER (1 << 2)
 #define XF_IPTABLES (1 << 3)
 
+/*
+ * Index the BIB with hash tables instead of trees. (NAT64 only.)
+ * Only meaningful during instance creation.
+ */
+#define XO_BIB_HASH (1 << 4)
+
 #define XT_ANY (XT_SIIT | XT_NAT64)
 #define XF_ANY (XF_NETFILTER | XF_IPTABLES)
 
@@ -247,4 +253,17 @@ void port_range_fuse(struct port_range *r1, const struct port_range *r2);
 bool ipv4_range_equals(struct ipv4_range const *r1, struct ipv4_range const *r2);
 bool ipv4_range_touches(struct ipv4_range const *r1, struct ipv4_range const *r2);
 
+/*
+ * Deterministic NAT64 (RFC 7422).
+ *
+ * @space is the prefix that contains all the subscribers, and @subscriber_len
+ * is the length of each subscriber's prefix. The bits in between are the
+ * subscriber's index.
+ */
+bool det_validate(struct ipv6_prefix const *space, __u8 subscriber_len);
+bool det_subscriber_index(struct ipv6_prefix const *space, __u8 subscriber_len,
+		struct in6_addr const *addr, __u32 *result);
+void det_subscriber_prefix(struct ipv6_prefix const *space,
+		__u8 subscriber_len, __u32 index, struct ipv6_prefix *result);
+
 #endif /* SRC_COMMON_TYPES_H */
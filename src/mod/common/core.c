@@ -13,7 +13,7 @@
 
 static verdict validate_xlator(struct xlation *state)
 {
-	struct jool_globals *cfg = &state->jool.globals;
+	struct jool_globals *cfg = &state->jool->globals;
 
 	if (!cfg->enabled)
 		return untranslatable(state, JSTAT_XLATOR_DISABLED);
@@ -44,14 +44,29 @@ static verdict core_common(struct xlation *state)
 	if (result != VERDICT_CONTINUE)
 		return result;
 
-	if (state->jool.is_hairpin(state)) {
+	if (state->jool->is_hairpin(state)) {
 		skb_dst_drop(state->out.skb);
-		result = state->jool.handling_hairpinning(state);
+		result = state->jool->handling_hairpinning(state);
 		kfree_skb(state->out.skb); /* Put this inside of hh()? */
 	} else {
 		result = sendpkt_send(state);
 		/* sendpkt_send() releases out's skb regardless of verdict. */
 	}
+
+	if (xlation_is_in_place(state)) {
+		/*
+		 * The incoming packet *was* the outgoing packet, so it's gone
+		 * regardless of verdict. Neither the kernel nor the ICMP error
+		 * code can touch it anymore.
+		 */
+		if (result != VERDICT_CONTINUE) {
+			state->result.icmp = ICMPERR_NONE;
+			return VERDICT_STOLEN;
+		}
+		log_debug(state, "Success.");
+		return stolen(state, JSTAT_SUCCESS);
+	}
+
 	if (result != VERDICT_CONTINUE)
 		return result;
 
@@ -77,9 +92,9 @@ static void send_icmp4_error(struct xlation *state, verdict result)
 	if (result == VERDICT_UNTRANSLATABLE)
 		return; /* Linux will decide what to do. */
 
-	success = icmp64_send4(&state->jool, state->in.skb,
+	success = icmp64_send4(state->jool, state->in.skb,
 			state->result.icmp, state->result.info);
-	jstat_inc(state->jool.stats, success
+	jstat_inc(state->jool->stats, success
 			? JSTAT_ICMP4ERR_SUCCESS
 			: JSTAT_ICMP4ERR_FAILURE);
 }
@@ -88,7 +103,7 @@ verdict core_4to6(struct sk_buff *skb, struct xlation *state)
 {
 	verdict result;
 
-	jstat_inc(state->jool.stats, JSTAT_RECEIVED4);
+	jstat_inc(state->jool->stats, JSTAT_RECEIVED4);
 
 	/*
 	 * PLEASE REFRAIN FROM READING HEADERS FROM @skb UNTIL
@@ -106,7 +121,7 @@ verdict core_4to6(struct sk_buff *skb, struct xlation *state)
 	if (result != VERDICT_CONTINUE)
 		goto end;
 
-	if (state->jool.globals.debug)
+	if (state->jool->globals.debug)
 		pkt_trace4(state);
 
 	result = core_common(state);
@@ -126,9 +141,9 @@ static void send_icmp6_error(struct xlation *state, verdict result)
 	if (result == VERDICT_UNTRANSLATABLE)
 		return; /* Linux will decide what to do. */
 
-	success = icmp64_send6(&state->jool, state->in.skb,
+	success = icmp64_send6(state->jool, state->in.skb,
 			state->result.icmp, state->result.info);
-	jstat_inc(state->jool.stats, success
+	jstat_inc(state->jool->stats, success
 			? JSTAT_ICMP6ERR_SUCCESS
 			: JSTAT_ICMP6ERR_FAILURE);
 }
@@ -137,7 +152,7 @@ verdict core_6to4(struct sk_buff *skb, struct xlation *state)
 {
 	verdict result;
 
-	jstat_inc(state->jool.stats, JSTAT_RECEIVED6);
+	jstat_inc(state->jool->stats, JSTAT_RECEIVED6);
 
 	/*
 	 * PLEASE REFRAIN FROM READING HEADERS FROM @skb UNTIL
@@ -155,7 +170,7 @@ verdict core_6to4(struct sk_buff *skb, struct xlation *state)
 	if (result != VERDICT_CONTINUE)
 		goto end;
 
-	if (state->jool.globals.debug)
+	if (state->jool->globals.debug)
 		pkt_trace6(state);
 
 	result = core_common(state);
@@ -1,20 +1,46 @@
 #include "mod/common/db/bib/db.h"
 
 #include <linux/ktime.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/rcupdate.h>
+#include <linux/rhashtable.h>
+#include <linux/seqlock.h>
 #include <net/ip6_checksum.h>
 
 #include "common/constants.h"
+#include "mod/common/evlog.h"
 #include "mod/common/icmp_wrapper.h"
 #include "mod/common/log.h"
+#include "mod/common/rfc6052.h"
 #include "mod/common/wkmalloc.h"
 #include "mod/common/db/rbtree.h"
+#include "mod/common/db/bib/pba.h"
 #include "mod/common/db/bib/pkt_queue.h"
+#include "mod/common/db/bib/port_map.h"
+#include "mod/common/db/bib/quota.h"
 
 #define XGLOBALS(xlator) (xlator->globals.nat64.bib)
-#define GLOBALS(state) (state->jool.globals.nat64.bib)
+#define GLOBALS(state) (state->jool->globals.nat64.bib)
 
 /*
- * TODO (performance) Maybe pack this?
+ * Each table is split into this many shards, so translations that touch
+ * different entries don't fight over the same lock. (See struct bib_table.)
+ */
+#define BIB_SHARD_BITS 4
+#define BIB_SHARDS (1 << BIB_SHARD_BITS)
+/*
+ * pool4 usually has few addresses, so sharding by address alone would not
+ * spread the load much. Instead, each address is split into blocks of
+ * 2^BIB_SHARD_PORT_BITS consecutive ports, and the blocks are scattered across
+ * the shards. Keeping consecutive ports together also means every word of the
+ * port index belongs to a single shard. (See port_map.h.)
+ */
+#define BIB_SHARD_PORT_BITS 6
+
+/*
+ * There can be millions of these (and of tabled_sessions), so please keep them
+ * tight.
  */
 struct tabled_bib {
 	/**
@@ -34,27 +60,76 @@ struct tabled_bib {
 	 */
 	struct ipv6_transport_addr src6;
 	struct ipv4_transport_addr src4;
-	l4_protocol proto;
+	/** l4_protocol, but one byte is plenty. */
+	__u8 proto;
 	bool is_static;
-
-	struct rb_node hook6;
+	/**
+	 * The port block @src4 was taken from, or NULL if the entry was not
+	 * allocated from a block. (See pba.h.)
+	 */
+	struct pba_block *block;
+	/**
+	 * The subscriber whose quotas the entry counts against, or NULL if
+	 * quotas were disabled when the entry was created. (See quota.h.)
+	 */
+	struct quota_subscriber *subscriber;
+
+	union {
+		/* Table is not hashed */
+		struct rb_node hook6;
+		/* Table is hashed */
+		struct rhash_head hash6;
+	};
 	struct rb_node hook4;
+	/* Only used if the table is hashed */
+	struct rhash_head hash4;
 
 	struct rb_root sessions;
+
+	struct rcu_head rcu;
 };
 
-/*
- * TODO (performance) Maybe pack this?
- */
 struct tabled_session {
-	/**
-	 * We don't strictly need to store @dst6; @dst6 is always @dst4 plus the
-	 * pool6 prefix. But we store it anyway so I don't have to make more
-	 * mess constatly in this module.
+	/*
+	 * There's no dst6 field; dst6 is always dst4 plus the pool6 prefix,
+	 * and NAT64 instances are not allowed to change their pool6.
+	 * (See get_dst6().)
 	 */
-	struct ipv6_transport_addr dst6;
 	struct ipv4_transport_addr dst4;
-	tcp_state state;
+	/**
+	 * Lower half of the jiffy this session was queued at its current
+	 * position in its expirer's list. (See get_queue_time().)
+	 */
+	__u32 queue_time;
+	/**
+	 * Jiffies between @queue_time and the last time this session was
+	 * updated/used. (See get_update_time().)
+	 *
+	 * Lazy refreshes never move the update time further than a granularity
+	 * away from the queue time (see get_granularity()), so 16 bits are
+	 * plenty. Everything else requeues. (See set_update_time().)
+	 *
+	 * This is the only field lockless readers write, so it must not share
+	 * its memory location with the bitfields below.
+	 */
+	__u16 update_delta;
+	/** tcp_state. */
+	__u8 state:3;
+	/**
+	 * session_timer_type; selects the expire_timer (from the shard) whose
+	 * list this session is queued in.
+	 */
+	__u8 timer:2;
+	/**
+	 * Is there a type 2 packet waiting on this session? (If so, it can be
+	 * found in the shard's @stored_pkts.)
+	 */
+	__u8 has_stored:1;
+	/**
+	 * Was this session allocated as a struct hashed_session?
+	 * (See alloc_session().)
+	 */
+	__u8 hashed:1;
 	/** MUST NOT be NULL. */
 	struct tabled_bib *bib;
 
@@ -85,13 +160,40 @@ struct tabled_session {
 	 */
 	struct rb_node tree_hook;
 
-	unsigned long update_time;
-	/** MUST NOT be NULL. */
-	struct expire_timer *expirer;
-	struct list_head list_hook;
+	union {
+		/* While the session is in the database. */
+		struct list_head list_hook;
+		/*
+		 * Once the session has been removed.
+		 * (Lockless readers never touch @list_hook.)
+		 */
+		struct rcu_head rcu;
+	};
+};
+
+/**
+ * A session from a hashed table.
+ *
+ * Most tables are not hashed, so the hook lives out here, where it doesn't cost
+ * the rest of the sessions anything.
+ */
+struct hashed_session {
+	struct tabled_session session;
+	struct rhash_head hook;
+};
 
-	/** See pke_queue.h for some thoughts on stored packets. */
-	struct sk_buff *stored;
+/**
+ * A type 2 packet (see pkt_queue.h), kept aside until its session either
+ * establishes or expires.
+ *
+ * There can only be a handful of these (see max_stored_pkts), so they're not
+ * worth a field in every session.
+ */
+struct stored_pkt {
+	/** The session that's waiting for the packet's fate. */
+	struct tabled_session *session;
+	struct sk_buff *skb;
+	struct list_head list_hook;
 };
 
 struct bib_session_tuple {
@@ -116,51 +218,167 @@ struct probing_session {
 };
 
 struct expire_timer {
+	/** Sorted by queue_time. */
 	struct list_head sessions;
+	/**
+	 * Sessions that reached the head of @sessions, but turned out to have
+	 * been refreshed lazily since. Also sorted by queue_time.
+	 */
+	struct list_head deferred;
 	session_timer_type type;
+	l4_protocol proto;
 	fate_cb decide_fate_cb;
 };
 
-struct bib_table {
-	/** Indexes the entries using their IPv6 identifiers. */
-	struct rb_root tree6;
-	/** Indexes the entries using their IPv4 identifiers. */
+struct bib_table;
+
+/**
+ * A slice of a table's IPv4 index. It owns the BIB entries whose src4 hashes
+ * to it (see get_shard4()), as well as their sessions.
+ */
+struct bib_shard {
+	/** Indexes this shard's entries using their IPv4 identifiers. */
 	struct rb_root tree4;
+	/** Indexes this shard's entries by src4. (Only if the table is hashed.) */
+	struct rhashtable hash4;
+	/**
+	 * Indexes this shard's sessions by src4 and dst4. (Only if the table
+	 * is hashed.)
+	 */
+	struct rhashtable session_hash;
 
 	spinlock_t lock;
+	seqcount_t seq;
 
-	/** Expires this table's established sessions. */
+	/** Expires this shard's established sessions. */
 	struct expire_timer est_timer;
-
-	/*
-	 * =============================================================
-	 * Fields below are only relevant in the TCP table.
-	 * (If you need to know what "type 1" and "type 2" mean, see the
-	 * pkt_queue module's .h.)
-	 * =============================================================
-	 */
-
 	/**
-	 * Expires this table's transitory sessions.
+	 * Expires this shard's transitory sessions.
 	 * This is initialized in the UDP/ICMP tables, but all their operations
 	 * become no-ops.
 	 */
 	struct expire_timer trans_timer;
 	/**
-	 * Expires this table's type-2 packets and their sessions.
+	 * Expires this shard's type-2 packets and their sessions.
 	 * This is initialized in the UDP/ICMP tables, but all their operations
 	 * become no-ops.
 	 */
 	struct expire_timer syn4_timer;
+	/**
+	 * This shard's type-2 packets. (struct stored_pkt)
+	 * Always empty in the UDP/ICMP tables.
+	 */
+	struct list_head stored_pkts;
+
+	/*
+	 * How many of this shard's sessions are in each TCP state, and in each
+	 * expirer. (See count_session().)
+	 */
+	unsigned int state_count[JSS_STATES];
+	unsigned int timer_count[JSS_TIMERS];
+
+	struct bib_table *table;
+};
+
+/**
+ * A slice of a table's IPv6 index. Entries are assigned to these by src6 hash.
+ * (See get_shard6().)
+ */
+struct bib_shard6 {
+	/** Unused if the table is hashed. (@hash6 replaces it.) */
+	struct rb_root tree6;
+	spinlock_t lock;
+	seqcount_t seq;
+};
+
+/*
+ * Concurrency notes:
+ *
+ * A table is split into BIB_SHARDS shards, and each of them has its own lock.
+ * BIB entries (along with their sessions and timers) belong to the shard
+ * selected by their src4. The src6 index lives apart, in its own slices,
+ * because there's no way to predict a new entry's src4 out of its src6.
+ *
+ * Writers (anyone who adds, removes or modifies entries) need to hold the
+ * shard's lock, and bump its @seq while they're at it. (See shard_lock().)
+ * Adding an entry to (or removing it from) the src6 index additionally needs
+ * the corresponding bib_shard6's lock. This second lock is always the inner
+ * one; nobody requests a shard's lock while holding a bib_shard6's lock.
+ *
+ * Nobody holds two shard locks at the same time either, except for the
+ * foreaches, which need a consistent view of the whole table. (They serialize
+ * themselves through @walk_lock. See lock_all().)
+ *
+ * The IPv6 lookups find the entry in the src6 index first, which reveals the
+ * shard. Since the entry might die before the shard is locked, the lookup is
+ * validated once the lock is held. (See find_bib6_locked().)
+ *
+ * The packet path first attempts to find established sessions without any
+ * locks: It searches the trees inside an RCU read-side critical section (nodes
+ * are only freed after a grace period), and then discards the result if the
+ * seqcounts reveal that a writer interfered. (See find_session6_rcu().)
+ * Anything else (additions, state transitions, timer refreshes, interference)
+ * falls back to the locks.
+ *
+ * There's one known benign race: A type 1 packet (see pkt_queue.h) can be
+ * stored while some other CPU is choosing its src4 for an unrelated BIB entry.
+ * If the latter wins, the Simultaneous Open fails, and the stored packet is
+ * eventually answered with an ICMP error. (Which is what would have happened
+ * if the packets had arrived in the opposite order.)
+ */
+struct bib_table {
+	struct bib_shard shards4[BIB_SHARDS];
+	struct bib_shard6 shards6[BIB_SHARDS];
+
+	/*
+	 * Optional hash indexes. (See bib_alloc().)
+	 *
+	 * The trees remain in charge of everything that needs order (pool4
+	 * mask allocation and paginated display), but exact-match lookups are
+	 * a lot cheaper on hash tables once the database grows large.
+	 *
+	 * If @hashed, @hash6 replaces the shards6' trees entirely (since nobody
+	 * needs the entries sorted by src6), while the shards4' hash tables
+	 * duplicate their trees.
+	 *
+	 * If !@hashed, the hash tables are not initialized.
+	 */
+	bool hashed;
+	/** Indexes the entries by src6. */
+	struct rhashtable hash6;
+
+	/** Serializes the operations that need to lock all the shards. */
+	spinlock_t walk_lock;
+
+	/**
+	 * The ports taken by the entries, so find_available_mask() can skip
+	 * them without touching the trees. Each port is guarded by the lock
+	 * of its shard4.
+	 */
+	struct port_maps ports;
+	/** The port blocks owned by the entries' src6s. */
+	struct pba_table pba;
+	/** The subscribers the entries count against. */
+	struct quota_table quota;
+
+	/*
+	 * =============================================================
+	 * Fields below are only relevant in the TCP table.
+	 * (If you need to know what "type 1" and "type 2" mean, see the
+	 * pkt_queue module's .h.)
+	 * =============================================================
+	 */
 
 	/** Current number of packets (of both types) in the table. */
-	int pkt_count;
+	atomic_t pkt_count;
 
 	/**
 	 * Packet storage for type 1 packets.
 	 * This is NULL in UDP/ICMP.
 	 */
 	struct pktqueue *pkt_queue;
+	/** Protects @pkt_queue. Inner to the shard locks. */
+	spinlock_t pktqueue_lock;
 };
 
 struct bib {
@@ -171,2054 +389,4710 @@ struct bib {
 	/** The session table for ICMP conversations. */
 	struct bib_table icmp;
 
+	/** Sessions in the three tables. (See make_room().) */
+	atomic_t session_count;
+	/** Rotates the first shard make_room() looks at. */
+	atomic_t evict_cursor;
+
 	struct kref refs;
 };
 
 static struct kmem_cache *bib_cache;
 static struct kmem_cache *session_cache;
+static struct kmem_cache *hashed_session_cache;
 
 #define alloc_bib(flags) wkmem_cache_alloc("bib entry", bib_cache, flags)
-#define alloc_session(flags) wkmem_cache_alloc("session", session_cache, flags)
 #define free_bib(bib) wkmem_cache_free("bib entry", bib_cache, bib)
-#define free_session(session) wkmem_cache_free("session", session_cache, session)
 
-static struct tabled_bib *bib6_entry(const struct rb_node *node)
+#define hashed_session(ts) container_of(ts, struct hashed_session, session)
+
+/*
+ * Sessions from hashed tables need the hash hook; the rest don't.
+ */
+static struct tabled_session *alloc_session(bool hashed, gfp_t flags)
 {
-	return node ? rb_entry(node, struct tabled_bib, hook6) : NULL;
+	struct hashed_session *hs;
+	struct tabled_session *session;
+
+	if (hashed) {
+		hs = wkmem_cache_alloc("session", hashed_session_cache, flags);
+		session = hs ? &hs->session : NULL;
+	} else {
+		session = wkmem_cache_alloc("session", session_cache, flags);
+	}
+
+	if (session)
+		session->hashed = hashed;
+	return session;
 }
 
-static struct tabled_bib *bib4_entry(const struct rb_node *node)
+static void free_session(struct tabled_session *session)
 {
-	return node ? rb_entry(node, struct tabled_bib, hook4) : NULL;
+	if (session->hashed)
+		wkmem_cache_free("session", hashed_session_cache,
+				hashed_session(session));
+	else
+		wkmem_cache_free("session", session_cache, session);
 }
 
-static struct tabled_session *node2session(const struct rb_node *node)
+/*
+ * Lockless readers might still be looking at entries that used to be indexed,
+ * so these need to wait for a grace period.
+ */
+
+static void __free_bib_rcu(struct rcu_head *rcu)
 {
-	return node ? rb_entry(node, struct tabled_session, tree_hook) : NULL;
+	free_bib(container_of(rcu, struct tabled_bib, rcu));
 }
 
-/**
- * "[Convert] tabled BIB to BIB entry"
+static void __free_session_rcu(struct rcu_head *rcu)
+{
+	free_session(container_of(rcu, struct tabled_session, rcu));
+}
+
+#define free_bib_rcu(bib) call_rcu(&(bib)->rcu, __free_bib_rcu)
+#define free_session_rcu(session) call_rcu(&(session)->rcu, __free_session_rcu)
+
+/*
+ * Locks @shard for writing. Also invalidates ongoing lockless lookups.
  */
-static void tbtobe(struct tabled_bib *tabled, struct bib_entry *bib)
+static void shard_lock(struct bib_shard *shard)
 {
-	if (!bib)
-		return;
+	spin_lock_bh(&shard->lock);
+	write_seqcount_begin(&shard->seq);
+}
 
-	bib->addr6 = tabled->src6;
-	bib->addr4 = tabled->src4;
-	bib->l4_proto = tabled->proto;
-	bib->is_static = tabled->is_static;
+static void shard_unlock(struct bib_shard *shard)
+{
+	write_seqcount_end(&shard->seq);
+	spin_unlock_bh(&shard->lock);
 }
 
-static unsigned long get_timeout(struct xlator *jool,
-		struct expire_timer *expirer)
+static void shard6_lock(struct bib_shard6 *shard6)
 {
-	struct bib *db = jool->nat64.bib;
-	__u32 msecs;
-
-	if (&db->tcp.est_timer == expirer)
-		msecs = XGLOBALS(jool).ttl.tcp_est;
-	else if (&db->tcp.trans_timer == expirer)
-		msecs = XGLOBALS(jool).ttl.tcp_trans;
-	else if (&db->udp.est_timer == expirer)
-		msecs = XGLOBALS(jool).ttl.udp;
-	else if (&db->tcp.syn4_timer == expirer)
-		msecs = 1000 * TCP_INCOMING_SYN;
-	else if (&db->icmp.est_timer == expirer)
-		msecs = XGLOBALS(jool).ttl.icmp;
-	else {
-		/*
-		 * This is known to happen whenever the timer is cleaning.
-		 * It's not cause for concern.
-		 */
-		msecs = 0;
-	}
+	spin_lock_bh(&shard6->lock);
+	write_seqcount_begin(&shard6->seq);
+}
 
-	return msecs_to_jiffies(msecs);
+static void shard6_unlock(struct bib_shard6 *shard6)
+{
+	write_seqcount_end(&shard6->seq);
+	spin_unlock_bh(&shard6->lock);
 }
 
-/**
- * "[Convert] tabled session to session entry"
+/*
+ * Locks all of @table's shards, for operations that need to see the entire
+ * table at once.
  */
-static void tstose(struct xlator *jool,
-		struct tabled_session *ts,
-		struct session_entry *se)
+static void lock_all(struct bib_table *table)
 {
-	se->src6 = ts->bib->src6;
-	se->dst6 = ts->dst6;
-	se->src4 = ts->bib->src4;
-	se->dst4 = ts->dst4;
-	se->proto = ts->bib->proto;
-	se->state = ts->state;
-	se->timer_type = ts->expirer->type;
-	se->update_time = ts->update_time;
-	se->timeout = get_timeout(jool, ts->expirer);
-	se->has_stored = !!ts->stored;
+	unsigned int i;
+
+	spin_lock_bh(&table->walk_lock);
+	for (i = 0; i < BIB_SHARDS; i++)
+		spin_lock_nest_lock(&table->shards4[i].lock, &table->walk_lock);
 }
 
-/**
- * "[Convert] tabled BIB to bib_session"
- */
-static void tbtobs(struct tabled_bib *tabled, struct bib_session *bs)
+static void unlock_all(struct bib_table *table)
 {
-	if (!bs)
-		return;
+	unsigned int i;
 
-	bs->bib_set = true;
-	bs->session.src6 = tabled->src6;
-	bs->session.src4 = tabled->src4;
-	bs->session.proto = tabled->proto;
+	for (i = 0; i < BIB_SHARDS; i++)
+		spin_unlock(&table->shards4[i].lock);
+	spin_unlock_bh(&table->walk_lock);
 }
 
-/**
- * [Convert] tabled session to bib_session"
- */
-static void tstobs(struct xlation *state, struct tabled_session *ts)
+static struct tabled_bib *bib6_entry(const struct rb_node *node)
 {
-	state->entries.bib_set = true;
-	state->entries.session_set = true;
-	tstose(&state->jool, ts, &state->entries.session);
+	return node ? rb_entry(node, struct tabled_bib, hook6) : NULL;
 }
 
-/**
- * One-liner to get the session table corresponding to the @proto protocol.
- */
-static struct bib_table *get_table(struct bib *db, l4_protocol proto)
+static struct tabled_bib *bib4_entry(const struct rb_node *node)
 {
-	switch (proto) {
-	case L4PROTO_TCP:
-		return &db->tcp;
-	case L4PROTO_UDP:
-		return &db->udp;
-	case L4PROTO_ICMP:
-		return &db->icmp;
-	case L4PROTO_OTHER:
-		break;
-	}
+	return node ? rb_entry(node, struct tabled_bib, hook4) : NULL;
+}
 
-	WARN(true, "Unsupported transport protocol: %u.", proto);
-	return NULL;
+static struct tabled_session *node2session(const struct rb_node *node)
+{
+	return node ? rb_entry(node, struct tabled_session, tree_hook) : NULL;
 }
 
-static void kill_stored_pkt(struct xlator *jool, struct bib_table *table,
-		struct tabled_session *session)
+/* Hash table boilerplate */
+
+struct session_key {
+	struct ipv4_transport_addr src4;
+	struct ipv4_transport_addr dst4;
+};
+
+static u32 hash_src6(void const *data, u32 len, u32 seed)
 {
-	if (!session->stored)
-		return;
+	struct ipv6_transport_addr const *src6 = data;
+	return jhash2(src6->l3.s6_addr32, 4, seed ^ src6->l4);
+}
 
-	__log_debug(jool, "Deleting stored type 2 packet.");
-	kfree_skb(session->stored);
-	session->stored = NULL;
-	table->pkt_count--;
+static u32 hash_src4(void const *data, u32 len, u32 seed)
+{
+	struct ipv4_transport_addr const *src4 = data;
+	return jhash_2words(src4->l3.s_addr, src4->l4, seed);
 }
 
-static int bib_setup(void)
+/*
+ * Returns the shard that owns (or would own) the BIB entry whose src4 is
+ * @addr.
+ */
+static struct bib_shard *get_shard4(struct bib_table *table,
+		struct ipv4_transport_addr const *addr)
 {
-	bib_cache = kmem_cache_create("bib_nodes",
-			sizeof(struct tabled_bib),
-			0, 0, NULL);
-	if (!bib_cache)
-		return -ENOMEM;
+	u32 hash;
 
-	session_cache = kmem_cache_create("session_nodes",
-			sizeof(struct tabled_session),
-			0, 0, NULL);
-	if (!session_cache) {
-		kmem_cache_destroy(bib_cache);
-		bib_cache = NULL;
-		return -ENOMEM;
-	}
+	hash = jhash_2words(addr->l3.s_addr, addr->l4 >> BIB_SHARD_PORT_BITS,
+			0);
+	return &table->shards4[hash & (BIB_SHARDS - 1)];
+}
 
-	return 0;
+static struct bib_shard6 *get_shard6(struct bib_table *table,
+		struct ipv6_transport_addr const *addr)
+{
+	return &table->shards6[hash_src6(addr, 0, 0) & (BIB_SHARDS - 1)];
 }
 
-void bib_teardown(void)
+static u32 __hash_session(struct ipv4_transport_addr const *src4,
+		struct ipv4_transport_addr const *dst4,
+		u32 seed)
 {
-	if (!bib_cache)
-		return;
+	return jhash_3words(src4->l3.s_addr, dst4->l3.s_addr,
+			(src4->l4 << 16) | dst4->l4, seed);
+}
 
-	kmem_cache_destroy(bib_cache);
-	bib_cache = NULL;
-	kmem_cache_destroy(session_cache);
-	session_cache = NULL;
+static u32 hash_session_key(void const *data, u32 len, u32 seed)
+{
+	struct session_key const *key = data;
+	return __hash_session(&key->src4, &key->dst4, seed);
 }
 
-static enum session_fate just_die(struct session_entry *session, void *arg)
+static u32 hash_bib6(void const *data, u32 len, u32 seed)
 {
-	return FATE_RM;
+	return hash_src6(&((struct tabled_bib const *)data)->src6, len, seed);
 }
 
-static void init_expirer(struct expire_timer *expirer,
-		unsigned long timeout,
-		session_timer_type type,
-		fate_cb fate_cb)
+static u32 hash_bib4(void const *data, u32 len, u32 seed)
 {
-	INIT_LIST_HEAD(&expirer->sessions);
-	expirer->type = type;
-	expirer->decide_fate_cb = fate_cb;
+	return hash_src4(&((struct tabled_bib const *)data)->src4, len, seed);
 }
 
-static void init_table(struct bib_table *table,
-		unsigned long est_timeout,
-		unsigned long trans_timeout,
-		fate_cb est_cb)
+static u32 hash_session(void const *data, u32 len, u32 seed)
 {
-	table->tree6 = RB_ROOT;
-	table->tree4 = RB_ROOT;
-	spin_lock_init(&table->lock);
-	init_expirer(&table->est_timer, est_timeout, SESSION_TIMER_EST, est_cb);
-
-	init_expirer(&table->trans_timer, trans_timeout, SESSION_TIMER_TRANS,
-			just_die);
-	/* TODO (warning) "just_die"? what about the stored packet? */
-	init_expirer(&table->syn4_timer, TCP_INCOMING_SYN, SESSION_TIMER_SYN4,
-			just_die);
-	table->pkt_count = 0;
-	table->pkt_queue = NULL;
+	struct tabled_session const *session = data;
+	return __hash_session(&session->bib->src4, &session->dst4, seed);
 }
 
-struct bib *bib_alloc(void)
+static int cmp_bib6(struct rhashtable_compare_arg *arg, void const *obj)
 {
-	struct bib *db;
-	bool cache_created;
+	struct tabled_bib const *bib = obj;
+	return !taddr6_equals(&bib->src6, arg->key);
+}
 
-	cache_created = false;
-	if (!bib_cache) {
-		if (bib_setup())
-			return NULL;
-		cache_created = true;
-	}
+static int cmp_bib4(struct rhashtable_compare_arg *arg, void const *obj)
+{
+	struct tabled_bib const *bib = obj;
+	return !taddr4_equals(&bib->src4, arg->key);
+}
 
-	db = wkmalloc(struct bib, GFP_KERNEL);
-	if (!db)
-		goto db_alloc_fail;
+static int cmp_session(struct rhashtable_compare_arg *arg, void const *obj)
+{
+	struct tabled_session const *session = obj;
+	struct session_key const *key = arg->key;
 
-	init_table(&db->udp, UDP_DEFAULT, 0, just_die);
-	init_table(&db->tcp, TCP_EST, TCP_TRANS, tcp_est_expire_cb);
-	init_table(&db->icmp, ICMP_DEFAULT, 0, just_die);
+	return !taddr4_equals(&session->bib->src4, &key->src4)
+			|| !taddr4_equals(&session->dst4, &key->dst4);
+}
 
-	db->tcp.pkt_queue = pktqueue_alloc();
-	if (!db->tcp.pkt_queue)
-		goto pktqueue_alloc_fail;
+static const struct rhashtable_params bib6_params = {
+	.head_offset = offsetof(struct tabled_bib, hash6),
+	.key_len = sizeof(struct ipv6_transport_addr),
+	.hashfn = hash_src6,
+	.obj_hashfn = hash_bib6,
+	.obj_cmpfn = cmp_bib6,
+	.automatic_shrinking = true,
+};
 
-	kref_init(&db->refs);
+static const struct rhashtable_params bib4_params = {
+	.head_offset = offsetof(struct tabled_bib, hash4),
+	.key_len = sizeof(struct ipv4_transport_addr),
+	.hashfn = hash_src4,
+	.obj_hashfn = hash_bib4,
+	.obj_cmpfn = cmp_bib4,
+	.automatic_shrinking = true,
+};
 
-	return db;
+static const struct rhashtable_params session_params = {
+	/*
+	 * @session is the first member, so the objects can be handled as
+	 * plain tabled_sessions.
+	 */
+	.head_offset = offsetof(struct hashed_session, hook),
+	.key_len = sizeof(struct session_key),
+	.hashfn = hash_session_key,
+	.obj_hashfn = hash_session,
+	.obj_cmpfn = cmp_session,
+	.automatic_shrinking = true,
+};
 
-pktqueue_alloc_fail:
-	wkfree(struct bib, db);
-db_alloc_fail:
-	if (cache_created)
-		bib_teardown();
-	return NULL;
+static int compare_src6(struct tabled_bib const *a,
+		struct ipv6_transport_addr const *b)
+{
+	return taddr6_compare(&a->src6, b);
 }
 
-void bib_get(struct bib *db)
+static int compare_src6_rbnode(struct rb_node *a, struct rb_node *b)
 {
-	kref_get(&db->refs);
+	return taddr6_compare(&bib6_entry(a)->src6, &bib6_entry(b)->src6);
 }
 
-/**
- * Potentially includes laggy packet fetches; please do not hold spinlocks while
- * calling this function!
+/*
+ * Adds @bib to @table's src6 index. (Whichever it is.)
+ *
+ * Returns -EAGAIN if some other CPU indexed @bib's src6 after the caller looked
+ * it up, in which case the caller should start over.
  */
-static void release_bib_entry(struct tabled_bib *bib)
+static int index6_add(struct bib_table *table, struct tabled_bib *bib)
 {
-	struct tabled_session *sessions, *tmp;
+	struct bib_shard6 *shard6;
+	struct tree_slot slot;
+	int error = 0;
 
-	rbtree_foreach(sessions, tmp, &bib->sessions, tree_hook) {
-		if (sessions->stored) {
-			icmp64_send(NULL, sessions->stored,
-					ICMPERR_PORT_UNREACHABLE, 0);
-			kfree_skb(sessions->stored);
-		}
-		free_session(sessions);
+	shard6 = get_shard6(table, &bib->src6);
+	shard6_lock(shard6);
+
+	if (table->hashed) {
+		error = rhashtable_lookup_insert_fast(&table->hash6,
+				&bib->hash6, bib6_params);
+		if (error == -EEXIST)
+			error = -EAGAIN;
+	} else if (rbtree_find_slot(&bib->hook6, &shard6->tree6,
+			compare_src6_rbnode, &slot)) {
+		error = -EAGAIN;
+	} else {
+		treeslot_commit(&slot);
 	}
 
-	free_bib(bib);
+	shard6_unlock(shard6);
+	return error;
 }
 
-static void bib_release(struct kref *refs)
+/*
+ * Unindexes @bib from the src6 index. (Whichever it is.)
+ */
+static void index6_rm(struct bib_table *table, struct tabled_bib *bib)
 {
-	struct bib *db;
-	struct tabled_bib *bib, *tmp;
-
-	db = container_of(refs, struct bib, refs);
-
-	/*
-	 * The trees share the entries, so only one tree of each protocol
-	 * needs to be emptied.
-	 */
-	rbtree_foreach(bib, tmp, &db->udp.tree4, hook4)
-		release_bib_entry(bib);
-	rbtree_foreach(bib, tmp, &db->tcp.tree4, hook4)
-		release_bib_entry(bib);
-	rbtree_foreach(bib, tmp, &db->icmp.tree4, hook4)
-		release_bib_entry(bib);
-
-	pktqueue_release(db->tcp.pkt_queue);
-
-	wkfree(struct bib, db);
+	struct bib_shard6 *shard6;
+
+	shard6 = get_shard6(table, &bib->src6);
+	shard6_lock(shard6);
+	if (table->hashed)
+		rhashtable_remove_fast(&table->hash6, &bib->hash6, bib6_params);
+	else
+		rb_erase(&bib->hook6, &shard6->tree6);
+	shard6_unlock(shard6);
 }
 
-void bib_put(struct bib *db)
+/*
+ * Adds @bib to @shard's src4 hash index. (If any.)
+ */
+static int hash_add_bib4(struct bib_shard *shard, struct tabled_bib *bib)
 {
-	kref_put(&db->refs, bib_release);
+	if (!shard->table->hashed)
+		return 0;
+	return rhashtable_insert_fast(&shard->hash4, &bib->hash4, bib4_params);
 }
 
-static void log_bib(struct xlator *jool, struct tabled_bib *bib, char *action)
+static void hash_rm_bib4(struct bib_shard *shard, struct tabled_bib *bib)
 {
-	time64_t tsec;
-	struct tm time;
-
-	if (!jool->globals.nat64.bib.bib_logging)
-		return;
-
-	tsec = ktime_get_real_seconds();
-	time64_to_tm(tsec, 0, &time);
-	log_info("%s %ld/%d/%d %d:%d:%d (GMT) - %s " TA6PP " to " TA4PP " (%s)",
-			jool->iname,
-			1900 + time.tm_year, time.tm_mon + 1, time.tm_mday,
-			time.tm_hour, time.tm_min, time.tm_sec, action,
-			TA6PA(bib->src6), TA4PA(bib->src4),
-			l4proto_to_string(bib->proto));
+	if (shard->table->hashed)
+		rhashtable_remove_fast(&shard->hash4, &bib->hash4, bib4_params);
 }
 
-static void log_new_bib(struct xlator *jool, struct tabled_bib *bib)
+/*
+ * Adds @session to @shard's session hash index. (If any.)
+ * @session->bib needs to be already set.
+ */
+static int hash_add_session(struct bib_shard *shard,
+		struct tabled_session *session)
 {
-	return log_bib(jool, bib, "Mapped");
+	if (!shard->table->hashed)
+		return 0;
+	return rhashtable_insert_fast(&shard->session_hash,
+			&hashed_session(session)->hook, session_params);
 }
 
-static void log_session(struct xlator *jool,
-		struct tabled_session *session,
-		char *action)
+static void hash_rm_session(struct bib_shard *shard,
+		struct tabled_session *session)
 {
-	time64_t tsec;
-	struct tm time;
-
-	if (!jool->globals.nat64.bib.session_logging)
-		return;
+	if (shard->table->hashed)
+		rhashtable_remove_fast(&shard->session_hash,
+				&hashed_session(session)->hook,
+				session_params);
+}
 
-	tsec = ktime_get_real_seconds();
-	time64_to_tm(tsec, 0, &time);
-	log_info("%s %ld/%d/%d %d:%d:%d (GMT) - %s " TA6PP "|" TA6PP "|"
-			TA4PP "|" TA4PP "|%s", jool->iname,
-			1900 + time.tm_year, time.tm_mon + 1, time.tm_mday,
-			time.tm_hour, time.tm_min, time.tm_sec, action,
-			TA6PA(session->bib->src6), TA6PA(session->dst6),
-			TA4PA(session->bib->src4), TA4PA(session->dst4),
-			l4proto_to_string(session->bib->proto));
+/*
+ * Flags @bib's src4 as taken in @table's port index.
+ */
+static int ports_add(struct bib_table *table, struct tabled_bib *bib)
+{
+	return port_map_set(&table->ports, &bib->src4.l3, bib->src4.l4);
 }
 
-static void log_new_session(struct xlator *jool, struct tabled_session *session)
+static void ports_rm(struct bib_table *table, struct tabled_bib *bib)
 {
-	return log_session(jool, session, "Added session");
+	port_map_clear(&table->ports, &bib->src4.l3, bib->src4.l4);
 }
 
-/**
- * This function does not return a result because whatever needs to happen later
- * needs to happen regardless of probe status.
- *
- * This function does not actually send the probe; it merely prepares it so the
- * caller can commit to sending it after releasing the spinlock.
+/*
+ * Unindexes @bib from everything but its sessions.
  */
-static void handle_probe(struct xlator *jool,
-		struct bib_table *table,
-		struct list_head *probes,
-		struct tabled_session *session,
-		struct session_entry *tmp)
+static void erase_bib(struct bib_shard *shard, struct tabled_bib *bib)
 {
-	struct probing_session *probe;
-
-	if (WARN(!probes, "Probe needed but caller doesn't support it"))
-		goto discard_probe;
-
-	/*
-	 * Why add a dummy session instead of the real one?
-	 * In the case of TCP probes it's because the real session's list hook
-	 * must remain attached to the database.
-	 * In the case of ICMP errors it's because the fact that a session
-	 * removal can cascade into a BIB entry removal really complicates
-	 * things.
-	 * This way requires this malloc but it's otherwise very clean.
-	 */
-	probe = wkmalloc(struct probing_session, GFP_ATOMIC);
-	if (!probe)
-		goto discard_probe;
-
-	probe->session = *tmp;
-	if (session->stored) {
-		probe->skb = session->stored;
-		session->stored = NULL;
-		table->pkt_count--;
-	} else {
-		probe->skb = NULL;
-	}
-	list_add(&probe->list_hook, probes);
-	return;
-
-discard_probe:
-	/*
-	 * We're going to have to pretend that we sent it anyway; a probe
-	 * failure should not prevent the state from evolving from V4 INIT and
-	 * we do not want that massive thing to linger in the database anymore,
-	 * especially if we failed due to a memory allocation.
-	 */
-	kill_stored_pkt(jool, table, session);
+	ports_rm(shard->table, bib);
+	index6_rm(shard->table, bib);
+	hash_rm_bib4(shard, bib);
+	rb_erase(&bib->hook4, &shard->tree4);
 }
 
-static void rm(struct xlator *jool,
-		struct bib_table *table,
-		struct list_head *probes,
-		struct tabled_session *session,
-		struct session_entry *tmp)
+/**
+ * "[Convert] tabled BIB to BIB entry"
+ */
+static void tbtobe(struct tabled_bib *tabled, struct bib_entry *bib)
 {
-	struct tabled_bib *bib = session->bib;
-
-	if (session->stored)
-		handle_probe(jool, table, probes, session, tmp);
-
-	rb_erase(&session->tree_hook, &bib->sessions);
-	list_del(&session->list_hook);
-	log_session(jool, session, "Forgot session");
-	free_session(session);
-	jstat_dec(jool->stats, JSTAT_SESSIONS);
+	if (!bib)
+		return;
 
-	if (!bib->is_static && RB_EMPTY_ROOT(&bib->sessions)) {
-		rb_erase(&bib->hook6, &table->tree6);
-		rb_erase(&bib->hook4, &table->tree4);
-		log_bib(jool, bib, "Forgot");
-		free_bib(bib);
-		jstat_dec(jool->stats, JSTAT_BIB_ENTRIES);
-	}
+	bib->addr6 = tabled->src6;
+	bib->addr4 = tabled->src4;
+	bib->l4_proto = tabled->proto;
+	bib->is_static = tabled->is_static;
 }
 
-static void handle_fate_timer(struct tabled_session *session,
-		struct expire_timer *timer)
+/*
+ * If pressure-timeouts is enabled, returns how many times the session timeouts
+ * should be halved, depending on how close the instance is to max-sessions.
+ */
+static unsigned int get_pressure(struct xlator *jool)
 {
-	session->update_time = jiffies;
-	session->expirer = timer;
-	list_del(&session->list_hook);
-	list_add_tail(&session->list_hook, &timer->sessions);
+	unsigned int max;
+	unsigned int count;
+
+	max = XGLOBALS(jool).max_sessions;
+	if (!max || !XGLOBALS(jool).pressure_timeouts)
+		return 0;
+
+	count = atomic_read(&jool->nat64.bib->session_count);
+	if (count >= max - max / 10) /* 90% */
+		return 3;
+	if (count >= max - max / 4) /* 75% */
+		return 2;
+	if (count >= max / 2) /* 50% */
+		return 1;
+	return 0;
 }
 
-static int queue_unsorted_session(struct bib_table *table,
-		struct tabled_session *session,
-		session_timer_type timer_type,
-		bool remove_first)
+static unsigned long get_timeout(struct xlator *jool,
+		session_timer_type type,
+		l4_protocol proto)
 {
-	struct expire_timer *expirer;
-	struct list_head *list;
-	struct list_head *cursor;
-	struct tabled_session *old;
+	__u32 msecs = 0;
 
-	switch (timer_type) {
+	switch (type) {
 	case SESSION_TIMER_EST:
-		expirer = &table->est_timer;
+		switch (proto) {
+		case L4PROTO_TCP:
+			msecs = XGLOBALS(jool).ttl.tcp_est;
+			break;
+		case L4PROTO_UDP:
+			msecs = XGLOBALS(jool).ttl.udp;
+			break;
+		case L4PROTO_ICMP:
+			msecs = XGLOBALS(jool).ttl.icmp;
+			break;
+		case L4PROTO_OTHER:
+			break;
+		}
 		break;
 	case SESSION_TIMER_TRANS:
-		expirer = &table->trans_timer;
+		if (proto == L4PROTO_TCP)
+			msecs = XGLOBALS(jool).ttl.tcp_trans;
 		break;
 	case SESSION_TIMER_SYN4:
-		expirer = &table->syn4_timer;
+		/* Mandated by RFC 6146; not subject to pressure. */
+		if (proto == L4PROTO_TCP)
+			return msecs_to_jiffies(1000 * TCP_INCOMING_SYN);
 		break;
-	default:
-		log_warn_once("incoming joold session's timer (%d) is unknown.",
-				timer_type);
-		return -EINVAL;
 	}
 
-	list = &expirer->sessions;
-	for (cursor = list->prev; cursor != list; cursor = cursor->prev) {
-		old = list_entry(cursor, struct tabled_session, list_hook);
-		if (old->update_time < session->update_time)
-			break;
-	}
+	return msecs_to_jiffies(msecs >> get_pressure(jool));
+}
 
-	if (remove_first)
-		list_del(&session->list_hook);
-	list_add(&session->list_hook, cursor);
-	session->expirer = expirer;
-	return 0;
+/**
+ * Rebuilds @session's dst6. (See struct tabled_session.)
+ */
+static void get_dst6(struct xlator *jool, struct tabled_session *session,
+		struct ipv6_transport_addr *dst6)
+{
+	/* pool6 was validated during the instance add, so this can't fail. */
+	__rfc6052_4to6(&jool->globals.pool6.prefix, &session->dst4.l3,
+			&dst6->l3);
+	/* See the comment above tabled_session.tree_hook. */
+	dst6->l4 = (session->bib->proto == L4PROTO_ICMP)
+			? session->bib->src6.l4
+			: session->dst4.l4;
 }
 
 /**
- * Decides what should happen to @session via @cb, and carries the verdict out.
- * Returns true if the packet should be translated, false if the packet should
- * be dropped. (Assuming that the caller has a packet linked to @session.)
+ * Returns the full jiffy @session was queued in its expirer's list.
  *
- * Assumes result->session has been set (result->session_set is true).
+ * Sessions only store the lower 32 bits, which suffices as long as nobody
+ * lingers in the database for more than 2^32 jiffies. (Timeouts are several
+ * orders of magnitude shorter than that.)
  */
-static bool decide_fate(struct xlator *jool,
-		struct collision_cb *cb,
-		struct bib_table *table,
-		struct tabled_session *session,
-		struct list_head *probes)
+static unsigned long get_queue_time(struct tabled_session *session)
 {
-	struct session_entry tmp;
-	enum session_fate fate;
+	unsigned long now = jiffies;
+	return now - (__u32)((__u32)now - READ_ONCE(session->queue_time));
+}
 
-	if (!cb)
-		return true;
+/**
+ * Returns the full jiffy @session was last updated.
+ */
+static unsigned long get_update_time(struct tabled_session *session)
+{
+	unsigned long now = jiffies;
+	unsigned long update_time;
 
-	tstose(jool, session, &tmp);
-	fate = cb->cb(&tmp, cb->arg);
+	update_time = get_queue_time(session) + READ_ONCE(session->update_delta);
+	/* See lockless_refresh(). */
+	return time_after(update_time, now) ? now : update_time;
+}
 
-	/* The callback above is entitled to tweak these fields. */
-	session->state = tmp.state;
-	session->update_time = tmp.update_time;
-	if (!tmp.has_stored)
-		kill_stored_pkt(jool, table, session);
-	/* Also the expirer, which is down below. */
+/**
+ * Sets both of @session's times to @time. Only for sessions that are not (or
+ * are about to stop being) where their queue time says.
+ */
+static void reset_times(struct tabled_session *session, unsigned long time)
+{
+	session->queue_time = time;
+	session->update_delta = 0;
+}
 
-	switch (fate) {
-	case FATE_TIMER_EST:
-		handle_fate_timer(session, &table->est_timer);
-		break;
+/**
+ * Returns the number of jiffies a session refresh is allowed to skip requeuing
+ * for. Never exceeds @timeout, so lazily refreshed sessions cannot be in the
+ * expiration code's way.
+ */
+static unsigned long get_granularity(struct xlator *jool, unsigned long timeout)
+{
+	unsigned long granularity;
 
-	case FATE_PROBE:
-		/*
-		 * TODO (warning) ICMP errors aren't supposed to drop down to
-		 * TRANS.
-		 */
-		handle_probe(jool, table, probes, session, &tmp);
-		handle_fate_timer(session, &table->trans_timer);
-		break;
+	granularity = msecs_to_jiffies(XGLOBALS(jool).refresh_granularity);
+	/* Also, @update_delta needs to be able to hold it. */
+	return min3(granularity, timeout, (unsigned long)U16_MAX);
+}
 
-	case FATE_TIMER_TRANS:
-		handle_fate_timer(session, &table->trans_timer);
-		break;
+/**
+ * Returns true if @session can be refreshed without moving it in its expirer's
+ * list.
+ */
+static bool can_refresh_lazily(struct xlator *jool,
+		struct tabled_session *session,
+		session_timer_type type)
+{
+	unsigned long timeout;
 
-	case FATE_RM:
-		rm(jool, table, probes, session, &tmp);
-		break;
+	if (session->timer != type)
+		return false;
 
-	case FATE_PRESERVE:
-		break;
-	case FATE_DROP:
-		return false;
-
-	case FATE_TIMER_SLOW:
-		/*
-		 * Nothing to do with the return value.
-		 * If timer type was invalid, well don't change the expirer.
-		 * We left a warning in the log.
-		 */
-		queue_unsorted_session(table, session, tmp.timer_type, true);
-		break;
-	}
+	timeout = get_timeout(jool, type, session->bib->proto);
+	return time_before(jiffies, get_queue_time(session)
+			+ get_granularity(jool, timeout));
+}
 
-	return true;
+/**
+ * "[Convert] tabled session to session entry"
+ */
+static void tstose(struct xlator *jool,
+		struct tabled_session *ts,
+		struct session_entry *se)
+{
+	se->src6 = ts->bib->src6;
+	get_dst6(jool, ts, &se->dst6);
+	se->src4 = ts->bib->src4;
+	se->dst4 = ts->dst4;
+	se->proto = ts->bib->proto;
+	se->state = ts->state;
+	se->timer_type = ts->timer;
+	se->update_time = get_update_time(ts);
+	se->timeout = get_timeout(jool, ts->timer, ts->bib->proto);
+	se->has_stored = ts->has_stored;
 }
 
 /**
- * send_probe_packet - Sends a probe packet to @session's IPv6 endpoint,
- * to trigger a confirmation ACK if the connection is still alive.
- *
- * From RFC 6146 page 30.
- *
- * @session: the established session that has been inactive for too long.
- *
- * Best if not called with spinlocks held.
+ * "[Convert] tabled BIB to bib_session"
  */
-static void send_probe_packet(struct xlator *jool, struct session_entry *session)
+static void tbtobs(struct tabled_bib *tabled, struct bib_session *bs)
 {
-	struct sk_buff *skb;
-	struct ipv6hdr *iph;
-	struct tcphdr *th;
-	struct flowi6 flow;
-	struct dst_entry *dst;
-	int error;
+	if (!bs)
+		return;
 
-	unsigned int l3_hdr_len = sizeof(*iph);
-	unsigned int l4_hdr_len = sizeof(*th);
+	bs->bib_set = true;
+	bs->session.src6 = tabled->src6;
+	bs->session.src4 = tabled->src4;
+	bs->session.proto = tabled->proto;
+}
 
-	skb = alloc_skb(LL_MAX_HEADER + l3_hdr_len + l4_hdr_len, GFP_ATOMIC);
-	if (!skb) {
-		__log_debug(jool, "Could not allocate a probe packet.");
-		goto fail;
+/**
+ * [Convert] tabled session to bib_session"
+ */
+static void tstobs(struct xlation *state, struct tabled_session *ts)
+{
+	state->entries.bib_set = true;
+	state->entries.session_set = true;
+	tstose(state->jool, ts, &state->entries.session);
+}
+
+/**
+ * One-liner to get the session table corresponding to the @proto protocol.
+ */
+static struct bib_table *get_table(struct bib *db, l4_protocol proto)
+{
+	switch (proto) {
+	case L4PROTO_TCP:
+		return &db->tcp;
+	case L4PROTO_UDP:
+		return &db->udp;
+	case L4PROTO_ICMP:
+		return &db->icmp;
+	case L4PROTO_OTHER:
+		break;
 	}
 
-	skb_reserve(skb, LL_MAX_HEADER);
-	skb_put(skb, l3_hdr_len + l4_hdr_len);
-	skb_reset_mac_header(skb);
-	skb_reset_network_header(skb);
-	skb_set_transport_header(skb, l3_hdr_len);
+	WARN(true, "Unsupported transport protocol: %u.", proto);
+	return NULL;
+}
 
-	iph = ipv6_hdr(skb);
-	iph->version = 6;
-	iph->priority = 0;
-	iph->flow_lbl[0] = 0;
-	iph->flow_lbl[1] = 0;
-	iph->flow_lbl[2] = 0;
-	iph->payload_len = cpu_to_be16(l4_hdr_len);
-	iph->nexthdr = NEXTHDR_TCP;
-	iph->hop_limit = 255;
-	iph->saddr = session->dst6.l3;
-	iph->daddr = session->src6.l3;
+static struct stored_pkt *find_stored_pkt(struct bib_shard *shard,
+		struct tabled_session *session)
+{
+	struct stored_pkt *stored;
 
-	th = tcp_hdr(skb);
-	th->source = cpu_to_be16(session->dst6.l4);
-	th->dest = cpu_to_be16(session->src6.l4);
-	th->seq = htonl(0);
-	th->ack_seq = htonl(0);
-	th->res1 = 0;
-	th->doff = l4_hdr_len / 4;
-	th->fin = 0;
-	th->syn = 0;
-	th->rst = 0;
-	th->psh = 0;
-	th->ack = 1;
-	th->urg = 0;
-	th->ece = 0;
-	th->cwr = 0;
-	th->window = htons(8192);
-	th->check = 0;
-	th->urg_ptr = 0;
+	if (!session->has_stored)
+		return NULL;
 
-	/* TODO (performance) can't we just defer this to somebody else? */
-	th->check = csum_ipv6_magic(&iph->saddr, &iph->daddr, l4_hdr_len,
-			IPPROTO_TCP, csum_partial(th, l4_hdr_len, 0));
-	skb->ip_summed = CHECKSUM_UNNECESSARY;
+	list_for_each_entry(stored, &shard->stored_pkts, list_hook)
+		if (stored->session == session)
+			return stored;
 
-	memset(&flow, 0, sizeof(flow));
-	flow.flowi6_scope = RT_SCOPE_UNIVERSE;
-	flow.flowi6_proto = NEXTHDR_TCP;
-	flow.saddr = iph->saddr;
-	flow.daddr = iph->daddr;
-	flow.fl6_sport = th->source;
-	flow.fl6_dport = th->dest;
+	WARN(true, "Session's type 2 packet is not in its shard.");
+	session->has_stored = false;
+	return NULL;
+}
 
-	dst = route6(jool, &flow);
-	if (!dst)
-		goto revert;
+/**
+ * Unlinks @session's type 2 packet (if any) from the database, and returns it.
+ * The caller takes over the packet.
+ */
+static struct sk_buff *take_stored_pkt(struct bib_shard *shard,
+		struct tabled_session *session)
+{
+	struct stored_pkt *stored;
+	struct sk_buff *skb;
 
-	skb_dst_set(skb, dst);
+	stored = find_stored_pkt(shard, session);
+	if (!stored)
+		return NULL;
 
-	/* Implicit kfree_skb(skb) here. */
-	error = dst_output(jool->ns, NULL, skb);
-	if (error) {
-		__log_debug(jool, "dst_output() returned errcode %d.", error);
-		goto fail;
-	}
+	skb = stored->skb;
+	list_del(&stored->list_hook);
+	wkfree(struct stored_pkt, stored);
+	session->has_stored = false;
+	atomic_dec(&shard->table->pkt_count);
+	return skb;
+}
 
-	return;
+static void kill_stored_pkt(struct xlator *jool, struct bib_shard *shard,
+		struct tabled_session *session)
+{
+	struct sk_buff *skb;
 
-revert:
+	skb = take_stored_pkt(shard, session);
+	if (!skb)
+		return;
+
+	__log_debug(jool, "Deleting stored type 2 packet.");
 	kfree_skb(skb);
-fail:
-	__log_debug(jool, "A TCP connection will probably break.");
 }
 
 /**
- * Sends all the probes and ICMP errors listed in @probes.
+ * ICMP errors and releases the type 2 packets in @list.
+ *
+ * Potentially includes laggy packet fetches; please do not hold spinlocks while
+ * calling this function!
  */
-static void post_fate(struct xlator *jool, struct list_head *probes)
+static void release_stored_pkts(struct list_head *list)
 {
-	struct probing_session *probe;
-	struct probing_session *tmp;
+	struct stored_pkt *stored, *tmp;
 
-	list_for_each_entry_safe(probe, tmp, probes, list_hook) {
-		if (probe->skb) {
-			/* The "probe" is not a probe; it's an ICMP error. */
-			icmp64_send(jool, probe->skb, ICMPERR_PORT_UNREACHABLE,
-					0);
-			kfree_skb(probe->skb);
-		} else {
-			/* Actual TCP probe. */
-			send_probe_packet(jool, &probe->session);
-		}
-		wkfree(struct probing_session, probe);
+	list_for_each_entry_safe(stored, tmp, list, list_hook) {
+		icmp64_send(NULL, stored->skb, ICMPERR_PORT_UNREACHABLE, 0);
+		kfree_skb(stored->skb);
+		wkfree(struct stored_pkt, stored);
 	}
 }
 
-struct slot_group {
-	struct tree_slot bib6;
-	struct tree_slot bib4;
-	struct tree_slot session;
-};
-
-static void commit_bib_add(struct xlator *jool, struct slot_group *slots)
+static int bib_setup(void)
 {
-	treeslot_commit(&slots->bib6);
-	treeslot_commit(&slots->bib4);
-	jstat_inc(jool->stats, JSTAT_BIB_ENTRIES);
-}
+	bib_cache = kmem_cache_create("bib_nodes",
+			sizeof(struct tabled_bib),
+			0, 0, NULL);
+	if (!bib_cache)
+		return -ENOMEM;
 
-static void commit_session_add(struct xlator *jool, struct tree_slot *slot)
-{
-	treeslot_commit(slot);
-	jstat_inc(jool->stats, JSTAT_SESSIONS);
-}
+	session_cache = kmem_cache_create("session_nodes",
+			sizeof(struct tabled_session),
+			0, 0, NULL);
+	if (!session_cache)
+		goto session_fail;
 
-static void attach_timer(struct tabled_session *session,
-		struct expire_timer *expirer)
-{
-	session->update_time = jiffies;
-	session->expirer = expirer;
-	list_add_tail(&session->list_hook, &expirer->sessions);
-}
+	hashed_session_cache = kmem_cache_create("hashed_session_nodes",
+			sizeof(struct hashed_session),
+			0, 0, NULL);
+	if (!hashed_session_cache)
+		goto hashed_fail;
 
-static int compare_src6(struct tabled_bib *a, struct ipv6_transport_addr *b)
-{
-	return taddr6_compare(&a->src6, b);
-}
+	if (port_map_setup())
+		goto port_map_fail;
 
-static int compare_src6_rbnode(struct rb_node *a, struct rb_node *b)
-{
-	return taddr6_compare(&bib6_entry(a)->src6, &bib6_entry(b)->src6);
-}
+	return 0;
 
-static int compare_src4(struct tabled_bib const *a,
-		struct ipv4_transport_addr const *b)
-{
-	return taddr4_compare(&a->src4, b);
+port_map_fail:
+	kmem_cache_destroy(hashed_session_cache);
+	hashed_session_cache = NULL;
+hashed_fail:
+	kmem_cache_destroy(session_cache);
+	session_cache = NULL;
+session_fail:
+	kmem_cache_destroy(bib_cache);
+	bib_cache = NULL;
+	return -ENOMEM;
 }
 
-static int compare_src4_rbnode(struct rb_node *a, struct rb_node *b)
+void bib_teardown(void)
 {
-	return taddr4_compare(&bib4_entry(a)->src4, &bib4_entry(b)->src4);
+	if (!bib_cache)
+		return;
+
+	rcu_barrier(); /* Wait for the pending free_*_rcu()s. */
+	kmem_cache_destroy(bib_cache);
+	bib_cache = NULL;
+	kmem_cache_destroy(session_cache);
+	session_cache = NULL;
+	kmem_cache_destroy(hashed_session_cache);
+	hashed_session_cache = NULL;
+	port_map_teardown();
 }
 
-static int compare_dst4(struct tabled_session *a, struct tabled_session *b)
+static enum session_fate just_die(struct session_entry *session, void *arg)
 {
-	return taddr4_compare(&a->dst4, &b->dst4);
+	return FATE_RM;
 }
 
-static struct tabled_bib *find_bib6(struct bib_table *table,
-		struct ipv6_transport_addr *addr)
+static void init_expirer(struct expire_timer *expirer,
+		unsigned long timeout,
+		session_timer_type type,
+		l4_protocol proto,
+		fate_cb fate_cb)
 {
-	return rbtree_find(addr, &table->tree6, compare_src6, struct tabled_bib,
-			hook6);
+	INIT_LIST_HEAD(&expirer->sessions);
+	INIT_LIST_HEAD(&expirer->deferred);
+	expirer->type = type;
+	expirer->proto = proto;
+	expirer->decide_fate_cb = fate_cb;
 }
 
-static struct tabled_bib *find_bib4(struct bib_table *table,
-		struct ipv4_transport_addr *addr)
+static void init_table(struct bib_table *table,
+		l4_protocol proto,
+		unsigned long est_timeout,
+		unsigned long trans_timeout,
+		fate_cb est_cb)
 {
-	return rbtree_find(addr, &table->tree4, compare_src4, struct tabled_bib,
-			hook4);
+	struct bib_shard *shard;
+	struct bib_shard6 *shard6;
+	unsigned int i;
+
+	/* The port index's words must not straddle shards. */
+	BUILD_BUG_ON(BITS_PER_LONG > (1 << BIB_SHARD_PORT_BITS));
+
+	for (i = 0; i < BIB_SHARDS; i++) {
+		shard = &table->shards4[i];
+		shard->tree4 = RB_ROOT;
+		spin_lock_init(&shard->lock);
+		seqcount_init(&shard->seq);
+		init_expirer(&shard->est_timer, est_timeout, SESSION_TIMER_EST,
+				proto, est_cb);
+		init_expirer(&shard->trans_timer, trans_timeout,
+				SESSION_TIMER_TRANS, proto, just_die);
+		/* TODO (warning) "just_die"? what about the stored packet? */
+		init_expirer(&shard->syn4_timer, TCP_INCOMING_SYN,
+				SESSION_TIMER_SYN4, proto, just_die);
+		INIT_LIST_HEAD(&shard->stored_pkts);
+		memset(shard->state_count, 0, sizeof(shard->state_count));
+		memset(shard->timer_count, 0, sizeof(shard->timer_count));
+		shard->table = table;
+
+		shard6 = &table->shards6[i];
+		shard6->tree6 = RB_ROOT;
+		spin_lock_init(&shard6->lock);
+		seqcount_init(&shard6->seq);
+	}
+
+	table->hashed = false;
+	spin_lock_init(&table->walk_lock);
+	port_maps_init(&table->ports);
+	pba_table_init(&table->pba);
+	atomic_set(&table->pkt_count, 0);
+	table->pkt_queue = NULL;
+	spin_lock_init(&table->pktqueue_lock);
 }
 
-static struct tabled_bib *find_bibtree6_slot(struct bib_table *table,
-		struct tabled_bib *new,
-		struct tree_slot *slot)
+static void destroy_shard_hashes(struct bib_table *table, unsigned int count)
 {
-	struct rb_node *collision;
-	collision = rbtree_find_slot(&new->hook6, &table->tree6,
-			compare_src6_rbnode, slot);
-	return bib6_entry(collision);
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		rhashtable_destroy(&table->shards4[i].session_hash);
+		rhashtable_destroy(&table->shards4[i].hash4);
+	}
 }
 
-static struct tabled_bib *find_bibtree4_slot(struct bib_table *table,
-		struct tabled_bib *new,
-		struct tree_slot *slot)
+static int init_hashes(struct bib_table *table)
 {
-	struct rb_node *collision;
-	collision = rbtree_find_slot(&new->hook4, &table->tree4,
-			compare_src4_rbnode, slot);
-	return bib4_entry(collision);
+	struct bib_shard *shard;
+	unsigned int i;
+	int error;
+
+	error = rhashtable_init(&table->hash6, &bib6_params);
+	if (error)
+		return error;
+
+	for (i = 0; i < BIB_SHARDS; i++) {
+		shard = &table->shards4[i];
+		error = rhashtable_init(&shard->hash4, &bib4_params);
+		if (error)
+			goto fail;
+		error = rhashtable_init(&shard->session_hash, &session_params);
+		if (error) {
+			rhashtable_destroy(&shard->hash4);
+			goto fail;
+		}
+	}
+
+	table->hashed = true;
+	return 0;
+
+fail:
+	destroy_shard_hashes(table, i);
+	rhashtable_destroy(&table->hash6);
+	return error;
 }
 
-/**
- * Attempts to find the slot where @new would be inserted if you wanted to add
- * it to @bib's session tree.
- *
- * On success:
- * - Initializes @slots as the place (in @bib's session tree) where @new would
- *   be inserted if you wanted to do so.
- * - Returns NULL.
- *
- * If @session collides with @bib's session S:
- * - @slot is undefined.
- * - S is returned.
- *
- * As a side effect, @allow will tell you whether the entry is allowed to be
- * added to the tree if address-dependent filtering is enabled. Send NULL if you
- * don't care about that.
- *
- * Please notice: This searches via @new's dst4, *not* dst6. @new *must* carry
- * an initialized dst4.
+/*
+ * Does not release the entries; that's the trees' job.
  */
-static struct tabled_session *find_session_slot(struct tabled_bib *bib,
-		struct tabled_session *new,
-		bool *allow,
-		struct tree_slot *slot)
+static void destroy_hashes(struct bib_table *table)
 {
-	struct tabled_session *session;
-	struct rb_node *node;
-	int comparison;
+	if (!table->hashed)
+		return;
 
-	treeslot_init(slot, &bib->sessions, &new->tree_hook);
-	node = bib->sessions.rb_node;
-	if (allow)
-		*allow = false;
+	destroy_shard_hashes(table, BIB_SHARDS);
+	rhashtable_destroy(&table->hash6);
+	table->hashed = false;
+}
 
-	while (node) {
-		session = node2session(node);
-		comparison = compare_dst4(session, new);
+/**
+ * If @hashed, exact-match lookups will be served by hash tables instead of
+ * trees. (See struct bib_table.) Costs some memory, but is a lot faster on
+ * large databases.
+ */
+struct bib *bib_alloc(bool hashed)
+{
+	struct bib *db;
+	bool cache_created;
 
-		if (allow && (session->dst4.l3.s_addr == new->dst4.l3.s_addr))
-			*allow = true;
+	cache_created = false;
+	if (!bib_cache) {
+		if (bib_setup())
+			return NULL;
+		cache_created = true;
+	}
 
-		slot->parent = node;
-		if (comparison < 0) {
-			slot->rb_link = &node->rb_right;
-			node = node->rb_right;
-		} else if (comparison > 0) {
-			slot->rb_link = &node->rb_left;
-			node = node->rb_left;
-		} else {
-			return session;
-		}
+	db = wkmalloc(struct bib, GFP_KERNEL);
+	if (!db)
+		goto db_alloc_fail;
+
+	init_table(&db->udp, L4PROTO_UDP, UDP_DEFAULT, 0, just_die);
+	init_table(&db->tcp, L4PROTO_TCP, TCP_EST, TCP_TRANS,
+			tcp_est_expire_cb);
+	init_table(&db->icmp, L4PROTO_ICMP, ICMP_DEFAULT, 0, just_die);
+	atomic_set(&db->session_count, 0);
+	atomic_set(&db->evict_cursor, 0);
+
+	if (quota_table_init(&db->udp.quota))
+		goto udp_quota_fail;
+	if (quota_table_init(&db->tcp.quota))
+		goto tcp_quota_fail;
+	if (quota_table_init(&db->icmp.quota))
+		goto icmp_quota_fail;
+
+	if (hashed) {
+		if (init_hashes(&db->udp))
+			goto hash_fail;
+		if (init_hashes(&db->tcp))
+			goto hash_fail;
+		if (init_hashes(&db->icmp))
+			goto hash_fail;
 	}
 
-	return NULL;
-}
+	db->tcp.pkt_queue = pktqueue_alloc();
+	if (!db->tcp.pkt_queue)
+		goto hash_fail;
 
-static int alloc_bib_session(struct bib_session_tuple *tuple)
-{
-	tuple->bib = alloc_bib(GFP_ATOMIC);
-	if (!tuple->bib)
-		return -ENOMEM;
+	kref_init(&db->refs);
 
-	tuple->session = alloc_session(GFP_ATOMIC);
-	if (!tuple->session) {
-		free_bib(tuple->bib);
-		return -ENOMEM;
-	}
+	return db;
 
-	return 0;
+hash_fail:
+	destroy_hashes(&db->udp);
+	destroy_hashes(&db->tcp);
+	destroy_hashes(&db->icmp);
+	quota_table_destroy(&db->icmp.quota);
+icmp_quota_fail:
+	quota_table_destroy(&db->tcp.quota);
+tcp_quota_fail:
+	quota_table_destroy(&db->udp.quota);
+udp_quota_fail:
+	wkfree(struct bib, db);
+db_alloc_fail:
+	if (cache_created)
+		bib_teardown();
+	return NULL;
 }
 
-static int create_bib_session6(struct bib_session_tuple *tuple,
-		struct tuple *tuple6,
-		struct ipv4_transport_addr *dst4,
-		tcp_state state)
+void bib_get(struct bib *db)
 {
-	int error;
+	kref_get(&db->refs);
+}
 
-	error = alloc_bib_session(tuple);
-	if (error)
-		return error;
+/**
+ * Potentially includes laggy packet fetches; please do not hold spinlocks while
+ * calling this function!
+ */
+static void release_bib_entry(struct tabled_bib *bib)
+{
+	struct tabled_session *sessions, *tmp;
 
-	/*
-	 * Hooks, expirer fields and session->bib are left uninitialized since
-	 * they depend on database knowledge.
-	 */
+	rbtree_foreach(sessions, tmp, &bib->sessions, tree_hook)
+		free_session_rcu(sessions);
 
-	tuple->bib->src6 = tuple6->src.addr6;
-	/*
-	 * src4 is left uninitialized on purpose.
-	 * It needs to be inferred later by comparing the masks and the existing
-	 * BIB entries.
-	 */
-	tuple->bib->proto = tuple6->l4_proto;
-	tuple->bib->is_static = false;
-	tuple->bib->sessions = RB_ROOT;
-	tuple->session->dst6 = tuple6->dst.addr6;
-	tuple->session->dst4 = *dst4;
-	tuple->session->state = state;
-	tuple->session->stored = NULL;
-	return 0;
+	free_bib_rcu(bib);
 }
 
-static struct tabled_session *create_session4(struct tuple *tuple4,
-		struct ipv6_transport_addr *dst6,
-		tcp_state state)
+static void bib_release(struct kref *refs)
 {
-	struct tabled_session *session;
+	struct bib *db;
+	struct tabled_bib *bib, *tmp;
+	unsigned int i;
 
-	session = alloc_session(GFP_ATOMIC);
-	if (!session)
-		return NULL;
+	db = container_of(refs, struct bib, refs);
 
 	/*
-	 * Hooks, expirer fields and session->bib are left uninitialized since
-	 * they depend on database knowledge.
+	 * The trees share the entries, so only one tree of each protocol
+	 * needs to be emptied.
 	 */
-	session->dst6 = *dst6;
-	session->dst4 = tuple4->src.addr4;
-	session->state = state;
-	session->stored = NULL;
-	return session;
-}
+	for (i = 0; i < BIB_SHARDS; i++) {
+		rbtree_foreach(bib, tmp, &db->udp.shards4[i].tree4, hook4)
+			release_bib_entry(bib);
+		release_stored_pkts(&db->tcp.shards4[i].stored_pkts);
+		rbtree_foreach(bib, tmp, &db->tcp.shards4[i].tree4, hook4)
+			release_bib_entry(bib);
+		rbtree_foreach(bib, tmp, &db->icmp.shards4[i].tree4, hook4)
+			release_bib_entry(bib);
+	}
 
-static int create_bib_session(struct session_entry *session,
-		struct bib_session_tuple *tuple)
-{
-	int error;
+	destroy_hashes(&db->udp);
+	destroy_hashes(&db->tcp);
+	destroy_hashes(&db->icmp);
+	port_maps_destroy(&db->udp.ports);
+	port_maps_destroy(&db->tcp.ports);
+	port_maps_destroy(&db->icmp.ports);
+	pba_table_destroy(&db->udp.pba);
+	pba_table_destroy(&db->tcp.pba);
+	pba_table_destroy(&db->icmp.pba);
+	quota_table_destroy(&db->udp.quota);
+	quota_table_destroy(&db->tcp.quota);
+	quota_table_destroy(&db->icmp.quota);
+	pktqueue_release(db->tcp.pkt_queue);
 
-	error = alloc_bib_session(tuple);
-	if (error)
-		return error;
+	wkfree(struct bib, db);
+}
 
-	/*
-	 * Hooks, most expirer fields and session->bib are left uninitialized
-	 * since they depend on database knowledge.
-	 */
-	tuple->bib->src6 = session->src6;
-	tuple->bib->src4 = session->src4;
-	tuple->bib->proto = session->proto;
-	tuple->bib->is_static = false;
-	tuple->bib->sessions = RB_ROOT;
-	tuple->session->dst6 = session->dst6;
-	tuple->session->dst4 = session->dst4;
-	tuple->session->state = session->state;
-	tuple->session->update_time = session->update_time;
-	tuple->session->stored = NULL;
-	return 0;
+void bib_put(struct bib *db)
+{
+	kref_put(&db->refs, bib_release);
 }
 
-/**
- * Boilerplate code to finish hanging @new->session (and potentially @new->bib
- * as well) on one af @table's trees. 6-to-4 direction.
- *
- * It assumes @slots already describes the tree containers where the entries are
- * supposed to be added.
+/*
+ * Keeps the entry counters (and the memory they account for) up to date.
  */
-static void commit_add6(struct xlation *state,
-		struct bib_session_tuple *old,
-		struct bib_session_tuple *new,
-		struct slot_group *slots,
-		struct expire_timer *expirer)
+static void count_bibs(struct xlator *jool, int delta)
 {
-	new->session->bib = old->bib ? : new->bib;
-	commit_session_add(&state->jool, &slots->session);
-	attach_timer(new->session, expirer);
-	log_new_session(&state->jool, new->session);
-	tstobs(state, new->session);
-	new->session = NULL; /* Do not free! */
-
-	if (!old->bib) {
-		commit_bib_add(&state->jool, slots);
-		log_new_bib(&state->jool, new->bib);
-		new->bib = NULL; /* Do not free! */
-	}
+	jstat_add(jool->stats, JSTAT_BIB_ENTRIES, delta);
+	jstat_add(jool->stats, JSTAT_BIB_BYTES,
+			delta * (int)sizeof(struct tabled_bib));
 }
 
-/**
- * Boilerplate code to finish hanging *@new on one af @table's trees.
- * 4-to-6 direction.
- *
- * It assumes @slot already describes the tree container where the session is
- * supposed to be added.
- */
-static void commit_add4(struct xlation *state,
-		struct bib_session_tuple *old,
-		struct tabled_session **new,
-		struct tree_slot *slot,
-		struct expire_timer *expirer)
+static size_t session_size(struct bib_table *table)
 {
-	struct tabled_session *session = *new;
+	return table->hashed
+			? sizeof(struct hashed_session)
+			: sizeof(struct tabled_session);
+}
 
-	session->bib = old->bib;
-	commit_session_add(&state->jool, slot);
-	attach_timer(session, expirer);
-	log_new_session(&state->jool, session);
-	tstobs(state, session);
-	*new = NULL; /* Do not free! */
+static void count_sessions(struct xlator *jool, struct bib_table *table,
+		int delta)
+{
+	atomic_add(delta, &jool->nat64.bib->session_count);
+	jstat_add(jool->stats, JSTAT_SESSIONS, delta);
+	jstat_add(jool->stats, JSTAT_SESSION_BYTES,
+			delta * (int)session_size(table));
 }
 
-/**
- * Boilerplate code to finish hanging *@new on one af @table's trees.
- * joold version.
+/*
+ * Keeps @shard's state and timer counters up to date. Call it with @delta = 1
+ * once @session is queued in an expirer, and with @delta = -1 once it leaves.
+ * State and expirer changes in between go through set_state() and set_timer().
  *
- * It assumes @slots already describes the tree containers where the entries are
- * supposed to be added.
+ * The shard's lock must be held.
  */
-static int commit_add(struct xlator *jool,
-		struct bib_table *table,
-		struct bib_session_tuple *old,
-		struct bib_session_tuple *new,
-		struct slot_group *slots,
-		session_timer_type timer_type)
+static void count_session(struct bib_shard *shard,
+		struct tabled_session *session, int delta)
 {
-	int error;
-
-	error = queue_unsorted_session(table, new->session, timer_type, false);
-	if (error)
-		return error;
-
-	new->session->bib = old->bib ? : new->bib;
-	commit_session_add(jool, &slots->session);
-	log_new_session(jool, new->session);
-	new->session = NULL; /* Do not free! */
+	shard->state_count[session->state] += delta;
+	shard->timer_count[session->timer] += delta;
+}
 
-	if (!old->bib) {
-		commit_bib_add(jool, slots);
-		log_new_bib(jool, new->bib);
-		new->bib = NULL; /* Do not free! */
-	}
+static void set_state(struct bib_shard *shard, struct tabled_session *session,
+		tcp_state state)
+{
+	shard->state_count[session->state]--;
+	session->state = state;
+	shard->state_count[state]++;
+}
 
-	return 0;
+static void set_timer(struct bib_shard *shard, struct tabled_session *session,
+		session_timer_type timer)
+{
+	shard->timer_count[session->timer]--;
+	session->timer = timer;
+	shard->timer_count[timer]++;
 }
 
-static int detach_sessions(struct bib_table *table, struct tabled_bib *bib)
+static void log_bib(struct xlator *jool, struct tabled_bib *bib,
+		enum jool_event_type type)
 {
-	struct tabled_session *session, *tmp;
-	int detached = 0;
+	struct jool_event event;
+	time64_t tsec;
+	struct tm time;
 
-	rbtree_foreach(session, tmp, &bib->sessions, tree_hook) {
-		list_del(&session->list_hook);
-		if (session->stored)
-			table->pkt_count--;
-		detached--;
+	if (!jool->globals.nat64.bib.bib_logging)
+		return;
+	/* The block's log already covers the entry. */
+	if (bib->block)
+		return;
+
+	if (jool->globals.nat64.bib.binary_logging) {
+		memset(&event, 0, sizeof(event));
+		event.src6 = bib->src6.l3;
+		event.src6_port = cpu_to_be16(bib->src6.l4);
+		event.src4 = bib->src4.l3;
+		event.src4_port = cpu_to_be16(bib->src4.l4);
+		event.proto = bib->proto;
+		evlog_add(jool, type, &event);
+		return;
 	}
 
-	return detached;
+	tsec = ktime_get_real_seconds();
+	time64_to_tm(tsec, 0, &time);
+	log_info("%s %ld/%d/%d %d:%d:%d (GMT) - %s " TA6PP " to " TA4PP " (%s)",
+			jool->iname,
+			1900 + time.tm_year, time.tm_mon + 1, time.tm_mday,
+			time.tm_hour, time.tm_min, time.tm_sec,
+			(type == JEV_BIB_ADD) ? "Mapped" : "Forgot",
+			TA6PA(bib->src6), TA4PA(bib->src4),
+			l4proto_to_string(bib->proto));
 }
 
-static void detach_bib(struct xlator *jool, struct bib_table *table,
-		struct tabled_bib *bib)
+static void log_new_bib(struct xlator *jool, struct tabled_bib *bib)
 {
-	rb_erase(&bib->hook6, &table->tree6);
-	rb_erase(&bib->hook4, &table->tree4);
-	jstat_dec(jool->stats, JSTAT_BIB_ENTRIES);
-	/* NOTE THAT detach_sessions() RETURNS NEGATIVE. */
-	jstat_add(jool->stats, JSTAT_SESSIONS, detach_sessions(table, bib));
+	return log_bib(jool, bib, JEV_BIB_ADD);
 }
 
-struct bib_delete_list {
-	struct rb_node *first;
-};
-
-static void add_to_delete_list(struct bib_delete_list *bdl,
-		struct rb_node *node)
+static void log_block(struct xlator *jool, struct pba_block *block,
+		l4_protocol proto, enum jool_event_type type)
 {
-	node->rb_right = bdl->first;
-	bdl->first = node;
-}
+	struct jool_event event;
+	time64_t tsec;
+	struct tm time;
 
-static void commit_delete_list(struct bib_delete_list *list)
-{
-	struct rb_node *node;
-	struct rb_node *next;
+	if (!jool->globals.nat64.bib.bib_logging)
+		return;
 
-	for (node = list->first; node; node = next) {
-		next = node->rb_right;
-		release_bib_entry(bib4_entry(node));
+	if (jool->globals.nat64.bib.binary_logging) {
+		memset(&event, 0, sizeof(event));
+		event.src6 = block->addr;
+		event.src4 = block->first.l3;
+		event.src4_port = cpu_to_be16(block->first.l4);
+		event.dst4 = block->last.l3;
+		event.dst4_port = cpu_to_be16(block->last.l4);
+		event.proto = proto;
+		evlog_add(jool, type, &event);
+		return;
 	}
+
+	tsec = ktime_get_real_seconds();
+	time64_to_tm(tsec, 0, &time);
+	log_info("%s %ld/%d/%d %d:%d:%d (GMT) - %s block %pI6c to " TA4PP
+			" - " TA4PP " (%s, mark %u)", jool->iname,
+			1900 + time.tm_year, time.tm_mon + 1, time.tm_mday,
+			time.tm_hour, time.tm_min, time.tm_sec,
+			(type == JEV_BLOCK_ADD) ? "Allocated" : "Released",
+			&block->addr, TA4PA(block->first), TA4PA(block->last),
+			l4proto_to_string(proto), block->mark);
 }
 
-/**
- * Tests whether @predecessor's immediate succesor tree slot is a suitable
- * placeholder for @bib. Returns the colliding node.
- *
- * (That is, returns NULL on success, a collision on failure.)
- *
- * In other words:
- * Assumes that @predecessor belongs to @table's v4 tree and that it is @bib's
- * predecessor. (ie. @predecessor's transport address is @bib's transport
- * address - 1.) You want to test whether @bib can be inserted to the tree.
- * If @predecessor's succesor collides with @bib (ie. it has @bib's v4 address),
- * it returns the colliding succesor.
- * If @predecessor's succesor does not collide with @bib, it returns NULL and
- * initializes @slot so you can actually add @bib to the tree.
- */
-static struct tabled_bib *try_next(struct bib_table *table,
-		struct tabled_bib *predecessor,
-		struct tabled_bib *bib,
-		struct tree_slot *slot)
+/*
+ * Drops @bib's reference to its port block (if any), returning the block to
+ * pool4 if nobody else is using it.
+ */
+static void put_block(struct xlator *jool, struct bib_table *table,
+		struct tabled_bib *bib)
 {
-	struct tabled_bib *next;
+	if (!bib->block)
+		return;
 
-	next = bib4_entry(rb_next(&predecessor->hook4));
-	if (!next) {
-		/* There is no succesor and therefore no collision. */
-		slot->tree = &table->tree4;
-		slot->entry = &bib->hook4;
-		slot->parent = &predecessor->hook4;
-		slot->rb_link = &slot->parent->rb_right;
-		return NULL;
+	if (pba_put(&table->pba, bib->block)) {
+		jstat_inc(jool->stats, JSTAT_PBA_RELEASED);
+		log_block(jool, bib->block, bib->proto, JEV_BLOCK_RM);
+		pba_free(bib->block);
 	}
+	bib->block = NULL;
+}
 
-	if (taddr4_equals(&next->src4, &bib->src4))
-		return next; /* Next is yet another collision. */
-
-	slot->tree = &table->tree4;
-	slot->entry = &bib->hook4;
-	if (predecessor->hook4.rb_right) {
-		slot->parent = &next->hook4;
-		slot->rb_link = &slot->parent->rb_left;
-	} else {
-		slot->parent = &predecessor->hook4;
-		slot->rb_link = &slot->parent->rb_right;
-	}
-	return NULL;
+static bool quotas_enabled(struct xlator *jool)
+{
+	return XGLOBALS(jool).max_bibs_per_subscriber
+			|| XGLOBALS(jool).max_sessions_per_subscriber;
 }
 
-/**
- * This is this function in pseudocode form:
- *
- * 	// wraps around until offset - 1
- * 	foreach (mask in @masks starting from some offset)
- * 		if (mask is not taken by an existing BIB entry from @table)
- * 			init the new BIB entry, @bib, using mask
- * 			init @slot as the tree slot where @bib should be added
- * 			return success (0)
- * 	return failure (-ENOENT)
- *
+/*
+ * If quotas are enabled, makes @bib count against its subscriber. If
+ * @enforce, fails with -EDQUOT if the subscriber already has all the BIB
+ * entries it's allowed.
  */
-static int find_available_mask(struct bib_table *table,
-		struct mask_domain *masks,
-		struct tabled_bib *bib,
-		struct tree_slot *slot)
+static int get_subscriber(struct xlator *jool, struct bib_table *table,
+		struct tabled_bib *bib, bool enforce)
 {
-	struct tabled_bib *collision = NULL;
-	bool consecutive;
 	int error;
 
-	/*
-	 * We're going to assume the masks are generally consecutive.
-	 * I think it's a fair assumption until someone requests otherwise as a
-	 * new feature.
-	 * This allows us to find an unoccupied mask with minimal further tree
-	 * traversal.
-	 */
-	do {
-		error = mask_domain_next(masks, &bib->src4, &consecutive);
-		if (error)
-			goto end;
+	/* We're retrying; @bib already counts. */
+	if (bib->subscriber)
+		return 0;
+	if (!quotas_enabled(jool))
+		return 0;
+
+	error = quota_get(&table->quota, &bib->src6.l3,
+			XGLOBALS(jool).quota_subscriber_len,
+			enforce ? XGLOBALS(jool).max_bibs_per_subscriber : 0,
+			&bib->subscriber);
+	if (error == -EDQUOT) {
+		jstat_inc(jool->stats, JSTAT_BIB_QUOTA);
+		__log_debug(jool, "%pI6c reached its BIB entry quota.",
+				&bib->src6.l3);
+	}
+	return error;
+}
 
-		/*
-		 * Just for the sake of clarity:
-		 * @consecutive is never true on the first iteration.
-		 */
-		collision = consecutive
-				? try_next(table, collision, bib, slot)
-				: find_bibtree4_slot(table, bib, slot);
+static void put_subscriber(struct bib_table *table, struct tabled_bib *bib)
+{
+	if (!bib->subscriber)
+		return;
 
-	} while (collision);
+	quota_put(&table->quota, bib->subscriber);
+	bib->subscriber = NULL;
+}
 
-end:
-	mask_domain_commit(masks);
-	return error;
+/*
+ * Counts one more session of @bib against its subscriber. (If any.) If
+ * @enforce, fails with -EDQUOT if the subscriber already has all the sessions
+ * it's allowed.
+ */
+static int get_subscriber_session(struct xlator *jool, struct tabled_bib *bib,
+		bool enforce)
+{
+	if (quota_session_add(bib->subscriber, enforce
+			? XGLOBALS(jool).max_sessions_per_subscriber
+			: 0))
+		return 0;
+
+	jstat_inc(jool->stats, JSTAT_SESSION_QUOTA);
+	__log_debug(jool, "%pI6c reached its session quota.", &bib->src6.l3);
+	return -EDQUOT;
 }
 
-static int upgrade_pktqueue_session(struct xlator *jool,
-		struct bib_table *table,
-		struct mask_domain *masks,
-		struct bib_session_tuple *new,
-		struct bib_session_tuple *old)
+/*
+ * Releases @bib, which never made it to the database.
+ */
+static void discard_bib(struct xlator *jool, struct bib_table *table,
+		struct tabled_bib *bib)
 {
-	struct pktqueue_session *sos; /* "simultaneous open" session */
-	struct tabled_bib *bib;
-	struct tabled_bib *collision;
-	struct tabled_session *session;
-	struct tree_slot bib_slot6;
-	struct tree_slot bib_slot4;
-	int error;
+	put_block(jool, table, bib);
+	put_subscriber(table, bib);
+	free_bib(bib);
+}
 
-	if (new->bib->proto != L4PROTO_TCP)
-		return -ESRCH;
+static void log_session(struct xlator *jool,
+		struct tabled_session *session,
+		enum jool_event_type type)
+{
+	struct jool_event event;
+	struct ipv6_transport_addr dst6;
+	time64_t tsec;
+	struct tm time;
 
-	sos = pktqueue_find(table->pkt_queue, &new->session->dst6, masks);
-	if (!sos)
-		return -ESRCH;
-	table->pkt_count--;
+	if (!jool->globals.nat64.bib.session_logging)
+		return;
 
-	if (!masks) {
-		/*
-		 * This happens during joold adds. It's a lost cause.
-		 *
-		 * The point of SO is that the v4 node decides session [*, dst6,
-		 * src4, dst4] and the first v6 packet needing a new mask that
-		 * matches that session keeps it.
-		 *
-		 * But we're not synchronizing pktqueue sessions, because we
-		 * want to keep joold as simple as possible (which is not simple
-		 * enough), at least so long as it remains a niche thing.
-		 *
-		 * So if one Jool instance gets the v4 SO packet and some other
-		 * instance gets the v6 SO packet, the latter will choose a
-		 * random src4 and mess up the SO. That situation is this if.
-		 * Our reaction is to go like "whatever" and pretend that we
-		 * never received the v4 packet.
-		 *
-		 * One might argue that we should send the ICMP error when this
-		 * happens. But that doesn't yield satisfactory behavior either;
-		 * The SO failed anyway. To fix this properly we would need to
-		 * sync the pktqueue sessions. Combine that with the fact that
-		 * sending the ICMP error would be a pain (because we want to do
-		 * it outside of the spinlock, and we don't want to send it if
-		 * the random src4 selected happens to match the stored
-		 * session), and the result is a big fat meh. I really don't
-		 * want to do it.
-		 *
-		 * The admin signed a best-effort contract when s/he enabled
-		 * joold anyway. And this is only a problem in active-active
-		 * scenarios.
-		 */
-		pktqueue_put_node(jool, sos);
-		return -ESRCH;
+	if (jool->globals.nat64.bib.binary_logging) {
+		memset(&event, 0, sizeof(event));
+		event.src6 = session->bib->src6.l3;
+		event.src6_port = cpu_to_be16(session->bib->src6.l4);
+		event.src4 = session->bib->src4.l3;
+		event.src4_port = cpu_to_be16(session->bib->src4.l4);
+		event.dst4 = session->dst4.l3;
+		event.dst4_port = cpu_to_be16(session->dst4.l4);
+		event.proto = session->bib->proto;
+		event.state = session->state;
+		evlog_add(jool, type, &event);
+		return;
 	}
 
-	__log_debug(jool, "Simultaneous Open!");
-	/*
-	 * We're going to pretend that @sos has been a valid V4 INIT session all
-	 * along.
-	 */
-	error = alloc_bib_session(old);
-	if (error) {
-		pktqueue_put_node(jool, sos);
-		return error;
-	}
+	/* The text log has never included state changes. */
+	if (type == JEV_SESSION_STATE)
+		return;
 
-	bib = old->bib;
-	session = old->session;
+	get_dst6(jool, session, &dst6);
+	tsec = ktime_get_real_seconds();
+	time64_to_tm(tsec, 0, &time);
+	log_info("%s %ld/%d/%d %d:%d:%d (GMT) - %s " TA6PP "|" TA6PP "|"
+			TA4PP "|" TA4PP "|%s", jool->iname,
+			1900 + time.tm_year, time.tm_mon + 1, time.tm_mday,
+			time.tm_hour, time.tm_min, time.tm_sec,
+			(type == JEV_SESSION_ADD) ? "Added session" : "Forgot session",
+			TA6PA(session->bib->src6), TA6PA(dst6),
+			TA4PA(session->bib->src4), TA4PA(session->dst4),
+			l4proto_to_string(session->bib->proto));
+}
 
-	bib->src6 = new->bib->src6;
-	bib->src4 = sos->src4;
-	bib->proto = L4PROTO_TCP;
-	bib->is_static = false;
-	bib->sessions = RB_ROOT;
+static void log_new_session(struct xlator *jool, struct tabled_session *session)
+{
+	return log_session(jool, session, JEV_SESSION_ADD);
+}
 
-	session->dst6 = sos->dst6;
-	session->dst4 = sos->dst4;
-	session->state = V4_INIT;
-	session->bib = bib;
-	session->update_time = jiffies;
-	session->stored = NULL;
+/**
+ * This function does not return a result because whatever needs to happen later
+ * needs to happen regardless of probe status.
+ *
+ * This function does not actually send the probe; it merely prepares it so the
+ * caller can commit to sending it after releasing the spinlock.
+ */
+static void handle_probe(struct xlator *jool,
+		struct bib_shard *shard,
+		struct list_head *probes,
+		struct tabled_session *session,
+		struct session_entry *tmp)
+{
+	struct probing_session *probe;
+
+	if (WARN(!probes, "Probe needed but caller doesn't support it"))
+		goto discard_probe;
 
 	/*
-	 * This *has* to work. src6 wasn't in the database because we just
-	 * looked it up and src4 wasn't either because pktqueue had it.
+	 * Why add a dummy session instead of the real one?
+	 * In the case of TCP probes it's because the real session's list hook
+	 * must remain attached to the database.
+	 * In the case of ICMP errors it's because the fact that a session
+	 * removal can cascade into a BIB entry removal really complicates
+	 * things.
+	 * This way requires this malloc but it's otherwise very clean.
 	 */
-	collision = find_bibtree6_slot(table, bib, &bib_slot6);
-	if (WARN(collision, "BIB entry was and then wasn't in the v6 tree."))
-		goto trainwreck;
-	collision = find_bibtree4_slot(table, bib, &bib_slot4);
-	if (WARN(collision, "BIB entry was and then wasn't in the v4 tree."))
-		goto trainwreck;
-	treeslot_commit(&bib_slot6);
-	treeslot_commit(&bib_slot4);
-	jstat_inc(jool->stats, JSTAT_BIB_ENTRIES);
-
-	rb_link_node(&session->tree_hook, NULL, &bib->sessions.rb_node);
-	rb_insert_color(&session->tree_hook, &bib->sessions);
-	attach_timer(session, &table->syn4_timer);
-	jstat_inc(jool->stats, JSTAT_SESSIONS);
-
-	pktqueue_put_node(jool, sos);
+	probe = wkmalloc(struct probing_session, GFP_ATOMIC);
+	if (!probe)
+		goto discard_probe;
 
-	log_new_bib(jool, bib);
-	log_new_session(jool, session);
-	return 0;
+	probe->session = *tmp;
+	probe->skb = take_stored_pkt(shard, session);
+	list_add(&probe->list_hook, probes);
+	return;
 
-trainwreck:
-	pktqueue_put_node(jool, sos);
-	free_bib(bib);
-	free_session(session);
-	return -EINVAL;
+discard_probe:
+	/*
+	 * We're going to have to pretend that we sent it anyway; a probe
+	 * failure should not prevent the state from evolving from V4 INIT and
+	 * we do not want that massive thing to linger in the database anymore,
+	 * especially if we failed due to a memory allocation.
+	 */
+	kill_stored_pkt(jool, shard, session);
 }
 
-static bool issue216_needed(struct mask_domain *masks,
-		struct bib_session_tuple *old)
+static void rm(struct xlator *jool,
+		struct bib_shard *shard,
+		struct list_head *probes,
+		struct tabled_session *session,
+		struct session_entry *tmp)
 {
-	if (!masks)
-		return false;
-	return mask_domain_is_dynamic(masks)
-			&& !mask_domain_matches(masks, &old->bib->src4);
+	struct tabled_bib *bib = session->bib;
+
+	if (session->has_stored)
+		handle_probe(jool, shard, probes, session, tmp);
+
+	rb_erase(&session->tree_hook, &bib->sessions);
+	hash_rm_session(shard, session);
+	list_del(&session->list_hook);
+	count_session(shard, session, -1);
+	log_session(jool, session, JEV_SESSION_RM);
+	free_session_rcu(session);
+	count_sessions(jool, shard->table, -1);
+	quota_session_rm(bib->subscriber, 1);
+
+	if (!bib->is_static && RB_EMPTY_ROOT(&bib->sessions)) {
+		erase_bib(shard, bib);
+		log_bib(jool, bib, JEV_BIB_RM);
+		put_block(jool, shard->table, bib);
+		put_subscriber(shard->table, bib);
+		free_bib_rcu(bib);
+		count_bibs(jool, -1);
+	}
 }
 
 /**
- * This is a find and an add at the same time, for both @new->bib and
- * @new->session.
- *
- * If @new->bib needs to be added, initializes @slots->bib*.
- * If @new->session needs to be added, initializes @slots->session.
- * If @new->bib collides, you will find the collision in @old->bib.
- * If @new->session collides, you will find the collision in @old->session.
+ * Refreshes @session, and moves it to the end of @timer's list.
  *
- * @masks will be used to init @new->bib.src4 if applies.
+ * The move dirties the list heads, so if the session was queued recently
+ * enough, it is skipped. The expiration code will notice @session's update
+ * time is newer than its position suggests, and defer it.
  */
-static int find_bib_session6(struct xlator *jool,
-		struct bib_table *table,
-		struct mask_domain *masks,
-		struct bib_session_tuple *new,
-		struct bib_session_tuple *old,
-		struct slot_group *slots,
-		struct bib_delete_list *bdl)
+static void handle_fate_timer(struct xlator *jool,
+		struct bib_shard *shard,
+		struct tabled_session *session,
+		struct expire_timer *timer)
 {
-	int error;
+	if (can_refresh_lazily(jool, session, timer->type)) {
+		session->update_delta = jiffies - get_queue_time(session);
+		return;
+	}
 
-	/*
-	 * Please be careful around this function. All it wants to do is
-	 * find/add, but it is constrained by several requirements at the same
-	 * time:
-	 *
-	 * 1. If @new->bib->proto is ICMP (ie. 3-tuple), then
-	 *    @new->session->dst4.l4 is invalid and needs to be patched. Though
-	 *    it cannot be patched until we acquire a valid BIB entry.
-	 *    (dst4.l4 is just fat that should not be used in 3-tuple
-	 *    translation code, but a chunk of Jool assumes that
+	reset_times(session, jiffies);
+	set_timer(shard, session, timer->type);
+	list_del(&session->list_hook);
+	list_add_tail(&session->list_hook, &timer->sessions);
+}
+
+/**
+ * Queues @session in @timer_type's list, at the position @update_time
+ * warrants.
+ */
+static int queue_unsorted_session(struct bib_shard *shard,
+		struct tabled_session *session,
+		session_timer_type timer_type,
+		bool remove_first,
+		unsigned long update_time)
+{
+	struct expire_timer *expirer;
+	struct list_head *list;
+	struct list_head *cursor;
+	struct tabled_session *old;
+
+	switch (timer_type) {
+	case SESSION_TIMER_EST:
+		expirer = &shard->est_timer;
+		break;
+	case SESSION_TIMER_TRANS:
+		expirer = &shard->trans_timer;
+		break;
+	case SESSION_TIMER_SYN4:
+		expirer = &shard->syn4_timer;
+		break;
+	default:
+		log_warn_once("incoming joold session's timer (%d) is unknown.",
+				timer_type);
+		return -EINVAL;
+	}
+
+	list = &expirer->sessions;
+	for (cursor = list->prev; cursor != list; cursor = cursor->prev) {
+		old = list_entry(cursor, struct tabled_session, list_hook);
+		if (time_before(get_queue_time(old), update_time))
+			break;
+	}
+
+	if (remove_first) {
+		list_del(&session->list_hook);
+		set_timer(shard, session, timer_type);
+	} else {
+		session->timer = timer_type;
+		count_session(shard, session, 1);
+	}
+	list_add(&session->list_hook, cursor);
+	reset_times(session, update_time);
+	return 0;
+}
+
+/**
+ * Sets @session's update time. @session must be queued; if @update_time
+ * cannot be represented from its current position, it gets requeued.
+ */
+static void set_update_time(struct bib_shard *shard,
+		struct tabled_session *session,
+		unsigned long update_time)
+{
+	unsigned long queue_time;
+
+	queue_time = get_queue_time(session);
+	if (time_before(update_time, queue_time)
+			|| time_after(update_time, queue_time + U16_MAX))
+		queue_unsorted_session(shard, session, session->timer, true,
+				update_time);
+	else
+		session->update_delta = update_time - queue_time;
+}
+
+/**
+ * Decides what should happen to @session via @cb, and carries the verdict out.
+ * Returns true if the packet should be translated, false if the packet should
+ * be dropped. (Assuming that the caller has a packet linked to @session.)
+ *
+ * Assumes result->session has been set (result->session_set is true).
+ */
+static bool decide_fate(struct xlator *jool,
+		struct collision_cb *cb,
+		struct bib_shard *shard,
+		struct tabled_session *session,
+		struct list_head *probes)
+{
+	struct session_entry tmp;
+	enum session_fate fate;
+
+	if (!cb)
+		return true;
+
+	tstose(jool, session, &tmp);
+	fate = cb->cb(&tmp, cb->arg);
+
+	/* The callback above is entitled to tweak these fields. */
+	if (session->state != tmp.state) {
+		set_state(shard, session, tmp.state);
+		log_session(jool, session, JEV_SESSION_STATE);
+	}
+	if (!tmp.has_stored)
+		kill_stored_pkt(jool, shard, session);
+	/*
+	 * Also the update time and expirer, which are down below. (The timer
+	 * fates overwrite the update time anyway.)
+	 */
+
+	switch (fate) {
+	case FATE_TIMER_EST:
+		handle_fate_timer(jool, shard, session, &shard->est_timer);
+		break;
+
+	case FATE_PROBE:
+		/*
+		 * TODO (warning) ICMP errors aren't supposed to drop down to
+		 * TRANS.
+		 */
+		handle_probe(jool, shard, probes, session, &tmp);
+		handle_fate_timer(jool, shard, session, &shard->trans_timer);
+		break;
+
+	case FATE_TIMER_TRANS:
+		handle_fate_timer(jool, shard, session, &shard->trans_timer);
+		break;
+
+	case FATE_RM:
+		rm(jool, shard, probes, session, &tmp);
+		break;
+
+	case FATE_PRESERVE:
+		if (tmp.update_time != get_update_time(session))
+			set_update_time(shard, session, tmp.update_time);
+		break;
+	case FATE_DROP:
+		if (tmp.update_time != get_update_time(session))
+			set_update_time(shard, session, tmp.update_time);
+		return false;
+
+	case FATE_TIMER_SLOW:
+		/*
+		 * If timer type was invalid, well don't change the expirer.
+		 * We left a warning in the log.
+		 */
+		if (queue_unsorted_session(shard, session, tmp.timer_type, true,
+				tmp.update_time))
+			set_update_time(shard, session, tmp.update_time);
+		break;
+	}
+
+	return true;
+}
+
+/**
+ * send_probe_packet - Sends a probe packet to @session's IPv6 endpoint,
+ * to trigger a confirmation ACK if the connection is still alive.
+ *
+ * From RFC 6146 page 30.
+ *
+ * @session: the established session that has been inactive for too long.
+ *
+ * Best if not called with spinlocks held.
+ */
+static void send_probe_packet(struct xlator *jool, struct session_entry *session)
+{
+	struct sk_buff *skb;
+	struct ipv6hdr *iph;
+	struct tcphdr *th;
+	struct flowi6 flow;
+	struct dst_entry *dst;
+	int error;
+
+	unsigned int l3_hdr_len = sizeof(*iph);
+	unsigned int l4_hdr_len = sizeof(*th);
+
+	skb = alloc_skb(LL_MAX_HEADER + l3_hdr_len + l4_hdr_len, GFP_ATOMIC);
+	if (!skb) {
+		__log_debug(jool, "Could not allocate a probe packet.");
+		goto fail;
+	}
+
+	skb_reserve(skb, LL_MAX_HEADER);
+	skb_put(skb, l3_hdr_len + l4_hdr_len);
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+	skb_set_transport_header(skb, l3_hdr_len);
+
+	iph = ipv6_hdr(skb);
+	iph->version = 6;
+	iph->priority = 0;
+	iph->flow_lbl[0] = 0;
+	iph->flow_lbl[1] = 0;
+	iph->flow_lbl[2] = 0;
+	iph->payload_len = cpu_to_be16(l4_hdr_len);
+	iph->nexthdr = NEXTHDR_TCP;
+	iph->hop_limit = 255;
+	iph->saddr = session->dst6.l3;
+	iph->daddr = session->src6.l3;
+
+	th = tcp_hdr(skb);
+	th->source = cpu_to_be16(session->dst6.l4);
+	th->dest = cpu_to_be16(session->src6.l4);
+	th->seq = htonl(0);
+	th->ack_seq = htonl(0);
+	th->res1 = 0;
+	th->doff = l4_hdr_len / 4;
+	th->fin = 0;
+	th->syn = 0;
+	th->rst = 0;
+	th->psh = 0;
+	th->ack = 1;
+	th->urg = 0;
+	th->ece = 0;
+	th->cwr = 0;
+	th->window = htons(8192);
+	th->check = 0;
+	th->urg_ptr = 0;
+
+	/* TODO (performance) can't we just defer this to somebody else? */
+	th->check = csum_ipv6_magic(&iph->saddr, &iph->daddr, l4_hdr_len,
+			IPPROTO_TCP, csum_partial(th, l4_hdr_len, 0));
+	skb->ip_summed = CHECKSUM_UNNECESSARY;
+
+	memset(&flow, 0, sizeof(flow));
+	flow.flowi6_scope = RT_SCOPE_UNIVERSE;
+	flow.flowi6_proto = NEXTHDR_TCP;
+	flow.saddr = iph->saddr;
+	flow.daddr = iph->daddr;
+	flow.fl6_sport = th->source;
+	flow.fl6_dport = th->dest;
+
+	dst = route6(jool, &flow);
+	if (!dst)
+		goto revert;
+
+	skb_dst_set(skb, dst);
+
+	/* Implicit kfree_skb(skb) here. */
+	error = dst_output(jool->ns, NULL, skb);
+	if (error) {
+		__log_debug(jool, "dst_output() returned errcode %d.", error);
+		goto fail;
+	}
+
+	return;
+
+revert:
+	kfree_skb(skb);
+fail:
+	__log_debug(jool, "A TCP connection will probably break.");
+}
+
+/**
+ * Sends all the probes and ICMP errors listed in @probes.
+ */
+static void post_fate(struct xlator *jool, struct list_head *probes)
+{
+	struct probing_session *probe;
+	struct probing_session *tmp;
+
+	list_for_each_entry_safe(probe, tmp, probes, list_hook) {
+		if (probe->skb) {
+			/* The "probe" is not a probe; it's an ICMP error. */
+			icmp64_send(jool, probe->skb, ICMPERR_PORT_UNREACHABLE,
+					0);
+			kfree_skb(probe->skb);
+		} else {
+			/* Actual TCP probe. */
+			send_probe_packet(jool, &probe->session);
+		}
+		wkfree(struct probing_session, probe);
+	}
+}
+
+/*
+ * Returns true if the instance cannot hold more sessions.
+ */
+static bool sessions_full(struct xlator *jool)
+{
+	unsigned int max = XGLOBALS(jool).max_sessions;
+
+	return max && atomic_read(&jool->nat64.bib->session_count) >= max;
+}
+
+/*
+ * Kills the least recently updated session of @expirer, which belongs to
+ * @shard. Returns false if @expirer was empty.
+ */
+static bool evict(struct xlator *jool, struct bib_shard *shard,
+		struct expire_timer *expirer)
+{
+	struct tabled_session *session;
+	struct tabled_session *deferred;
+	struct session_entry tmp;
+	LIST_HEAD(probes);
+
+	/* Racy, but it spares the empty shards the lock. */
+	if (list_empty(&expirer->sessions) && list_empty(&expirer->deferred))
+		return false;
+
+	shard_lock(shard);
+
+	session = list_first_entry_or_null(&expirer->sessions,
+			struct tabled_session, list_hook);
+	deferred = list_first_entry_or_null(&expirer->deferred,
+			struct tabled_session, list_hook);
+	if (!session || (deferred && time_before(get_update_time(deferred),
+			get_update_time(session))))
+		session = deferred;
+
+	if (session) {
+		tstose(jool, session, &tmp);
+		rm(jool, shard, &probes, session, &tmp);
+	}
+
+	shard_unlock(shard);
+
+	post_fate(jool, &probes);
+	return session != NULL;
+}
+
+/*
+ * Evicts one session, so a new one can be added once the instance has reached
+ * max-sessions.
+ *
+ * The victim is the oldest UDP or ICMP session of some shard, or, if there are
+ * none, the oldest transitory TCP session of some shard. (Established TCP
+ * sessions are never evicted.) Shards are visited in rotation, so the victims
+ * approximate the globally oldest sessions without having to compare every
+ * shard's.
+ */
+static bool evict_any(struct xlator *jool)
+{
+	struct bib *db = jool->nat64.bib;
+	unsigned int start;
+	unsigned int i;
+	struct bib_shard *shard;
+
+	start = atomic_inc_return(&db->evict_cursor);
+
+	for (i = 0; i < BIB_SHARDS; i++) {
+		shard = &db->udp.shards4[(start + i) % BIB_SHARDS];
+		if (evict(jool, shard, &shard->est_timer))
+			return true;
+		shard = &db->icmp.shards4[(start + i) % BIB_SHARDS];
+		if (evict(jool, shard, &shard->est_timer))
+			return true;
+	}
+
+	for (i = 0; i < BIB_SHARDS; i++) {
+		shard = &db->tcp.shards4[(start + i) % BIB_SHARDS];
+		if (evict(jool, shard, &shard->trans_timer))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Call when a commit fails with -ENOSPC. (ie. the instance has max-sessions
+ * sessions.) No locks can be held.
+ *
+ * If this is the first attempt (according to @evicted), evicts a session and
+ * returns zero, and the caller should retry. Otherwise, or if there was nothing
+ * to evict, counts the drop and returns -ENOSPC.
+ */
+static int make_room(struct xlator *jool, bool *evicted)
+{
+	if (!*evicted && evict_any(jool)) {
+		jstat_inc(jool->stats, JSTAT_SESSION_EVICTED);
+		*evicted = true;
+		return 0;
+	}
+
+	jstat_inc(jool->stats, JSTAT_SESSION_LIMIT);
+	__log_debug(jool, "The session table is full.");
+	return -ENOSPC;
+}
+
+struct slot_group {
+	struct tree_slot bib4;
+	struct tree_slot session;
+};
+
+/*
+ * Indexes @bib (in the src6 index, @shard's hash table and the port index)
+ * and/or @session (in @shard's hash table), whichever are not NULL, before
+ * their trees are committed. On failure, nothing is indexed.
+ *
+ * This is the only part of an addition that can fail. (See index6_add() for
+ * the meaning of -EAGAIN.)
+ */
+static int index_add(struct bib_shard *shard, struct tabled_bib *bib,
+		struct tabled_session *session)
+{
+	int error;
+
+	if (bib) {
+		error = index6_add(shard->table, bib);
+		if (error)
+			return error;
+		error = hash_add_bib4(shard, bib);
+		if (error)
+			goto bib4_fail;
+		error = ports_add(shard->table, bib);
+		if (error)
+			goto ports_fail;
+	}
+
+	if (session) {
+		error = hash_add_session(shard, session);
+		if (error)
+			goto session_fail;
+	}
+
+	return 0;
+
+session_fail:
+	if (bib)
+		ports_rm(shard->table, bib);
+ports_fail:
+	if (bib)
+		hash_rm_bib4(shard, bib);
+bib4_fail:
+	if (bib)
+		index6_rm(shard->table, bib);
+	return error;
+}
+
+static void commit_bib_add(struct xlator *jool, struct slot_group *slots)
+{
+	treeslot_commit(&slots->bib4);
+	count_bibs(jool, 1);
+}
+
+static void commit_session_add(struct xlator *jool, struct bib_shard *shard,
+		struct tree_slot *slot)
+{
+	treeslot_commit(slot);
+	count_sessions(jool, shard->table, 1);
+}
+
+static void attach_timer(struct bib_shard *shard,
+		struct tabled_session *session,
+		struct expire_timer *expirer)
+{
+	reset_times(session, jiffies);
+	session->timer = expirer->type;
+	list_add_tail(&session->list_hook, &expirer->sessions);
+	count_session(shard, session, 1);
+}
+
+static int compare_src4(struct tabled_bib const *a,
+		struct ipv4_transport_addr const *b)
+{
+	return taddr4_compare(&a->src4, b);
+}
+
+static int compare_src4_rbnode(struct rb_node *a, struct rb_node *b)
+{
+	return taddr4_compare(&bib4_entry(a)->src4, &bib4_entry(b)->src4);
+}
+
+static int compare_dst4(struct tabled_session *a, struct tabled_session *b)
+{
+	return taddr4_compare(&a->dst4, &b->dst4);
+}
+
+static int compare_dst4_taddr(struct tabled_session *a,
+		struct ipv4_transport_addr *b)
+{
+	return taddr4_compare(&a->dst4, b);
+}
+
+/*
+ * Needs @shard6's lock, or an RCU read-side critical section and validation.
+ * (@shard6 has to be get_shard6(@addr).)
+ */
+static struct tabled_bib *find_bib6(struct bib_table *table,
+		struct bib_shard6 *shard6,
+		struct ipv6_transport_addr const *addr)
+{
+	if (table->hashed)
+		return rhashtable_lookup_fast(&table->hash6, addr, bib6_params);
+	return rbtree_find_rcu(addr, &shard6->tree6, compare_src6,
+			struct tabled_bib, hook6);
+}
+
+static struct tabled_bib *find_bib4(struct bib_shard *shard,
+		struct ipv4_transport_addr const *addr)
+{
+	if (shard->table->hashed)
+		return rhashtable_lookup_fast(&shard->hash4, addr, bib4_params);
+	return rbtree_find(addr, &shard->tree4, compare_src4, struct tabled_bib,
+			hook4);
+}
+
+/*
+ * Finds the BIB entry whose src6 is @addr, and locks the shard it belongs to.
+ * The shard is returned in @result.
+ *
+ * Returns NULL (and locks nothing) if there's no such entry.
+ */
+static struct tabled_bib *find_bib6_locked(struct bib_table *table,
+		struct ipv6_transport_addr const *addr,
+		struct bib_shard **result)
+{
+	struct bib_shard6 *shard6;
+	struct bib_shard *shard;
+	struct tabled_bib *bib;
+
+	shard6 = get_shard6(table, addr);
+
+	rcu_read_lock();
+	do {
+		spin_lock_bh(&shard6->lock);
+		bib = find_bib6(table, shard6, addr);
+		spin_unlock_bh(&shard6->lock);
+		if (!bib)
+			break;
+
+		shard = get_shard4(table, &bib->src4);
+		shard_lock(shard);
+		/*
+		 * The entry might have died while we weren't holding any locks.
+		 * (Its memory is still valid because of the RCU lock.)
+		 */
+		if (find_bib4(shard, &bib->src4) == bib) {
+			*result = shard;
+			break;
+		}
+		shard_unlock(shard);
+	} while (true);
+	rcu_read_unlock();
+
+	return bib;
+}
+
+static struct tabled_bib *find_bibtree4_slot(struct bib_shard *shard,
+		struct tabled_bib *new,
+		struct tree_slot *slot)
+{
+	struct rb_node *collision;
+	collision = rbtree_find_slot(&new->hook4, &shard->tree4,
+			compare_src4_rbnode, slot);
+	return bib4_entry(collision);
+}
+
+/**
+ * Attempts to find the slot where @new would be inserted if you wanted to add
+ * it to @bib's session tree.
+ *
+ * On success:
+ * - Initializes @slots as the place (in @bib's session tree) where @new would
+ *   be inserted if you wanted to do so.
+ * - Returns NULL.
+ *
+ * If @session collides with @bib's session S:
+ * - @slot is undefined.
+ * - S is returned.
+ *
+ * As a side effect, @allow will tell you whether the entry is allowed to be
+ * added to the tree if address-dependent filtering is enabled. Send NULL if you
+ * don't care about that.
+ *
+ * Please notice: This searches via @new's dst4, *not* dst6. @new *must* carry
+ * an initialized dst4.
+ */
+static struct tabled_session *find_session_slot(struct tabled_bib *bib,
+		struct tabled_session *new,
+		bool *allow,
+		struct tree_slot *slot)
+{
+	struct tabled_session *session;
+	struct rb_node *node;
+	int comparison;
+
+	treeslot_init(slot, &bib->sessions, &new->tree_hook);
+	node = bib->sessions.rb_node;
+	if (allow)
+		*allow = false;
+
+	while (node) {
+		session = node2session(node);
+		comparison = compare_dst4(session, new);
+
+		if (allow && (session->dst4.l3.s_addr == new->dst4.l3.s_addr))
+			*allow = true;
+
+		slot->parent = node;
+		if (comparison < 0) {
+			slot->rb_link = &node->rb_right;
+			node = node->rb_right;
+		} else if (comparison > 0) {
+			slot->rb_link = &node->rb_left;
+			node = node->rb_left;
+		} else {
+			return session;
+		}
+	}
+
+	return NULL;
+}
+
+static int alloc_bib_session(struct bib_table *table,
+		struct bib_session_tuple *tuple)
+{
+	tuple->bib = alloc_bib(GFP_ATOMIC);
+	if (!tuple->bib)
+		return -ENOMEM;
+
+	tuple->session = alloc_session(table->hashed, GFP_ATOMIC);
+	if (!tuple->session) {
+		free_bib(tuple->bib);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static int create_bib_session6(struct bib_table *table,
+		struct bib_session_tuple *tuple,
+		struct tuple *tuple6,
+		struct ipv4_transport_addr *dst4,
+		tcp_state state)
+{
+	int error;
+
+	error = alloc_bib_session(table, tuple);
+	if (error)
+		return error;
+
+	/*
+	 * Hooks, expirer fields and session->bib are left uninitialized since
+	 * they depend on database knowledge.
+	 */
+
+	tuple->bib->src6 = tuple6->src.addr6;
+	/*
+	 * src4 is left uninitialized on purpose.
+	 * It needs to be inferred later by comparing the masks and the existing
+	 * BIB entries.
+	 */
+	tuple->bib->proto = tuple6->l4_proto;
+	tuple->bib->is_static = false;
+	tuple->bib->block = NULL;
+	tuple->bib->subscriber = NULL;
+	tuple->bib->sessions = RB_ROOT;
+	tuple->session->dst4 = *dst4;
+	tuple->session->state = state;
+	tuple->session->has_stored = false;
+	return 0;
+}
+
+static struct tabled_session *create_session4(struct bib_table *table,
+		struct tuple *tuple4,
+		tcp_state state)
+{
+	struct tabled_session *session;
+
+	session = alloc_session(table->hashed, GFP_ATOMIC);
+	if (!session)
+		return NULL;
+
+	/*
+	 * Hooks, expirer fields and session->bib are left uninitialized since
+	 * they depend on database knowledge.
+	 */
+	session->dst4 = tuple4->src.addr4;
+	session->state = state;
+	session->has_stored = false;
+	return session;
+}
+
+static int create_bib_session(struct bib_table *table,
+		struct session_entry *session,
+		struct bib_session_tuple *tuple)
+{
+	int error;
+
+	error = alloc_bib_session(table, tuple);
+	if (error)
+		return error;
+
+	/*
+	 * Hooks, most expirer fields and session->bib are left uninitialized
+	 * since they depend on database knowledge.
+	 */
+	tuple->bib->src6 = session->src6;
+	tuple->bib->src4 = session->src4;
+	tuple->bib->proto = session->proto;
+	tuple->bib->is_static = false;
+	tuple->bib->block = NULL;
+	tuple->bib->subscriber = NULL;
+	tuple->bib->sessions = RB_ROOT;
+	tuple->session->dst4 = session->dst4;
+	tuple->session->state = session->state;
+	reset_times(tuple->session, session->update_time);
+	tuple->session->has_stored = false;
+	return 0;
+}
+
+/**
+ * Boilerplate code to finish hanging @new->session (and potentially @new->bib
+ * as well) on one af @shard's trees. 6-to-4 direction.
+ *
+ * It assumes @slots already describes the tree containers where the entries are
+ * supposed to be added.
+ *
+ * Nothing is added on failure. (See index_add().) -ENOSPC means the instance
+ * is full; see make_room().
+ */
+static int commit_add6(struct xlation *state,
+		struct bib_shard *shard,
+		struct bib_session_tuple *old,
+		struct bib_session_tuple *new,
+		struct slot_group *slots,
+		struct expire_timer *expirer)
+{
+	int error;
+
+	if (sessions_full(state->jool))
+		return -ENOSPC;
+
+	new->session->bib = old->bib ? : new->bib;
+	error = get_subscriber_session(state->jool, new->session->bib, true);
+	if (error)
+		return error;
+	error = index_add(shard, old->bib ? NULL : new->bib, new->session);
+	if (error) {
+		quota_session_rm(new->session->bib->subscriber, 1);
+		return error;
+	}
+
+	commit_session_add(state->jool, shard, &slots->session);
+	attach_timer(shard, new->session, expirer);
+	log_new_session(state->jool, new->session);
+	tstobs(state, new->session);
+	new->session = NULL; /* Do not free! */
+
+	if (!old->bib) {
+		commit_bib_add(state->jool, slots);
+		log_new_bib(state->jool, new->bib);
+		new->bib = NULL; /* Do not free! */
+	}
+
+	return 0;
+}
+
+/**
+ * Boilerplate code to finish hanging *@new on one af @shard's trees.
+ * 4-to-6 direction.
+ *
+ * It assumes @slot already describes the tree container where the session is
+ * supposed to be added.
+ *
+ * Nothing is added on failure. (See commit_add6().)
+ */
+static int commit_add4(struct xlation *state,
+		struct bib_shard *shard,
+		struct bib_session_tuple *old,
+		struct tabled_session **new,
+		struct tree_slot *slot,
+		struct expire_timer *expirer)
+{
+	struct tabled_session *session = *new;
+	int error;
+
+	if (sessions_full(state->jool))
+		return -ENOSPC;
+
+	session->bib = old->bib;
+	error = get_subscriber_session(state->jool, session->bib, true);
+	if (error)
+		return error;
+	error = hash_add_session(shard, session);
+	if (error) {
+		quota_session_rm(session->bib->subscriber, 1);
+		return error;
+	}
+
+	commit_session_add(state->jool, shard, slot);
+	attach_timer(shard, session, expirer);
+	log_new_session(state->jool, session);
+	tstobs(state, session);
+	*new = NULL; /* Do not free! */
+	return 0;
+}
+
+/**
+ * Boilerplate code to finish hanging *@new on one af @shard's trees.
+ * joold and checkpoint version.
+ *
+ * It assumes @slots already describes the tree containers where the entries are
+ * supposed to be added.
+ *
+ * If @enforce, fails with -ENOSPC if the instance is full, and with -EDQUOT if
+ * the subscriber is. (joold sessions were already admitted by some other
+ * instance, so they aren't limited.)
+ */
+static int commit_add(struct xlator *jool,
+		struct bib_shard *shard,
+		struct bib_session_tuple *old,
+		struct bib_session_tuple *new,
+		struct slot_group *slots,
+		session_timer_type timer_type,
+		bool enforce)
+{
+	int error;
+
+	if (enforce && sessions_full(jool)) {
+		jstat_inc(jool->stats, JSTAT_SESSION_LIMIT);
+		return -ENOSPC;
+	}
+
+	new->session->bib = old->bib ? : new->bib;
+	error = get_subscriber_session(jool, new->session->bib, enforce);
+	if (error)
+		return error;
+	error = index_add(shard, old->bib ? NULL : new->bib, new->session);
+	if (error)
+		goto fail;
+
+	error = queue_unsorted_session(shard, new->session, timer_type, false,
+			get_queue_time(new->session));
+	if (error) {
+		hash_rm_session(shard, new->session);
+		if (!old->bib) {
+			ports_rm(shard->table, new->bib);
+			hash_rm_bib4(shard, new->bib);
+			index6_rm(shard->table, new->bib);
+		}
+		goto fail;
+	}
+
+	commit_session_add(jool, shard, &slots->session);
+	log_new_session(jool, new->session);
+	new->session = NULL; /* Do not free! */
+
+	if (!old->bib) {
+		commit_bib_add(jool, slots);
+		log_new_bib(jool, new->bib);
+		new->bib = NULL; /* Do not free! */
+	}
+
+	return 0;
+
+fail:
+	quota_session_rm(new->session->bib->subscriber, 1);
+	return error;
+}
+
+struct bib_delete_list {
+	struct rb_node *first;
+	/** The detached sessions' type 2 packets. (struct stored_pkt) */
+	struct list_head stored;
+};
+
+#define BIB_DELETE_LIST(name) \
+	struct bib_delete_list name = { NULL, LIST_HEAD_INIT(name.stored) }
+
+static void add_to_delete_list(struct bib_delete_list *bdl,
+		struct rb_node *node)
+{
+	node->rb_right = bdl->first;
+	bdl->first = node;
+}
+
+static void commit_delete_list(struct bib_delete_list *list)
+{
+	struct rb_node *node;
+	struct rb_node *next;
+
+	for (node = list->first; node; node = next) {
+		next = node->rb_right;
+		release_bib_entry(bib4_entry(node));
+	}
+
+	release_stored_pkts(&list->stored);
+}
+
+static int detach_sessions(struct bib_shard *shard, struct tabled_bib *bib,
+		struct list_head *stored_pkts)
+{
+	struct tabled_session *session, *tmp;
+	struct stored_pkt *stored;
+	int detached = 0;
+
+	rbtree_foreach(session, tmp, &bib->sessions, tree_hook) {
+		hash_rm_session(shard, session);
+		list_del(&session->list_hook);
+		count_session(shard, session, -1);
+		stored = find_stored_pkt(shard, session);
+		if (stored) {
+			list_move(&stored->list_hook, stored_pkts);
+			atomic_dec(&shard->table->pkt_count);
+		}
+		detached++;
+	}
+
+	return detached;
+}
+
+/*
+ * Removes @bib (and its sessions) from the database, and queues it for release
+ * once @bdl is committed.
+ */
+static void detach_bib(struct xlator *jool, struct bib_shard *shard,
+		struct tabled_bib *bib, struct bib_delete_list *bdl)
+{
+	int detached;
+
+	erase_bib(shard, bib);
+	put_block(jool, shard->table, bib);
+	count_bibs(jool, -1);
+	detached = detach_sessions(shard, bib, &bdl->stored);
+	count_sessions(jool, shard->table, -detached);
+	quota_session_rm(bib->subscriber, detached);
+	put_subscriber(shard->table, bib);
+	add_to_delete_list(bdl, &bib->hook4);
+}
+
+static int find_free_port(void *arg, struct in_addr const *addr,
+		unsigned int min, unsigned int max)
+{
+	return port_map_find_free(arg, addr, min, max);
+}
+
+/**
+ * This is this function in pseudocode form:
+ *
+ * 	// wraps around until offset - 1
+ * 	foreach (mask in @masks starting from some offset)
+ * 		if (mask is not taken by an existing BIB entry from @table)
+ * 			init the new BIB entry, @bib, using mask
+ * 			init @slot as the tree slot where @bib should be added
+ * 			return success (0)
+ * 	return failure (-ENOENT)
+ *
+ * The masks the port index knows to be taken are skipped without locking
+ * anything. The index can be outdated, though, so the survivors still need to
+ * be validated against the tree.
+ *
+ * On success, the shard @bib belongs to is returned, locked, in @result.
+ * On failure, nothing is locked.
+ */
+static int find_available_mask(struct bib_table *table,
+		struct mask_domain *masks,
+		struct tabled_bib *bib,
+		struct tree_slot *slot,
+		struct bib_shard **result)
+{
+	struct bib_shard *shard;
+	int error;
+
+	do {
+		error = mask_domain_next(masks, find_free_port, &table->ports,
+				&bib->src4);
+		if (error)
+			break;
+
+		shard = get_shard4(table, &bib->src4);
+		shard_lock(shard);
+		if (!find_bibtree4_slot(shard, bib, slot)) {
+			*result = shard;
+			break;
+		}
+		shard_unlock(shard);
+	} while (true);
+
+	mask_domain_commit(masks);
+	return error;
+}
+
+/*
+ * On success, the shard the new entries belong to is returned, locked, in
+ * @result. On failure, nothing is locked.
+ *
+ * Returns -ENOSPC (without touching the stored packet) if the instance has
+ * max-sessions sessions, in which case the caller should make_room() and retry.
+ */
+static int upgrade_pktqueue_session(struct xlator *jool,
+		struct bib_table *table,
+		struct mask_domain *masks,
+		struct ipv6_transport_addr *dst6,
+		struct bib_session_tuple *new,
+		struct bib_session_tuple *old,
+		struct bib_shard **result)
+{
+	struct pktqueue_session *sos; /* "simultaneous open" session */
+	struct bib_shard *shard;
+	struct tabled_bib *bib;
+	struct tabled_session *session;
+	struct tree_slot bib_slot4;
+	int error;
+
+	if (new->bib->proto != L4PROTO_TCP)
+		return -ESRCH;
+
+	/*
+	 * pktqueue_find() takes the node out of the queue, so this has to
+	 * happen first, or the stored packet would be lost on the retry.
+	 * (Racy, like the normal path's check.)
+	 */
+	if (masks && atomic_read(&table->pkt_count) && sessions_full(jool))
+		return -ENOSPC;
+
+	spin_lock_bh(&table->pktqueue_lock);
+	sos = pktqueue_find(table->pkt_queue, dst6, masks);
+	spin_unlock_bh(&table->pktqueue_lock);
+	if (!sos)
+		return -ESRCH;
+	atomic_dec(&table->pkt_count);
+
+	if (!masks) {
+		/*
+		 * This happens during joold adds. It's a lost cause.
+		 *
+		 * The point of SO is that the v4 node decides session [*, dst6,
+		 * src4, dst4] and the first v6 packet needing a new mask that
+		 * matches that session keeps it.
+		 *
+		 * But we're not synchronizing pktqueue sessions, because we
+		 * want to keep joold as simple as possible (which is not simple
+		 * enough), at least so long as it remains a niche thing.
+		 *
+		 * So if one Jool instance gets the v4 SO packet and some other
+		 * instance gets the v6 SO packet, the latter will choose a
+		 * random src4 and mess up the SO. That situation is this if.
+		 * Our reaction is to go like "whatever" and pretend that we
+		 * never received the v4 packet.
+		 *
+		 * One might argue that we should send the ICMP error when this
+		 * happens. But that doesn't yield satisfactory behavior either;
+		 * The SO failed anyway. To fix this properly we would need to
+		 * sync the pktqueue sessions. Combine that with the fact that
+		 * sending the ICMP error would be a pain (because we want to do
+		 * it outside of the spinlock, and we don't want to send it if
+		 * the random src4 selected happens to match the stored
+		 * session), and the result is a big fat meh. I really don't
+		 * want to do it.
+		 *
+		 * The admin signed a best-effort contract when s/he enabled
+		 * joold anyway. And this is only a problem in active-active
+		 * scenarios.
+		 */
+		pktqueue_put_node(jool, sos);
+		return -ESRCH;
+	}
+
+	__log_debug(jool, "Simultaneous Open!");
+	/*
+	 * We're going to pretend that @sos has been a valid V4 INIT session all
+	 * along.
+	 */
+	error = alloc_bib_session(table, old);
+	if (error) {
+		pktqueue_put_node(jool, sos);
+		return error;
+	}
+
+	bib = old->bib;
+	session = old->session;
+
+	bib->src6 = new->bib->src6;
+	bib->src4 = sos->src4;
+	bib->proto = L4PROTO_TCP;
+	bib->is_static = false;
+	bib->block = NULL;
+	bib->subscriber = NULL;
+	bib->sessions = RB_ROOT;
+
+	session->dst4 = sos->dst4;
+	session->state = V4_INIT;
+	session->bib = bib;
+	session->has_stored = false;
+
+	/* The IPv4 node started the connection; it only gets counted. */
+	error = get_subscriber(jool, table, bib, false);
+	if (error)
+		goto release;
+
+	shard = get_shard4(table, &bib->src4);
+	shard_lock(shard);
+
+	/*
+	 * src4 was free when pktqueue stored the packet, but we weren't holding
+	 * its shard's lock when we took it out, so some other CPU might have
+	 * claimed it since. Same for src6. (See the concurrency notes.)
+	 */
+	if (find_bibtree4_slot(shard, bib, &bib_slot4)) {
+		error = -EEXIST;
+		goto fail;
+	}
+	error = index_add(shard, bib, session);
+	if (error)
+		goto fail;
+
+	treeslot_commit(&bib_slot4);
+	count_bibs(jool, 1);
+	get_subscriber_session(jool, bib, false);
+
+	rb_link_node_rcu(&session->tree_hook, NULL, &bib->sessions.rb_node);
+	rb_insert_color(&session->tree_hook, &bib->sessions);
+	attach_timer(shard, session, &shard->syn4_timer);
+	count_sessions(jool, table, 1);
+
+	pktqueue_put_node(jool, sos);
+
+	log_new_bib(jool, bib);
+	log_new_session(jool, session);
+	*result = shard;
+	return 0;
+
+fail:
+	shard_unlock(shard);
+release:
+	pktqueue_put_node(jool, sos);
+	discard_bib(jool, table, bib);
+	free_session(session);
+	old->bib = NULL;
+	old->session = NULL;
+	return error;
+}
+
+static bool issue216_needed(struct mask_domain *masks, struct tabled_bib *bib)
+{
+	if (!masks)
+		return false;
+	return mask_domain_is_dynamic(masks)
+			&& !mask_domain_matches(masks, &bib->src4);
+}
+
+/*
+ * If port block allocation is enabled, makes sure @bib's src6 owns a block of
+ * @masks, and restricts @masks to it.
+ */
+static int narrow_to_block(struct xlator *jool, struct bib_table *table,
+		struct mask_domain *masks, struct tabled_bib *bib)
+{
+	struct pba_block *block;
+	unsigned int size;
+	unsigned int offset;
+	bool allocated;
+	int error;
+
+	/* We're retrying; @masks is already narrowed. */
+	if (bib->block)
+		return 0;
+
+	size = XGLOBALS(jool).pba_block_size;
+	if (!size || mask_domain_is_dynamic(masks))
+		return 0;
+	/* Deterministic mode already narrowed @masks to the subscriber's. */
+	if (jool->globals.nat64.det.prefix.set)
+		return 0;
+
+	error = pba_get(&table->pba, &bib->src6.l3,
+			mask_domain_get_mark(masks), size,
+			mask_domain_block_count(masks, size),
+			&bib->block, &allocated);
+	if (error) {
+		if (error == -ENOENT) {
+			jstat_inc(jool->stats, JSTAT_PBA_EXHAUSTED);
+			log_warn_once("I'm out of port blocks for mark %u.",
+					mask_domain_get_mark(masks));
+		}
+		return error;
+	}
+
+	block = bib->block;
+	offset = block->index * block->size;
+
+	if (allocated) {
+		mask_domain_taddr(masks, offset, &block->first);
+		mask_domain_taddr(masks, offset + block->size - 1,
+				&block->last);
+		jstat_inc(jool->stats, JSTAT_PBA_ALLOCATED);
+		log_block(jool, block, bib->proto, JEV_BLOCK_ADD);
+	} else if (block->index >= mask_domain_block_count(masks, block->size)) {
+		/* pool4 shrank since the block was allocated. */
+		return -ENOENT;
+	}
+
+	mask_domain_narrow(masks, offset, block->size);
+	return 0;
+}
+
+/**
+ * This is a find and an add at the same time, for both @new->bib and
+ * @new->session.
+ *
+ * If @new->bib needs to be added, initializes @slots->bib4.
+ * If @new->session needs to be added, initializes @slots->session.
+ * If @new->bib collides, you will find the collision in @old->bib.
+ * If @new->session collides, you will find the collision in @old->session.
+ *
+ * @masks will be used to init @new->bib.src4 if applies.
+ *
+ * On success, the shard in which all of this happens is returned, locked, in
+ * @result. On failure, nothing is locked.
+ *
+ * Since the src6 index is only locked while it's being modified, another CPU
+ * might add @new->bib's src6 before the caller commits. If that happens, the
+ * commit will return -EAGAIN, and the caller should unlock and call this again.
+ */
+static int find_bib_session6(struct xlator *jool,
+		struct bib_table *table,
+		struct mask_domain *masks,
+		struct ipv6_transport_addr *dst6,
+		struct bib_session_tuple *new,
+		struct bib_session_tuple *old,
+		struct slot_group *slots,
+		struct bib_delete_list *bdl,
+		struct bib_shard **result)
+{
+	struct bib_shard *shard;
+	int error;
+
+	/*
+	 * Please be careful around this function. All it wants to do is
+	 * find/add, but it is constrained by several requirements at the same
+	 * time:
+	 *
+	 * 1. If @new->bib->proto is ICMP (ie. 3-tuple), then
+	 *    @new->session->dst4.l4 is invalid and needs to be patched. Though
+	 *    it cannot be patched until we acquire a valid BIB entry.
+	 *    (dst4.l4 is just fat that should not be used in 3-tuple
+	 *    translation code, but a chunk of Jool assumes that
 	 *    dst4.l4 == dst6.l4 in 5-tuples and dst4.l4 == src4.l4 in
 	 *    3-tuples.)
 	 * 2. @masks can be NULL!
 	 *    If this happens, just assume that @old->bib->src4 and
 	 *    (once acquired) @new->bib->src4 are both valid.
 	 *
-	 * See below for more stuff.
+	 * See below for more stuff.
+	 */
+
+	old->bib = find_bib6_locked(table, &new->bib->src6, &shard);
+	if (old->bib) {
+		if (!issue216_needed(masks, old->bib)) {
+			if (new->bib->proto == L4PROTO_ICMP)
+				new->session->dst4.l4 = old->bib->src4.l4;
+
+			old->session = find_session_slot(old->bib, new->session,
+					NULL, &slots->session);
+			*result = shard;
+			return 0; /* Typical happy path for existing sessions */
+		}
+
+		/*
+		 * Issue #216:
+		 * If pool4 was empty (when @masks was generated) and the BIB
+		 * entry's IPv4 address is no longer a mask candidate, drop the
+		 * BIB entry and recompute it from scratch.
+		 * https://github.com/NICMx/Jool/issues/216
+		 */
+		__log_debug(jool, "Issue #216.");
+		detach_bib(jool, shard, old->bib, bdl);
+		/* The new mask might belong to some other shard. */
+		shard_unlock(shard);
+		old->bib = NULL;
+
+	} else {
+		/*
+		 * No BIB nor session in the main database? Try the SO
+		 * sub-database.
+		 */
+		error = upgrade_pktqueue_session(jool, table, masks, dst6, new,
+				old, result);
+		if (!error)
+			return 0; /* Unusual happy path for existing sessions */
+		if (error != -ESRCH)
+			return error;
+	}
+
+	/*
+	 * In case you're tweaking this function: By this point, old->bib has to
+	 * be NULL and nothing is locked. We're now in create-new-BIB-and-session
+	 * mode.
+	 * Time to worry about slots->bib4.
+	 *
+	 * (BTW: If old->bib is NULL, then old->session is also supposed to be
+	 * NULL.)
+	 */
+	/* Without @masks, the entries come from joold; only count them. */
+	error = get_subscriber(jool, table, new->bib, !!masks);
+	if (error)
+		return error;
+
+	if (masks) {
+		error = narrow_to_block(jool, table, masks, new->bib);
+		if (error)
+			return error;
+
+		error = find_available_mask(table, masks, new->bib,
+				&slots->bib4, &shard);
+		if (error) {
+			if (WARN(error != -ENOENT, "Unknown error: %d", error))
+				return error;
+			/*
+			 * TODO (issue175) the rate limit might be a bit of a
+			 * problem.
+			 * If both mark 0 and mark 1 are running out of
+			 * addresses, only one of them will be logged.
+			 * The problem is that remembering which marks have been
+			 * logged might get pretty ridiculous.
+			 * I don't think it's too bad because there will still
+			 * be at least one message every minute.
+			 * Also, it's better than what we had before. (Not
+			 * logging the offending mark.)
+			 * Might not be worth fixing since #175 is in the radar.
+			 */
+			log_warn_once("I'm running out of pool4 addresses for mark %u.",
+					mask_domain_get_mark(masks));
+			return error;
+		}
+
+		if (new->bib->proto == L4PROTO_ICMP)
+			new->session->dst4.l4 = new->bib->src4.l4;
+
+	} else {
+		/*
+		 * TODO (issue113) perhaps the sender's session shold be trusted
+		 * more.
+		 */
+		shard = get_shard4(table, &new->bib->src4);
+		shard_lock(shard);
+		if (find_bibtree4_slot(shard, new->bib, &slots->bib4)) {
+			shard_unlock(shard);
+			return -EEXIST;
+		}
+	}
+
+	/* Ok, time to worry about slots->session now. */
+
+	treeslot_init(&slots->session, &new->bib->sessions,
+			&new->session->tree_hook);
+	old->session = NULL;
+
+	*result = shard;
+	return 0; /* Happy path for new sessions */
+}
+
+/**
+ * Returns true if @session's packet can be translated without @shard's lock.
+ * That is, if @session is established, can be refreshed lazily, and @cb (if
+ * any) agrees that the packet doesn't change anything.
+ *
+ * Only reads @session. (The caller refreshes it; see lockless_refresh().)
+ */
+static bool is_lockless_hit(struct xlator *jool,
+		struct bib_shard *shard,
+		struct tabled_session *session,
+		struct collision_cb *cb)
+{
+	struct session_entry tmp;
+
+	if (!can_refresh_lazily(jool, session, SESSION_TIMER_EST))
+		return false;
+	if (!cb)
+		return true;
+
+	tstose(jool, session, &tmp);
+	if (cb->cb(&tmp, cb->arg) != FATE_TIMER_EST)
+		return false;
+
+	/* The callback wants to tweak the session; need the lock for that. */
+	return tmp.state == session->state
+			&& tmp.update_time == get_update_time(session)
+			&& tmp.has_stored == session->has_stored;
+}
+
+/*
+ * handle_fate_timer(), minus the (unneeded, as per is_lockless_hit()) list
+ * move. Racing with a locked update is harmless, since both store the current
+ * jiffy, and the expiration code cannot be interested in @session yet.
+ *
+ * If a requeue moves the queue time forward in the meantime, the delta
+ * computed here overshoots, and the update time lands in the future.
+ * get_update_time() clamps it, so the session can only expire late, never
+ * early.
+ */
+static void lockless_refresh(struct tabled_session *session)
+{
+	unsigned long delta;
+
+	delta = jiffies - get_queue_time(session);
+	WRITE_ONCE(session->update_delta, min(delta, (unsigned long)U16_MAX));
+}
+
+/*
+ * Returns @bib's session towards @dst4, if it exists.
+ *
+ * Does not need @shard's lock, but if you don't hold it, you need to be inside
+ * an RCU read-side critical section, and validate the result. (See
+ * find_session6_rcu().)
+ */
+static struct tabled_session *find_session(struct bib_shard *shard,
+		struct tabled_bib *bib,
+		struct ipv4_transport_addr *dst4)
+{
+	struct session_key key;
+
+	key.src4 = bib->src4;
+	key.dst4 = *dst4;
+	if (bib->proto == L4PROTO_ICMP)
+		key.dst4.l4 = bib->src4.l4;
+
+	return shard->table->hashed
+		? rhashtable_lookup_fast(&shard->session_hash, &key,
+				session_params)
+		: rbtree_find_rcu(&key.dst4, &bib->sessions,
+				compare_dst4_taddr, struct tabled_session,
+				tree_hook);
+}
+
+/*
+ * Returns the IPv6-initiated packet's session if it already exists in the main
+ * database, and locks its shard. (Which is returned in @result.)
+ *
+ * Returns NULL (and locks nothing) if the caller needs to go the long way.
+ * (The session doesn't exist, might live in the SO sub-database, or the BIB
+ * entry is subject to issue #216.)
+ */
+static struct tabled_session *find_session6(struct bib_table *table,
+		struct mask_domain *masks,
+		struct tuple *tuple6,
+		struct ipv4_transport_addr *dst4,
+		struct bib_shard **result)
+{
+	struct bib_shard *shard;
+	struct tabled_bib *bib;
+	struct tabled_session *session;
+
+	bib = find_bib6_locked(table, &tuple6->src.addr6, &shard);
+	if (!bib)
+		return NULL;
+
+	session = issue216_needed(masks, bib)
+			? NULL
+			: find_session(shard, bib, dst4);
+	if (!session) {
+		shard_unlock(shard);
+		return NULL;
+	}
+
+	*result = shard;
+	return session;
+}
+
+/*
+ * IPv4 counterpart of find_session6().
+ *
+ * Does not lock anything. Does not need @shard's lock, but if you don't hold
+ * it, you need to be inside an RCU read-side critical section, and validate
+ * the result. (See find_session4_rcu().)
+ */
+static struct tabled_session *find_session4(struct bib_shard *shard,
+		struct tuple *tuple4)
+{
+	struct tabled_bib *bib;
+	struct session_key key;
+
+	if (shard->table->hashed) {
+		/* Hashed sessions can be found without the BIB entry. */
+		key.src4 = tuple4->dst.addr4;
+		key.dst4 = tuple4->src.addr4;
+		return rhashtable_lookup_fast(&shard->session_hash, &key,
+				session_params);
+	}
+
+	bib = rbtree_find_rcu(&tuple4->dst.addr4, &shard->tree4, compare_src4,
+			struct tabled_bib, hook4);
+	if (!bib)
+		return NULL;
+
+	return rbtree_find_rcu(&tuple4->src.addr4, &bib->sessions,
+			compare_dst4_taddr, struct tabled_session, tree_hook);
+}
+
+/*
+ * Attempts to find (and validate) the IPv6-initiated packet's session without
+ * taking any locks. Returns true (and copies the session to @state) if this
+ * succeeded. Returns false if the caller needs to fall back to the locked
+ * path. (Which happens whenever the session does not exist, needs to be
+ * modified, or a writer interfered with the search.)
+ *
+ * Notice that a false negative is harmless, but a false positive is not. This
+ * is why we need the seqcounts; a concurrent rebalance can send the search
+ * down the wrong branch, and a concurrent writer can update the session while
+ * we're reading it.
+ *
+ * Two seqcounts are involved: The src6 index's (because the BIB entry might be
+ * removed while we're looking at it), and the shard's (for the session).
+ */
+static bool find_session6_rcu(struct xlation *state,
+		struct bib_table *table,
+		struct mask_domain *masks,
+		struct tuple *tuple6,
+		struct ipv4_transport_addr *dst4,
+		struct collision_cb *cb)
+{
+	struct bib_shard6 *shard6;
+	struct bib_shard *shard;
+	struct tabled_bib *bib;
+	struct tabled_session *session;
+	unsigned int seq6;
+	unsigned int seq4;
+	bool success = false;
+
+	shard6 = get_shard6(table, &tuple6->src.addr6);
+
+	rcu_read_lock();
+	seq6 = raw_read_seqcount_begin(&shard6->seq);
+
+	bib = find_bib6(table, shard6, &tuple6->src.addr6);
+	if (!bib || issue216_needed(masks, bib))
+		goto end;
+
+	shard = get_shard4(table, &bib->src4);
+	seq4 = raw_read_seqcount_begin(&shard->seq);
+
+	session = find_session(shard, bib, dst4);
+	if (!session || !is_lockless_hit(state->jool, shard, session, cb))
+		goto end;
+
+	tstobs(state, session);
+	success = !read_seqcount_retry(&shard->seq, seq4)
+			&& !read_seqcount_retry(&shard6->seq, seq6);
+	if (success)
+		lockless_refresh(session);
+	/* Fall through */
+
+end:
+	rcu_read_unlock();
+	return success;
+}
+
+/*
+ * IPv4 counterpart of find_session6_rcu().
+ */
+static bool find_session4_rcu(struct xlation *state,
+		struct bib_shard *shard,
+		struct tuple *tuple4,
+		struct collision_cb *cb)
+{
+	struct tabled_session *session;
+	unsigned int seq;
+	bool success = false;
+
+	rcu_read_lock();
+	seq = raw_read_seqcount_begin(&shard->seq);
+
+	session = find_session4(shard, tuple4);
+	if (!session || !is_lockless_hit(state->jool, shard, session, cb))
+		goto end;
+
+	tstobs(state, session);
+	success = !read_seqcount_retry(&shard->seq, seq);
+	if (success)
+		lockless_refresh(session);
+	/* Fall through */
+
+end:
+	rcu_read_unlock();
+	return success;
+}
+
+static void count_avoided_allocs6(struct xlator *jool)
+{
+	jstat_inc(jool->stats, JSTAT_BIB_ALLOC_AVOIDED);
+	jstat_inc(jool->stats, JSTAT_SESSION_ALLOC_AVOIDED);
+}
+
+static void count_avoided_allocs4(struct xlator *jool)
+{
+	jstat_inc(jool->stats, JSTAT_SESSION_ALLOC_AVOIDED);
+}
+
+/**
+ * @db current BIB & session database.
+ * @masks Should a BIB entry be created, its IPv4 address mask will be allocated
+ *     from one of these candidates.
+ * @tuple6 The connection that you want to mask.
+ * @dst4 translated version of @tuple.dst.addr6.
+ * @result A copy of the resulting BIB entry and session from the database will
+ *     be placed here. (if not NULL)
+ *
+ * TODO (fine) return verdict
+ */
+int bib_add6(struct xlation *state,
+		struct mask_domain *masks,
+		struct tuple *tuple6,
+		struct ipv4_transport_addr *dst4)
+{
+	struct bib_table *table;
+	struct bib_shard *shard;
+	struct bib_session_tuple new;
+	struct bib_session_tuple old;
+	struct slot_group slots;
+	BIB_DELETE_LIST(bdl);
+	bool evicted = false;
+	int error;
+
+	table = get_table(state->jool->nat64.bib, tuple6->l4_proto);
+	if (!table)
+		return -EINVAL;
+
+	/*
+	 * Most packets belong to existing sessions, so start with plain
+	 * lookups. These don't need to allocate anything.
+	 */
+	if (find_session6_rcu(state, table, masks, tuple6, dst4, NULL))
+		goto avoided;
+
+	old.session = find_session6(table, masks, tuple6, dst4, &shard);
+	if (old.session) {
+		handle_fate_timer(state->jool, shard, old.session,
+				&shard->est_timer);
+		tstobs(state, old.session);
+		shard_unlock(shard);
+		goto avoided;
+	}
+
+	/*
+	 * Ok, we probably need to create something. (Though another CPU might
+	 * beat us to it.)
+	 *
+	 * We might have a lot to do. This function may index three RB-trees
+	 * so spinlock time is tight.
+	 *
+	 * (That's 3 potential lookups (2 guaranteed) and 3 potential
+	 * rebalances, though at least one of the trees is usually minuscule.)
+	 *
+	 * There's also the optional port allocation thing, which in the worst
+	 * case is an unfortunate full traversal of @masks.
+	 *
+	 * So let's allocate and initialize the objects before the lock.
+	 */
+	error = create_bib_session6(table, &new, tuple6, dst4, ESTABLISHED);
+	if (error)
+		return error;
+
+retry: /* Here goes... */
+	error = find_bib_session6(state->jool, table, masks, &tuple6->dst.addr6,
+			&new, &old, &slots, &bdl, &shard);
+	if (error)
+		goto end;
+
+	if (old.session) { /* Session already exists. */
+		handle_fate_timer(state->jool, shard, old.session,
+				&shard->est_timer);
+		tstobs(state, old.session);
+		goto unlock;
+	}
+
+	/* New connection; add the session. (And maybe the BIB entry as well) */
+	error = commit_add6(state, shard, &old, &new, &slots, &shard->est_timer);
+	if (error == -EAGAIN) {
+		shard_unlock(shard);
+		goto retry;
+	}
+	if (error == -ENOSPC) {
+		shard_unlock(shard);
+		error = make_room(state->jool, &evicted);
+		if (!error)
+			goto retry;
+		goto end;
+	}
+	/* Fall through */
+
+unlock:
+	shard_unlock(shard);
+end:
+	if (new.bib)
+		discard_bib(state->jool, table, new.bib);
+	if (new.session)
+		free_session(new.session);
+	commit_delete_list(&bdl);
+
+	return error;
+
+avoided:
+	count_avoided_allocs6(state->jool);
+	return 0;
+}
+
+static void find_bib_session4(struct bib_shard *shard,
+		struct tuple *tuple4,
+		struct tabled_session *new,
+		struct bib_session_tuple *old,
+		bool *allow,
+		struct tree_slot *slot)
+{
+	old->bib = find_bib4(shard, &tuple4->dst.addr4);
+	old->session = old->bib
+			? find_session_slot(old->bib, new, allow, slot)
+			: NULL;
+}
+
+/**
+ * See @bib_add6.
+ *
+ * TODO (fine) return verdict
+ */
+int bib_add4(struct xlation *state, struct tuple *tuple4)
+{
+	struct bib_table *table;
+	struct bib_shard *shard;
+	struct bib_session_tuple old;
+	struct tabled_session *new;
+	struct tree_slot session_slot;
+	bool allow;
+	bool evicted = false;
+	int error = 0;
+
+	table = get_table(state->jool->nat64.bib, tuple4->l4_proto);
+	if (!table)
+		return -EINVAL;
+	shard = get_shard4(table, &tuple4->dst.addr4);
+
+	if (find_session4_rcu(state, shard, tuple4, NULL))
+		goto avoided;
+
+	shard_lock(shard);
+	old.session = find_session4(shard, tuple4);
+	if (old.session) {
+		handle_fate_timer(state->jool, shard, old.session,
+				&shard->est_timer);
+		tstobs(state, old.session);
+		shard_unlock(shard);
+		goto avoided;
+	}
+	shard_unlock(shard);
+
+	new = create_session4(table, tuple4, ESTABLISHED);
+	if (!new)
+		return -ENOMEM;
+
+retry:
+	shard_lock(shard);
+
+	find_bib_session4(shard, tuple4, new, &old, &allow, &session_slot);
+
+	if (old.session) {
+		handle_fate_timer(state->jool, shard, old.session,
+				&shard->est_timer);
+		tstobs(state, old.session);
+		goto end;
+	}
+
+	if (!old.bib) {
+		error = -ESRCH;
+		goto end;
+	}
+
+	/* Address-Dependent Filtering. */
+	if (GLOBALS(state).drop_by_addr && !allow) {
+		error = -EPERM;
+		goto end;
+	}
+
+	/* Ok, no issues; add the session. */
+	error = commit_add4(state, shard, &old, &new, &session_slot,
+			&shard->est_timer);
+	if (error == -ENOSPC) {
+		shard_unlock(shard);
+		error = make_room(state->jool, &evicted);
+		if (!error)
+			goto retry;
+		goto free;
+	}
+	/* Fall through */
+
+end:
+	shard_unlock(shard);
+free:
+	if (new)
+		free_session(new);
+	return error;
+
+avoided:
+	count_avoided_allocs4(state->jool);
+	return 0;
+}
+
+/*
+ * Handles a TCP packet whose session was found in the database.
+ * (All states except CLOSED.)
+ */
+static verdict existing_tcp_session(struct xlation *state,
+		struct bib_shard *shard,
+		struct tabled_session *session,
+		struct collision_cb *cb)
+{
+	if (decide_fate(state->jool, cb, shard, session, NULL)) {
+		tstobs(state, session);
+		return VERDICT_CONTINUE;
+	}
+
+	/* TODO (fine) ugly hack; we're assuming SO_EXISTS. */
+	return drop(state, JSTAT_SO_EXISTS);
+}
+
+/**
+ * Note: This particular incarnation of fate_cb is not prepared to return
+ * FATE_PROBE.
+ */
+verdict bib_add_tcp6(struct xlation *state,
+		struct mask_domain *masks,
+		struct ipv4_transport_addr *dst4,
+		struct collision_cb *cb)
+{
+	struct packet *pkt;
+	struct bib_table *table;
+	struct bib_shard *shard;
+	struct bib_session_tuple new;
+	struct bib_session_tuple old;
+	struct slot_group slots;
+	BIB_DELETE_LIST(bdl);
+	bool evicted = false;
+	verdict result;
+	int error;
+
+	pkt = &state->in;
+	if (WARN(pkt->tuple.l4_proto != L4PROTO_TCP, "Incorrect l4 proto in TCP handler."))
+		return drop(state, JSTAT_UNKNOWN);
+
+	table = &state->jool->nat64.bib->tcp;
+	if (find_session6_rcu(state, table, masks, &pkt->tuple, dst4, cb)) {
+		count_avoided_allocs6(state->jool);
+		return VERDICT_CONTINUE;
+	}
+
+	old.session = find_session6(table, masks, &pkt->tuple, dst4, &shard);
+	if (old.session) {
+		result = existing_tcp_session(state, shard, old.session, cb);
+		shard_unlock(shard);
+		count_avoided_allocs6(state->jool);
+		return result;
+	}
+
+	if (create_bib_session6(table, &new, &pkt->tuple, dst4, V6_INIT))
+		return drop(state, JSTAT_ENOMEM);
+
+retry:
+	error = find_bib_session6(state->jool, table, masks,
+			&pkt->tuple.dst.addr6, &new, &old, &slots, &bdl, &shard);
+	if (error == -ENOSPC) {
+		/* Simultaneous Open, but the table is full. */
+		if (!make_room(state->jool, &evicted))
+			goto retry;
+		result = VERDICT_DROP; /* Already counted. */
+		goto end;
+	}
+	if (error) {
+		/* Quota drops were already counted. */
+		if (error == -EDQUOT)
+			result = VERDICT_DROP;
+		else if (error == -ENOMEM)
+			result = drop(state, JSTAT_ENOMEM);
+		else
+			result = drop(state, JSTAT_UNKNOWN);
+		goto end;
+	}
+
+	if (old.session) {
+		result = existing_tcp_session(state, shard, old.session, cb);
+		goto unlock;
+	}
+
+	/* CLOSED state beginning now. */
+
+	if (!pkt_tcp_hdr(pkt)->syn) {
+		if (old.bib) {
+			tbtobs(old.bib, &state->entries);
+			result = VERDICT_CONTINUE;
+		} else {
+			log_debug(state, "Packet is not SYN and lacks state.");
+			result = drop(state, JSTAT_SYN6_EXPECTED);
+		}
+		goto unlock;
+	}
+
+	/* All exits up till now require @new.* to be deleted. */
+
+	error = commit_add6(state, shard, &old, &new, &slots,
+			&shard->trans_timer);
+	if (error == -EAGAIN) {
+		shard_unlock(shard);
+		goto retry;
+	}
+	if (error == -ENOSPC) {
+		shard_unlock(shard);
+		if (!make_room(state->jool, &evicted))
+			goto retry;
+		result = VERDICT_DROP; /* Already counted. */
+		goto end;
+	}
+	if (!error)
+		result = VERDICT_CONTINUE;
+	else if (error == -EDQUOT)
+		result = VERDICT_DROP; /* Already counted. */
+	else
+		result = drop(state, JSTAT_ENOMEM);
+	/* Fall through */
+
+unlock:
+	shard_unlock(shard);
+end:
+	if (new.bib)
+		discard_bib(state->jool, table, new.bib);
+	if (new.session)
+		free_session(new.session);
+	commit_delete_list(&bdl);
+
+	return result;
+}
+
+/**
+ * Note: This particular incarnation of fate_cb is not prepared to return
+ * FATE_PROBE.
+ */
+verdict bib_add_tcp4(struct xlation *state,
+		struct ipv6_transport_addr *dst6,
+		struct collision_cb *cb)
+{
+	struct packet *pkt;
+	struct bib_table *table;
+	struct bib_shard *shard;
+	struct tabled_session *new;
+	struct bib_session_tuple old;
+	struct tree_slot session_slot;
+	struct stored_pkt *stored;
+	bool evicted = false;
+	verdict result;
+	int error;
+
+	pkt = &state->in;
+	if (WARN(pkt->tuple.l4_proto != L4PROTO_TCP, "Incorrect l4 proto in TCP handler."))
+		return drop(state, JSTAT_UNKNOWN);
+
+	table = &state->jool->nat64.bib->tcp;
+	shard = get_shard4(table, &pkt->tuple.dst.addr4);
+	if (find_session4_rcu(state, shard, &pkt->tuple, cb)) {
+		count_avoided_allocs4(state->jool);
+		return VERDICT_CONTINUE;
+	}
+
+	shard_lock(shard);
+	old.session = find_session4(shard, &pkt->tuple);
+	if (old.session) {
+		result = existing_tcp_session(state, shard, old.session, cb);
+		shard_unlock(shard);
+		count_avoided_allocs4(state->jool);
+		return result;
+	}
+	shard_unlock(shard);
+
+	new = create_session4(table, &pkt->tuple, V4_INIT);
+	if (!new)
+		return drop(state, JSTAT_ENOMEM);
+
+retry:
+	stored = NULL;
+	new->has_stored = false;
+	shard_lock(shard);
+
+	find_bib_session4(shard, &pkt->tuple, new, &old, NULL, &session_slot);
+
+	if (old.session) {
+		result = existing_tcp_session(state, shard, old.session, cb);
+		goto end;
+	}
+
+	/* CLOSED state beginning now. */
+
+	if (!pkt_tcp_hdr(pkt)->syn) {
+		if (old.bib) {
+			tbtobs(old.bib, &state->entries);
+			result = VERDICT_CONTINUE;
+		} else {
+			log_debug(state, "Packet is not SYN and lacks state.");
+			result = drop(state, JSTAT_SYN4_EXPECTED);
+		}
+		goto end;
+	}
+
+	if (GLOBALS(state).drop_external_tcp) {
+		log_debug(state, "Externally initiated TCP connections are prohibited.");
+		result = drop(state, JSTAT_V4_SYN);
+		goto end;
+	}
+
+	if (!old.bib) {
+		bool too_many;
+
+		log_debug(state, "Potential Simultaneous Open; storing type 1 packet.");
+		too_many = atomic_read(&table->pkt_count)
+				>= GLOBALS(state).max_stored_pkts;
+		spin_lock(&table->pktqueue_lock);
+		error = pktqueue_add(table->pkt_queue, pkt, dst6, too_many);
+		spin_unlock(&table->pktqueue_lock);
+		switch (error) {
+		case 0:
+			result = stolen(state, JSTAT_TYPE1PKT);
+			atomic_inc(&table->pkt_count);
+			goto end;
+		case -EEXIST:
+			log_debug(state, "Simultaneous Open already exists.");
+			result = drop(state, JSTAT_SO_EXISTS);
+			goto end;
+		case -ENOSPC:
+			goto too_many_pkts;
+		case -ENOMEM:
+			result = drop(state, JSTAT_ENOMEM);
+			goto end;
+		}
+
+		WARN(1, "pktqueue_add() threw unknown error %d", error);
+		result = drop(state, JSTAT_UNKNOWN);
+		goto end;
+	}
+
+	if (GLOBALS(state).drop_by_addr) {
+		if (atomic_read(&table->pkt_count)
+				>= GLOBALS(state).max_stored_pkts)
+			goto too_many_pkts;
+
+		log_debug(state, "Potential Simultaneous Open; storing type 2 packet.");
+		stored = wkmalloc(struct stored_pkt, GFP_ATOMIC);
+		if (!stored) {
+			result = drop(state, JSTAT_ENOMEM);
+			goto end;
+		}
+		stored->session = new;
+		stored->skb = pkt_original_pkt(pkt)->skb;
+		new->has_stored = true;
+		/*
+		 * Yes, fall through. No goto; we need to add this session.
+		 * The packet is not really stored until the commit succeeds.
+		 */
+	}
+
+	error = commit_add4(state, shard, &old, &new, &session_slot,
+			stored ? &shard->syn4_timer : &shard->trans_timer);
+	if (error) {
+		if (stored)
+			wkfree(struct stored_pkt, stored);
+		if (error == -ENOSPC) {
+			shard_unlock(shard);
+			if (!make_room(state->jool, &evicted))
+				goto retry;
+			free_session(new);
+			return VERDICT_DROP; /* Already counted. */
+		}
+		result = (error == -EDQUOT)
+				? VERDICT_DROP /* Already counted. */
+				: drop(state, JSTAT_ENOMEM);
+		goto end;
+	}
+
+	if (stored) {
+		list_add(&stored->list_hook, &shard->stored_pkts);
+		result = stolen(state, JSTAT_TYPE2PKT);
+		atomic_inc(&table->pkt_count);
+	} else {
+		result = VERDICT_CONTINUE;
+	}
+	/* Fall through */
+
+end:
+	shard_unlock(shard);
+
+	if (new)
+		free_session(new);
+
+	return result;
+
+too_many_pkts:
+	shard_unlock(shard);
+	free_session(new);
+	log_debug(state, "Too many Simultaneous Opens.");
+	/* Fall back to assume there's no SO. */
+	return drop_icmp(state, JSTAT_SO_FULL, ICMPERR_PORT_UNREACHABLE, 0);
+}
+
+int bib_find(struct bib *db, struct tuple *tuple, struct bib_session *result)
+{
+	struct bib_entry tmp;
+	int error;
+
+	switch (tuple->l3_proto) {
+	case L3PROTO_IPV6:
+		error = bib_find6(db, tuple->l4_proto, &tuple->src.addr6, &tmp);
+		break;
+	case L3PROTO_IPV4:
+		error = bib_find4(db, tuple->l4_proto, &tuple->dst.addr4, &tmp);
+		break;
+	default:
+		WARN(true, "Unknown layer 3 protocol: %u", tuple->l3_proto);
+		return -EINVAL;
+	}
+
+	if (error)
+		return error;
+
+	result->bib_set = true;
+	result->session.src6 = tmp.addr6;
+	result->session.src4 = tmp.addr4;
+	result->session.proto = tmp.l4_proto;
+	return 0;
+}
+
+int bib_add_session(struct xlator *jool,
+		struct session_entry *session,
+		struct collision_cb *cb)
+{
+	struct bib_table *table;
+	struct bib_shard *shard;
+	struct bib_session_tuple new;
+	struct bib_session_tuple old;
+	struct slot_group slots;
+	BIB_DELETE_LIST(bdl);
+	int error;
+
+	table = get_table(jool->nat64.bib, session->proto);
+	if (!table)
+		return -EINVAL;
+
+	error = create_bib_session(table, session, &new);
+	if (error)
+		return error;
+
+retry:
+	error = find_bib_session6(jool, table, NULL, &session->dst6, &new, &old,
+			&slots, &bdl, &shard);
+	if (error)
+		goto end;
+
+	if (old.session) {
+		/* There's no packet; ignore the verdict. */
+		decide_fate(jool, cb, shard, old.session, NULL);
+		goto unlock;
+	}
+
+	error = commit_add(jool, shard, &old, &new, &slots, session->timer_type,
+			false);
+	if (error == -EAGAIN) {
+		shard_unlock(shard);
+		goto retry;
+	}
+	/* Fall through */
+
+unlock:
+	shard_unlock(shard);
+end:
+	if (new.bib)
+		discard_bib(jool, table, new.bib);
+	if (new.session)
+		free_session(new.session);
+	commit_delete_list(&bdl);
+
+	return error;
+}
+
+/*
+ * Adds @entry to @shard (which must be @entry's shard, and be locked), along
+ * with its BIB entry if it doesn't exist yet. Returns -EEXIST if the session
+ * already exists, or if its addresses belong to some other BIB entry. Returns
+ * -ENOSPC or -EDQUOT if it doesn't fit. (See commit_add().)
+ */
+static int import_session(struct xlator *jool, struct bib_shard *shard,
+		struct session_entry *entry)
+{
+	struct bib_session_tuple new;
+	struct bib_session_tuple old;
+	struct slot_group slots;
+	int error;
+
+	error = create_bib_session(shard->table, entry, &new);
+	if (error)
+		return error;
+
+	old.bib = find_bib4(shard, &entry->src4);
+	if (old.bib) {
+		if (!taddr6_equals(&old.bib->src6, &entry->src6)) {
+			error = -EEXIST;
+			goto end;
+		}
+		if (entry->proto == L4PROTO_ICMP)
+			new.session->dst4.l4 = old.bib->src4.l4;
+		old.session = find_session_slot(old.bib, new.session, NULL,
+				&slots.session);
+		if (old.session) {
+			error = -EEXIST;
+			goto end;
+		}
+	} else {
+		error = get_subscriber(jool, shard->table, new.bib, true);
+		if (error)
+			goto end;
+		find_bibtree4_slot(shard, new.bib, &slots.bib4);
+		if (entry->proto == L4PROTO_ICMP)
+			new.session->dst4.l4 = new.bib->src4.l4;
+		treeslot_init(&slots.session, &new.bib->sessions,
+				&new.session->tree_hook);
+		old.session = NULL;
+	}
+
+	error = commit_add(jool, shard, &old, &new, &slots, entry->timer_type,
+			true);
+	/* -EAGAIN: The src6 belongs to some other BIB entry. */
+	if (error == -EAGAIN)
+		error = -EEXIST;
+
+end:
+	if (new.bib)
+		discard_bib(jool, shard->table, new.bib);
+	if (new.session)
+		free_session(new.session);
+	return error;
+}
+
+/* Protocol (table) and shard. */
+#define IMPORT_KEYS (3 * BIB_SHARDS)
+
+/**
+ * Adds @count (at most BIB_IMPORT_MAX) sessions to the database at once, along
+ * with the BIB entries they need. For restoring checkpoints.
+ *
+ * The sessions are grouped by shard first, so each shard is only locked once
+ * per call. Sessions that already exist, that collide with a different BIB
+ * entry, or that don't fit in max-sessions or their subscriber's quotas, are
+ * skipped. (Nothing is evicted to make room for them.)
+ *
+ * Sessions are queued in their expirers by update time. If @sessions is
+ * sorted that way, each of them lands at the end of its expirer's list, so the
+ * addition costs the same as the packet path's.
+ *
+ * Returns the number of sessions added, or a negative error code.
+ */
+int bib_import(struct xlator *jool, struct session_entry *sessions,
+		unsigned int count)
+{
+	struct bib *db = jool->nat64.bib;
+	struct bib_table *table;
+	struct bib_shard *shard;
+	u8 keys[BIB_IMPORT_MAX];
+	u8 order[BIB_IMPORT_MAX];
+	unsigned int starts[IMPORT_KEYS + 1];
+	unsigned int added;
+	unsigned int i, k;
+	int error;
+
+	if (count > BIB_IMPORT_MAX)
+		return -EINVAL;
+
+	/* Counting sort, so the sessions of each shard are contiguous. */
+	memset(starts, 0, sizeof(starts));
+	for (i = 0; i < count; i++) {
+		table = get_table(db, sessions[i].proto);
+		if (!table)
+			return -EINVAL;
+		keys[i] = sessions[i].proto * BIB_SHARDS
+				+ (get_shard4(table, &sessions[i].src4)
+					- table->shards4);
+		starts[keys[i] + 1]++;
+	}
+	for (k = 0; k < IMPORT_KEYS; k++)
+		starts[k + 1] += starts[k];
+	for (i = 0; i < count; i++)
+		order[starts[keys[i]]++] = i;
+	/* starts[k] is now the end of key k, which is the start of key k+1. */
+
+	added = 0;
+	i = 0;
+	for (k = 0; k < IMPORT_KEYS; k++) {
+		if (i == starts[k])
+			continue;
+
+		table = get_table(db, k / BIB_SHARDS);
+		shard = &table->shards4[k % BIB_SHARDS];
+		shard_lock(shard);
+		for (; i < starts[k]; i++) {
+			error = import_session(jool, shard, &sessions[order[i]]);
+			switch (error) {
+			case 0:
+				added++;
+				break;
+			case -EEXIST:
+			case -ENOSPC:
+			case -EDQUOT:
+				break;
+			default:
+				shard_unlock(shard);
+				return error;
+			}
+		}
+		shard_unlock(shard);
+	}
+
+	return added;
+}
+
+/*
+ * Maximum number of sessions an expiration pass is allowed to decide the fate
+ * of during a single hold of the shard lock. Once it runs out, the lock is
+ * released (so the packet path can get in) and the pass resumes afterwards.
+ */
+#define EXPIRE_BATCH 256
+
+/**
+ * Returns false if @budget ran out before @expirer's expired sessions did.
+ */
+static bool __clean(struct xlator *jool,
+		struct expire_timer *expirer,
+		struct bib_shard *shard,
+		struct list_head *probes,
+		unsigned int *budget)
+{
+	struct tabled_session *session;
+	struct tabled_session *tmp;
+	struct collision_cb cb;
+	unsigned long timeout;
+
+	cb.cb = expirer->decide_fate_cb;
+	cb.arg = NULL;
+	timeout = get_timeout(jool, expirer->type, expirer->proto);
+
+	/*
+	 * Deferred sessions expire at most one granularity after their queue
+	 * time, so waiting for the head is good enough.
 	 */
+	list_for_each_entry_safe(session, tmp, &expirer->deferred, list_hook) {
+		if (time_before(jiffies, get_update_time(session) + timeout))
+			break;
+		if (*budget == 0)
+			return false;
+		decide_fate(jool, &cb, shard, session, probes);
+		(*budget)--;
+	}
 
-	old->bib = find_bibtree6_slot(table, new->bib, &slots->bib6);
-	if (old->bib) {
-		if (!issue216_needed(masks, old)) {
-			if (new->bib->proto == L4PROTO_ICMP)
-				new->session->dst4.l4 = old->bib->src4.l4;
+	list_for_each_entry_safe(session, tmp, &expirer->sessions, list_hook) {
+		/*
+		 * "list" is sorted by queue time,
+		 * so stop on the first session that hasn't expired even then.
+		 */
+		if (time_before(jiffies, get_queue_time(session) + timeout))
+			return true;
+		if (*budget == 0)
+			return false;
+		/* Otherwise it might have been refreshed lazily; re-check. */
+		if (time_before(jiffies, get_update_time(session) + timeout))
+			list_move_tail(&session->list_hook, &expirer->deferred);
+		else
+			decide_fate(jool, &cb, shard, session, probes);
+		(*budget)--;
+	}
+
+	return true;
+}
+
+/**
+ * Adds a lock hold of @nsecs nanoseconds to the expiration histogram.
+ */
+static void count_expire_hold(struct xlator *jool, u64 nsecs)
+{
+	enum jool_stat_id stat;
+
+	if (nsecs < 10 * NSEC_PER_USEC)
+		stat = JSTAT_EXPIRE_HOLD_10US;
+	else if (nsecs < 100 * NSEC_PER_USEC)
+		stat = JSTAT_EXPIRE_HOLD_100US;
+	else if (nsecs < NSEC_PER_MSEC)
+		stat = JSTAT_EXPIRE_HOLD_1MS;
+	else if (nsecs < 10 * NSEC_PER_MSEC)
+		stat = JSTAT_EXPIRE_HOLD_10MS;
+	else
+		stat = JSTAT_EXPIRE_HOLD_SLOW;
+
+	jstat_inc(jool->stats, stat);
+}
+
+/**
+ * Runs one EXPIRE_BATCH worth of expiration on @shard.
+ * Returns false if the shard still has expired sessions left.
+ */
+static bool clean_shard(struct xlator *jool, struct bib_shard *shard)
+{
+	LIST_HEAD(probes);
+	unsigned int budget;
+	bool done;
+	u64 start;
+
+	budget = EXPIRE_BATCH;
+
+	shard_lock(shard);
+	start = ktime_get_ns();
+	done = __clean(jool, &shard->est_timer, shard, &probes, &budget)
+	    && __clean(jool, &shard->trans_timer, shard, &probes, &budget)
+	    && __clean(jool, &shard->syn4_timer, shard, &probes, &budget);
+	/* Idle passes would drown the histogram, so skip them. */
+	if (budget != EXPIRE_BATCH)
+		count_expire_hold(jool, ktime_get_ns() - start);
+	shard_unlock(shard);
+
+	post_fate(jool, &probes);
+	return done;
+}
+
+static void clean_pktqueue(struct bib_table *table)
+{
+	LIST_HEAD(icmps);
+
+	if (!table->pkt_queue)
+		return;
+
+	spin_lock_bh(&table->pktqueue_lock);
+	atomic_sub(pktqueue_prepare_clean(table->pkt_queue, &icmps),
+			&table->pkt_count);
+	spin_unlock_bh(&table->pktqueue_lock);
+
+	pktqueue_clean(&icmps);
+}
+
+/*
+ * Maximum amount of time (in nanoseconds) a bib_clean() call is allowed to
+ * run. (It can be exceeded by up to one batch.)
+ */
+#define CLEAN_SLICE (NSEC_PER_MSEC)
+
+/**
+ * Forgets or downgrades (from EST to TRANS) old sessions.
+ *
+ * One shard at a time, so the packet path only ever waits for one. If the
+ * slice runs out first, @cursor records where the pass left off, and false is
+ * returned; call again (after yielding) to resume. Returns true (and resets
+ * @cursor) once the pass is complete.
+ */
+bool bib_clean(struct xlator *jool, unsigned int *cursor)
+{
+	struct bib *db = jool->nat64.bib;
+	struct bib_table *tables[] = { &db->udp, &db->tcp, &db->icmp };
+	u64 deadline;
+
+	if (*cursor == 0) {
+		clean_pktqueue(&db->udp);
+		clean_pktqueue(&db->tcp);
+		clean_pktqueue(&db->icmp);
+	}
+
+	deadline = ktime_get_ns() + CLEAN_SLICE;
+	while (*cursor < ARRAY_SIZE(tables) * BIB_SHARDS) {
+		if (clean_shard(jool, &tables[*cursor / BIB_SHARDS]
+				->shards4[*cursor % BIB_SHARDS]))
+			(*cursor)++;
+		if (ktime_get_ns() >= deadline)
+			return false;
+	}
+
+	*cursor = 0;
+	return true;
+}
+
+static struct rb_node *find_starting_point(struct bib_shard *shard,
+		const struct ipv4_transport_addr *offset,
+		bool include_offset)
+{
+	struct tabled_bib *bib;
+	struct rb_node **node;
+	struct rb_node *parent;
+
+	/* If there's no offset, start from the beginning. */
+	if (!offset)
+		return rb_first(&shard->tree4);
+
+	/* If offset is found, start from offset or offset's next. */
+	rbtree_find_node(offset, &shard->tree4, compare_src4, struct tabled_bib,
+			hook4, parent, node);
+	if (*node)
+		return include_offset ? (*node) : rb_next(*node);
+
+	if (!parent)
+		return NULL;
 
-			old->session = find_session_slot(old->bib, new->session,
-					NULL, &slots->session);
-			return 0; /* Typical happy path for existing sessions */
-		}
+	/*
+	 * If offset is not found, start from offset's next anyway.
+	 * (If offset was meant to exist, it probably timed out and died while
+	 * the caller wasn't holding the spinlock; it's nothing to worry about.)
+	 */
+	bib = rb_entry(parent, struct tabled_bib, hook4);
+	return (compare_src4(bib, offset) < 0) ? rb_next(parent) : parent;
+}
 
-		/*
-		 * Issue #216:
-		 * If pool4 was empty (when @masks was generated) and the BIB
-		 * entry's IPv4 address is no longer a mask candidate, drop the
-		 * BIB entry and recompute it from scratch.
-		 * https://github.com/NICMx/Jool/issues/216
-		 */
-		__log_debug(jool, "Issue #216.");
-		detach_bib(jool, table, old->bib);
-		add_to_delete_list(bdl, &old->bib->hook4);
+/*
+ * Iterates over all of a table's BIB entries in src4 order.
+ *
+ * Each shard's tree is sorted, but the shards interleave, so this keeps one
+ * cursor per shard and always yields the smallest one.
+ * (The caller has to hold all the shard locks. See lock_all().)
+ */
+struct bib_walk {
+	struct rb_node *nodes[BIB_SHARDS];
+};
 
-		/*
-		 * The detaching above might have involved a rebalance.
-		 * I believe that completely invalidates the bib6 slot.
-		 * Tough luck; we'll need another lookup.
-		 * At least this only happens on empty pool4s. (Low traffic.)
-		 */
-		old->bib = find_bibtree6_slot(table, new->bib, &slots->bib6);
-		if (WARN(old->bib, "Found a BIB entry I just removed!"))
-			return -EINVAL;
+static void walk_init(struct bib_table *table, struct bib_walk *walk,
+		const struct ipv4_transport_addr *offset,
+		bool include_offset)
+{
+	unsigned int i;
 
-	} else {
-		/*
-		 * No BIB nor session in the main database? Try the SO
-		 * sub-database.
-		 */
-		error = upgrade_pktqueue_session(jool, table, masks, new, old);
-		if (!error)
-			return 0; /* Unusual happy path for existing sessions */
+	for (i = 0; i < BIB_SHARDS; i++) {
+		walk->nodes[i] = find_starting_point(&table->shards4[i], offset,
+				include_offset);
 	}
+}
 
-	/*
-	 * In case you're tweaking this function: By this point, old->bib has to
-	 * be NULL and slots->bib6 has to be a valid potential tree slot. We're
-	 * now in create-new-BIB-and-session mode.
-	 * Time to worry about slots->bib4.
-	 *
-	 * (BTW: If old->bib is NULL, then old->session is also supposed to be
-	 * NULL.)
-	 */
-	if (masks) {
-		error = find_available_mask(table, masks, new->bib, &slots->bib4);
-		if (error) {
-			if (WARN(error != -ENOENT, "Unknown error: %d", error))
-				return error;
-			/*
-			 * TODO (issue175) the rate limit might be a bit of a
-			 * problem.
-			 * If both mark 0 and mark 1 are running out of
-			 * addresses, only one of them will be logged.
-			 * The problem is that remembering which marks have been
-			 * logged might get pretty ridiculous.
-			 * I don't think it's too bad because there will still
-			 * be at least one message every minute.
-			 * Also, it's better than what we had before. (Not
-			 * logging the offending mark.)
-			 * Might not be worth fixing since #175 is in the radar.
-			 */
-			log_warn_once("I'm running out of pool4 addresses for mark %u.",
-					mask_domain_get_mark(masks));
-			return error;
+static struct tabled_bib *walk_next(struct bib_walk *walk)
+{
+	struct tabled_bib *bib;
+	struct tabled_bib *min = NULL;
+	unsigned int min_index = 0;
+	unsigned int i;
+
+	for (i = 0; i < BIB_SHARDS; i++) {
+		bib = bib4_entry(walk->nodes[i]);
+		if (bib && (!min || compare_src4(bib, &min->src4) < 0)) {
+			min = bib;
+			min_index = i;
 		}
+	}
 
-		if (new->bib->proto == L4PROTO_ICMP)
-			new->session->dst4.l4 = new->bib->src4.l4;
+	if (min)
+		walk->nodes[min_index] = rb_next(&min->hook4);
+	return min;
+}
 
-	} else {
-		/*
-		 * TODO (issue113) perhaps the sender's session shold be trusted
-		 * more.
-		 */
-		if (find_bibtree4_slot(table, new->bib, &slots->bib4))
-			return -EEXIST;
+int bib_foreach(struct bib *db, l4_protocol proto,
+		bib_foreach_entry_cb cb, void *cb_arg,
+		const struct ipv4_transport_addr *offset)
+{
+	struct bib_table *table;
+	struct bib_walk walk;
+	struct tabled_bib *tabled;
+	struct bib_entry bib;
+	int error = 0;
+
+	table = get_table(db, proto);
+	if (!table)
+		return -EINVAL;
+
+	lock_all(table);
+
+	walk_init(table, &walk, offset, false);
+	while (!error && (tabled = walk_next(&walk))) {
+		tbtobe(tabled, &bib);
+		error = cb(&bib, cb_arg);
 	}
 
-	/* Ok, time to worry about slots->session now. */
+	unlock_all(table);
+	return error;
+}
 
-	treeslot_init(&slots->session, &new->bib->sessions,
-			&new->session->tree_hook);
-	old->session = NULL;
+static struct rb_node *slot_next(struct tree_slot *slot)
+{
+	if (!slot->parent)
+		return NULL;
+	if (&slot->parent->rb_left == slot->rb_link)
+		return slot->parent;
+	/* else if (slot->parent->rb_right == &slot->rb_link) */
+	return rb_next(slot->parent);
+}
 
-	return 0; /* Happy path for new sessions */
+static void next_session(struct rb_node *next, struct bib_walk *walk,
+		struct bib_session_tuple *pos)
+{
+	pos->session = node2session(next);
+	if (!pos->session) {
+		/* Tree was empty or the previous was the last session. */
+		/* Cascade "next" to the supertree. */
+		pos->bib = walk_next(walk);
+	}
 }
 
 /**
- * @db current BIB & session database.
- * @masks Should a BIB entry be created, its IPv4 address mask will be allocated
- *     from one of these candidates.
- * @tuple6 The connection that you want to mask.
- * @dst4 translated version of @tuple.dst.addr6.
- * @result A copy of the resulting BIB entry and session from the database will
- *     be placed here. (if not NULL)
+ * Finds the BIB entry and/or session where a foreach of the sessions should
+ * start with, based on @offset. Also initializes @walk so it can continue from
+ * there.
  *
- * TODO (fine) return verdict
+ * If a session that matches @offset is found, will initialize both @pos->bib
+ * and @pos->session to point to this session.
+ * If @pos->bib is defined but @pos->session is not, the foreach should start
+ * from @pos->bib's first session.
+ * If neither @pos->bib nor @pos->session are defined, iteration ended.
+ * (offset lies after the last session.)
+ *
+ * If @offset is not found, it always tries to return the session that would
+ * follow one that would match perfectly. This is because sessions expiring
+ * during ongoing fragmented foreaches are not considered a problem.
  */
-int bib_add6(struct xlation *state,
-		struct mask_domain *masks,
-		struct tuple *tuple6,
-		struct ipv4_transport_addr *dst4)
+static void find_session_offset(struct bib_table *table,
+		struct session_foreach_offset *offset,
+		struct bib_walk *walk,
+		struct bib_session_tuple *pos)
+{
+	struct tabled_session tmp_session;
+	struct tree_slot slot;
+
+	memset(pos, 0, sizeof(*pos));
+
+	/* Whatever happens, the walk continues after offset's BIB entry. */
+	walk_init(table, walk, &offset->offset.src, false);
+
+	pos->bib = find_bib4(get_shard4(table, &offset->offset.src),
+			&offset->offset.src);
+	if (!pos->bib) {
+		pos->bib = walk_next(walk);
+		return;
+	}
+
+	tmp_session.dst4 = offset->offset.dst;
+	pos->session = find_session_slot(pos->bib, &tmp_session, NULL, &slot);
+	if (!pos->session) {
+		next_session(slot_next(&slot), walk, pos);
+		return;
+	}
+
+	if (!offset->include_offset)
+		next_session(rb_next(&pos->session->tree_hook), walk, pos);
+}
+
+#define foreach_session(tree, node) \
+		for (node = node2session(rb_first(tree)); \
+				node; \
+				node = node2session(rb_next(&node->tree_hook)))
+
+int bib_foreach_session(struct xlator *jool, l4_protocol proto,
+		session_foreach_entry_cb cb, void *cb_arg,
+		struct session_foreach_offset *offset)
 {
 	struct bib_table *table;
-	struct bib_session_tuple new;
-	struct bib_session_tuple old;
-	struct slot_group slots;
-	struct bib_delete_list bdl = { NULL };
-	int error;
+	struct bib_walk walk;
+	struct bib_session_tuple pos;
+	struct session_entry tmp;
+	int error = 0;
 
-	table = get_table(state->jool.nat64.bib, tuple6->l4_proto);
+	table = get_table(jool->nat64.bib, proto);
 	if (!table)
 		return -EINVAL;
 
-	/*
-	 * We might have a lot to do. This function may index three RB-trees
-	 * so spinlock time is tight.
-	 *
-	 * (That's 3 potential lookups (2 guaranteed) and 3 potential
-	 * rebalances, though at least one of the trees is usually minuscule.)
-	 *
-	 * There's also the optional port allocation thing, which in the worst
-	 * case is an unfortunate full traversal of @masks.
-	 *
-	 * Let's start by allocating and initializing the objects as much as we
-	 * can, even if we end up not needing them.
-	 */
-	error = create_bib_session6(&new, tuple6, dst4, ESTABLISHED);
-	if (error)
-		return error;
-
-	spin_lock_bh(&table->lock); /* Here goes... */
-
-	error = find_bib_session6(&state->jool, table, masks, &new, &old, &slots, &bdl);
-	if (error)
-		goto end;
+	lock_all(table);
 
-	if (old.session) { /* Session already exists. */
-		handle_fate_timer(old.session, &table->est_timer);
-		tstobs(state, old.session);
+	if (offset) {
+		find_session_offset(table, offset, &walk, &pos);
+		/* if pos.session != NULL, then pos.bib != NULL. */
+		if (pos.session)
+			goto goto_session;
+		if (pos.bib)
+			goto goto_bib;
 		goto end;
 	}
 
-	/* New connection; add the session. (And maybe the BIB entry as well) */
-	commit_add6(state, &old, &new, &slots, &table->est_timer);
-	/* Fall through */
+	walk_init(table, &walk, NULL, false);
+	while ((pos.bib = walk_next(&walk))) {
+goto_bib:	foreach_session(&pos.bib->sessions, pos.session) {
+goto_session:		tstose(jool, pos.session, &tmp);
+			error = cb(&tmp, cb_arg);
+			if (error)
+				goto end;
+		}
+	}
 
 end:
-	spin_unlock_bh(&table->lock);
+	unlock_all(table);
+	return error;
+}
 
-	if (new.bib)
-		free_bib(new.bib);
-	if (new.session)
-		free_session(new.session);
-	commit_delete_list(&bdl);
+#undef foreach_session
 
-	return error;
+static bool filter_match6(struct bib_filter const *filter,
+		struct tabled_bib *bib)
+{
+	return !filter || !filter->src6_set
+			|| prefix6_contains(&filter->src6, &bib->src6.l3);
 }
 
-static void find_bib_session4(struct bib_table *table,
-		struct tuple *tuple4,
-		struct tabled_session *new,
-		struct bib_session_tuple *old,
-		bool *allow,
-		struct tree_slot *slot)
+/*
+ * The src4 scans start at the beginning of @filter's src4 prefix, and tree4 is
+ * sorted by src4, so the first entry that falls out of the prefix ends them.
+ */
+static bool filter_past4(struct bib_filter const *filter,
+		struct tabled_bib *bib)
 {
-	old->bib = find_bib4(table, &tuple4->dst.addr4);
-	old->session = old->bib
-			? find_session_slot(old->bib, new, allow, slot)
-			: NULL;
+	return filter && filter->src4_set
+			&& !prefix4_contains(&filter->src4, &bib->src4.l3);
+}
+
+/*
+ * The src6 index can only be scanned by prefix if it's a tree. Otherwise, src6
+ * filters are evaluated during the src4 scan, so they need a src4 filter to
+ * bound it. (Userspace requests lacking one are rejected by init_dump().)
+ */
+static bool use_index6(struct bib_table *table, struct bib_filter const *filter)
+{
+	return filter && filter->src6_set && !filter->src4_set
+			&& !table->hashed;
+}
+
+/*
+ * Returns the node of @shard where the src4 scan should resume. If
+ * @include_last, the cursor's own entry is included.
+ */
+static struct rb_node *dump_start4(struct bib_shard *shard,
+		struct bib_dump_cursor *cursor,
+		struct bib_filter const *filter,
+		bool include_last)
+{
+	struct ipv4_transport_addr start;
+
+	if (cursor->started)
+		return find_starting_point(shard, &cursor->last.src,
+				include_last);
+	if (!filter || !filter->src4_set)
+		return rb_first(&shard->tree4);
+
+	start.l3 = filter->src4.addr;
+	start.l4 = 0;
+	return find_starting_point(shard, &start, true);
+}
+
+/*
+ * Returns the node of @bib's first session whose dst4 follows @offset, or of
+ * its very first session if @offset is NULL. As usual, @offset need not exist.
+ */
+static struct rb_node *session_after(struct tabled_bib *bib,
+		struct ipv4_transport_addr const *offset)
+{
+	struct tabled_session tmp;
+	struct tabled_session *session;
+	struct tree_slot slot;
+
+	if (!offset)
+		return rb_first(&bib->sessions);
+
+	tmp.dst4 = *offset;
+	session = find_session_slot(bib, &tmp, NULL, &slot);
+	return session ? rb_next(&session->tree_hook) : slot_next(&slot);
 }
 
-/**
- * See @bib_add6.
- *
- * TODO (fine) return verdict
+/*
+ * Returns the first session at or after @node, where @node is one of *@bib's
+ * sessions. (NULL means "after *@bib's last session".) The search cascades
+ * through *@bib's successors in the shard, and updates *@bib accordingly.
  */
-int bib_add4(struct xlation *state,
-		struct ipv6_transport_addr *dst6,
-		struct tuple *tuple4)
+static struct tabled_session *dump_next_session(struct tabled_bib **bib,
+		struct rb_node *node)
 {
-	struct bib_table *table;
-	struct bib_session_tuple old;
-	struct tabled_session *new;
-	struct tree_slot session_slot;
-	bool allow;
-	int error = 0;
-
-	table = get_table(state->jool.nat64.bib, tuple4->l4_proto);
-	if (!table)
-		return -EINVAL;
+	while (!node) {
+		*bib = bib4_entry(rb_next(&(*bib)->hook4));
+		if (!(*bib))
+			return NULL;
+		node = rb_first(&(*bib)->sessions);
+	}
 
-	new = create_session4(tuple4, dst6, ESTABLISHED);
-	if (!new)
-		return -ENOMEM;
+	return node2session(node);
+}
 
-	spin_lock_bh(&table->lock);
+/*
+ * Returns the first session of @shard that follows @cursor, and its BIB entry
+ * in @bib. As in find_session_offset(), the cursor's session need not exist
+ * anymore.
+ */
+static struct tabled_session *dump_first_session(struct bib_shard *shard,
+		struct bib_dump_cursor *cursor,
+		struct bib_filter const *filter,
+		struct tabled_bib **bib)
+{
+	*bib = bib4_entry(dump_start4(shard, cursor, filter, true));
+	if (!(*bib))
+		return NULL;
 
-	find_bib_session4(table, tuple4, new, &old, &allow, &session_slot);
+	if (!cursor->started || compare_src4(*bib, &cursor->last.src) != 0)
+		return dump_next_session(bib, session_after(*bib, NULL));
+	return dump_next_session(bib, session_after(*bib, &cursor->last.dst));
+}
 
-	if (old.session) {
-		handle_fate_timer(old.session, &table->est_timer);
-		tstobs(state, old.session);
-		goto end;
-	}
+/* How many BIB entries the src6 scans pick up per bib_shard6 lock. */
+#define DUMP6_BATCH 16
 
-	if (!old.bib) {
-		error = -ESRCH;
-		goto end;
-	}
+struct dump6_key {
+	struct ipv6_transport_addr src6;
+	struct ipv4_transport_addr src4;
+};
 
-	/* Address-Dependent Filtering. */
-	if (GLOBALS(state).drop_by_addr && !allow) {
-		error = -EPERM;
-		goto end;
-	}
+static struct rb_node *find_starting_point6(struct bib_shard6 *shard6,
+		const struct ipv6_transport_addr *offset,
+		bool include_offset)
+{
+	struct tabled_bib *bib;
+	struct rb_node **node;
+	struct rb_node *parent;
 
-	/* Ok, no issues; add the session. */
-	commit_add4(state, &old, &new, &session_slot, &table->est_timer);
-	/* Fall through */
+	rbtree_find_node(offset, &shard6->tree6, compare_src6,
+			struct tabled_bib, hook6, parent, node);
+	if (*node)
+		return include_offset ? (*node) : rb_next(*node);
+	if (!parent)
+		return NULL;
 
-end:
-	spin_unlock_bh(&table->lock);
-	if (new)
-		free_session(new);
-	return error;
+	bib = rb_entry(parent, struct tabled_bib, hook6);
+	return (compare_src6(bib, offset) < 0) ? rb_next(parent) : parent;
 }
 
-/**
- * Note: This particular incarnation of fate_cb is not prepared to return
- * FATE_PROBE.
+/*
+ * Copies the identifiers of the next (at most DUMP6_BATCH) entries of @shard6
+ * whose src6 belongs to @prefix into @keys. Returns how many there were.
+ *
+ * The entries can't be used directly, because the bib_shard6 lock can't be
+ * held while the entries' shards are locked. (See the concurrency notes.)
  */
-verdict bib_add_tcp6(struct xlation *state,
-		struct mask_domain *masks,
-		struct ipv4_transport_addr *dst4,
-		struct collision_cb *cb)
+static unsigned int collect6(struct bib_shard6 *shard6,
+		struct bib_dump_cursor *cursor,
+		struct ipv6_prefix const *prefix,
+		bool include_last,
+		struct dump6_key *keys)
 {
-	struct packet *pkt;
-	struct bib_table *table;
-	struct bib_session_tuple new;
-	struct bib_session_tuple old;
-	struct slot_group slots;
-	struct bib_delete_list bdl = { NULL };
-	verdict result;
-
-	pkt = &state->in;
-	if (WARN(pkt->tuple.l4_proto != L4PROTO_TCP, "Incorrect l4 proto in TCP handler."))
-		return drop(state, JSTAT_UNKNOWN);
-
-	if (create_bib_session6(&new, &pkt->tuple, dst4, V6_INIT))
-		return drop(state, JSTAT_ENOMEM);
+	struct ipv6_transport_addr start;
+	struct rb_node *node;
+	struct tabled_bib *bib;
+	unsigned int count = 0;
 
-	table = &state->jool.nat64.bib->tcp;
-	spin_lock_bh(&table->lock);
+	spin_lock_bh(&shard6->lock);
 
-	if (find_bib_session6(&state->jool, table, masks, &new, &old, &slots, &bdl)) {
-		result = drop(state, JSTAT_UNKNOWN);
-		goto end;
+	if (cursor->started) {
+		node = find_starting_point6(shard6, &cursor->last6,
+				include_last);
+	} else {
+		start.l3 = prefix->addr;
+		start.l4 = 0;
+		node = find_starting_point6(shard6, &start, true);
 	}
 
-	if (old.session) {
-		/* All states except CLOSED. */
-		if (decide_fate(&state->jool, cb, table, old.session, NULL)) {
-			tstobs(state, old.session);
-			result = VERDICT_CONTINUE;
-		} else {
-			/* TODO (fine) ugly hack; we're assuming SO_EXISTS. */
-			result = drop(state, JSTAT_SO_EXISTS);
-		}
-		goto end;
+	for (; node && count < DUMP6_BATCH; node = rb_next(node)) {
+		bib = bib6_entry(node);
+		if (!prefix6_contains(prefix, &bib->src6.l3))
+			break;
+		keys[count].src6 = bib->src6;
+		keys[count].src4 = bib->src4;
+		count++;
 	}
 
-	/* CLOSED state beginning now. */
+	spin_unlock_bh(&shard6->lock);
+	return count;
+}
 
-	if (!pkt_tcp_hdr(pkt)->syn) {
-		if (old.bib) {
-			tbtobs(old.bib, &state->entries);
-			result = VERDICT_CONTINUE;
-		} else {
-			log_debug(state, "Packet is not SYN and lacks state.");
-			result = drop(state, JSTAT_SYN6_EXPECTED);
-		}
-		goto end;
-	}
+/*
+ * Locks the shard of @key's BIB entry, and returns the entry. Returns NULL
+ * (and locks nothing) if the entry died after it was collected.
+ */
+static struct tabled_bib *lock_key(struct bib_table *table,
+		struct dump6_key const *key,
+		struct bib_shard **shard)
+{
+	struct tabled_bib *bib;
 
-	/* All exits up till now require @new.* to be deleted. */
+	*shard = get_shard4(table, &key->src4);
+	spin_lock_bh(&(*shard)->lock);
 
-	commit_add6(state, &old, &new, &slots, &table->trans_timer);
-	result = VERDICT_CONTINUE;
-	/* Fall through */
+	bib = find_bib4(*shard, &key->src4);
+	if (bib && taddr6_equals(&bib->src6, &key->src6))
+		return bib;
 
-end:
-	spin_unlock_bh(&table->lock);
+	spin_unlock_bh(&(*shard)->lock);
+	return NULL;
+}
 
-	if (new.bib)
-		free_bib(new.bib);
-	if (new.session)
-		free_session(new.session);
-	commit_delete_list(&bdl);
+static int bib_dump6(struct bib_table *table, struct bib_dump_cursor *cursor,
+		struct ipv6_prefix const *prefix,
+		bib_foreach_entry_cb cb, void *cb_arg)
+{
+	struct dump6_key keys[DUMP6_BATCH];
+	struct bib_shard *shard;
+	struct tabled_bib *tabled;
+	struct bib_entry bib;
+	unsigned int count, i;
+	int error;
 
-	return result;
+	for (; cursor->shard < BIB_SHARDS; cursor->shard++) {
+		do {
+			count = collect6(&table->shards6[cursor->shard], cursor,
+					prefix, false, keys);
+			for (i = 0; i < count; i++) {
+				tabled = lock_key(table, &keys[i], &shard);
+				if (tabled) {
+					tbtobe(tabled, &bib);
+					spin_unlock_bh(&shard->lock);
+					error = cb(&bib, cb_arg);
+					if (error)
+						return error;
+				}
+				cursor->last6 = keys[i].src6;
+				cursor->started = true;
+			}
+		} while (count == DUMP6_BATCH);
+
+		cursor->started = false;
+	}
+
+	return 0;
 }
 
 /**
- * Note: This particular incarnation of fate_cb is not prepared to return
- * FATE_PROBE.
+ * Iterates over @proto's BIB entries (only the ones that match @filter, if
+ * not NULL), starting after @cursor, and updates @cursor as it goes. Only one
+ * shard is locked at a time, so this can be called repeatedly (until it
+ * returns zero) without stalling the translation.
+ *
+ * If @cb returns nonzero, iteration stops, @cursor is left pointing to the
+ * previous entry (so the rejected entry will be visited again next time), and
+ * @cb's result is returned.
+ *
+ * Prefix filters are range scans over the src4 or src6 indexes, so they only
+ * visit the entries they return (plus one per shard).
  */
-verdict bib_add_tcp4(struct xlation *state,
-		struct ipv6_transport_addr *dst6,
-		struct collision_cb *cb)
+int bib_dump(struct bib *db, l4_protocol proto,
+		struct bib_dump_cursor *cursor,
+		struct bib_filter const *filter,
+		bib_foreach_entry_cb cb, void *cb_arg)
 {
-	struct packet *pkt;
 	struct bib_table *table;
-	struct tabled_session *new;
-	struct bib_session_tuple old;
-	struct tree_slot session_slot;
-	verdict result;
+	struct bib_shard *shard;
+	struct rb_node *node;
+	struct tabled_bib *tabled;
+	struct bib_entry bib;
 	int error;
 
-	pkt = &state->in;
-	if (WARN(pkt->tuple.l4_proto != L4PROTO_TCP, "Incorrect l4 proto in TCP handler."))
-		return drop(state, JSTAT_UNKNOWN);
-
-	new = create_session4(&pkt->tuple, dst6, V4_INIT);
-	if (!new)
-		return drop(state, JSTAT_ENOMEM);
-
-	table = &state->jool.nat64.bib->tcp;
-	spin_lock_bh(&table->lock);
-
-	find_bib_session4(table, &pkt->tuple, new, &old, NULL, &session_slot);
-
-	if (old.session) {
-		/* All states except CLOSED. */
-		if (decide_fate(&state->jool, cb, table, old.session, NULL)) {
-			tstobs(state, old.session);
-			result = VERDICT_CONTINUE;
-		} else {
-			/* TODO (fine) ugly hack; we're assuming SO_EXISTS. */
-			result = drop(state, JSTAT_SO_EXISTS);
+	table = get_table(db, proto);
+	if (!table)
+		return -EINVAL;
+	if (use_index6(table, filter))
+		return bib_dump6(table, cursor, &filter->src6, cb, cb_arg);
+
+	for (; cursor->shard < BIB_SHARDS; cursor->shard++) {
+		shard = &table->shards4[cursor->shard];
+		spin_lock_bh(&shard->lock);
+
+		node = dump_start4(shard, cursor, filter, false);
+		for (; node; node = rb_next(node)) {
+			tabled = bib4_entry(node);
+			if (filter_past4(filter, tabled))
+				break;
+			if (filter_match6(filter, tabled)) {
+				tbtobe(tabled, &bib);
+				error = cb(&bib, cb_arg);
+				if (error) {
+					spin_unlock_bh(&shard->lock);
+					return error;
+				}
+			}
+			cursor->last.src = tabled->src4;
+			cursor->started = true;
 		}
-		goto end;
-	}
-
-	/* CLOSED state beginning now. */
 
-	if (!pkt_tcp_hdr(pkt)->syn) {
-		if (old.bib) {
-			tbtobs(old.bib, &state->entries);
-			result = VERDICT_CONTINUE;
-		} else {
-			log_debug(state, "Packet is not SYN and lacks state.");
-			result = drop(state, JSTAT_SYN4_EXPECTED);
-		}
-		goto end;
+		spin_unlock_bh(&shard->lock);
+		cursor->started = false;
 	}
 
-	if (GLOBALS(state).drop_external_tcp) {
-		log_debug(state, "Externally initiated TCP connections are prohibited.");
-		result = drop(state, JSTAT_V4_SYN);
-		goto end;
-	}
+	return 0;
+}
 
-	if (!old.bib) {
-		bool too_many;
+/*
+ * Feeds @bib's sessions (the ones after @offset, if not NULL) to @cb, and
+ * records each one in @cursor. (If @cursor is not NULL.)
+ */
+static int foreach_bib_session(struct xlator *jool, struct tabled_bib *bib,
+		struct ipv4_transport_addr const *offset,
+		struct bib_dump_cursor *cursor,
+		session_foreach_entry_cb cb, void *cb_arg)
+{
+	struct rb_node *node;
+	struct tabled_session *session;
+	struct session_entry tmp;
+	int error;
 
-		log_debug(state, "Potential Simultaneous Open; storing type 1 packet.");
-		too_many = table->pkt_count >= GLOBALS(state).max_stored_pkts;
-		error = pktqueue_add(table->pkt_queue, pkt, dst6, too_many);
-		switch (error) {
-		case 0:
-			result = stolen(state, JSTAT_TYPE1PKT);
-			table->pkt_count++;
-			goto end;
-		case -EEXIST:
-			log_debug(state, "Simultaneous Open already exists.");
-			result = drop(state, JSTAT_SO_EXISTS);
-			goto end;
-		case -ENOSPC:
-			goto too_many_pkts;
-		case -ENOMEM:
-			result = drop(state, JSTAT_ENOMEM);
-			goto end;
+	for (node = session_after(bib, offset); node; node = rb_next(node)) {
+		session = node2session(node);
+		tstose(jool, session, &tmp);
+		error = cb(&tmp, cb_arg);
+		if (error)
+			return error;
+		if (cursor) {
+			cursor->last6 = bib->src6;
+			cursor->last.dst = session->dst4;
+			cursor->started = true;
+			cursor->mid_bib = true;
 		}
-
-		WARN(1, "pktqueue_add() threw unknown error %d", error);
-		result = drop(state, JSTAT_UNKNOWN);
-		goto end;
 	}
 
-	result = VERDICT_CONTINUE;
+	return 0;
+}
 
-	if (GLOBALS(state).drop_by_addr) {
-		if (table->pkt_count >= GLOBALS(state).max_stored_pkts)
-			goto too_many_pkts;
+static int bib_dump_sessions6(struct xlator *jool, struct bib_table *table,
+		struct bib_dump_cursor *cursor,
+		struct ipv6_prefix const *prefix,
+		session_foreach_entry_cb cb, void *cb_arg)
+{
+	struct dump6_key keys[DUMP6_BATCH];
+	struct bib_shard *shard;
+	struct tabled_bib *bib;
+	bool resume;
+	unsigned int count, i;
+	int error;
 
-		log_debug(state, "Potential Simultaneous Open; storing type 2 packet.");
-		new->stored = pkt_original_pkt(pkt)->skb;
-		result = stolen(state, JSTAT_TYPE2PKT);
-		table->pkt_count++;
-		/*
-		 * Yes, fall through. No goto; we need to add this session.
-		 * Notice that if you need to cancel before the spin unlock then
-		 * you need to revert the packet storing above.
-		 */
+	for (; cursor->shard < BIB_SHARDS; cursor->shard++) {
+		do {
+			/* If the last entry was left halfway, revisit it. */
+			count = collect6(&table->shards6[cursor->shard], cursor,
+					prefix, cursor->mid_bib, keys);
+			for (i = 0; i < count; i++) {
+				resume = cursor->mid_bib && taddr6_equals(
+						&keys[i].src6, &cursor->last6);
+				bib = lock_key(table, &keys[i], &shard);
+				if (bib) {
+					error = foreach_bib_session(jool, bib,
+							resume ? &cursor->last.dst : NULL,
+							cursor, cb, cb_arg);
+					spin_unlock_bh(&shard->lock);
+					if (error)
+						return error;
+				}
+				cursor->last6 = keys[i].src6;
+				cursor->started = true;
+				cursor->mid_bib = false;
+			}
+		} while (count == DUMP6_BATCH);
+
+		cursor->started = false;
 	}
 
-	commit_add4(state, &old, &new, &session_slot,
-			new->stored ? &table->syn4_timer : &table->trans_timer);
-	/* Fall through */
-
-end:
-	spin_unlock_bh(&table->lock);
-
-	if (new)
-		free_session(new);
-
-	return result;
-
-too_many_pkts:
-	spin_unlock_bh(&table->lock);
-	free_session(new);
-	log_debug(state, "Too many Simultaneous Opens.");
-	/* Fall back to assume there's no SO. */
-	return drop_icmp(state, JSTAT_SO_FULL, ICMPERR_PORT_UNREACHABLE, 0);
+	return 0;
 }
 
-int bib_find(struct bib *db, struct tuple *tuple, struct bib_session *result)
+/**
+ * Same as bib_dump(), except it iterates over the sessions. (@filter applies to
+ * their BIB entries.)
+ */
+int bib_dump_sessions(struct xlator *jool, l4_protocol proto,
+		struct bib_dump_cursor *cursor,
+		struct bib_filter const *filter,
+		session_foreach_entry_cb cb, void *cb_arg)
 {
-	struct bib_entry tmp;
+	struct bib_table *table;
+	struct bib_shard *shard;
+	struct tabled_bib *bib;
+	struct tabled_session *session;
+	struct session_entry tmp;
 	int error;
 
-	switch (tuple->l3_proto) {
-	case L3PROTO_IPV6:
-		error = bib_find6(db, tuple->l4_proto, &tuple->src.addr6, &tmp);
-		break;
-	case L3PROTO_IPV4:
-		error = bib_find4(db, tuple->l4_proto, &tuple->dst.addr4, &tmp);
-		break;
-	default:
-		WARN(true, "Unknown layer 3 protocol: %u", tuple->l3_proto);
+	table = get_table(jool->nat64.bib, proto);
+	if (!table)
 		return -EINVAL;
+	if (use_index6(table, filter)) {
+		return bib_dump_sessions6(jool, table, cursor, &filter->src6,
+				cb, cb_arg);
 	}
 
-	if (error)
-		return error;
+	for (; cursor->shard < BIB_SHARDS; cursor->shard++) {
+		shard = &table->shards4[cursor->shard];
+		spin_lock_bh(&shard->lock);
+
+		session = dump_first_session(shard, cursor, filter, &bib);
+		while (session) {
+			if (filter_past4(filter, bib))
+				break;
+			if (!filter_match6(filter, bib)) {
+				/* Skip the entire BIB entry. */
+				session = dump_next_session(&bib, NULL);
+				continue;
+			}
+
+			tstose(jool, session, &tmp);
+			error = cb(&tmp, cb_arg);
+			if (error) {
+				spin_unlock_bh(&shard->lock);
+				return error;
+			}
+			cursor->last.src = bib->src4;
+			cursor->last.dst = session->dst4;
+			cursor->started = true;
+
+			session = dump_next_session(&bib,
+					rb_next(&session->tree_hook));
+		}
+
+		spin_unlock_bh(&shard->lock);
+		cursor->started = false;
+	}
 
-	result->bib_set = true;
-	result->session.src6 = tmp.addr6;
-	result->session.src4 = tmp.addr4;
-	result->session.proto = tmp.l4_proto;
 	return 0;
 }
 
-int bib_add_session(struct xlator *jool,
-		struct session_entry *session,
-		struct collision_cb *cb)
+/**
+ * Iterates over the sessions of the BIB entry whose src6 is @addr6 (or, if
+ * @addr6 is NULL, whose src4 is @addr4), in dst4 order, starting after
+ * @offset. (If not NULL.)
+ *
+ * The entry is found through the indexes, so this doesn't visit anything else.
+ * Returns -ESRCH if the entry doesn't exist.
+ */
+int bib_foreach_bib_session(struct xlator *jool, l4_protocol proto,
+		struct ipv6_transport_addr const *addr6,
+		struct ipv4_transport_addr const *addr4,
+		session_foreach_entry_cb cb, void *cb_arg,
+		struct ipv4_transport_addr const *offset)
 {
 	struct bib_table *table;
-	struct bib_session_tuple new;
-	struct bib_session_tuple old;
-	struct slot_group slots;
-	struct bib_delete_list bdl = { NULL };
+	struct bib_shard *shard;
+	struct tabled_bib *bib;
 	int error;
 
-	table = get_table(jool->nat64.bib, session->proto);
+	table = get_table(jool->nat64.bib, proto);
 	if (!table)
 		return -EINVAL;
 
-	error = create_bib_session(session, &new);
-	if (error)
-		return error;
-
-	spin_lock_bh(&table->lock);
-
-	error = find_bib_session6(jool, table, NULL, &new, &old, &slots, &bdl);
-	if (error)
-		goto end;
-
-	if (old.session) {
-		/* There's no packet; ignore the verdict. */
-		decide_fate(jool, cb, table, old.session, NULL);
-		goto end;
+	if (addr6) {
+		bib = find_bib6_locked(table, addr6, &shard);
+		if (!bib)
+			return -ESRCH;
+	} else {
+		shard = get_shard4(table, addr4);
+		shard_lock(shard);
+		bib = find_bib4(shard, addr4);
+		if (!bib) {
+			shard_unlock(shard);
+			return -ESRCH;
+		}
 	}
 
-	error = commit_add(jool, table, &old, &new, &slots, session->timer_type);
-	/* Fall through */
-
-end:
-	spin_unlock_bh(&table->lock);
-
-	if (new.bib)
-		free_bib(new.bib);
-	if (new.session)
-		free_session(new.session);
-	commit_delete_list(&bdl);
+	error = foreach_bib_session(jool, bib, offset, NULL, cb, cb_arg);
 
+	shard_unlock(shard);
 	return error;
 }
 
-static void __clean(struct xlator *jool,
-		struct expire_timer *expirer,
-		struct bib_table *table,
-		struct list_head *probes)
-{
-	struct tabled_session *session;
-	struct tabled_session *tmp;
-	struct collision_cb cb;
-	unsigned long timeout;
+/* How many sessions the idle walk counts per hold of a shard lock. */
+#define STATS_BATCH 256
 
-	cb.cb = expirer->decide_fate_cb;
-	cb.arg = NULL;
-	timeout = get_timeout(jool, expirer);
+static void count_idle(struct tabled_session *session, unsigned int *idle)
+{
+	static const unsigned int bounds[] = JSS_IDLE_BOUNDS;
+	unsigned long secs;
+	unsigned int i;
 
-	list_for_each_entry_safe(session, tmp, &expirer->sessions, list_hook) {
-		/*
-		 * "list" is sorted by expiration date,
-		 * so stop on the first unexpired session.
-		 */
-		if (time_before(jiffies, session->update_time + timeout))
+	secs = (jiffies - get_update_time(session)) / HZ;
+	for (i = 0; i < ARRAY_SIZE(bounds); i++)
+		if (secs < bounds[i])
 			break;
-		decide_fate(jool, &cb, table, session, probes);
-	}
+	idle[i]++;
 }
 
-static void clean_table(struct xlator *jool, struct bib_table *table)
+/*
+ * Builds the idle time histogram. Same traversal as bib_dump_sessions(), except
+ * the lock is released every STATS_BATCH sessions.
+ */
+static void stats_idle(struct bib_table *table, struct bib_stats *stats)
 {
-	LIST_HEAD(probes);
-	LIST_HEAD(icmps);
-
-	spin_lock_bh(&table->lock);
-	__clean(jool, &table->est_timer, table, &probes);
-	__clean(jool, &table->trans_timer, table, &probes);
-	__clean(jool, &table->syn4_timer, table, &probes);
-	if (table->pkt_queue) {
-		table->pkt_count -= pktqueue_prepare_clean(table->pkt_queue,
-				&icmps);
+	struct bib_dump_cursor cursor;
+	struct bib_shard *shard;
+	struct tabled_bib *bib;
+	struct tabled_session *session;
+	unsigned int budget;
+
+	memset(&cursor, 0, sizeof(cursor));
+	for (; cursor.shard < BIB_SHARDS; cursor.shard++) {
+		shard = &table->shards4[cursor.shard];
+		do {
+			spin_lock_bh(&shard->lock);
+			session = dump_first_session(shard, &cursor, NULL, &bib);
+			for (budget = STATS_BATCH; session && budget; budget--) {
+				count_idle(session, stats->idle);
+				cursor.last.src = bib->src4;
+				cursor.last.dst = session->dst4;
+				cursor.started = true;
+				session = dump_next_session(&bib,
+						rb_next(&session->tree_hook));
+			}
+			spin_unlock_bh(&shard->lock);
+			cond_resched();
+		} while (session);
+		cursor.started = false;
 	}
-	spin_unlock_bh(&table->lock);
-
-	post_fate(jool, &probes);
-	pktqueue_clean(&icmps);
 }
 
-/**
- * Forgets or downgrades (from EST to TRANS) old sessions.
- */
-void bib_clean(struct xlator *jool)
-{
-	struct bib *db = jool->nat64.bib;
-	clean_table(jool, &db->udp);
-	clean_table(jool, &db->tcp);
-	clean_table(jool, &db->icmp);
-}
+/* The pending keys of one bib_shard6, during the subscriber walk. */
+struct stats6_queue {
+	struct bib_dump_cursor cursor;
+	struct dump6_key keys[DUMP6_BATCH];
+	unsigned int count;
+	unsigned int next;
+	bool done;
+};
 
-static struct rb_node *find_starting_point(struct bib_table *table,
-		const struct ipv4_transport_addr *offset,
-		bool include_offset)
+/* Returns the smallest key @queue hasn't handed out yet. */
+static struct dump6_key *peek6(struct bib_shard6 *shard6,
+		struct stats6_queue *queue)
 {
-	struct tabled_bib *bib;
-	struct rb_node **node;
-	struct rb_node *parent;
-
-	/* If there's no offset, start from the beginning. */
-	if (!offset)
-		return rb_first(&table->tree4);
+	static const struct ipv6_prefix everything = { .len = 0 };
 
-	/* If offset is found, start from offset or offset's next. */
-	rbtree_find_node(offset, &table->tree4, compare_src4, struct tabled_bib,
-			hook4, parent, node);
-	if (*node)
-		return include_offset ? (*node) : rb_next(*node);
+	if (queue->next < queue->count)
+		return &queue->keys[queue->next];
+	if (queue->done)
+		return NULL;
 
-	if (!parent)
+	queue->count = collect6(shard6, &queue->cursor, &everything, false,
+			queue->keys);
+	queue->next = 0;
+	if (queue->count < DUMP6_BATCH)
+		queue->done = true;
+	if (queue->count == 0)
 		return NULL;
 
-	/*
-	 * If offset is not found, start from offset's next anyway.
-	 * (If offset was meant to exist, it probably timed out and died while
-	 * the caller wasn't holding the spinlock; it's nothing to worry about.)
-	 */
-	bib = rb_entry(parent, struct tabled_bib, hook4);
-	return (compare_src4(bib, offset) < 0) ? rb_next(parent) : parent;
+	queue->cursor.last6 = queue->keys[queue->count - 1].src6;
+	queue->cursor.started = true;
+	return &queue->keys[0];
 }
 
-int bib_foreach(struct bib *db, l4_protocol proto,
-		bib_foreach_entry_cb cb, void *cb_arg,
-		const struct ipv4_transport_addr *offset)
+static unsigned int count_key_sessions(struct bib_table *table,
+		struct dump6_key const *key)
 {
-	struct bib_table *table;
+	struct bib_shard *shard;
+	struct tabled_bib *bib;
 	struct rb_node *node;
-	struct tabled_bib *tabled;
-	struct bib_entry bib;
-	int error = 0;
-
-	table = get_table(db, proto);
-	if (!table)
-		return -EINVAL;
+	unsigned int count = 0;
 
-	spin_lock_bh(&table->lock);
-
-	node = find_starting_point(table, offset, false);
-	for (; node && !error; node = rb_next(node)) {
-		tabled = bib4_entry(node);
-		tbtobe(tabled, &bib);
-		error = cb(&bib, cb_arg);
-	}
+	bib = lock_key(table, key, &shard);
+	if (!bib)
+		return 0;
+	for (node = rb_first(&bib->sessions); node; node = rb_next(node))
+		count++;
+	spin_unlock_bh(&shard->lock);
 
-	spin_unlock_bh(&table->lock);
-	return error;
+	return count;
 }
 
-static struct rb_node *slot_next(struct tree_slot *slot)
+static void add_subscriber(struct bib_stats *stats, unsigned int sessions)
 {
-	if (!slot->parent)
-		return NULL;
-	if (&slot->parent->rb_left == slot->rb_link)
-		return slot->parent;
-	/* else if (slot->parent->rb_right == &slot->rb_link) */
-	return rb_next(slot->parent);
+	if (!sessions)
+		return;
+	stats->subscriber_count++;
+	stats->subscribers[min(ilog2(sessions),
+			JSS_SUBSCRIBER_BUCKETS - 1)]++;
 }
 
-static void next_bib(struct rb_node *next, struct bib_session_tuple *pos)
+/*
+ * Builds the sessions-per-subscriber histogram.
+ *
+ * Every bib_shard6 tree is sorted by src6, so merging them yields the entire
+ * table in src6 order, which places each subscriber's entries next to each
+ * other. The trees are read DUMP6_BATCH keys at a time (see collect6()), so no
+ * more than one lock is held at any given moment.
+ */
+static int stats_subscribers(struct bib_table *table, unsigned int len,
+		struct bib_stats *stats)
 {
-	pos->bib = bib4_entry(next);
-}
+	struct stats6_queue *queues;
+	struct dump6_key *key, *first;
+	struct in6_addr subscriber;
+	unsigned int sessions;
+	unsigned int i, m;
+
+	queues = __wkmalloc("Stats queues", BIB_SHARDS * sizeof(*queues),
+			GFP_KERNEL);
+	if (!queues)
+		return -ENOMEM;
+	memset(queues, 0, BIB_SHARDS * sizeof(*queues));
 
-static void next_session(struct rb_node *next, struct bib_session_tuple *pos)
-{
-	pos->session = node2session(next);
-	if (!pos->session) {
-		/* Tree was empty or the previous was the last session. */
-		/* Cascade "next" to the supertree. */
-		next_bib(rb_next(&pos->bib->hook4), pos);
-	}
+	memset(&subscriber, 0, sizeof(subscriber));
+	sessions = 0;
+	m = 0;
+
+	do {
+		first = NULL;
+		for (i = 0; i < BIB_SHARDS; i++) {
+			key = peek6(&table->shards6[i], &queues[i]);
+			if (key && (!first || taddr6_compare(&key->src6,
+					&first->src6) < 0)) {
+				first = key;
+				m = i;
+			}
+		}
+		if (!first)
+			break;
+
+		if (!ipv6_prefix_equal(&first->src6.l3, &subscriber, len)) {
+			add_subscriber(stats, sessions);
+			subscriber = first->src6.l3;
+			sessions = 0;
+		}
+		sessions += count_key_sessions(table, first);
+		queues[m].next++;
+
+		cond_resched();
+	} while (true);
+
+	add_subscriber(stats, sessions);
+	__wkfree("Stats queues", queues);
+	return 0;
 }
 
 /**
- * Finds the BIB entry and/or session where a foreach of the sessions should
- * start with, based on @offset.
- *
- * If a session that matches @offset is found, will initialize both @pos->bib
- * and @pos->session to point to this session.
- * If @pos->bib is defined but @pos->session is not, the foreach should start
- * from @pos->bib's first session.
- * If neither @pos->bib nor @pos->session are defined, iteration ended.
- * (offset lies after the last session.)
+ * Fills @stats with @proto's aggregate numbers. (See common/session_stats.h.)
+ * A subscriber is a /@subscriber_len of src6s.
  *
- * If @offset is not found, it always tries to return the session that would
- * follow one that would match perfectly. This is because sessions expiring
- * during ongoing fragmented foreaches are not considered a problem.
+ * The counters are read without locking, and the histograms are built one
+ * shard at a time, so the result is only approximate while the table is
+ * changing. Must be called in process context. (It sleeps between batches.)
  */
-static void find_session_offset(struct bib_table *table,
-		struct session_foreach_offset *offset,
-		struct bib_session_tuple *pos)
+int bib_stats(struct bib *db, l4_protocol proto, unsigned int subscriber_len,
+		struct bib_stats *stats)
 {
-	struct tabled_bib tmp_bib;
-	struct tabled_session tmp_session;
-	struct tree_slot slot;
+	struct bib_table *table;
+	struct bib_shard *shard;
+	unsigned int s, i;
 
-	memset(pos, 0, sizeof(*pos));
+	table = get_table(db, proto);
+	if (!table)
+		return -EINVAL;
 
-	tmp_bib.src4 = offset->offset.src;
-	pos->bib = find_bibtree4_slot(table, &tmp_bib, &slot);
-	if (!pos->bib) {
-		next_bib(slot_next(&slot), pos);
-		return;
+	memset(stats, 0, sizeof(*stats));
+	stats->bib_bytes = sizeof(struct tabled_bib);
+	stats->session_bytes = session_size(table);
+	for (s = 0; s < BIB_SHARDS; s++) {
+		shard = &table->shards4[s];
+		for (i = 0; i < JSS_STATES; i++)
+			stats->states[i] += READ_ONCE(shard->state_count[i]);
+		for (i = 0; i < JSS_TIMERS; i++)
+			stats->timers[i] += READ_ONCE(shard->timer_count[i]);
 	}
 
-	tmp_session.dst4 = offset->offset.dst;
-	pos->session = find_session_slot(pos->bib, &tmp_session, NULL, &slot);
-	if (!pos->session) {
-		next_session(slot_next(&slot), pos);
-		return;
-	}
+	stats_idle(table, stats);
 
-	if (!offset->include_offset)
-		next_session(rb_next(&pos->session->tree_hook), pos);
+	/* When hashed, the src6 index is not sorted. */
+	if (table->hashed)
+		return 0;
+	stats->has_subscribers = true;
+	return stats_subscribers(table, subscriber_len, stats);
 }
 
-#define foreach_bib(table, node) \
-		for (node = bib4_entry(rb_first(&(table)->tree4)); \
-				node; \
-				node = bib4_entry(rb_next(&node->hook4)))
-#define foreach_session(tree, node) \
-		for (node = node2session(rb_first(tree)); \
-				node; \
-				node = node2session(rb_next(&node->tree_hook)))
-
-int bib_foreach_session(struct xlator *jool, l4_protocol proto,
-		session_foreach_entry_cb cb, void *cb_arg,
-		struct session_foreach_offset *offset)
+/**
+ * Calls @cb once for every IPv4 address @proto's table has ever masked with,
+ * along with the number of BIB entries currently using it.
+ */
+int bib_foreach_addr4(struct bib *db, l4_protocol proto,
+		bib_foreach_addr4_cb cb, void *cb_arg)
 {
 	struct bib_table *table;
-	struct bib_session_tuple pos;
-	struct session_entry tmp;
-	int error = 0;
 
-	table = get_table(jool->nat64.bib, proto);
+	table = get_table(db, proto);
 	if (!table)
 		return -EINVAL;
 
-	spin_lock_bh(&table->lock);
-
-	if (offset) {
-		find_session_offset(table, offset, &pos);
-		/* if pos.session != NULL, then pos.bib != NULL. */
-		if (pos.session)
-			goto goto_session;
-		if (pos.bib)
-			goto goto_bib;
-		goto end;
-	}
-
-	foreach_bib(table, pos.bib) {
-goto_bib:	foreach_session(&pos.bib->sessions, pos.session) {
-goto_session:		tstose(jool, pos.session, &tmp);
-			error = cb(&tmp, cb_arg);
-			if (error)
-				goto end;
-		}
-	}
-
-end:
-	spin_unlock_bh(&table->lock);
-	return error;
+	return port_maps_foreach(&table->ports, cb, cb_arg);
 }
 
-#undef foreach_session
-#undef foreach_bib
-
 int bib_find6(struct bib *db, l4_protocol proto,
 		struct ipv6_transport_addr *addr,
 		struct bib_entry *result)
 {
 	struct bib_table *table;
+	struct bib_shard *shard;
 	struct tabled_bib *bib;
 
 	table = get_table(db, proto);
 	if (!table)
 		return -EINVAL;
 
-	spin_lock_bh(&table->lock);
-	bib = find_bib6(table, addr);
-	if (bib)
-		tbtobe(bib, result);
-	spin_unlock_bh(&table->lock);
+	bib = find_bib6_locked(table, addr, &shard);
+	if (!bib)
+		return -ESRCH;
 
-	return bib ? 0 : -ESRCH;
+	tbtobe(bib, result);
+	shard_unlock(shard);
+	return 0;
 }
 
 int bib_find4(struct bib *db, l4_protocol proto,
@@ -2226,17 +5100,19 @@ int bib_find4(struct bib *db, l4_protocol proto,
 		struct bib_entry *result)
 {
 	struct bib_table *table;
+	struct bib_shard *shard;
 	struct tabled_bib *bib;
 
 	table = get_table(db, proto);
 	if (!table)
 		return -EINVAL;
+	shard = get_shard4(table, addr);
 
-	spin_lock_bh(&table->lock);
-	bib = find_bib4(table, addr);
+	spin_lock_bh(&shard->lock);
+	bib = find_bib4(shard, addr);
 	if (bib)
 		tbtobe(bib, result);
-	spin_unlock_bh(&table->lock);
+	spin_unlock_bh(&shard->lock);
 
 	return bib ? 0 : -ESRCH;
 }
@@ -2247,6 +5123,8 @@ static void bib2tabled(struct bib_entry *bib, struct tabled_bib *tabled)
 	tabled->src4 = bib->addr4;
 	tabled->proto = bib->l4_proto;
 	tabled->is_static = true;
+	tabled->block = NULL;
+	tabled->subscriber = NULL;
 	tabled->sessions = RB_ROOT;
 }
 
@@ -2254,10 +5132,11 @@ static int __bib_add_static(struct xlator *jool, struct bib_entry *new,
 		struct bib_entry *old)
 {
 	struct bib_table *table;
+	struct bib_shard *shard;
 	struct tabled_bib *bib;
 	struct tabled_bib *collision;
-	struct tree_slot slot6;
 	struct tree_slot slot4;
+	int error;
 
 	__log_debug(jool, "Adding static BIB entry " BEPP ".", BEPA(new));
 
@@ -2270,22 +5149,31 @@ static int __bib_add_static(struct xlator *jool, struct bib_entry *new,
 		return -ENOMEM;
 	bib2tabled(new, bib);
 
-	spin_lock_bh(&table->lock);
-
-	collision = find_bibtree6_slot(table, bib, &slot6);
+retry:
+	collision = find_bib6_locked(table, &bib->src6, &shard);
 	if (collision) {
 		if (taddr4_equals(&bib->src4, &collision->src4))
 			goto upgrade;
 		goto eexist;
 	}
 
-	collision = find_bibtree4_slot(table, bib, &slot4);
+	shard = get_shard4(table, &bib->src4);
+	shard_lock(shard);
+
+	collision = find_bibtree4_slot(shard, bib, &slot4);
 	if (collision)
 		goto eexist;
 
-	treeslot_commit(&slot6);
+	error = index_add(shard, bib, NULL);
+	if (error == -EAGAIN) {
+		shard_unlock(shard);
+		goto retry;
+	}
+	if (error)
+		goto enomem;
+
 	treeslot_commit(&slot4);
-	jstat_inc(jool->stats, JSTAT_BIB_ENTRIES);
+	count_bibs(jool, 1);
 
 	/*
 	 * Since the BIB entry is now available, and assuming ADF is disabled,
@@ -2293,23 +5181,31 @@ static int __bib_add_static(struct xlator *jool, struct bib_entry *new,
 	 * That's bound to be a lot of messy code though, and the v4 client is
 	 * going to retry anyway, so let's just forget the packets instead.
 	 */
-	if (new->l4_proto == L4PROTO_TCP)
-		pktqueue_rm(jool->nat64.bib->tcp.pkt_queue, &new->addr4);
+	if (new->l4_proto == L4PROTO_TCP) {
+		spin_lock(&table->pktqueue_lock);
+		pktqueue_rm(table->pkt_queue, &new->addr4);
+		spin_unlock(&table->pktqueue_lock);
+	}
 
-	spin_unlock_bh(&table->lock);
+	shard_unlock(shard);
 	return 0;
 
 upgrade:
 	collision->is_static = true;
-	spin_unlock_bh(&table->lock);
+	shard_unlock(shard);
 	free_bib(bib);
 	return 0;
 
 eexist:
 	tbtobe(collision, old);
-	spin_unlock_bh(&table->lock);
+	shard_unlock(shard);
 	free_bib(bib);
 	return -EEXIST;
+
+enomem:
+	shard_unlock(shard);
+	free_bib(bib);
+	return -ENOMEM;
 }
 
 /* Noisy version. */
@@ -2337,8 +5233,10 @@ int bib_add_static(struct xlator *jool, struct bib_entry *new)
 int bib_rm(struct xlator *jool, struct bib_entry *entry)
 {
 	struct bib_table *table;
+	struct bib_shard *shard;
 	struct tabled_bib key;
 	struct tabled_bib *bib;
+	BIB_DELETE_LIST(bdl);
 	int error = -ESRCH;
 
 	table = get_table(jool->nat64.bib, entry->l4_proto);
@@ -2347,75 +5245,84 @@ int bib_rm(struct xlator *jool, struct bib_entry *entry)
 
 	bib2tabled(entry, &key);
 
-	spin_lock_bh(&table->lock);
+	bib = find_bib6_locked(table, &key.src6, &shard);
+	if (!bib)
+		return error;
 
-	bib = find_bib6(table, &key.src6);
-	if (bib && taddr4_equals(&key.src4, &bib->src4)) {
-		detach_bib(jool, table, bib);
+	if (taddr4_equals(&key.src4, &bib->src4)) {
+		detach_bib(jool, shard, bib, &bdl);
 		error = 0;
 	}
 
-	spin_unlock_bh(&table->lock);
-
-	if (!error)
-		release_bib_entry(bib);
+	shard_unlock(shard);
 
+	commit_delete_list(&bdl);
 	return error;
 }
 
-void bib_rm_range(struct xlator *jool, l4_protocol proto,
-		struct ipv4_range *range)
+static void rm_range_shard(struct xlator *jool, struct bib_shard *shard,
+		struct ipv4_range *range,
+		struct bib_delete_list *delete_list)
 {
-	struct bib_table *table;
 	struct ipv4_transport_addr offset;
 	struct rb_node *node;
 	struct rb_node *next;
 	struct tabled_bib *bib;
-	struct bib_delete_list delete_list = { NULL };
-
-	table = get_table(jool->nat64.bib, proto);
-	if (!table)
-		return;
 
 	offset.l3 = range->prefix.addr;
 	offset.l4 = range->ports.min;
 
-	spin_lock_bh(&table->lock);
+	shard_lock(shard);
 
-	node = find_starting_point(table, &offset, true);
+	node = find_starting_point(shard, &offset, true);
 	for (; node; node = next) {
 		next = rb_next(node);
 		bib = bib4_entry(node);
 
 		if (!prefix4_contains(&range->prefix, &bib->src4.l3))
 			break;
-		if (port_range_contains(&range->ports, bib->src4.l4)) {
-			detach_bib(jool, table, bib);
-			add_to_delete_list(&delete_list, node);
-		}
+		if (port_range_contains(&range->ports, bib->src4.l4))
+			detach_bib(jool, shard, bib, delete_list);
 	}
 
-	spin_unlock_bh(&table->lock);
+	shard_unlock(shard);
+}
+
+void bib_rm_range(struct xlator *jool, l4_protocol proto,
+		struct ipv4_range *range)
+{
+	struct bib_table *table;
+	BIB_DELETE_LIST(delete_list);
+	unsigned int i;
+
+	table = get_table(jool->nat64.bib, proto);
+	if (!table)
+		return;
+
+	for (i = 0; i < BIB_SHARDS; i++)
+		rm_range_shard(jool, &table->shards4[i], range, &delete_list);
 
 	commit_delete_list(&delete_list);
 }
 
 static void flush_table(struct xlator *jool, struct bib_table *table)
 {
+	struct bib_shard *shard;
 	struct rb_node *node;
 	struct rb_node *next;
-	struct bib_delete_list delete_list = { NULL };
-
-	spin_lock_bh(&table->lock);
-
-	for (node = rb_first(&table->tree4); node; node = next) {
-		next = rb_next(node);
-		detach_bib(jool, table, bib4_entry(node));
-		add_to_delete_list(&delete_list, node);
+	BIB_DELETE_LIST(delete_list);
+	unsigned int i;
+
+	for (i = 0; i < BIB_SHARDS; i++) {
+		shard = &table->shards4[i];
+		shard_lock(shard);
+		for (node = rb_first(&shard->tree4); node; node = next) {
+			next = rb_next(node);
+			detach_bib(jool, shard, bib4_entry(node), &delete_list);
+		}
+		shard_unlock(shard);
 	}
 
-	spin_unlock_bh(&table->lock);
-
 	commit_delete_list(&delete_list);
 }
 
@@ -2444,8 +5351,7 @@ static void print_session(struct rb_node *node, int tabs, char *prefix)
 
 	session = node2session(node);
 	print_tabs(tabs);
-	pr_cont("[%s] " TA4PP " " TA6PP "\n", prefix, TA4PA(session->dst4),
-			TA6PA(session->dst6));
+	pr_cont("[%s] " TA4PP "\n", prefix, TA4PA(session->dst4));
 
 	print_session(node->rb_left, tabs + 1, "L"); /* "Left" */
 	print_session(node->rb_right, tabs + 1, "R"); /* "Right" */
@@ -2468,12 +5374,22 @@ static void print_bib(struct rb_node *node, int tabs)
 	print_bib(node->rb_right, tabs + 1);
 }
 
+static void print_table(struct bib_table *table)
+{
+	unsigned int i;
+
+	for (i = 0; i < BIB_SHARDS; i++) {
+		LOG_DEBUG("  Shard %u:", i);
+		print_bib(table->shards4[i].tree4.rb_node, 2);
+	}
+}
+
 void bib_print(struct bib *db)
 {
 	LOG_DEBUG("TCP:");
-	print_bib(db->tcp.tree4.rb_node, 1);
+	print_table(&db->tcp);
 	LOG_DEBUG("UDP:");
-	print_bib(db->udp.tree4.rb_node, 1);
+	print_table(&db->udp);
 	LOG_DEBUG("ICMP:");
-	print_bib(db->icmp.tree4.rb_node, 1);
+	print_table(&db->icmp);
 }
@@ -8,6 +8,7 @@
  */
 
 #include "common/config.h"
+#include "common/session_stats.h"
 #include "mod/common/packet.h"
 #include "mod/common/translation_state.h"
 #include "mod/common/db/pool4/db.h"
@@ -59,7 +60,7 @@ enum session_fate {
 /* bib_setup() not needed. */
 void bib_teardown(void);
 
-struct bib *bib_alloc(void);
+struct bib *bib_alloc(bool hashed);
 void bib_get(struct bib *db);
 void bib_put(struct bib *db);
 
@@ -81,9 +82,7 @@ int bib_add6(struct xlation *state,
 		struct mask_domain *masks,
 		struct tuple *tuple6,
 		struct ipv4_transport_addr *dst4);
-int bib_add4(struct xlation *state,
-		struct ipv6_transport_addr *dst6,
-		struct tuple *tuple4);
+int bib_add4(struct xlation *state, struct tuple *tuple4);
 verdict bib_add_tcp6(struct xlation *xstate,
 		struct mask_domain *masks,
 		struct ipv4_transport_addr *dst4,
@@ -98,7 +97,12 @@ int bib_find(struct bib *db, struct tuple *tuple,
 		struct bib_session *result);
 int bib_add_session(struct xlator *jool, struct session_entry *new,
 		struct collision_cb *cb);
-void bib_clean(struct xlator *jool);
+bool bib_clean(struct xlator *jool, unsigned int *cursor);
+
+/* Maximum number of sessions bib_import() accepts per call. */
+#define BIB_IMPORT_MAX 256
+int bib_import(struct xlator *jool, struct session_entry *sessions,
+		unsigned int count);
 
 /* These are used by userspace request handling. */
 
@@ -116,6 +120,68 @@ int bib_foreach(struct bib *db, l4_protocol proto,
 int bib_foreach_session(struct xlator *jool, l4_protocol proto,
 		session_foreach_entry_cb cb, void *cb_arg,
 		struct session_foreach_offset *offset);
+/*
+ * Where a dump left off. Unlike the foreaches, dumps visit one shard at a
+ * time, so they never lock the whole table. (As a consequence, the entries
+ * come out sorted within each shard, but not overall.)
+ */
+struct bib_dump_cursor {
+	unsigned int shard;
+	/*
+	 * Last entry visited, within @shard. Only meaningful if @started.
+	 * The src6 scans (see struct bib_filter) use @last6 and @last.dst;
+	 * everyone else uses @last.
+	 */
+	struct taddr4_tuple last;
+	struct ipv6_transport_addr last6;
+	bool started;
+	/* src6 session scans: @last.dst is a session of @last6's entry. */
+	bool mid_bib;
+};
+
+/*
+ * Restricts a dump to the BIB entries (or the sessions of the BIB entries)
+ * whose addresses belong to these prefixes.
+ */
+struct bib_filter {
+	struct ipv6_prefix src6;
+	bool src6_set;
+	struct ipv4_prefix src4;
+	bool src4_set;
+};
+
+int bib_dump(struct bib *db, l4_protocol proto,
+		struct bib_dump_cursor *cursor,
+		struct bib_filter const *filter,
+		bib_foreach_entry_cb cb, void *cb_arg);
+int bib_dump_sessions(struct xlator *jool, l4_protocol proto,
+		struct bib_dump_cursor *cursor,
+		struct bib_filter const *filter,
+		session_foreach_entry_cb cb, void *cb_arg);
+int bib_foreach_bib_session(struct xlator *jool, l4_protocol proto,
+		struct ipv6_transport_addr const *addr6,
+		struct ipv4_transport_addr const *addr4,
+		session_foreach_entry_cb cb, void *cb_arg,
+		struct ipv4_transport_addr const *offset);
+/* Host byte order version of struct jool_session_stats. */
+struct bib_stats {
+	unsigned int states[JSS_STATES];
+	unsigned int timers[JSS_TIMERS];
+	unsigned int idle[JSS_IDLE_BUCKETS];
+	unsigned int subscribers[JSS_SUBSCRIBER_BUCKETS];
+	unsigned int subscriber_count;
+	bool has_subscribers;
+	unsigned int bib_bytes;
+	unsigned int session_bytes;
+};
+
+typedef int (*bib_foreach_addr4_cb)(struct in_addr const *, unsigned int,
+		void *);
+
+int bib_stats(struct bib *db, l4_protocol proto, unsigned int subscriber_len,
+		struct bib_stats *stats);
+int bib_foreach_addr4(struct bib *db, l4_protocol proto,
+		bib_foreach_addr4_cb cb, void *cb_arg);
 int bib_find6(struct bib *db, l4_protocol proto,
 		struct ipv6_transport_addr *addr,
 		struct bib_entry *result);
@@ -0,0 +1,250 @@
+#include "mod/common/db/bib/pba.h"
+
+#include <net/ipv6.h>
+#include "mod/common/wkmalloc.h"
+
+static unsigned int block_offset(struct pba_block const *block)
+{
+	return block->index * block->size;
+}
+
+static int compare_addr6(struct pba_block const *block, __u32 mark,
+		struct in6_addr const *addr)
+{
+	if (block->mark != mark)
+		return (block->mark < mark) ? -1 : 1;
+	return ipv6_addr_cmp(&block->addr, addr);
+}
+
+static int compare_offset(struct pba_block const *block, __u32 mark,
+		unsigned int offset)
+{
+	if (block->mark != mark)
+		return (block->mark < mark) ? -1 : 1;
+	if (block_offset(block) != offset)
+		return (block_offset(block) < offset) ? -1 : 1;
+	return 0;
+}
+
+void pba_table_init(struct pba_table *table)
+{
+	table->tree6 = RB_ROOT;
+	table->tree_index = RB_ROOT;
+	table->next_index = 0;
+	spin_lock_init(&table->lock);
+}
+
+/**
+ * Assumes nobody is using @table anymore.
+ */
+void pba_table_destroy(struct pba_table *table)
+{
+	struct pba_block *block, *tmp;
+
+	rbtree_postorder_for_each_entry_safe(block, tmp, &table->tree6, hook6)
+		wkfree(struct pba_block, block);
+}
+
+static struct pba_block *find_block6(struct pba_table *table,
+		struct in6_addr const *addr, __u32 mark)
+{
+	struct rb_node *node = table->tree6.rb_node;
+	struct pba_block *block;
+	int comparison;
+
+	while (node) {
+		block = rb_entry(node, struct pba_block, hook6);
+		comparison = compare_addr6(block, mark, addr);
+		if (comparison < 0)
+			node = node->rb_right;
+		else if (comparison > 0)
+			node = node->rb_left;
+		else
+			return block;
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns the block of @mark that overlaps offsets [@start, @end), if any.
+ *
+ * Blocks never overlap each other, so if the last block that starts before
+ * @end doesn't reach @start, none of the earlier ones does either.
+ */
+static struct pba_block *find_overlap(struct pba_table *table, __u32 mark,
+		unsigned int start, unsigned int end)
+{
+	struct rb_node *node = table->tree_index.rb_node;
+	struct pba_block *block;
+	struct pba_block *last = NULL;
+
+	while (node) {
+		block = rb_entry(node, struct pba_block, hook_index);
+		if (compare_offset(block, mark, end) < 0) {
+			last = block;
+			node = node->rb_right;
+		} else {
+			node = node->rb_left;
+		}
+	}
+
+	if (last && last->mark == mark
+			&& block_offset(last) + last->size > start)
+		return last;
+	return NULL;
+}
+
+/*
+ * Finds the first index in [@first, @last) whose @size block doesn't overlap
+ * any of @mark's blocks. Each collision skips the entire colliding block, so
+ * this is bounded by the number of blocks, not by the number of indexes.
+ */
+static bool scan(struct pba_table *table, __u32 mark, unsigned int size,
+		unsigned int first, unsigned int last, unsigned int *result)
+{
+	struct pba_block *overlap;
+	unsigned int i;
+
+	i = first;
+	while (i < last) {
+		overlap = find_overlap(table, mark, i * size, (i + 1) * size);
+		if (!overlap) {
+			*result = i;
+			return true;
+		}
+		i = DIV_ROUND_UP(block_offset(overlap) + overlap->size, size);
+	}
+
+	return false;
+}
+
+static bool find_free_index(struct pba_table *table, __u32 mark,
+		unsigned int size, unsigned int count, unsigned int *result)
+{
+	unsigned int start;
+
+	start = (table->next_index < count) ? table->next_index : 0;
+	if (scan(table, mark, size, start, count, result))
+		return true;
+	return start && scan(table, mark, size, 0, start, result);
+}
+
+static void add_block(struct pba_table *table, struct pba_block *block)
+{
+	struct rb_node **link;
+	struct rb_node *parent;
+	struct pba_block *other;
+
+	link = &table->tree6.rb_node;
+	parent = NULL;
+	while (*link) {
+		parent = *link;
+		other = rb_entry(parent, struct pba_block, hook6);
+		if (compare_addr6(other, block->mark, &block->addr) < 0)
+			link = &parent->rb_right;
+		else
+			link = &parent->rb_left;
+	}
+	rb_link_node(&block->hook6, parent, link);
+	rb_insert_color(&block->hook6, &table->tree6);
+
+	link = &table->tree_index.rb_node;
+	parent = NULL;
+	while (*link) {
+		parent = *link;
+		other = rb_entry(parent, struct pba_block, hook_index);
+		if (compare_offset(other, block->mark, block_offset(block)) < 0)
+			link = &parent->rb_right;
+		else
+			link = &parent->rb_left;
+	}
+	rb_link_node(&block->hook_index, parent, link);
+	rb_insert_color(&block->hook_index, &table->tree_index);
+}
+
+/**
+ * Returns (in @result) @addr's block, and counts one more reference to it.
+ *
+ * If @addr didn't have a block, one of @size transport addresses is reserved
+ * for it (out of the @count blocks that fit in the domain), and @allocated is
+ * set to true. Blocks are chosen next-fit, so recently released blocks are the
+ * last to be reused.
+ *
+ * Returns -ENOENT if all the blocks are taken, -ENOMEM on memory allocation
+ * failure.
+ */
+int pba_get(struct pba_table *table, struct in6_addr const *addr, __u32 mark,
+		unsigned int size, unsigned int count,
+		struct pba_block **result, bool *allocated)
+{
+	struct pba_block *block;
+	unsigned int index;
+	int error;
+
+	spin_lock_bh(&table->lock);
+
+	block = find_block6(table, addr, mark);
+	if (block) {
+		block->refs++;
+		*allocated = false;
+		goto success;
+	}
+
+	if (!find_free_index(table, mark, size, count, &index)) {
+		error = -ENOENT;
+		goto fail;
+	}
+
+	block = wkmalloc(struct pba_block, GFP_ATOMIC);
+	if (!block) {
+		error = -ENOMEM;
+		goto fail;
+	}
+
+	block->addr = *addr;
+	block->mark = mark;
+	block->index = index;
+	block->size = size;
+	block->refs = 1;
+	add_block(table, block);
+	table->next_index = index + 1;
+	*allocated = true;
+	/* Fall through */
+
+success:
+	spin_unlock_bh(&table->lock);
+	*result = block;
+	return 0;
+
+fail:
+	spin_unlock_bh(&table->lock);
+	return error;
+}
+
+/**
+ * Drops one of @block's references. If it was the last one, the block is
+ * returned to the pool, true is returned, and the caller is expected to
+ * pba_free() @block (once it's done logging it).
+ */
+bool pba_put(struct pba_table *table, struct pba_block *block)
+{
+	bool released;
+
+	spin_lock_bh(&table->lock);
+
+	block->refs--;
+	released = !block->refs;
+	if (released) {
+		rb_erase(&block->hook6, &table->tree6);
+		rb_erase(&block->hook_index, &table->tree_index);
+	}
+
+	spin_unlock_bh(&table->lock);
+	return released;
+}
+
+void pba_free(struct pba_block *block)
+{
+	wkfree(struct pba_block, block);
+}
@@ -0,0 +1,61 @@
+#ifndef SRC_MOD_NAT64_BIB_PBA_H_
+#define SRC_MOD_NAT64_BIB_PBA_H_
+
+/**
+ * @file
+ * Port Block Allocation. While an IPv6 address has dynamic BIB entries in some
+ * table (under some mark), it owns a block of that mark's pool4 domain, and
+ * its new masks are only chosen from the block. This way, the translator only
+ * needs to log (and the admin only needs to store) one line per block, instead
+ * of one per BIB entry.
+ *
+ * Blocks are numbered. Block n is the domain's n'th run of @size transport
+ * addresses. This module only keeps track of who owns which number; turning
+ * numbers into transport addresses is pool4's business. (See
+ * mask_domain_narrow().)
+ *
+ * Concurrency: The functions take the table's lock by themselves. It can be
+ * acquired while holding a BIB shard lock, but not the other way around.
+ */
+
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include "common/types.h"
+
+struct pba_block {
+	struct in6_addr addr;
+	__u32 mark;
+	unsigned int index;
+	/** pba-block-size, as it was when the block was allocated. */
+	unsigned int size;
+	/** Number of BIB entries (committed or not) that point to the block. */
+	unsigned int refs;
+
+	/* First and last transport addresses of the block. For logging. */
+	struct ipv4_transport_addr first;
+	struct ipv4_transport_addr last;
+
+	/** Hook to the (mark, addr) tree. */
+	struct rb_node hook6;
+	/** Hook to the (mark, index) tree. */
+	struct rb_node hook_index;
+};
+
+struct pba_table {
+	struct rb_root tree6;
+	struct rb_root tree_index;
+	/** The search for a free index starts here. (Next fit.) */
+	unsigned int next_index;
+	spinlock_t lock;
+};
+
+void pba_table_init(struct pba_table *table);
+void pba_table_destroy(struct pba_table *table);
+
+int pba_get(struct pba_table *table, struct in6_addr const *addr, __u32 mark,
+		unsigned int size, unsigned int count,
+		struct pba_block **result, bool *allocated);
+bool pba_put(struct pba_table *table, struct pba_block *block);
+void pba_free(struct pba_block *block);
+
+#endif /* SRC_MOD_NAT64_BIB_PBA_H_ */
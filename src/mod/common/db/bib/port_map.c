@@ -0,0 +1,409 @@
+#include "mod/common/db/bib/port_map.h"
+
+#include <linux/bitmap.h>
+#include <linux/bitops.h>
+#include <linux/hash.h>
+#include <linux/rculist.h>
+
+#include "mod/common/wkmalloc.h"
+
+#define PORT_COUNT (1 << 16)
+#define PORT_MAP_CHUNK_PORTS 1024
+#define PORT_MAP_CHUNKS (PORT_COUNT / PORT_MAP_CHUNK_PORTS)
+#define PORT_MAP_CHUNK_WORDS BITS_TO_LONGS(PORT_MAP_CHUNK_PORTS)
+
+struct port_chunk {
+	/**
+	 * Number of bits set in @used.
+	 * Only drops to zero (and back) while holding the collection's lock.
+	 */
+	atomic_t taken;
+	/** Bit w is set if word w of @used is full (all of its ports taken). */
+	unsigned long full[BITS_TO_LONGS(PORT_MAP_CHUNK_WORDS)];
+	/** Bit p is set if port p (relative to the chunk) is taken. */
+	unsigned long used[PORT_MAP_CHUNK_WORDS];
+
+	struct rcu_head rcu;
+};
+
+struct port_map {
+	struct in_addr addr;
+	/** Number of ports taken. (ie. the sum of the chunks' @taken.) */
+	atomic_t taken;
+	/** Number of non-NULL @chunks. Protected by the collection's lock. */
+	unsigned int chunk_count;
+	struct hlist_node hook;
+	struct rcu_head rcu;
+
+	/** NULL chunks have no ports taken. */
+	struct port_chunk __rcu *chunks[PORT_MAP_CHUNKS];
+};
+
+/*
+ * A map is a little over half a kilobyte, and a chunk is a little over a
+ * hundred bytes. kmalloc() would round both up rather wastefully.
+ */
+static struct kmem_cache *map_cache;
+static struct kmem_cache *chunk_cache;
+
+#define alloc_map() wkmem_cache_alloc("port map", map_cache, GFP_ATOMIC)
+#define alloc_chunk() wkmem_cache_alloc("port chunk", chunk_cache, GFP_ATOMIC)
+#define free_map(map) wkmem_cache_free("port map", map_cache, map)
+#define free_chunk(chunk) wkmem_cache_free("port chunk", chunk_cache, chunk)
+
+static void __free_map_rcu(struct rcu_head *rcu)
+{
+	free_map(container_of(rcu, struct port_map, rcu));
+}
+
+static void __free_chunk_rcu(struct rcu_head *rcu)
+{
+	free_chunk(container_of(rcu, struct port_chunk, rcu));
+}
+
+int port_map_setup(void)
+{
+	map_cache = kmem_cache_create("jool_port_maps",
+			sizeof(struct port_map), 0, 0, NULL);
+	if (!map_cache)
+		return -ENOMEM;
+
+	chunk_cache = kmem_cache_create("jool_port_chunks",
+			sizeof(struct port_chunk), 0, 0, NULL);
+	if (!chunk_cache) {
+		kmem_cache_destroy(map_cache);
+		map_cache = NULL;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/**
+ * Assumes the pending RCU callbacks have already run. (See rcu_barrier().)
+ */
+void port_map_teardown(void)
+{
+	kmem_cache_destroy(chunk_cache);
+	chunk_cache = NULL;
+	kmem_cache_destroy(map_cache);
+	map_cache = NULL;
+}
+
+static struct hlist_head *get_bucket(struct port_maps *maps,
+		struct in_addr const *addr)
+{
+	return &maps->buckets[hash_32((__force __u32)addr->s_addr,
+			PORT_MAP_BUCKET_BITS)];
+}
+
+void port_maps_init(struct port_maps *maps)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(maps->buckets); i++)
+		INIT_HLIST_HEAD(&maps->buckets[i]);
+	spin_lock_init(&maps->lock);
+}
+
+/**
+ * Assumes nobody is using @maps anymore.
+ */
+void port_maps_destroy(struct port_maps *maps)
+{
+	struct port_map *map;
+	struct port_chunk *chunk;
+	struct hlist_node *tmp;
+	unsigned int b, c;
+
+	for (b = 0; b < ARRAY_SIZE(maps->buckets); b++) {
+		hlist_for_each_entry_safe(map, tmp, &maps->buckets[b], hook) {
+			hlist_del(&map->hook);
+			for (c = 0; c < PORT_MAP_CHUNKS; c++) {
+				chunk = rcu_dereference_raw(map->chunks[c]);
+				if (chunk)
+					free_chunk(chunk);
+			}
+			free_map(map);
+		}
+	}
+}
+
+/**
+ * Returns @addr's map, or NULL if @addr has no ports taken.
+ * Needs either the RCU read lock or @maps's lock.
+ */
+static struct port_map *port_map_find(struct port_maps *maps,
+		struct in_addr const *addr)
+{
+	struct port_map *map;
+
+	hlist_for_each_entry_rcu(map, get_bucket(maps, addr), hook)
+		if (map->addr.s_addr == addr->s_addr)
+			return map;
+
+	return NULL;
+}
+
+/**
+ * Returns @addr's @index'th chunk, creating it (and the map) if it doesn't
+ * exist yet. A reference is taken on the chunk's behalf. The map is returned
+ * in @result.
+ *
+ * Returns NULL on memory allocation failure.
+ */
+static struct port_chunk *get_chunk(struct port_maps *maps,
+		struct in_addr const *addr, unsigned int index,
+		struct port_map **result)
+{
+	struct port_map *map;
+	struct port_map *new_map = NULL;
+	struct port_chunk *chunk;
+
+	spin_lock_bh(&maps->lock);
+
+	/* Somebody might have created them while we weren't looking. */
+	map = port_map_find(maps, addr);
+	if (map) {
+		chunk = rcu_dereference_protected(map->chunks[index],
+				lockdep_is_held(&maps->lock));
+		if (chunk) {
+			/* Published chunks have at least one reference. */
+			atomic_inc(&chunk->taken);
+			goto end;
+		}
+	} else {
+		new_map = alloc_map();
+		if (!new_map) {
+			chunk = NULL;
+			goto end;
+		}
+		memset(new_map, 0, sizeof(*new_map));
+		new_map->addr = *addr;
+		map = new_map;
+	}
+
+	chunk = alloc_chunk();
+	if (!chunk) {
+		if (new_map)
+			free_map(new_map);
+		goto end;
+	}
+	memset(chunk, 0, sizeof(*chunk));
+	atomic_set(&chunk->taken, 1);
+
+	rcu_assign_pointer(map->chunks[index], chunk);
+	map->chunk_count++;
+	if (new_map)
+		hlist_add_head_rcu(&new_map->hook, get_bucket(maps, addr));
+	/* Fall through */
+
+end:
+	spin_unlock_bh(&maps->lock);
+	*result = map;
+	return chunk;
+}
+
+/**
+ * Drops one of @chunk's references, and releases it (along with @map, if it
+ * was its last chunk) if that was the last one.
+ */
+static void put_chunk(struct port_maps *maps, struct port_map *map,
+		struct port_chunk *chunk, unsigned int index)
+{
+	/* Fast path; only the last reference needs the lock. */
+	if (atomic_add_unless(&chunk->taken, -1, 1))
+		return;
+
+	spin_lock_bh(&maps->lock);
+
+	if (atomic_dec_and_test(&chunk->taken)) {
+		RCU_INIT_POINTER(map->chunks[index], NULL);
+		call_rcu(&chunk->rcu, __free_chunk_rcu);
+
+		map->chunk_count--;
+		if (map->chunk_count == 0) {
+			hlist_del_rcu(&map->hook);
+			call_rcu(&map->rcu, __free_map_rcu);
+		}
+	}
+
+	spin_unlock_bh(&maps->lock);
+}
+
+/**
+ * Flags @addr#@port as taken.
+ * Returns -ENOMEM if the map or chunk could not be allocated.
+ */
+int port_map_set(struct port_maps *maps, struct in_addr const *addr,
+		__u16 port)
+{
+	struct port_map *map;
+	struct port_chunk *chunk = NULL;
+	unsigned int index = port / PORT_MAP_CHUNK_PORTS;
+	unsigned int bit = port % PORT_MAP_CHUNK_PORTS;
+	unsigned int word = BIT_WORD(bit);
+	int error = 0;
+
+	rcu_read_lock();
+
+	map = port_map_find(maps, addr);
+	if (map) {
+		chunk = rcu_dereference(map->chunks[index]);
+		/* If it's dropping to zero, it's on its way out. */
+		if (chunk && !atomic_inc_not_zero(&chunk->taken))
+			chunk = NULL;
+	}
+	if (!chunk) {
+		chunk = get_chunk(maps, addr, index, &map);
+		if (!chunk) {
+			error = -ENOMEM;
+			goto end;
+		}
+	}
+
+	if (test_and_set_bit(bit, chunk->used)) {
+		/* Already taken; it has its own reference, so this isn't it. */
+		atomic_dec(&chunk->taken);
+		goto end;
+	}
+
+	atomic_inc(&map->taken);
+	if (READ_ONCE(chunk->used[word]) == ~0UL)
+		set_bit(word, chunk->full);
+	/* Fall through */
+
+end:
+	rcu_read_unlock();
+	return error;
+}
+
+void port_map_clear(struct port_maps *maps, struct in_addr const *addr,
+		__u16 port)
+{
+	struct port_map *map;
+	struct port_chunk *chunk;
+	unsigned int index = port / PORT_MAP_CHUNK_PORTS;
+	unsigned int bit = port % PORT_MAP_CHUNK_PORTS;
+
+	rcu_read_lock();
+
+	map = port_map_find(maps, addr);
+	if (!map)
+		goto end;
+	chunk = rcu_dereference(map->chunks[index]);
+	if (!chunk || !test_and_clear_bit(bit, chunk->used))
+		goto end;
+
+	clear_bit(BIT_WORD(bit), chunk->full);
+	atomic_dec(&map->taken);
+	put_chunk(maps, map, chunk, index);
+	/* Fall through */
+
+end:
+	rcu_read_unlock();
+}
+
+/**
+ * Calls @cb once for every map in @maps, along with the number of ports taken
+ * from its address. The maps are visited in no particular order.
+ *
+ * Needs no locks; the counters are only a snapshot.
+ */
+int port_maps_foreach(struct port_maps *maps,
+		int (*cb)(struct in_addr const *, unsigned int, void *),
+		void *arg)
+{
+	struct port_map *map;
+	unsigned int i;
+	int error = 0;
+
+	rcu_read_lock();
+	for (i = 0; i < ARRAY_SIZE(maps->buckets); i++) {
+		hlist_for_each_entry_rcu(map, &maps->buckets[i], hook) {
+			error = cb(&map->addr, atomic_read(&map->taken), arg);
+			if (error)
+				goto end;
+		}
+	}
+
+end:
+	rcu_read_unlock();
+	return error;
+}
+
+/**
+ * Returns the lowest port (relative to @chunk) from @min onwards that @chunk
+ * doesn't flag as taken, or -ENOENT if there is none.
+ */
+static int chunk_find_free(struct port_chunk *chunk, unsigned int min)
+{
+	unsigned long bits;
+	unsigned int word;
+
+	/* The first word might contain ports lower than @min; mask them. */
+	word = BIT_WORD(min);
+	bits = ~READ_ONCE(chunk->used[word]) & BITMAP_FIRST_WORD_MASK(min);
+
+	while (!bits) {
+		word = find_next_zero_bit(chunk->full, PORT_MAP_CHUNK_WORDS,
+				word + 1);
+		if (word >= PORT_MAP_CHUNK_WORDS)
+			return -ENOENT;
+		/* Might still be full; @full is only updated after @used. */
+		bits = ~READ_ONCE(chunk->used[word]);
+	}
+
+	return word * BITS_PER_LONG + __ffs(bits);
+}
+
+static int map_find_free(struct port_map *map, unsigned int min,
+		unsigned int max)
+{
+	struct port_chunk *chunk;
+	unsigned int index;
+	unsigned int first;
+	int port;
+
+	for (index = min / PORT_MAP_CHUNK_PORTS; index < PORT_MAP_CHUNKS;
+			index++) {
+		first = index * PORT_MAP_CHUNK_PORTS;
+		if (first > max)
+			break;
+		if (first < min)
+			first = min;
+
+		chunk = rcu_dereference(map->chunks[index]);
+		if (!chunk)
+			return first;
+
+		port = chunk_find_free(chunk, first % PORT_MAP_CHUNK_PORTS);
+		if (port >= 0) {
+			port += index * PORT_MAP_CHUNK_PORTS;
+			return (port <= max) ? port : -ENOENT;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/**
+ * Returns the lowest port in [@min, @max] that @addr's map doesn't flag as
+ * taken, or -ENOENT if there is none.
+ */
+int port_map_find_free(struct port_maps *maps, struct in_addr const *addr,
+		unsigned int min, unsigned int max)
+{
+	struct port_map *map;
+	int port;
+
+	if (min > max)
+		return -ENOENT;
+
+	rcu_read_lock();
+	map = port_map_find(maps, addr);
+	port = map ? map_find_free(map, min, max) : min;
+	rcu_read_unlock();
+
+	return port;
+}
@@ -0,0 +1,62 @@
+#ifndef SRC_MOD_NAT64_BIB_PORT_MAP_H_
+#define SRC_MOD_NAT64_BIB_PORT_MAP_H_
+
+/**
+ * @file
+ * An index of the ports taken by a BIB table, one map per IPv4 address.
+ * It allows mask allocation to skip over the taken ports without having to
+ * query the trees candidate by candidate.
+ *
+ * A map is a small array of chunks, each of which is a bitmap of
+ * PORT_MAP_CHUNK_PORTS consecutive ports. Chunks are only allocated while at
+ * least one of their ports is taken, so an address that only uses a handful of
+ * ports costs a handful of chunks, and an address that stops being used costs
+ * nothing.
+ *
+ * Each chunk has a second, smaller bitmap on top, which flags the words of the
+ * first one that are full. Thus, finding the first free port after some offset
+ * takes a bounded (and small) number of word operations, regardless of how
+ * exhausted the address is.
+ *
+ * Concurrency:
+ *
+ * Readers do not need locking; whatever they find is only a hint, which the
+ * BIB double-checks against its trees. Writers need to hold the lock of the
+ * BIB shard that owns the port. (This works because port_map_set() and
+ * port_map_clear() only modify the bitmap words that belong to the port's
+ * shard; see BIB_SHARD_PORT_BITS.) Chunks span several shards, so they are
+ * reference counted (one reference per taken port), and only created and
+ * released under the collection's lock. Released chunks and maps are freed
+ * after an RCU grace period.
+ */
+
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#define PORT_MAP_BUCKET_BITS 4
+
+struct port_maps {
+	/** Maps, hashed by address. */
+	struct hlist_head buckets[1 << PORT_MAP_BUCKET_BITS];
+	/** Serializes map and chunk creation and release. Readers don't need it. */
+	spinlock_t lock;
+};
+
+int port_map_setup(void);
+void port_map_teardown(void);
+
+void port_maps_init(struct port_maps *maps);
+void port_maps_destroy(struct port_maps *maps);
+
+int port_map_set(struct port_maps *maps, struct in_addr const *addr,
+		__u16 port);
+void port_map_clear(struct port_maps *maps, struct in_addr const *addr,
+		__u16 port);
+int port_map_find_free(struct port_maps *maps, struct in_addr const *addr,
+		unsigned int min, unsigned int max);
+
+int port_maps_foreach(struct port_maps *maps,
+		int (*cb)(struct in_addr const *, unsigned int, void *),
+		void *arg);
+
+#endif /* SRC_MOD_NAT64_BIB_PORT_MAP_H_ */
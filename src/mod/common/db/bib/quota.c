@@ -0,0 +1,180 @@
+#include "mod/common/db/bib/quota.h"
+
+#include <net/ipv6.h>
+#include "mod/common/wkmalloc.h"
+
+static const struct rhashtable_params quota_params = {
+	.head_offset = offsetof(struct quota_subscriber, hook),
+	.key_offset = offsetof(struct quota_subscriber, key),
+	.key_len = sizeof(struct quota_key),
+	.automatic_shrinking = true,
+};
+
+int quota_table_init(struct quota_table *table)
+{
+	spin_lock_init(&table->lock);
+	return rhashtable_init(&table->hash, &quota_params);
+}
+
+static void free_subscriber(void *ptr, void *arg)
+{
+	wkfree(struct quota_subscriber, ptr);
+}
+
+/**
+ * Assumes nobody is using @table anymore.
+ */
+void quota_table_destroy(struct quota_table *table)
+{
+	rhashtable_free_and_destroy(&table->hash, free_subscriber, NULL);
+}
+
+static void init_key(struct quota_key *key, struct in6_addr const *addr,
+		unsigned int len)
+{
+	ipv6_addr_prefix(&key->prefix, addr, len);
+	key->len = len;
+}
+
+/**
+ * Counts one more BIB entry against @subscriber, unless it already has @max
+ * (zero means no limit).
+ *
+ * Returns -EDQUOT if the subscriber is full, -ESRCH if it's being released.
+ */
+static int subscriber_get(struct quota_subscriber *subscriber,
+		unsigned int max)
+{
+	int old, current_count;
+
+	current_count = atomic_read(&subscriber->bibs);
+	do {
+		if (current_count == 0)
+			return -ESRCH;
+		if (max && (unsigned int)current_count >= max)
+			return -EDQUOT;
+		old = current_count;
+		current_count = atomic_cmpxchg(&subscriber->bibs, old, old + 1);
+	} while (current_count != old);
+
+	return 0;
+}
+
+/**
+ * Returns (in @result) the subscriber @addr belongs to, and counts one more
+ * BIB entry against it. The subscriber is created if it didn't exist.
+ *
+ * Returns -EDQUOT if the subscriber already has @max_bibs BIB entries (zero
+ * means no limit), -ENOMEM on memory allocation failure.
+ */
+int quota_get(struct quota_table *table, struct in6_addr const *addr,
+		unsigned int len, unsigned int max_bibs,
+		struct quota_subscriber **result)
+{
+	struct quota_subscriber *subscriber;
+	struct quota_key key;
+	int error;
+
+	init_key(&key, addr, len);
+
+	/* Fast path: The subscriber exists, and is not going away. */
+	rcu_read_lock();
+	subscriber = rhashtable_lookup(&table->hash, &key, quota_params);
+	error = subscriber ? subscriber_get(subscriber, max_bibs) : -ESRCH;
+	rcu_read_unlock();
+	if (error != -ESRCH)
+		goto end;
+
+	spin_lock_bh(&table->lock);
+
+	/*
+	 * Somebody might have created it (or finished releasing it) while we
+	 * weren't looking. Subscribers found under the lock are never dying.
+	 */
+	subscriber = rhashtable_lookup_fast(&table->hash, &key, quota_params);
+	if (subscriber) {
+		error = subscriber_get(subscriber, max_bibs);
+		goto unlock;
+	}
+
+	subscriber = wkmalloc(struct quota_subscriber, GFP_ATOMIC);
+	if (!subscriber) {
+		error = -ENOMEM;
+		goto unlock;
+	}
+
+	subscriber->key = key;
+	atomic_set(&subscriber->bibs, 1);
+	atomic_set(&subscriber->sessions, 0);
+	error = rhashtable_insert_fast(&table->hash, &subscriber->hook,
+			quota_params);
+	if (error)
+		wkfree(struct quota_subscriber, subscriber);
+	/* Fall through */
+
+unlock:
+	spin_unlock_bh(&table->lock);
+end:
+	if (!error)
+		*result = subscriber;
+	return error;
+}
+
+/**
+ * Reverts a quota_get(). If it was the subscriber's last BIB entry, the
+ * subscriber is forgotten.
+ *
+ * (Lockless lookups might still be looking at the subscriber, so it's freed
+ * after a grace period. They will see a zero counter, and leave it alone.)
+ */
+void quota_put(struct quota_table *table, struct quota_subscriber *subscriber)
+{
+	/* Fast path: Not the last one, so the lock is not needed. */
+	if (atomic_add_unless(&subscriber->bibs, -1, 1))
+		return;
+
+	spin_lock_bh(&table->lock);
+	if (atomic_dec_and_test(&subscriber->bibs)) {
+		rhashtable_remove_fast(&table->hash, &subscriber->hook,
+				quota_params);
+		__wkfree_rcu("struct quota_subscriber", subscriber, rcu);
+	}
+	spin_unlock_bh(&table->lock);
+}
+
+/**
+ * Counts one more session against @subscriber, unless it already has @max
+ * (zero means no limit), in which case false is returned.
+ *
+ * @subscriber can be NULL (the BIB entry is not being counted), in which case
+ * this always succeeds.
+ */
+bool quota_session_add(struct quota_subscriber *subscriber, unsigned int max)
+{
+	int old, current_count;
+
+	if (!subscriber)
+		return true;
+	if (!max) {
+		atomic_inc(&subscriber->sessions);
+		return true;
+	}
+
+	/* Other shards can be adding sessions to the same subscriber. */
+	current_count = atomic_read(&subscriber->sessions);
+	do {
+		if ((unsigned int)current_count >= max)
+			return false;
+		old = current_count;
+		current_count = atomic_cmpxchg(&subscriber->sessions, old,
+				old + 1);
+	} while (current_count != old);
+
+	return true;
+}
+
+void quota_session_rm(struct quota_subscriber *subscriber, int count)
+{
+	if (subscriber)
+		atomic_sub(count, &subscriber->sessions);
+}
@@ -0,0 +1,67 @@
+#ifndef SRC_MOD_NAT64_BIB_QUOTA_H_
+#define SRC_MOD_NAT64_BIB_QUOTA_H_
+
+/**
+ * @file
+ * Per-subscriber quotas. A subscriber is a /quota-subscriber-length of IPv6
+ * source addresses. While quotas are enabled, every new dynamic BIB entry
+ * holds a reference to its subscriber, which counts the subscriber's BIB
+ * entries and sessions. This way, the limits can be checked without walking
+ * anything.
+ *
+ * Entries created while quotas were disabled don't count.
+ *
+ * Concurrency: Lookups are lockless (RCU), and the BIB entry counter doubles as
+ * the subscriber's reference counter, so quota_get() and quota_put() only need
+ * the table's lock when they create or release a subscriber. (The lock can be
+ * acquired while holding a BIB shard lock, but not the other way around.) The
+ * session counters are atomic, and need no locking either.
+ */
+
+#include <linux/atomic.h>
+#include <linux/rhashtable.h>
+#include <linux/spinlock.h>
+#include "common/types.h"
+
+struct quota_key {
+	/* The subscriber's prefix, with the host bits zeroed. */
+	struct in6_addr prefix;
+	/*
+	 * quota-subscriber-length, as it was when the subscriber was created.
+	 * (So subscribers created before and after a change don't mix.)
+	 */
+	__u32 len;
+};
+
+struct quota_subscriber {
+	struct quota_key key;
+	/**
+	 * Number of BIB entries (committed or not) that point to the
+	 * subscriber. The subscriber is released once this drops to zero, which
+	 * only happens while holding the table's lock.
+	 */
+	atomic_t bibs;
+	/** Number of sessions hanging from those BIB entries. */
+	atomic_t sessions;
+	struct rhash_head hook;
+	struct rcu_head rcu;
+};
+
+struct quota_table {
+	struct rhashtable hash;
+	/** Serializes subscriber creation and release. Lookups don't need it. */
+	spinlock_t lock;
+};
+
+int quota_table_init(struct quota_table *table);
+void quota_table_destroy(struct quota_table *table);
+
+int quota_get(struct quota_table *table, struct in6_addr const *addr,
+		unsigned int len, unsigned int max_bibs,
+		struct quota_subscriber **result);
+void quota_put(struct quota_table *table, struct quota_subscriber *subscriber);
+
+bool quota_session_add(struct quota_subscriber *subscriber, unsigned int max);
+void quota_session_rm(struct quota_subscriber *subscriber, int count);
+
+#endif /* SRC_MOD_NAT64_BIB_QUOTA_H_ */
@@ -93,6 +93,7 @@ int globals_init(struct jool_globals *config, xlator_type type,
 		config->nat64.drop_icmp6_info = DEFAULT_FILTER_ICMPV6_INFO;
 		config->nat64.src_icmp6errs_better = DEFAULT_SRC_ICMP6ERRS_BETTER;
 		config->nat64.f_args = DEFAULT_F_ARGS;
+		config->nat64.f_hash = DEFAULT_F_HASH;
 		config->nat64.handle_rst_during_fin_rcv = DEFAULT_HANDLE_FIN_RCV_RST;
 
 		config->nat64.bib.ttl.tcp_est = 1000 * TCP_EST;
@@ -101,9 +102,21 @@ int globals_init(struct jool_globals *config, xlator_type type,
 		config->nat64.bib.ttl.icmp = 1000 * ICMP_DEFAULT;
 		config->nat64.bib.bib_logging = DEFAULT_BIB_LOGGING;
 		config->nat64.bib.session_logging = DEFAULT_SESSION_LOGGING;
+		config->nat64.bib.binary_logging = DEFAULT_BINARY_LOGGING;
 		config->nat64.bib.drop_by_addr = DEFAULT_ADDR_DEPENDENT_FILTERING;
 		config->nat64.bib.drop_external_tcp = DEFAULT_DROP_EXTERNAL_CONNECTIONS;
 		config->nat64.bib.max_stored_pkts = DEFAULT_MAX_STORED_PKTS;
+		config->nat64.bib.refresh_granularity = 1000 * DEFAULT_REFRESH_GRANULARITY;
+		config->nat64.bib.pba_block_size = DEFAULT_PBA_BLOCK_SIZE;
+		config->nat64.bib.quota_subscriber_len = DEFAULT_QUOTA_SUBSCRIBER_LEN;
+		config->nat64.bib.max_bibs_per_subscriber = DEFAULT_MAX_BIBS_PER_SUBSCRIBER;
+		config->nat64.bib.max_sessions_per_subscriber = DEFAULT_MAX_SESSIONS_PER_SUBSCRIBER;
+		config->nat64.bib.max_sessions = DEFAULT_MAX_SESSIONS;
+		config->nat64.bib.pressure_timeouts = DEFAULT_PRESSURE_TIMEOUTS;
+
+		config->nat64.det.prefix.set = false;
+		config->nat64.det.subscriber_len = DEFAULT_DET_SUBSCRIBER_LEN;
+		config->nat64.det.block_size = DEFAULT_DET_BLOCK_SIZE;
 
 		config->nat64.joold.enabled = DEFAULT_JOOLD_ENABLED;
 		config->nat64.joold.flush_asap = false;
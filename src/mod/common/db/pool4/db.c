@@ -2,6 +2,8 @@
 
 #include <linux/hash.h>
 #include <linux/list.h>
+#include <linux/percpu.h>
+#include <linux/random.h>
 #include <linux/slab.h>
 
 #include "common/types.h"
@@ -20,12 +22,16 @@
  * Each table is made out of entries (struct ipv4_range).
  * Entries are roughly what the user --pool4 --added.
  *
- * There's also struct mask_domain, which is a copy of a table, and with
- * the ability to iterate through its entries' transport addresses easily.
- * So tables are the compact version meant for storage and need locking, domains
- * are more versatile, disposable, meant for outside use and don't need locking.
+ * Packets don't read the trees. Every change publishes an immutable copy of the
+ * mark trees (struct pool4_snapshot), in which each table is a sorted array
+ * (struct pool4_domain) that also knows where in the table's transport address
+ * count each of its entries begins. Packets read the snapshot through RCU.
  *
- * Only pool4 and mask_domain are public, and only in declaration form.
+ * There's also struct mask_domain, which is an iterator over a snapshot's
+ * domain. It is disposable, meant for outside use, and does not need to be
+ * allocated.
+ *
+ * Only pool4 and mask_domain are public. pool4 only in declaration form.
  *
  * Unlike the BIB, these terms haven't been documented in the user manual so
  * they can be changed. (I'm not so sure about "table" in particular. Other
@@ -86,77 +92,94 @@ struct pool4_trees {
 	struct rb_root icmp;
 };
 
+/**
+ * A mark-based table, frozen. (See struct pool4_snapshot.)
+ */
+struct pool4_domain {
+	__u32 mark;
+	unsigned int taddr_count;
+	/** compute_max_iterations(), precomputed. */
+	unsigned int max_iterations;
+
+	unsigned int range_count;
+	/** A copy of the table's entries. */
+	struct ipv4_range *ranges;
+	/**
+	 * offsets[i] is the number of transport addresses in ranges[0, i).
+	 * (ie. where ranges[i] starts, from the point of view of F().)
+	 */
+	unsigned int *offsets;
+};
+
+struct pool4_domains {
+	/** Sorted the same way as the corresponding mark tree. */
+	struct pool4_domain *array;
+	unsigned int count;
+};
+
+/**
+ * The mark trees, as seen by the translating packets.
+ *
+ * Snapshots are never modified. Every pool4 change publishes a new one, and the
+ * old one is released after an RCU grace period. The domains and their arrays
+ * all hang off the same allocation, after the struct.
+ */
+struct pool4_snapshot {
+	struct pool4_domains tcp;
+	struct pool4_domains udp;
+	struct pool4_domains icmp;
+	struct rcu_head rcu;
+};
+
 struct pool4 {
 	/** Entries indexed via mark. (Normally used in 6->4) */
 	struct pool4_trees tree_mark;
 	/** Entries indexed via address. (Normally used in 4->6) */
 	struct pool4_trees tree_addr;
 
-	spinlock_t lock;
-	struct kref refcounter;
-};
-
-struct mask_domain {
-	__u32 pool_mark;
-
-	unsigned int taddr_count;
-	unsigned int taddr_counter;
-	/* ITERATIONS_INFINITE is represented by this being zero. */
-	unsigned int max_iterations;
-
-	unsigned int range_count;
-	struct ipv4_range *current_range;
-	int current_port;
+	/**
+	 * Frozen copy of @tree_mark, for mask_domain_find().
+	 * NULL means pool4 is empty.
+	 * Writers need @lock, readers need RCU.
+	 */
+	struct pool4_snapshot __rcu *snapshot;
 
 	/**
-	 * A "dynamic" domain is one that was generated on the fly - that is,
-	 * Jool queried the interface addresses, picked one and used it to
-	 * improvise a domain.
+	 * From RFC 6056, algorithm 3.
+	 *
+	 * TODO (issue175) This is not perfect. According to the RFC, there
+	 * would ideally be one of these per `--f-args`-defined tuple, but
+	 * since that's not rational, we settle with one per CPU per instance.
+	 *
+	 * As far as the RFC is concerned, this is actually perfectly fine.
+	 * (The only purpose of `next_ephemeral` (as far as I can tell) is to
+	 * reduce looping for port allocations that share the `--f-args`
+	 * fields. This implementation definitely does that.) But this is only
+	 * because it doesn't care about gaming (see the giant note at
+	 * rfc6056.c). Sharing the counter puts a hamper on gaming because it
+	 * means unrelated traffic will separate the connections of a game's
+	 * client too much. This is, in fact, a natural problem of algorithm 3
+	 * (again, because the RFC doesn't care).
 	 *
-	 * A "static" domain is one the user predefined.
+	 * It's per-CPU so concurrent connection setup does not bounce a single
+	 * cache line around. (It used to be a module-wide atomic.) It's not
+	 * per-table because tables (and the snapshot's domains) come and go
+	 * without waiting for readers, and this needs to outlive them.
 	 *
-	 * Empty pool4 generates dynamic domains and populated ones generate
-	 * static domains.
+	 * Unsynchronized; a lost update only means a different starting point.
 	 */
-	bool dynamic;
+	unsigned int __percpu *next_ephemeral;
 
-	/*
-	 * An array of struct ipv4_range hangs off here.
-	 * (The array length is @sample_count.)
-	 */
+	spinlock_t lock;
+	struct kref refcounter;
 };
 
-/**
- * From RFC 6056, algorithm 3.
- *
- * TODO (issue175) This is not perfect. According to the RFC, there would
- * ideally be one of these per `--f-args`-defined tuple, but since that's not
- * rational, it settles with one per pool4 table.
- * This being a global variable, we're doing one per NAT64 kernel module. (Which
- * is even farther from the ideal.)
- *
- * As far as the RFC is concerned, this is actually perfectly fine. (The only
- * purpose of `next_ephemeral` (as far as I can tell) is to reduce looping for
- * port allocations that share the `--f-args` fields. This implementation
- * definitely does that.) But this is only because it doesn't care about gaming
- * (see the giant note at rfc6056.c). This being a global variable puts a hamper
- * on gaming because it means unrelated traffic will separate the connections of
- * a game's client too much. This is, in fact, a natural problem of algorithm 3
- * (again, because the RFC doesn't care), but we're making it worse.
- *
- * Because @next_ephemeral is needed during mask iteration, which does not have
- * access to the pool4 for significant locking/performance reasons, this is not
- * trivial to fix. I'm hoping (though haven't actually given it much thought)
- * that it will be more feasible once issue175 is implemented.
- */
-static atomic_t next_ephemeral = ATOMIC_INIT(0);
-
 /**
  * Assumes @domain has at least one entry.
  */
 #define foreach_domain_range(entry, domain) \
-	for (entry = first_domain_entry(domain); \
-			entry < first_domain_entry(domain) + domain->range_count; \
+	for (entry = (domain)->ranges; \
+			entry < (domain)->ranges + (domain)->range_count; \
 			entry++)
 
 static struct rb_root *get_tree(struct pool4_trees *trees, l4_protocol proto)
@@ -232,11 +255,6 @@ static struct ipv4_range *last_table_entry(struct pool4_table *table)
 	return first_table_entry(table) + table->sample_count - 1;
 }
 
-static struct ipv4_range *first_domain_entry(struct mask_domain *domain)
-{
-	return (struct ipv4_range *)(domain + 1);
-}
-
 /* Leaves table->addr and table->mark undefined! */
 static struct pool4_table *create_table(struct ipv4_range *range)
 {
@@ -263,17 +281,30 @@ static struct pool4_table *create_table(struct ipv4_range *range)
 struct pool4 *pool4db_alloc(void)
 {
 	struct pool4 *result;
+	int cpu;
 
 	result = wkmalloc(struct pool4, GFP_KERNEL);
 	if (!result)
 		return NULL;
 
+	result->next_ephemeral = alloc_percpu(unsigned int);
+	if (!result->next_ephemeral) {
+		wkfree(struct pool4, result);
+		return NULL;
+	}
+	/* Spread the CPUs so they don't start out probing the same ports. */
+	for_each_possible_cpu(cpu) {
+		get_random_bytes(per_cpu_ptr(result->next_ephemeral, cpu),
+				sizeof(unsigned int));
+	}
+
 	result->tree_mark.tcp = RB_ROOT;
 	result->tree_mark.udp = RB_ROOT;
 	result->tree_mark.icmp = RB_ROOT;
 	result->tree_addr.tcp = RB_ROOT;
 	result->tree_addr.udp = RB_ROOT;
 	result->tree_addr.icmp = RB_ROOT;
+	RCU_INIT_POINTER(result->snapshot, NULL);
 	spin_lock_init(&result->lock);
 	kref_init(&result->refcounter);
 
@@ -311,8 +342,15 @@ static void clear_trees(struct pool4 *pool)
 static void pool4db_release(struct kref *refcounter)
 {
 	struct pool4 *pool;
+	struct pool4_snapshot *snapshot;
+
 	pool = container_of(refcounter, struct pool4, refcounter);
 	clear_trees(pool);
+	/* No references means no readers. */
+	snapshot = rcu_dereference_protected(pool->snapshot, true);
+	if (snapshot)
+		__wkfree("pool4 snapshot", snapshot);
+	free_percpu(pool->next_ephemeral);
 	wkfree(struct pool4, pool);
 }
 
@@ -321,6 +359,125 @@ void pool4db_put(struct pool4 *pool)
 	kref_put(&pool->refcounter, pool4db_release);
 }
 
+static unsigned int compute_max_iterations(const struct pool4_table *table);
+
+static struct pool4_domains *get_domains(struct pool4_snapshot *snapshot,
+		l4_protocol proto)
+{
+	switch (proto) {
+	case L4PROTO_TCP:
+		return &snapshot->tcp;
+	case L4PROTO_UDP:
+		return &snapshot->udp;
+	case L4PROTO_ICMP:
+		return &snapshot->icmp;
+	case L4PROTO_OTHER:
+		break;
+	}
+
+	return NULL;
+}
+
+static void count_tree(struct rb_root *tree, unsigned int *tables,
+		unsigned int *ranges)
+{
+	struct rb_node *node;
+
+	for (node = rb_first(tree); node; node = rb_next(node)) {
+		(*tables)++;
+		*ranges += rb_entry(node, struct pool4_table, tree_hook)
+				->sample_count;
+	}
+}
+
+/* Where freeze_tree() should write next. */
+struct snapshot_cursor {
+	struct pool4_domain *domain;
+	struct ipv4_range *range;
+	unsigned int *offset;
+};
+
+static void freeze_tree(struct rb_root *tree, struct pool4_domains *domains,
+		struct snapshot_cursor *cursor)
+{
+	struct rb_node *node;
+	struct pool4_table *table;
+	struct pool4_domain *domain;
+	unsigned int offset;
+	unsigned int i;
+
+	domains->array = cursor->domain;
+	domains->count = 0;
+
+	for (node = rb_first(tree); node; node = rb_next(node)) {
+		table = rb_entry(node, struct pool4_table, tree_hook);
+
+		domain = cursor->domain++;
+		domain->mark = table->mark;
+		domain->taddr_count = table->taddr_count;
+		domain->max_iterations = compute_max_iterations(table);
+		domain->range_count = table->sample_count;
+		domain->ranges = cursor->range;
+		domain->offsets = cursor->offset;
+		cursor->range += table->sample_count;
+		cursor->offset += table->sample_count;
+
+		memcpy(domain->ranges, first_table_entry(table),
+				table->sample_count * sizeof(struct ipv4_range));
+		offset = 0;
+		for (i = 0; i < domain->range_count; i++) {
+			domain->offsets[i] = offset;
+			offset += port_range_count(&domain->ranges[i].ports);
+		}
+
+		domains->count++;
+	}
+}
+
+/*
+ * Replaces @pool's snapshot with a fresh copy of the mark trees.
+ * Needs @pool->lock.
+ */
+static int publish_snapshot(struct pool4 *pool)
+{
+	struct pool4_snapshot *old;
+	struct pool4_snapshot *new = NULL;
+	struct snapshot_cursor cursor;
+	unsigned int tables = 0;
+	unsigned int ranges = 0;
+
+	count_tree(&pool->tree_mark.tcp, &tables, &ranges);
+	count_tree(&pool->tree_mark.udp, &tables, &ranges);
+	count_tree(&pool->tree_mark.icmp, &tables, &ranges);
+
+	if (tables) {
+		new = __wkmalloc("pool4 snapshot", sizeof(struct pool4_snapshot)
+				+ tables * sizeof(struct pool4_domain)
+				+ ranges * sizeof(struct ipv4_range)
+				+ ranges * sizeof(unsigned int),
+				GFP_ATOMIC);
+		if (!new) {
+			log_err("Could not allocate the new pool4 snapshot. Translation will keep using the previous pool4 until the next successful change.");
+			return -ENOMEM;
+		}
+
+		cursor.domain = (struct pool4_domain *)(new + 1);
+		cursor.range = (struct ipv4_range *)(cursor.domain + tables);
+		cursor.offset = (unsigned int *)(cursor.range + ranges);
+		freeze_tree(&pool->tree_mark.tcp, &new->tcp, &cursor);
+		freeze_tree(&pool->tree_mark.udp, &new->udp, &cursor);
+		freeze_tree(&pool->tree_mark.icmp, &new->icmp, &cursor);
+	}
+
+	old = rcu_dereference_protected(pool->snapshot,
+			lockdep_is_held(&pool->lock));
+	rcu_assign_pointer(pool->snapshot, new);
+	if (old)
+		__wkfree_rcu("pool4 snapshot", old, rcu);
+
+	return 0;
+}
+
 static int max_iterations_validate(__u8 flags, __u32 iterations)
 {
 	bool automatic = flags & ITERATIONS_AUTO;
@@ -535,6 +692,7 @@ int pool4db_add(struct pool4 *pool, const struct pool4_entry *entry)
 	struct ipv4_range addend = { .ports = entry->range.ports };
 	u64 tmp;
 	int error;
+	int publish_error;
 
 	error = prefix4_validate(&entry->range.prefix);
 	if (error)
@@ -560,12 +718,17 @@ int pool4db_add(struct pool4 *pool, const struct pool4_entry *entry)
 		}
 		spin_unlock_bh(&pool->lock);
 		if (error)
-			return error;
+			break;
 	}
 
-	return 0;
+	/* Publish once per request; prefixes can span lots of addresses. */
+	spin_lock_bh(&pool->lock);
+	publish_error = publish_snapshot(pool);
+	spin_unlock_bh(&pool->lock);
+	return error ? error : publish_error;
 
 trainwreck:
+	publish_snapshot(pool);
 	spin_unlock_bh(&pool->lock);
 	/*
 	 * We're in a serious conundrum.
@@ -610,10 +773,11 @@ int pool4db_update(struct pool4 *pool, const struct pool4_update *update)
 	if (update->flags & ITERATIONS_SET) {
 		table->max_iterations_flags = update->flags;
 		table->max_iterations_allowed = update->iterations;
+		error = publish_snapshot(pool);
 	}
 
 	spin_unlock_bh(&pool->lock);
-	return 0;
+	return error;
 }
 
 static int remove_range(struct rb_root *tree, struct pool4_table *table,
@@ -755,6 +919,7 @@ int pool4db_rm(struct pool4 *pool, const __u32 mark, l4_protocol proto,
 		struct ipv4_range *range)
 {
 	int error;
+	int publish_error;
 
 	error = prefix4_validate(&range->prefix);
 	if (error)
@@ -767,9 +932,10 @@ int pool4db_rm(struct pool4 *pool, const __u32 mark, l4_protocol proto,
 	error = rm_from_mark_tree(pool, mark, proto, range);
 	if (!error)
 		error = rm_from_addr_tree(pool, proto, range);
+	publish_error = publish_snapshot(pool);
 
 	spin_unlock_bh(&pool->lock);
-	return error;
+	return error ? error : publish_error;
 }
 
 int pool4db_rm_usr(struct pool4 *pool, struct pool4_entry *entry)
@@ -781,6 +947,7 @@ void pool4db_flush(struct pool4 *pool)
 {
 	spin_lock_bh(&pool->lock);
 	clear_trees(pool);
+	publish_snapshot(pool); /* Empty snapshots don't allocate. */
 	spin_unlock_bh(&pool->lock);
 }
 
@@ -1041,155 +1208,254 @@ void pool4db_print(struct pool4 *pool)
 }
 
 static verdict find_empty(struct xlation *state, unsigned int offset,
-		struct mask_domain **out)
+		struct mask_domain *masks)
 {
-	struct mask_domain *masks;
 	struct ipv4_range *range;
 	verdict result;
 
-	masks = __wkmalloc("mask_domain",
-			sizeof(struct mask_domain) * sizeof(struct ipv4_range),
-			GFP_ATOMIC);
-	if (!masks)
-		return drop(state, JSTAT_ENOMEM);
-
-	range = (struct ipv4_range *)(masks + 1);
+	range = &masks->dynamic_range;
 	result = pool4empty_find(state, range);
-	if (result != VERDICT_CONTINUE) {
-		__wkfree("mask_domain", masks);
+	if (result != VERDICT_CONTINUE)
 		return result;
-	}
 
 	masks->pool_mark = 0;
 	masks->taddr_count = port_range_count(&range->ports);
 	masks->taddr_counter = 0;
+	masks->iterations = 0;
 	masks->max_iterations = 0;
+	masks->ranges = range;
+	masks->offsets = NULL;
 	masks->range_count = 1;
 	masks->current_range = range;
 	masks->current_port = range->ports.min + offset % masks->taddr_count;
 	masks->dynamic = true;
 
-	*out = masks;
 	return VERDICT_CONTINUE;
 }
 
-verdict mask_domain_find(struct xlation *state, struct mask_domain **out)
+static struct pool4_domain *find_domain(struct pool4_domains *domains,
+		__u32 mark)
 {
-	struct pool4 *pool;
-	struct pool4_table *table;
-	struct ipv4_range *entry;
-	struct mask_domain *masks;
-	unsigned int offset;
+	struct pool4_domain *domain;
+	unsigned int min;
+	unsigned int max;
+	int comparison;
 
-	if (rfc6056_f(state, &offset))
-		return drop(state, JSTAT_6056_F);
+	if (unlikely(!domains))
+		return NULL;
 
-	offset += atomic_read(&next_ephemeral);
+	/* Same order as the mark tree. (See cmp_mark().) */
+	min = 0;
+	max = domains->count;
+	while (min < max) {
+		domain = &domains->array[min + (max - min) / 2];
+		comparison = ((int)mark) - (int)domain->mark;
+		if (comparison < 0)
+			max = domain - domains->array;
+		else if (comparison > 0)
+			min = domain - domains->array + 1;
+		else
+			return domain;
+	}
 
-	pool = state->jool.nat64.pool4;
-	spin_lock_bh(&pool->lock);
+	return NULL;
+}
 
-	if (is_empty(pool)) {
-		spin_unlock_bh(&pool->lock);
-		return find_empty(state, offset, out);
+/*
+ * Returns the index of the range @offset lands on. That's the last range that
+ * starts before @offset, or the first one if there is none.
+ * (The off-by-one is mask_domain_next()'s; it starts by moving to the next
+ * port.)
+ */
+static unsigned int find_range(unsigned int const *offsets,
+		unsigned int range_count, unsigned int offset)
+{
+	unsigned int min = 0;
+	unsigned int max = range_count - 1;
+	unsigned int middle;
+
+	while (min < max) {
+		middle = min + (max - min + 1) / 2;
+		if (offsets[middle] < offset)
+			min = middle;
+		else
+			max = middle - 1;
 	}
 
-	table = find_by_mark(get_tree(&pool->tree_mark,
-			state->in.tuple.l4_proto),
-			state->in.skb->mark);
-	if (!table)
-		goto fail;
+	return min;
+}
 
-	masks = __wkmalloc("mask_domain", sizeof(struct mask_domain)
-			+ table->sample_count * sizeof(struct ipv4_range),
-			GFP_ATOMIC);
-	if (!masks)
-		goto fail;
+/**
+ * Initializes @masks as the set of transport addresses @state's packet can be
+ * masked with. (In deterministic mode, that's the port block of the packet's
+ * subscriber.)
+ *
+ * On success, the caller enters an RCU read-side critical section, which
+ * mask_domain_put() ends. (Packet translation already runs in one, so this
+ * only formalizes it.) On failure, there is nothing to put.
+ */
+verdict mask_domain_find(struct xlation *state, struct mask_domain *masks)
+{
+	struct pool4 *pool;
+	struct det_config const *det;
+	struct pool4_snapshot *snapshot;
+	struct pool4_domain *domain;
+	unsigned int offset;
+	__u32 subscriber;
+	unsigned int i;
+	verdict result;
 
-	memcpy(masks + 1, table + 1,
-			table->sample_count * sizeof(struct ipv4_range));
-	masks->taddr_count = table->taddr_count;
-	masks->max_iterations = compute_max_iterations(table);
-	masks->range_count = table->sample_count;
+	pool = state->jool->nat64.pool4;
+	det = &state->jool->globals.nat64.det;
+	masks->next_ephemeral = pool->next_ephemeral;
 
-	spin_unlock_bh(&pool->lock);
+	if (det->prefix.set) {
+		if (!det_subscriber_index(&det->prefix.prefix,
+				det->subscriber_len,
+				&state->in.tuple.src.addr6.l3, &subscriber))
+			return drop(state, JSTAT_DET_NOT_SUBSCRIBER);
+	} else {
+		if (rfc6056_f(state, &offset))
+			return drop(state, JSTAT_6056_F);
+		offset += this_cpu_read(*pool->next_ephemeral);
+	}
 
-	masks->pool_mark = state->in.skb->mark;
-	masks->taddr_counter = 0;
-	masks->dynamic = false;
-	offset %= masks->taddr_count;
+	rcu_read_lock();
 
-	foreach_domain_range(entry, masks) {
-		if (offset <= port_range_count(&entry->ports)) {
-			masks->current_range = entry;
-			masks->current_port = entry->ports.min + offset - 1;
-			*out = masks;
-			return VERDICT_CONTINUE; /* Happy path */
+	snapshot = rcu_dereference(pool->snapshot);
+	if (!snapshot) {
+		if (det->prefix.set) {
+			/* Interface addresses are too volatile for this. */
+			rcu_read_unlock();
+			return drop(state, JSTAT_DET_NO_BLOCK);
 		}
-		offset -= port_range_count(&entry->ports);
+		result = find_empty(state, offset, masks);
+		if (result != VERDICT_CONTINUE)
+			rcu_read_unlock();
+		return result;
 	}
 
-	WARN(true, "Bug: pool4 entry counter does not match entry count.");
-	__wkfree("mask_domain", masks);
-	return drop(state, JSTAT_UNKNOWN);
+	domain = find_domain(get_domains(snapshot, state->in.tuple.l4_proto),
+			state->in.skb->mark);
+	if (!domain) {
+		rcu_read_unlock();
+		return drop(state, JSTAT_MASK_DOMAIN_NOT_FOUND);
+	}
 
-fail:
-	spin_unlock_bh(&pool->lock);
-	return drop(state, JSTAT_MASK_DOMAIN_NOT_FOUND);
+	if (det->prefix.set) {
+		/*
+		 * RFC 7422: The n'th subscriber owns the n'th block of the
+		 * domain, and nothing else. (Blocks can straddle ranges.)
+		 */
+		if (subscriber >= domain->taddr_count / det->block_size) {
+			rcu_read_unlock();
+			return drop(state, JSTAT_DET_NO_BLOCK);
+		}
+		offset = subscriber * det->block_size;
+		masks->taddr_count = det->block_size;
+		masks->max_iterations = 0;
+	} else {
+		offset %= domain->taddr_count;
+		masks->taddr_count = domain->taddr_count;
+		masks->max_iterations = domain->max_iterations;
+	}
+	i = find_range(domain->offsets, domain->range_count, offset);
+
+	masks->pool_mark = state->in.skb->mark;
+	masks->taddr_counter = 0;
+	masks->iterations = 0;
+	masks->ranges = domain->ranges;
+	masks->offsets = domain->offsets;
+	masks->range_count = domain->range_count;
+	masks->current_range = &domain->ranges[i];
+	masks->current_port = masks->current_range->ports.min
+			+ (offset - domain->offsets[i]) - 1;
+	masks->dynamic = false;
+
+	return VERDICT_CONTINUE;
 }
 
 void mask_domain_put(struct mask_domain *masks)
 {
-	__wkfree("mask_domain", masks);
+	rcu_read_unlock();
 }
 
+/**
+ * Returns (in @addr) the next candidate from @masks that @find_free claims is
+ * available. Candidates @find_free skips are consumed, but they do not count as
+ * iterations; only the returned ones do. (Since @find_free is allowed to be
+ * wrong, the caller is expected to double-check the result.)
+ *
+ * Returns -ENOENT once the domain or the iterations run out.
+ */
 int mask_domain_next(struct mask_domain *masks,
-		struct ipv4_transport_addr *addr,
-		bool *consecutive)
+		mask_domain_find_free_cb find_free, void *arg,
+		struct ipv4_transport_addr *addr)
 {
-	masks->taddr_counter++;
-	if (masks->taddr_counter > masks->taddr_count)
-		return -ENOENT;
+	unsigned int min;
+	unsigned int max;
+	unsigned int remaining;
+	int port;
+
 	if (masks->max_iterations)
-		if (masks->taddr_counter > masks->max_iterations)
+		if (masks->iterations >= masks->max_iterations)
 			return -ENOENT;
 
-	masks->current_port++;
-	if (masks->current_port > masks->current_range->ports.max) {
-		*consecutive = false;
-		masks->current_range++;
-		if (masks->current_range >= first_domain_entry(masks) + masks->range_count)
-			masks->current_range = first_domain_entry(masks);
-		masks->current_port = masks->current_range->ports.min;
-	} else {
-		*consecutive = (masks->taddr_counter != 1);
+	while (masks->taddr_counter < masks->taddr_count) {
+		if (masks->current_port >= masks->current_range->ports.max) {
+			masks->current_range++;
+			if (masks->current_range >= masks->ranges + masks->range_count)
+				masks->current_range = masks->ranges;
+			masks->current_port = masks->current_range->ports.min - 1;
+		}
+
+		/* The stretch of the current range we haven't visited yet. */
+		min = masks->current_port + 1;
+		max = masks->current_range->ports.max;
+		remaining = masks->taddr_count - masks->taddr_counter;
+		if (max - min >= remaining)
+			max = min + remaining - 1;
+
+		port = find_free(arg, &masks->current_range->prefix.addr,
+				min, max);
+		if (port < 0) {
+			masks->taddr_counter += max - min + 1;
+			masks->current_port = max;
+			continue;
+		}
+
+		masks->taddr_counter += port - min + 1;
+		masks->current_port = port;
+		masks->iterations++;
+
+		addr->l3 = masks->current_range->prefix.addr;
+		addr->l4 = port;
+		return 0;
 	}
 
-	addr->l3 = masks->current_range->prefix.addr;
-	addr->l4 = masks->current_port;
-	return 0;
+	return -ENOENT;
 }
 
 /*
- * According to the kernel, adding to an atomic integer is "much slower"
- * (https://elixir.bootlin.com/linux/v5.0/source/arch/alpha/include/asm/atomic.h#L13)
- * than adding to a normal integer. That's why this function exists: We add once
- * when the loop is over instead of every time mask_domain_next() is called.
+ * We add once when the loop is over instead of every time mask_domain_next() is
+ * called.
  *
  * Now, this does mean that retrievals of @next_ephemeral that happen
  * concurrent to the loop will not get the maybe intended value, but RFC 6056 is
- * silent about what is actually supposed to happen in these cases. Also, I'm
- * probably micro-optimizing at this point.
+ * silent about what is actually supposed to happen in these cases.
+ *
+ * (The CPU might not be the one mask_domain_find() ran on, if we were
+ * preempted. That's fine too.)
  */
 void mask_domain_commit(struct mask_domain *masks)
 {
-	atomic_add(masks->taddr_counter, &next_ephemeral);
+	this_cpu_add(*masks->next_ephemeral, masks->taddr_counter);
 }
 
 bool mask_domain_matches(struct mask_domain *masks,
 		struct ipv4_transport_addr *addr)
 {
-	struct ipv4_range *entry;
+	struct ipv4_range const *entry;
 
 	foreach_domain_range(entry, masks) {
 		if (entry->prefix.addr.s_addr != addr->l3.s_addr)
@@ -1210,3 +1476,54 @@ __u32 mask_domain_get_mark(struct mask_domain *masks)
 {
 	return masks->pool_mark;
 }
+
+/**
+ * Returns the number of whole @block_size blocks @masks can be split into.
+ * Dynamic domains are never split (interface addresses are too volatile for
+ * that), so they always return zero.
+ *
+ * Assumes @masks has not been narrowed.
+ */
+unsigned int mask_domain_block_count(struct mask_domain *masks,
+		unsigned int block_size)
+{
+	if (masks->dynamic || block_size == 0)
+		return 0;
+	return masks->taddr_count / block_size;
+}
+
+/**
+ * Restricts @masks to the @count transport addresses that start at @offset
+ * (which are assumed to exist), and rewinds it to the first of them.
+ * Only legal on static domains, and before mask_domain_next().
+ */
+void mask_domain_narrow(struct mask_domain *masks, unsigned int offset,
+		unsigned int count)
+{
+	unsigned int i;
+
+	i = find_range(masks->offsets, masks->range_count, offset);
+
+	masks->taddr_count = count;
+	masks->taddr_counter = 0;
+	masks->iterations = 0;
+	masks->max_iterations = 0;
+	masks->current_range = &masks->ranges[i];
+	masks->current_port = masks->current_range->ports.min
+			+ (offset - masks->offsets[i]) - 1;
+}
+
+/**
+ * Returns (in @result) the transport address that sits at position @offset of
+ * static domain @masks.
+ */
+void mask_domain_taddr(struct mask_domain *masks, unsigned int offset,
+		struct ipv4_transport_addr *result)
+{
+	unsigned int i;
+
+	i = find_range(masks->offsets, masks->range_count, offset + 1);
+
+	result->l3 = masks->ranges[i].prefix.addr;
+	result->l4 = masks->ranges[i].ports.min + (offset - masks->offsets[i]);
+}
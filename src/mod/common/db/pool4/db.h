@@ -8,6 +8,7 @@
  */
 
 #include <linux/net.h>
+#include <linux/rcupdate.h>
 #include "common/config.h"
 #include "mod/common/route.h"
 #include "mod/common/translation_state.h"
@@ -42,19 +43,74 @@ int pool4db_foreach_sample(struct pool4 *pool, l4_protocol proto,
 		pool4db_foreach_entry_cb cb, void *arg,
 		struct pool4_entry *offset);
 
-struct mask_domain;
+/*
+ * An iterator over the transport addresses a packet is allowed to be masked
+ * with. (ie. over the pool4 table that matches its mark and protocol.)
+ *
+ * Allocate it wherever you want; mask_domain_find() initializes it. The fields
+ * are private to pool4.
+ */
+struct mask_domain {
+	__u32 pool_mark;
+
+	unsigned int taddr_count;
+	/** Number of candidates consumed so far. (See mask_domain_next().) */
+	unsigned int taddr_counter;
+	/** Number of candidates returned so far. */
+	unsigned int iterations;
+	/** pool4's cursor; mask_domain_commit() adds @taddr_counter to it. */
+	unsigned int __percpu *next_ephemeral;
+	/* ITERATIONS_INFINITE is represented by this being zero. */
+	unsigned int max_iterations;
+
+	/* Points to pool4's snapshot, or to @dynamic_range. */
+	struct ipv4_range const *ranges;
+	/* The snapshot's prefix sums of @ranges. NULL in dynamic domains. */
+	unsigned int const *offsets;
+	unsigned int range_count;
+	struct ipv4_range const *current_range;
+	int current_port;
+
+	/**
+	 * A "dynamic" domain is one that was generated on the fly - that is,
+	 * Jool queried the interface addresses, picked one and used it to
+	 * improvise a domain.
+	 *
+	 * A "static" domain is one the user predefined.
+	 *
+	 * Empty pool4 generates dynamic domains and populated ones generate
+	 * static domains.
+	 */
+	bool dynamic;
+	/** The only range of a dynamic domain. */
+	struct ipv4_range dynamic_range;
+};
 
-verdict mask_domain_find(struct xlation *state, struct mask_domain **out);
+/*
+ * Returns the lowest port in [@min, @max] (from @addr) that is available, or a
+ * negative error code if there is none.
+ */
+typedef int (*mask_domain_find_free_cb)(void *arg, struct in_addr const *addr,
+		unsigned int min, unsigned int max);
+
+verdict mask_domain_find(struct xlation *state, struct mask_domain *masks);
 void mask_domain_put(struct mask_domain *masks);
 int mask_domain_next(struct mask_domain *masks,
-		struct ipv4_transport_addr *addr,
-		bool *consecutive);
+		mask_domain_find_free_cb find_free, void *arg,
+		struct ipv4_transport_addr *addr);
 void mask_domain_commit(struct mask_domain *masks);
 bool mask_domain_matches(struct mask_domain *masks,
 		struct ipv4_transport_addr *addr);
 bool mask_domain_is_dynamic(struct mask_domain *masks);
 __u32 mask_domain_get_mark(struct mask_domain *masks);
 
+unsigned int mask_domain_block_count(struct mask_domain *masks,
+		unsigned int block_size);
+void mask_domain_narrow(struct mask_domain *masks, unsigned int offset,
+		unsigned int count);
+void mask_domain_taddr(struct mask_domain *masks, unsigned int offset,
+		struct ipv4_transport_addr *result);
+
 /*
  * Test functions (Illegal in production code)
  */
@@ -42,7 +42,7 @@ verdict pool4empty_find(struct xlation *state, struct ipv4_range *range)
 {
 	verdict result;
 
-	if (__rfc6052_6to4(&state->jool.globals.pool6.prefix,
+	if (__rfc6052_6to4(&state->jool->globals.pool6.prefix,
 			&state->in.tuple.dst.addr6.l3,
 			&state->out.tuple.dst.addr4.l3))
 		return untranslatable(state, JSTAT_UNTRANSLATABLE_DST6);
@@ -1,6 +1,7 @@
 #include "mod/common/db/pool4/rfc6056.h"
 
 #include <crypto/hash.h>
+#include <linux/siphash.h>
 #include "mod/common/linux_version.h"
 #include "mod/common/log.h"
 #include "mod/common/wkmalloc.h"
@@ -52,6 +53,12 @@
  * But nobody cares, probably, so this would be a lot of work for nothing.
  * 3 remains the winner for me.
  *
+ * F() itself used to be MD5 only, computed through the crypto API. That meant
+ * a descriptor allocation and several indirect calls per new connection, which
+ * shows up during connection floods. SipHash is just as keyed (and was designed
+ * for precisely this sort of job), but it runs on the stack. MD5 remains
+ * available through the f-hash global.
+ *
  * Also, I wonder if this whole gaming gimmic is that much of a factor. Do
  * servers really expect clients to maintain consistent IP addresses when NAT44
  * is so pervasive in today's Internet? Also, it's perfectly legal for
@@ -68,6 +75,7 @@
  */
 static unsigned char *secret_key;
 static size_t secret_key_len;
+static siphash_key_t siphash_key;
 
 /*
  * It looks like this does not require a spinlock either:
@@ -90,6 +98,7 @@ int rfc6056_setup(void)
 	if (!secret_key)
 		return -ENOMEM;
 	get_random_bytes(secret_key, secret_key_len);
+	get_random_bytes(&siphash_key, sizeof(siphash_key));
 
 	/* TFC stuff */
 	shash = crypto_alloc_shash("md5", 0, CRYPTO_ALG_ASYNC);
@@ -143,14 +152,7 @@ static int hash_tuple(struct shash_desc *desc, __u8 fields,
 	return crypto_shash_update(desc, secret_key, secret_key_len);
 }
 
-/**
- * RFC 6056, Algorithm 3. Returns a hash out of some of @tuple's fields.
- *
- * Just to clarify: Because our port pool is a somewhat complex data structure
- * (rather than a simple range), ephemerals are now handled by pool4. This
- * function has been stripped now to only consist of F(). (Hence the name.)
- */
-int rfc6056_f(struct xlation *state, unsigned int *result)
+static int f_md5(struct xlation *state, unsigned int *result)
 {
 	union {
 		__be32 as32[4];
@@ -176,7 +178,7 @@ int rfc6056_f(struct xlation *state, unsigned int *result)
 		goto end;
 	}
 
-	error = hash_tuple(desc, state->jool.globals.nat64.f_args,
+	error = hash_tuple(desc, state->jool->globals.nat64.f_args,
 			&state->in.tuple);
 	if (error) {
 		log_debug(state, "crypto_hash_update() error: %d", error);
@@ -196,3 +198,43 @@ end:
 	__wkfree("shash desc", desc);
 	return error;
 }
+
+static unsigned int f_siphash(__u8 fields, const struct tuple *tuple6)
+{
+	/* The fields @fields excludes are left as zero. */
+	struct {
+		struct in6_addr src_addr;
+		struct in6_addr dst_addr;
+		__u16 src_port;
+		__u16 dst_port;
+	} __aligned(SIPHASH_ALIGNMENT) input;
+
+	memset(&input, 0, sizeof(input));
+	if (fields & F_ARGS_SRC_ADDR)
+		input.src_addr = tuple6->src.addr6.l3;
+	if (fields & F_ARGS_SRC_PORT)
+		input.src_port = tuple6->src.addr6.l4;
+	if (fields & F_ARGS_DST_ADDR)
+		input.dst_addr = tuple6->dst.addr6.l3;
+	if (fields & F_ARGS_DST_PORT)
+		input.dst_port = tuple6->dst.addr6.l4;
+
+	return (unsigned int)siphash(&input, sizeof(input), &siphash_key);
+}
+
+/**
+ * RFC 6056, Algorithm 3. Returns a hash out of some of @tuple's fields.
+ *
+ * Just to clarify: Because our port pool is a somewhat complex data structure
+ * (rather than a simple range), ephemerals are now handled by pool4. This
+ * function has been stripped now to only consist of F(). (Hence the name.)
+ */
+int rfc6056_f(struct xlation *state, unsigned int *result)
+{
+	if (state->jool->globals.nat64.f_hash == F_HASH_MD5)
+		return f_md5(state, result);
+
+	*result = f_siphash(state->jool->globals.nat64.f_args,
+			&state->in.tuple);
+	return 0;
+}
@@ -14,6 +14,6 @@ void treeslot_init(struct tree_slot *slot,
 
 void treeslot_commit(struct tree_slot *slot)
 {
-	rb_link_node(slot->entry, slot->parent, slot->rb_link);
+	rb_link_node_rcu(slot->entry, slot->parent, slot->rb_link);
 	rb_insert_color(slot->entry, slot->tree);
 }
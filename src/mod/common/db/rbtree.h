@@ -9,6 +9,7 @@
  */
 
 #include <linux/rbtree.h>
+#include <linux/rcupdate.h>
 
 /**
  * rbtree_find - Stock search on a Red-Black tree.
@@ -42,6 +43,39 @@
 		result; \
 	})
 
+/**
+ * rbtree_find_rcu - rbtree_find(), except it does not need the writers' lock.
+ * Has to be called inside of an RCU read-side critical section, and the tree's
+ * nodes have to be freed through RCU.
+ *
+ * A concurrent rebalance can make the search miss an existing node (it will
+ * not crash nor loop forever, though), so the result can only be trusted if
+ * the caller can prove that the tree did not change during the search. (eg.
+ * through a seqcount.)
+ */
+#define rbtree_find_rcu(expected, root, compare_fn, type, hook_name) \
+	({ \
+		type *result = NULL; \
+		struct rb_node *node; \
+		\
+		node = rcu_dereference_raw((root)->rb_node); \
+		while (node) { \
+			type *entry = rb_entry(node, type, hook_name); \
+			int comparison = compare_fn(entry, expected); \
+			\
+			if (comparison < 0) { \
+				node = rcu_dereference_raw(node->rb_right); \
+			} else if (comparison > 0) { \
+				node = rcu_dereference_raw(node->rb_left); \
+			} else { \
+				result = entry; \
+				break; \
+			} \
+		} \
+		\
+		result; \
+	})
+
 /**
  * rbtree_add - Add a node to a Red-Black tree.
  *
@@ -130,7 +164,10 @@ struct tree_slot {
 void treeslot_init(struct tree_slot *slot,
 		struct rb_root *tree,
 		struct rb_node *entry);
-/** Adds @slot's node to the tree. Also rebalances while it's at it. */
+/**
+ * Adds @slot's node to the tree. Also rebalances while it's at it.
+ * The node is published in a way that is safe for rbtree_find_rcu().
+ */
 void treeslot_commit(struct tree_slot *slot);
 
 /**
@@ -8,12 +8,12 @@ static int get_pool_address(struct xlation *state, struct in_addr *result)
 	struct ipv4_prefix *pool;
 	__u32 n; /* We are going to return the "n"th address. */
 
-	if (state->jool.globals.siit.randomize_error_addresses)
+	if (state->jool->globals.siit.randomize_error_addresses)
 		get_random_bytes(&n, sizeof(n));
 	else
 		n = pkt_ip6_hdr(&state->in)->hop_limit;
 
-	pool = &state->jool.globals.siit.rfc6791_prefix4.prefix;
+	pool = &state->jool->globals.siit.rfc6791_prefix4.prefix;
 	n &= ~get_prefix4_mask(pool);
 	result->s_addr = cpu_to_be32(be32_to_cpu(pool->addr.s_addr) | n);
 
@@ -35,7 +35,7 @@ static int get_host_address(struct in_addr *result)
 
 int rfc6791v4_find(struct xlation *state, struct in_addr *result)
 {
-	return state->jool.globals.siit.rfc6791_prefix4.set
+	return state->jool->globals.siit.rfc6791_prefix4.set
 			? get_pool_address(state, result)
 			: get_host_address(result);
 }
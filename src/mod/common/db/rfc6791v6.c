@@ -15,10 +15,10 @@ static int get_pool_address(struct xlation *state, struct in6_addr *result)
 	size_t host_bytes_num;
 	__u8 randomized_byte;
 
-	if (!state->jool.globals.siit.rfc6791_prefix6.set)
+	if (!state->jool->globals.siit.rfc6791_prefix6.set)
 		return -EINVAL;
 
-	prefix = &state->jool.globals.siit.rfc6791_prefix6.prefix;
+	prefix = &state->jool->globals.siit.rfc6791_prefix6.prefix;
 
 	segment_bytes_num = prefix->len >> 3; /* >> 3 = / 8 */
 	modulus = prefix->len & 7; /* & 7 = % 8 */
@@ -0,0 +1,339 @@
+#include "mod/common/evlog.h"
+
+#include <linux/kref.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
+#include <net/genetlink.h>
+
+#include "common/constants.h"
+#include "common/xlat.h"
+#include "mod/common/log.h"
+#include "mod/common/stats.h"
+#include "mod/common/wkmalloc.h"
+#include "mod/common/nl/nl_handler.h"
+
+/* Must be a power of two. */
+#define EVLOG_RING_SIZE 512
+#define EVLOG_RING_MASK (EVLOG_RING_SIZE - 1)
+/* The drain is scheduled as soon as a ring has this many events queued. */
+#define EVLOG_BATCH 64
+/* Maximum number of events per Netlink message. */
+#define EVLOG_MSG_EVENTS 64
+#define EVLOG_MSG_SIZE (JOOLNL_HDRLEN \
+		+ nla_total_size(EVLOG_MSG_EVENTS * sizeof(struct jool_event)))
+
+/*
+ * Single producer (the ring's CPU, with bottom halves disabled), single
+ * consumer (the drain work). @head and @tail run freely; they are only masked
+ * when indexing @events.
+ */
+struct evlog_ring {
+	/* Written by the producer only. */
+	unsigned int head;
+	/* Written by the consumer only. */
+	unsigned int tail;
+	struct jool_event events[EVLOG_RING_SIZE];
+};
+
+struct evlog {
+	/*
+	 * One per possible CPU. They are allocated by evlog_enable() (ie. once
+	 * binary logging is first enabled), so instances that don't log don't
+	 * pay for them, and the packet path never allocates.
+	 */
+	struct evlog_ring * __percpu *rings;
+
+	/* Where the events are multicasted, and on behalf of which instance. */
+	struct net *ns;
+	char iname[INAME_MAX_SIZE];
+
+	struct work_struct drain;
+	/* The instance is gone; @ns might be too. Stop sending. */
+	bool stopped;
+
+	struct kref refs;
+};
+
+static struct workqueue_struct *wq;
+
+int evlog_setup(void)
+{
+	wq = alloc_workqueue("jool_evlog", WQ_UNBOUND, 0);
+	return wq ? 0 : -ENOMEM;
+}
+
+/**
+ * This function should be always called *after* all instances are gone.
+ */
+void evlog_teardown(void)
+{
+	destroy_workqueue(wq);
+}
+
+static void evlog_release(struct kref *refs)
+{
+	struct evlog *evlog;
+	unsigned int cpu;
+
+	evlog = container_of(refs, struct evlog, refs);
+
+	for_each_possible_cpu(cpu) {
+		if (*per_cpu_ptr(evlog->rings, cpu))
+			wkfree(struct evlog_ring, *per_cpu_ptr(evlog->rings, cpu));
+	}
+	free_percpu(evlog->rings);
+	wkfree(struct evlog, evlog);
+}
+
+void evlog_get(struct evlog *evlog)
+{
+	kref_get(&evlog->refs);
+}
+
+void evlog_put(struct evlog *evlog)
+{
+	kref_put(&evlog->refs, evlog_release);
+}
+
+static struct sk_buff *create_msg(struct evlog *evlog, unsigned int count,
+		struct jool_event **events)
+{
+	struct sk_buff *skb;
+	struct joolnlhdr *jhdr;
+	struct nlattr *attr;
+
+	skb = genlmsg_new(EVLOG_MSG_SIZE, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	jhdr = genlmsg_put(skb, 0, 0, jnl_family(), 0, 0);
+	if (WARN(!jhdr, "genlmsg_put() returned NULL"))
+		goto fail;
+
+	memset(jhdr, 0, sizeof(*jhdr));
+	memcpy(jhdr->magic, JOOLNL_HDR_MAGIC, JOOLNL_HDR_MAGIC_LEN);
+	jhdr->version = cpu_to_be32(xlat_version());
+	jhdr->xt = XT_NAT64;
+	memcpy(jhdr->iname, evlog->iname, INAME_MAX_SIZE);
+
+	attr = nla_reserve(skb, JNLAR_EVENTS,
+			count * sizeof(struct jool_event));
+	if (WARN(!attr, "nla_reserve() returned NULL"))
+		goto fail;
+
+	genlmsg_end(skb, jhdr);
+	*events = nla_data(attr);
+	return skb;
+
+fail:
+	kfree_skb(skb);
+	return NULL;
+}
+
+static void drain_ring(struct evlog *evlog, struct evlog_ring *ring)
+{
+	struct sk_buff *skb;
+	struct jool_event *events;
+	unsigned int head, tail;
+	unsigned int count, i;
+
+	tail = ring->tail;
+	head = smp_load_acquire(&ring->head);
+
+	while (head != tail) {
+		count = min(head - tail, (unsigned int)EVLOG_MSG_EVENTS);
+
+		/*
+		 * If this fails, the events stay in the ring; the next drain
+		 * will retry.
+		 */
+		skb = create_msg(evlog, count, &events);
+		if (!skb)
+			return;
+
+		for (i = 0; i < count; i++)
+			events[i] = ring->events[(tail + i) & EVLOG_RING_MASK];
+		tail += count;
+		/* Hand the slots back to the producer. */
+		smp_store_release(&ring->tail, tail);
+
+		/*
+		 * -ESRCH just means nobody is listening. Subscribers that can't
+		 * keep up find out through their own sockets (ENOBUFS).
+		 */
+		genlmsg_multicast_netns(jnl_family(), evlog->ns, skb, 0,
+				JNL_GROUP_EVENTS, GFP_KERNEL);
+	}
+}
+
+/* Discards everything; used once the instance is gone. */
+static void empty_ring(struct evlog_ring *ring)
+{
+	smp_store_release(&ring->tail, smp_load_acquire(&ring->head));
+}
+
+static void drain(struct work_struct *work)
+{
+	struct evlog *evlog;
+	struct evlog_ring *ring;
+	unsigned int cpu;
+
+	evlog = container_of(work, struct evlog, drain);
+
+	for_each_possible_cpu(cpu) {
+		ring = smp_load_acquire(per_cpu_ptr(evlog->rings, cpu));
+		if (!ring)
+			continue;
+		if (READ_ONCE(evlog->stopped))
+			empty_ring(ring);
+		else
+			drain_ring(evlog, ring);
+	}
+
+	/* See schedule_drain(). */
+	evlog_put(evlog);
+}
+
+static void schedule_drain(struct evlog *evlog)
+{
+	/* The work holds a reference, so it can outlive the instance. */
+	evlog_get(evlog);
+	if (!queue_work(wq, &evlog->drain))
+		evlog_put(evlog);
+}
+
+/**
+ * evlog_alloc - Constructor for evlog structs.
+ *
+ * @ns and @iname identify the instance whose events will be sent.
+ */
+struct evlog *evlog_alloc(struct net *ns, char *iname)
+{
+	struct evlog *evlog;
+
+	evlog = wkmalloc(struct evlog, GFP_KERNEL);
+	if (!evlog)
+		return NULL;
+
+	evlog->rings = alloc_percpu(struct evlog_ring *);
+	if (!evlog->rings) {
+		wkfree(struct evlog, evlog);
+		return NULL;
+	}
+
+	evlog->ns = ns;
+	memcpy(evlog->iname, iname, INAME_MAX_SIZE);
+	INIT_WORK(&evlog->drain, drain);
+	evlog->stopped = false;
+	kref_init(&evlog->refs);
+
+	return evlog;
+}
+
+/**
+ * Called when the instance dies (as opposed to being replaced). Pending events
+ * are discarded, and no more messages will be sent to the namespace.
+ * Can sleep.
+ */
+void evlog_stop(struct evlog *evlog)
+{
+	WRITE_ONCE(evlog->stopped, true);
+	flush_work(&evlog->drain);
+}
+
+/**
+ * Allocates the rings, unless they already exist. Needs to succeed before
+ * binary logging is enabled, because evlog_add() drops the events of CPUs that
+ * lack a ring.
+ *
+ * Can sleep. Calls need to be serialized.
+ */
+int evlog_enable(struct evlog *evlog)
+{
+	struct evlog_ring **slot;
+	struct evlog_ring *ring;
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		slot = per_cpu_ptr(evlog->rings, cpu);
+		if (*slot)
+			continue;
+
+		ring = wkmalloc(struct evlog_ring, GFP_KERNEL);
+		if (!ring)
+			return -ENOMEM;
+		ring->head = 0;
+		ring->tail = 0;
+		/* Publish the ring to the producer and the drain. */
+		smp_store_release(slot, ring);
+	}
+
+	return 0;
+}
+
+/**
+ * Queues @event (whose type will be @type) for userspace. Stamps the time.
+ *
+ * Never sleeps, never prints. If the current CPU's queue is full, the event is
+ * dropped and counted.
+ */
+void evlog_add(struct xlator *jool, enum jool_event_type type,
+		struct jool_event *event)
+{
+	struct evlog *evlog = jool->nat64.evlog;
+	struct evlog_ring *ring;
+	unsigned int head, tail;
+
+	event->time = cpu_to_be64(ktime_to_ms(ktime_get_real()));
+	event->type = type;
+
+	/* Keep everyone else in this CPU away from the ring. */
+	local_bh_disable();
+
+	ring = smp_load_acquire(this_cpu_ptr(evlog->rings));
+	if (unlikely(!ring))
+		goto drop;
+
+	head = ring->head;
+	tail = smp_load_acquire(&ring->tail);
+	if (head - tail >= EVLOG_RING_SIZE)
+		goto drop;
+
+	ring->events[head & EVLOG_RING_MASK] = *event;
+	/* Publish the event to the drain. */
+	smp_store_release(&ring->head, head + 1);
+
+	local_bh_enable();
+
+	jstat_inc(jool->stats, JSTAT_EVLOG_QUEUED);
+	/*
+	 * The queue's length only grows one at a time, so it can't skip this
+	 * value on its way up.
+	 */
+	if (head + 1 - tail == EVLOG_BATCH)
+		schedule_drain(evlog);
+	return;
+
+drop:
+	local_bh_enable();
+	jstat_inc(jool->stats, JSTAT_EVLOG_DROPPED);
+}
+
+/**
+ * Sends whatever is queued, even if the batches aren't full.
+ * (So that quiet periods don't leave events sitting in the rings.)
+ */
+void evlog_flush(struct xlator *jool)
+{
+	struct evlog *evlog = jool->nat64.evlog;
+	struct evlog_ring *ring;
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		ring = smp_load_acquire(per_cpu_ptr(evlog->rings, cpu));
+		if (ring && READ_ONCE(ring->head) != READ_ONCE(ring->tail)) {
+			schedule_drain(evlog);
+			return;
+		}
+	}
+}
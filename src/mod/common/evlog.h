@@ -0,0 +1,31 @@
+#ifndef SRC_MOD_COMMON_EVLOG_H_
+#define SRC_MOD_COMMON_EVLOG_H_
+
+/**
+ * @file
+ * The binary event log. (See logging-binary.)
+ *
+ * Events are queued in lock-free per-CPU rings by the translation path, and
+ * multicasted to userspace (through the events group) in batches, by a work
+ * item. Nothing here ever prints.
+ */
+
+#include "common/event.h"
+#include "mod/common/xlator.h"
+
+struct evlog;
+
+int evlog_setup(void);
+void evlog_teardown(void);
+
+struct evlog *evlog_alloc(struct net *ns, char *iname);
+void evlog_get(struct evlog *evlog);
+void evlog_put(struct evlog *evlog);
+void evlog_stop(struct evlog *evlog);
+int evlog_enable(struct evlog *evlog);
+
+void evlog_add(struct xlator *jool, enum jool_event_type type,
+		struct jool_event *event);
+void evlog_flush(struct xlator *jool);
+
+#endif /* SRC_MOD_COMMON_EVLOG_H_ */
@@ -3,6 +3,7 @@
 #include <linux/module.h>
 
 #include "mod/common/atomic_config.h"
+#include "mod/common/evlog.h"
 #include "mod/common/joold.h"
 #include "mod/common/log.h"
 #include "mod/common/timer.h"
@@ -32,10 +33,12 @@ static int setup_common_modules(void)
 	error = rfc6056_setup();
 	if (error)
 		goto rfc6056_fail;
-	/* TODO (performance) SIIT-only shouldn't need to pay for this; move. */
 	error = jtimer_setup();
 	if (error)
 		goto jtimer_fail;
+	error = evlog_setup();
+	if (error)
+		goto evlog_fail;
 
 	/* Common */
 	error = xlation_setup();
@@ -59,6 +62,8 @@ nlhandler_fail:
 xlator_fail:
 	xlation_teardown();
 xlation_fail:
+	evlog_teardown();
+evlog_fail:
 	jtimer_teardown();
 jtimer_fail:
 	rfc6056_teardown();
@@ -80,6 +85,7 @@ static void teardown_common_modules(void)
 	atomconfig_teardown();
 
 	/* NAT64 */
+	evlog_teardown();
 	jtimer_teardown();
 	rfc6056_teardown();
 	joold_teardown();
@@ -4,9 +4,11 @@
 #include <linux/netfilter_ipv4.h>
 #include <linux/netfilter_ipv6.h>
 #include "common/config.h"
+#include "mod/common/linux_version.h"
 
 #ifndef XTABLES_DISABLED
 #include <linux/netfilter/x_tables.h>
+#include "common/iptables.h"
 #endif
 
 unsigned int hook_ipv6(void *priv, struct sk_buff *skb,
@@ -16,7 +18,18 @@ unsigned int hook_ipv4(void *priv, struct sk_buff *skb,
 
 #ifndef XTABLES_DISABLED
 
+/*
+ * Keeps the kernel-only part of struct target_info away from userspace.
+ * (xt_target.usersize was introduced in kernel 4.11.)
+ */
+#if LINUX_VERSION_AT_LEAST(4, 11, 0, 8, 0)
+#define TARGET_USERSIZE .usersize = offsetof(struct target_info, cache),
+#else
+#define TARGET_USERSIZE
+#endif
+
 int target_checkentry(const struct xt_tgchk_param *param);
+void target_destroy(const struct xt_tgdtor_param *param);
 unsigned int target_ipv6(struct sk_buff *skb,
 		const struct xt_action_param *param);
 unsigned int target_ipv4(struct sk_buff *skb,
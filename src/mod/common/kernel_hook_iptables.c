@@ -6,12 +6,12 @@
 #include "mod/common/core.h"
 #include "mod/common/log.h"
 
-static verdict find_instance(struct net *ns, const struct target_info *info,
-		struct xlator *result)
+static verdict find_instance(const struct target_info *info,
+		struct xlator **result)
 {
 	int error;
 
-	error = xlator_find(ns, XF_IPTABLES | info->type, info->iname, result);
+	error = xlator_target_find(info->cache, result);
 	switch (error) {
 	case 0:
 		return VERDICT_CONTINUE;
@@ -20,9 +20,6 @@ static verdict find_instance(struct net *ns, const struct target_info *info,
 				"but the instance does not exist.\n"
 				"Have you created it yet?", info->iname);
 		return VERDICT_UNTRANSLATABLE;
-	case -EINVAL:
-		/* Error message already printed. */
-		return VERDICT_UNTRANSLATABLE;
 	}
 
 	WARN(true, "Unknown error code %d while trying to find iptables Jool instance '%s'.",
@@ -50,21 +47,29 @@ int target_checkentry(const struct xt_tgchk_param *param)
 		return error;
 	}
 
-	return 0;
-
 	/*
-	 * Probably don't need to check if the instance exists;
-	 * it would just annoy the user.
+	 * Don't require the instance to exist; it would just annoy the user.
 	 * Also, I don't think that we can prevent a user from removing an
 	 * instance while the rule exists so it would be pointless anyway.
+	 *
+	 * Instead, the cache tracks the instance's lifetime, so packets can
+	 * find it without having to search for it.
 	 */
+	return xlator_target_create(param->net, XF_IPTABLES | info->type,
+			info->iname, &info->cache);
 }
 EXPORT_SYMBOL_GPL(target_checkentry);
 
-static struct net *action_param_net(const struct xt_action_param *param)
+/**
+ * This is the function that the kernel calls whenever the user deletes an
+ * iptables/ip6tables rule that involves the Jool target.
+ */
+void target_destroy(const struct xt_tgdtor_param *param)
 {
-	return param->state->net;
+	struct target_info *info = param->targinfo;
+	xlator_target_destroy(info->cache);
 }
+EXPORT_SYMBOL_GPL(target_destroy);
 
 static unsigned int verdict2iptables(verdict result, bool enable_debug)
 {
@@ -94,24 +99,28 @@ static unsigned int verdict2iptables(verdict result, bool enable_debug)
 unsigned int target_ipv6(struct sk_buff *skb,
 		const struct xt_action_param *param)
 {
+	struct xlator *jool;
 	struct xlation *state;
 	verdict result;
 	bool enable_debug = false;
 
-	state = xlation_create(NULL);
-	if (!state)
-		return NF_DROP;
+	rcu_read_lock_bh();
 
-	result = find_instance(action_param_net(param), param->targinfo,
-			&state->jool);
+	result = find_instance(param->targinfo, &jool);
 	if (result != VERDICT_CONTINUE)
 		goto end;
-	enable_debug = state->jool.globals.debug;
+	enable_debug = jool->globals.debug;
+
+	state = xlation_create(jool);
+	if (!state) {
+		result = VERDICT_DROP;
+		goto end;
+	}
 
 	result = core_6to4(skb, state);
 
-	xlator_put(&state->jool);
-end:	xlation_destroy(state);
+	xlation_destroy(state);
+end:	rcu_read_unlock_bh();
 	return verdict2iptables(result, enable_debug);
 }
 EXPORT_SYMBOL_GPL(target_ipv6);
@@ -123,24 +132,28 @@ EXPORT_SYMBOL_GPL(target_ipv6);
 unsigned int target_ipv4(struct sk_buff *skb,
 		const struct xt_action_param *param)
 {
+	struct xlator *jool;
 	struct xlation *state;
 	verdict result;
 	bool enable_debug = false;
 
-	state = xlation_create(NULL);
-	if (!state)
-		return NF_DROP;
+	rcu_read_lock_bh();
 
-	result = find_instance(action_param_net(param), param->targinfo,
-			&state->jool);
+	result = find_instance(param->targinfo, &jool);
 	if (result != VERDICT_CONTINUE)
 		goto end;
-	enable_debug = state->jool.globals.debug;
+	enable_debug = jool->globals.debug;
+
+	state = xlation_create(jool);
+	if (!state) {
+		result = VERDICT_DROP;
+		goto end;
+	}
 
 	result = core_4to6(skb, state);
 
-	xlator_put(&state->jool);
-end:	xlation_destroy(state);
+	xlation_destroy(state);
+end:	rcu_read_unlock_bh();
 	return verdict2iptables(result, enable_debug);
 }
 EXPORT_SYMBOL_GPL(target_ipv4);
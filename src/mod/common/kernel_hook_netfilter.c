@@ -5,7 +5,7 @@
 
 /* #pragma GCC diagnostic error "-Wframe-larger-than=1" */
 
-static verdict find_instance(struct sk_buff *skb, struct xlator *result)
+static verdict find_instance(struct sk_buff *skb, struct xlator **result)
 {
 	int error;
 
@@ -58,23 +58,28 @@ static unsigned int verdict2netfilter(verdict result, bool enable_debug)
 unsigned int hook_ipv6(void *priv, struct sk_buff *skb,
 		const struct nf_hook_state *nhs)
 {
+	struct xlator *jool;
 	struct xlation *state;
 	verdict result;
 	bool enable_debug = false;
 
-	state = xlation_create(NULL);
-	if (!state)
-		return NF_DROP;
+	rcu_read_lock_bh();
 
-	result = find_instance(skb, &state->jool);
+	result = find_instance(skb, &jool);
 	if (result != VERDICT_CONTINUE)
 		goto end;
-	enable_debug = state->jool.globals.debug;
+	enable_debug = jool->globals.debug;
+
+	state = xlation_create(jool);
+	if (!state) {
+		result = VERDICT_DROP;
+		goto end;
+	}
 
 	result = core_6to4(skb, state);
 
-	xlator_put(&state->jool);
-end:	xlation_destroy(state);
+	xlation_destroy(state);
+end:	rcu_read_unlock_bh();
 	return verdict2netfilter(result, enable_debug);
 }
 EXPORT_SYMBOL_GPL(hook_ipv6);
@@ -86,23 +91,28 @@ EXPORT_SYMBOL_GPL(hook_ipv6);
 unsigned int hook_ipv4(void *priv, struct sk_buff *skb,
 		const struct nf_hook_state *nhs)
 {
+	struct xlator *jool;
 	struct xlation *state;
 	verdict result;
 	bool enable_debug = false;
 
-	state = xlation_create(NULL);
-	if (!state)
-		return NF_DROP;
+	rcu_read_lock_bh();
 
-	result = find_instance(skb, &state->jool);
+	result = find_instance(skb, &jool);
 	if (result != VERDICT_CONTINUE)
 		goto end;
-	enable_debug = state->jool.globals.debug;
+	enable_debug = jool->globals.debug;
+
+	state = xlation_create(jool);
+	if (!state) {
+		result = VERDICT_DROP;
+		goto end;
+	}
 
 	result = core_4to6(skb, state);
 
-	xlator_put(&state->jool);
-end:	xlation_destroy(state);
+	xlation_destroy(state);
+end:	rcu_read_unlock_bh();
 	return verdict2netfilter(result, enable_debug);
 }
 EXPORT_SYMBOL_GPL(hook_ipv4);
@@ -6,7 +6,7 @@
 
 static inline bool state_debug(struct xlation const *state)
 {
-	return state && state->jool.globals.debug;
+	return state && state->jool->globals.debug;
 }
 
 static inline bool xlator_debug(struct xlator const *instance)
@@ -37,7 +37,7 @@ static inline bool xlator_debug(struct xlator const *instance)
 #define log_debug(state, text, ...)					\
 	do {								\
 		if (state_debug(state))					\
-			JOOL_DEBUG(&state->jool, text, ##__VA_ARGS__);	\
+			JOOL_DEBUG(state->jool, text, ##__VA_ARGS__);	\
 	} while (0)
 #define __log_debug(jool, text, ...)					\
 	do {								\
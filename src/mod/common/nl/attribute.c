@@ -369,6 +369,56 @@ int jnla_get_bib(struct nlattr *attr, char const *name, struct bib_entry *entry)
 	return 0;
 }
 
+/**
+ * Like jnla_get_bib(), except only one of the transport addresses is required.
+ * (Enough to find the rest of the entry.) @has6 and @has4 say which ones were
+ * present.
+ */
+int jnla_get_bib_key(struct nlattr *attr, char const *name,
+		struct bib_entry *entry, bool *has6, bool *has4)
+{
+	struct nlattr *attrs[JNLAB_COUNT];
+	int error;
+
+	error = validate_null(attr, name);
+	if (error)
+		return error;
+
+	error = jnla_parse_nested(attrs, JNLAB_MAX, attr,
+			joolnl_bib_entry_policy, name);
+	if (error)
+		return error;
+
+	memset(entry, 0, sizeof(*entry));
+	*has6 = !!attrs[JNLAB_SRC6];
+	*has4 = !!attrs[JNLAB_SRC4];
+
+	if (!*has6 && !*has4) {
+		log_err("%s lacks both transport addresses.", name);
+		return -EINVAL;
+	}
+
+	if (*has6) {
+		error = jnla_get_taddr6(attrs[JNLAB_SRC6],
+				"IPv6 transport address", &entry->addr6);
+		if (error)
+			return error;
+	}
+	if (*has4) {
+		error = jnla_get_taddr4(attrs[JNLAB_SRC4],
+				"IPv4 transport address", &entry->addr4);
+		if (error)
+			return error;
+	}
+	error = jnla_get_u8(attrs[JNLAB_PROTO], "Protocol", &entry->l4_proto);
+	if (error)
+		return error;
+	if (attrs[JNLAB_STATIC])
+		entry->is_static = nla_get_u8(attrs[JNLAB_STATIC]);
+
+	return 0;
+}
+
 static int get_timeout(struct bib_config *config, struct session_entry *entry)
 {
 	unsigned long timeout;
@@ -405,6 +455,53 @@ static int get_timeout(struct bib_config *config, struct session_entry *entry)
 	return 0;
 }
 
+/*
+ * Rejects the session fields that the database would not know what to do with.
+ * (Such as UDP sessions in TCP states, or on the TCP timers.)
+ */
+static int validate_session_fields(struct session_entry const *se)
+{
+	switch (se->proto) {
+	case L4PROTO_TCP:
+		if (se->state > TRANS) {
+			log_err("Unknown TCP state: %u", se->state);
+			return -EINVAL;
+		}
+		if (se->timer_type > SESSION_TIMER_SYN4) {
+			log_err("Unknown session timer: %u", se->timer_type);
+			return -EINVAL;
+		}
+		if (se->timer_type == SESSION_TIMER_SYN4
+				&& se->state != V4_INIT) {
+			log_err("TCP state %u cannot be on the SYN4 timer.",
+					se->state);
+			return -EINVAL;
+		}
+		return 0;
+
+	case L4PROTO_UDP:
+	case L4PROTO_ICMP:
+		if (se->state != ESTABLISHED) {
+			log_err("%s sessions cannot have TCP state %u.",
+					l4proto_to_string(se->proto), se->state);
+			return -EINVAL;
+		}
+		if (se->timer_type != SESSION_TIMER_EST) {
+			log_err("%s sessions cannot be on timer %u.",
+					l4proto_to_string(se->proto),
+					se->timer_type);
+			return -EINVAL;
+		}
+		return 0;
+
+	case L4PROTO_OTHER:
+		break;
+	}
+
+	log_err("Unknown session protocol: %u", se->proto);
+	return -EINVAL;
+}
+
 #define READ_RAW(serialized, field)					\
 	memcpy(&field, serialized, sizeof(field));			\
 	serialized += sizeof(field);
@@ -449,6 +546,9 @@ int jnla_get_session_joold(struct nlattr *attr, char const *name,
 	se->proto = (__tmp16 >> 5) & 3;
 	se->state = (__tmp16 >> 2) & 7;
 	se->timer_type = __tmp16 & 3;
+	error = validate_session_fields(se);
+	if (error)
+		return error;
 
 	error = __rfc6052_4to6(&cfg->pool6.prefix, &se->dst4.l3, &se->dst6.l3);
 	if (error)
@@ -466,6 +566,45 @@ int jnla_get_session_joold(struct nlattr *attr, char const *name,
 	return 0;
 }
 
+/*
+ * Same as jnla_get_session_joold(), except for the compact records of the
+ * session dumps. (See common/dump.h.)
+ */
+int jnla_get_session_rec(struct jool_session_rec const *rec,
+		struct jool_globals *cfg, struct session_entry *se)
+{
+	int error;
+
+	memset(se, 0, sizeof(*se));
+	se->src6.l3 = rec->src6;
+	se->src6.l4 = ntohs(rec->src6_port);
+	se->src4.l3 = rec->src4;
+	se->src4.l4 = ntohs(rec->src4_port);
+	se->dst4.l3 = rec->dst4;
+	se->dst4.l4 = ntohs(rec->dst4_port);
+	se->proto = rec->proto;
+	se->state = rec->state;
+	se->timer_type = rec->timer;
+
+	error = validate_session_fields(se);
+	if (error)
+		return error;
+
+	error = __rfc6052_4to6(&cfg->pool6.prefix, &se->dst4.l3, &se->dst6.l3);
+	if (error)
+		return error;
+	se->dst6.l4 = (se->proto == L4PROTO_ICMP) ? se->src6.l4 : se->dst4.l4;
+
+	error = get_timeout(&cfg->nat64.bib, se);
+	if (error)
+		return error;
+
+	se->update_time = jiffies + msecs_to_jiffies(ntohl(rec->expiration))
+			- se->timeout;
+	se->has_stored = false;
+	return 0;
+}
+
 static int u16_compare(const void *a, const void *b)
 {
 	return *(__u16 *)b - *(__u16 *)a;
@@ -3,6 +3,7 @@
 
 #include <linux/netlink.h>
 #include "common/config.h"
+#include "common/dump.h"
 #include "mod/common/db/bib/entry.h"
 
 int jnla_get_u8(struct nlattr *attr, char const *name, __u8 *out);
@@ -20,7 +21,9 @@ int jnla_get_taddr4(struct nlattr *attr, char const *name, struct ipv4_transport
 int jnla_get_eam(struct nlattr *attr, char const *name, struct eamt_entry *eam);
 int jnla_get_pool4(struct nlattr *attr, char const *name, struct pool4_entry *entry);
 int jnla_get_bib(struct nlattr *attr, char const *name, struct bib_entry *entry);
+int jnla_get_bib_key(struct nlattr *attr, char const *name, struct bib_entry *entry, bool *has6, bool *has4);
 int jnla_get_session_joold(struct nlattr *attr, char const *name, struct jool_globals *cfg, struct session_entry *entry);
+int jnla_get_session_rec(struct jool_session_rec const *rec, struct jool_globals *cfg, struct session_entry *entry);
 int jnla_get_plateaus(struct nlattr *attr, struct mtu_plateaus *out);
 
 /* Note: None of these print error messages. */
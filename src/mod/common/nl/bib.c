@@ -1,8 +1,10 @@
 #include "mod/common/nl/bib.h"
 
+#include "common/dump.h"
 #include "mod/common/log.h"
 #include "mod/common/xlator.h"
 #include "mod/common/nl/attribute.h"
+#include "mod/common/nl/dump.h"
 #include "mod/common/nl/nl_common.h"
 #include "mod/common/nl/nl_core.h"
 #include "mod/common/db/pool4/db.h"
@@ -63,6 +65,42 @@ revert_start:
 	return error;
 }
 
+static int dump_bib_entry(struct bib_entry const *entry, void *arg)
+{
+	struct jool_bib_rec *rec;
+
+	rec = jdump_reserve(arg, sizeof(*rec));
+	if (!rec)
+		return 1;
+
+	rec->src6 = entry->addr6.l3;
+	rec->src4 = entry->addr4.l3;
+	rec->src6_port = cpu_to_be16(entry->addr6.l4);
+	rec->src4_port = cpu_to_be16(entry->addr4.l4);
+	rec->proto = entry->l4_proto;
+	rec->is_static = entry->is_static;
+	memset(rec->reserved, 0, sizeof(rec->reserved));
+	return 0;
+}
+
+int handle_bib_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct jool_dump *dump;
+	int error;
+
+	dump = jdump_get(skb, cb, &error);
+	if (!dump)
+		return error;
+
+	error = jdump_begin(skb, cb, dump, JNLAR_BIB_RECS);
+	if (error)
+		return error;
+
+	error = bib_dump(dump->jool.nat64.bib, dump->proto, &dump->cursor,
+			&dump->filter, dump_bib_entry, skb);
+	return jdump_end(skb, dump, error);
+}
+
 int handle_bib_add(struct sk_buff *skb, struct genl_info *info)
 {
 	struct xlator jool;
@@ -93,54 +131,90 @@ revert_start:
 	return error;
 }
 
-int handle_bib_rm(struct sk_buff *skb, struct genl_info *info)
+/* Completes @entry, whose key was just parsed by jnla_get_bib_key(). */
+static int find_bib(struct xlator *jool, struct bib_entry *entry,
+		bool has6, bool has4)
+{
+	if (!has4)
+		return bib_find6(jool->nat64.bib, entry->l4_proto,
+				&entry->addr6, entry);
+	if (!has6)
+		return bib_find4(jool->nat64.bib, entry->l4_proto,
+				&entry->addr4, entry);
+	return 0;
+}
+
+int handle_bib_find(struct sk_buff *skb, struct genl_info *info)
 {
 	struct xlator jool;
-	struct nlattr *attrs[JNLAB_COUNT];
+	struct jool_response response;
 	struct bib_entry entry;
+	bool has6, has4;
 	int error;
 
 	error = request_handle_start(info, XT_NAT64, &jool, true);
 	if (error)
 		return jresponse_send_simple(NULL, info, error);
 
-	__log_debug(&jool, "Removing BIB entry.");
+	__log_debug(&jool, "Looking up BIB entry.");
 
-	if (!info->attrs[JNLAR_OPERAND]) {
-		log_err("The request lacks an operand attribute.");
+	error = jnla_get_bib_key(info->attrs[JNLAR_OPERAND], "Operand", &entry,
+			&has6, &has4);
+	if (error)
+		goto revert_start;
+	if (has6 && has4) {
+		log_err("Please specify only one of the transport addresses.");
 		error = -EINVAL;
 		goto revert_start;
 	}
 
-	error = jnla_parse_nested(attrs, JNLAB_MAX, info->attrs[JNLAR_OPERAND], joolnl_bib_entry_policy, "BIB entry");
+	error = find_bib(&jool, &entry, has6, has4);
+	if (error == -ESRCH) {
+		log_err("The entry wasn't in the database.");
+		goto revert_start;
+	}
 	if (error)
 		goto revert_start;
 
-	if (!attrs[JNLAB_SRC6] && !attrs[JNLAB_SRC4]) {
-		error = -EINVAL;
+	error = jresponse_init(&response, info);
+	if (error)
 		goto revert_start;
+	error = jnla_put_bib(response.skb, JNLAR_OPERAND, &entry);
+	if (error) {
+		report_put_failure();
+		goto revert_response;
 	}
 
-	if (attrs[JNLAB_SRC6]) {
-		error = jnla_get_taddr6(attrs[JNLAB_SRC6], "IPv6 transport address", &entry.addr6);
-		if (error)
-			goto revert_start;
-	}
-	if (attrs[JNLAB_SRC4]) {
-		error = jnla_get_taddr4(attrs[JNLAB_SRC4], "IPv4 transport address", &entry.addr4);
-		if (error)
-			goto revert_start;
-	}
+	request_handle_end(&jool);
+	return jresponse_send(&response);
+
+revert_response:
+	jresponse_cleanup(&response);
+revert_start:
+	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
 
-	if (attrs[JNLAB_PROTO])
-		entry.l4_proto = nla_get_u8(attrs[JNLAB_PROTO]);
-	if (attrs[JNLAB_STATIC])
-		entry.is_static = nla_get_u8(attrs[JNLAB_STATIC]);
+int handle_bib_rm(struct sk_buff *skb, struct genl_info *info)
+{
+	struct xlator jool;
+	struct bib_entry entry;
+	bool has6, has4;
+	int error;
+
+	error = request_handle_start(info, XT_NAT64, &jool, true);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	__log_debug(&jool, "Removing BIB entry.");
+
+	error = jnla_get_bib_key(info->attrs[JNLAR_OPERAND], "Operand", &entry,
+			&has6, &has4);
+	if (error)
+		goto revert_start;
 
-	if (!attrs[JNLAB_SRC4])
-		error = bib_find6(jool.nat64.bib, entry.l4_proto, &entry.addr6, &entry);
-	else if (!attrs[JNLAB_SRC6])
-		error = bib_find4(jool.nat64.bib, entry.l4_proto, &entry.addr4, &entry);
+	error = find_bib(&jool, &entry, has6, has4);
 	if (error == -ESRCH)
 		goto esrch;
 	if (error)
@@ -0,0 +1,284 @@
+#include "mod/common/nl/dump.h"
+
+#include "common/constants.h"
+#include "mod/common/error_pool.h"
+#include "mod/common/log.h"
+#include "mod/common/wkmalloc.h"
+#include "mod/common/nl/attribute.h"
+#include "mod/common/nl/nl_common.h"
+#include "mod/common/nl/nl_handler.h"
+
+/*
+ * cb->args[] layout. The dump's state lives in a separate allocation, because
+ * it doesn't fit.
+ */
+#define ARG_DUMP 0
+/* The request was rejected, and userspace has already been told. */
+#define ARG_REJECTED 1
+
+static struct joolnlhdr *put_hdr(struct sk_buff *skb,
+		struct netlink_callback *cb)
+{
+	struct joolnlhdr *hdr;
+
+	hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq,
+			jnl_family(), NLM_F_MULTI, 0);
+	if (hdr)
+		memcpy(hdr, get_dump_hdr(cb), sizeof(*hdr));
+	return hdr;
+}
+
+/*
+ * Writes @error_code (and the error pool's message) into @skb, following the
+ * same format as jresponse_send_simple().
+ */
+static int put_error(struct sk_buff *skb, struct netlink_callback *cb,
+		int error_code)
+{
+	struct joolnlhdr *hdr;
+	char *error_msg;
+	size_t error_msg_size;
+	int error;
+
+	/* Not even a header to answer to; the error code will have to do. */
+	if (!get_dump_hdr(cb))
+		return error_code;
+
+	error = error_pool_get_message(&error_msg, &error_msg_size);
+	if (error)
+		return error;
+
+	hdr = put_hdr(skb, cb);
+	if (!hdr) {
+		error = -EMSGSIZE;
+		goto end;
+	}
+	hdr->flags |= JOOLNLHDR_FLAGS_ERROR;
+
+	error_code = min(abs(error_code), (int)MAX_U16);
+	if (nla_put_u16(skb, JNLAERR_CODE, error_code)) {
+		error = -EMSGSIZE;
+		goto cancel;
+	}
+	if (nla_put_string(skb, JNLAERR_MSG, error_msg)) {
+		error_msg[128] = '\0';
+		if (nla_put_string(skb, JNLAERR_MSG, error_msg)) {
+			error = -EMSGSIZE;
+			goto cancel;
+		}
+	}
+
+	genlmsg_end(skb, hdr);
+	error = skb->len;
+	goto end;
+
+cancel:
+	genlmsg_cancel(skb, hdr);
+end:
+	__wkfree("Error msg out", error_msg);
+	return error;
+}
+
+static struct nlattr *find_attr(struct netlink_callback *cb, int type)
+{
+	return nlmsg_find_attr(cb->nlh, GENL_HDRLEN + sizeof(struct joolnlhdr),
+			type);
+}
+
+static int parse_filter(struct nlattr *root, struct bib_filter *filter)
+{
+	struct nlattr *attrs[JNLAF_COUNT];
+	int error;
+
+	memset(filter, 0, sizeof(*filter));
+	if (!root)
+		return 0;
+
+	error = jnla_parse_nested(attrs, JNLAF_MAX, root, joolnl_filter_policy,
+			"filter");
+	if (error)
+		return error;
+
+	if (attrs[JNLAF_SRC6]) {
+		error = jnla_get_prefix6(attrs[JNLAF_SRC6], "IPv6 source prefix",
+				&filter->src6);
+		if (error)
+			return error;
+		filter->src6_set = true;
+	}
+	if (attrs[JNLAF_SRC4]) {
+		error = jnla_get_prefix4(attrs[JNLAF_SRC4], "IPv4 source prefix",
+				&filter->src4);
+		if (error)
+			return error;
+		filter->src4_set = true;
+	}
+
+	return 0;
+}
+
+static int init_dump(struct netlink_callback *cb, struct jool_dump *dump)
+{
+	struct nlattr *proto;
+	int error;
+
+	error = request_dump_start(cb, XT_NAT64, &dump->jool);
+	if (error)
+		return error;
+
+	/* The family's policy is not enforced on dumps by every kernel. */
+	proto = find_attr(cb, JNLAR_PROTO);
+	if (!proto || nla_len(proto) < sizeof(__u8)) {
+		log_err("The request is missing a transport protocol.");
+		error = -EINVAL;
+		goto fail;
+	}
+	dump->proto = nla_get_u8(proto);
+
+	error = parse_filter(find_attr(cb, JNLAR_FILTER), &dump->filter);
+	if (error)
+		goto fail;
+	/* Hashed BIBs have no src6 tree, so this would walk the whole table. */
+	if ((dump->jool.flags & XO_BIB_HASH) && dump->filter.src6_set
+			&& !dump->filter.src4_set) {
+		log_err("This instance's BIB is hashed (--bib-hash), so it cannot be\n"
+				"filtered by IPv6 prefix alone. Please add an IPv4 prefix\n"
+				"filter.");
+		error = -EINVAL;
+		goto fail;
+	}
+
+	memset(&dump->cursor, 0, sizeof(dump->cursor));
+	return 0;
+
+fail:
+	request_handle_end(&dump->jool);
+	return error;
+}
+
+/**
+ * Returns the state of @cb's dump, initializing it if this is the first
+ * message.
+ *
+ * If NULL is returned, the dumpit callback should return @result right away.
+ * (Either because the request was rejected, in which case the error was
+ * written into @skb, or because the rejection was already sent and the dump is
+ * over.)
+ */
+struct jool_dump *jdump_get(struct sk_buff *skb, struct netlink_callback *cb,
+		int *result)
+{
+	struct jool_dump *dump;
+	int error;
+
+	dump = (struct jool_dump *)cb->args[ARG_DUMP];
+	if (dump)
+		return dump;
+	if (cb->args[ARG_REJECTED]) {
+		*result = 0;
+		return NULL;
+	}
+
+	/* pre_doit() is not called for dumps. */
+	error_pool_activate();
+
+	dump = wkmalloc(struct jool_dump, GFP_KERNEL);
+	if (!dump) {
+		error = -ENOMEM;
+		goto fail;
+	}
+
+	error = init_dump(cb, dump);
+	if (error) {
+		wkfree(struct jool_dump, dump);
+		goto fail;
+	}
+
+	error_pool_deactivate();
+	cb->args[ARG_DUMP] = (long)dump;
+	return dump;
+
+fail:
+	*result = put_error(skb, cb, error);
+	error_pool_deactivate();
+	cb->args[ARG_REJECTED] = true;
+	return NULL;
+}
+
+/**
+ * Starts the message that will be written into @skb. Records are then appended
+ * with jdump_reserve(), and the message is closed with jdump_end().
+ */
+int jdump_begin(struct sk_buff *skb, struct netlink_callback *cb,
+		struct jool_dump *dump, int attrtype)
+{
+	dump->hdr = put_hdr(skb, cb);
+	if (!dump->hdr)
+		return -EMSGSIZE;
+
+	/* Its length is fixed by jdump_end(). */
+	dump->recs = nla_reserve(skb, attrtype, 0);
+	if (!dump->recs) {
+		genlmsg_cancel(skb, dump->hdr);
+		return -EMSGSIZE;
+	}
+
+	return 0;
+}
+
+/**
+ * Appends @size bytes to the current message's records. Returns NULL if they
+ * don't fit.
+ *
+ * @size must be a multiple of 4 (NLA_ALIGNTO).
+ */
+void *jdump_reserve(struct sk_buff *skb, size_t size)
+{
+	return (skb_tailroom(skb) >= size) ? skb_put(skb, size) : NULL;
+}
+
+/**
+ * Closes the current message. @error is the result of the table iteration.
+ * Returns what the dumpit callback should return.
+ */
+int jdump_end(struct sk_buff *skb, struct jool_dump *dump, int error)
+{
+	int len;
+
+	if (error < 0)
+		goto cancel;
+
+	len = skb_tail_pointer(skb) - (unsigned char *)dump->recs;
+	if (len == nla_total_size(0)) {
+		/*
+		 * Nothing left (error == 0), or the first record didn't fit in
+		 * an empty message (error > 0; shouldn't happen).
+		 */
+		error = error ? -EMSGSIZE : 0;
+		goto cancel;
+	}
+
+	dump->recs->nla_len = len;
+	genlmsg_end(skb, dump->hdr);
+	return skb->len;
+
+cancel:
+	genlmsg_cancel(skb, dump->hdr);
+	return error;
+}
+
+/**
+ * The done callback of the dump operations.
+ */
+int jdump_done(struct netlink_callback *cb)
+{
+	struct jool_dump *dump;
+
+	dump = (struct jool_dump *)cb->args[ARG_DUMP];
+	if (dump) {
+		request_handle_end(&dump->jool);
+		wkfree(struct jool_dump, dump);
+	}
+
+	return 0;
+}
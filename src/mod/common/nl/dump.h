@@ -0,0 +1,37 @@
+#ifndef SRC_MOD_COMMON_NL_DUMP_H_
+#define SRC_MOD_COMMON_NL_DUMP_H_
+
+/**
+ * @file
+ * Netlink dumps of the BIB and session tables.
+ *
+ * Unlike the foreach operations, a dump is a single request. The kernel fills
+ * as many messages as the reader wants to receive (one per dumpit call), and
+ * the cursor stays here between them, so nothing has to be searched again.
+ * Entries travel as compact records. (See common/dump.h.)
+ */
+
+#include <net/genetlink.h>
+#include "mod/common/xlator.h"
+#include "mod/common/db/bib/db.h"
+
+struct jool_dump {
+	struct xlator jool;
+	l4_protocol proto;
+	struct bib_filter filter;
+	struct bib_dump_cursor cursor;
+
+	/* The current message. (See jdump_begin().) */
+	struct joolnlhdr *hdr;
+	struct nlattr *recs;
+};
+
+struct jool_dump *jdump_get(struct sk_buff *skb, struct netlink_callback *cb,
+		int *result);
+int jdump_begin(struct sk_buff *skb, struct netlink_callback *cb,
+		struct jool_dump *dump, int attrtype);
+void *jdump_reserve(struct sk_buff *skb, size_t size);
+int jdump_end(struct sk_buff *skb, struct jool_dump *dump, int error);
+int jdump_done(struct netlink_callback *cb);
+
+#endif /* SRC_MOD_COMMON_NL_DUMP_H_ */
@@ -103,10 +103,12 @@ int handle_instance_add(struct sk_buff *skb, struct genl_info *info)
 	static struct nla_policy add_policy[JNLAIA_COUNT] = {
 		[JNLAIA_XF] = { .type = NLA_U8 },
 		[JNLAIA_POOL6] = { .type = NLA_NESTED, },
+		[JNLAIA_BIB_HASH] = { .type = NLA_U8 },
 	};
 	struct nlattr *attrs[JNLAIA_COUNT];
 	struct config_prefix6 pool6;
 	__u8 xf;
+	__u8 bib_hash;
 	int error;
 
 	LOG_DEBUG("Adding Jool instance.");
@@ -136,9 +138,16 @@ int handle_instance_add(struct sk_buff *skb, struct genl_info *info)
 		if (error)
 			goto revert_start;
 	}
+	bib_hash = 0;
+	if (attrs[JNLAIA_BIB_HASH]) {
+		error = jnla_get_u8(attrs[JNLAIA_BIB_HASH], "BIB hash",
+				&bib_hash);
+		if (error)
+			goto revert_start;
+	}
 
 	return jresponse_send_simple(NULL, info, xlator_add(
-		xf | get_jool_hdr(info)->xt,
+		xf | (bib_hash ? XO_BIB_HASH : 0) | get_jool_hdr(info)->xt,
 		get_jool_hdr(info)->iname,
 		pool6.set ? &pool6.prefix : NULL,
 		NULL
@@ -70,23 +70,21 @@ static int validate_version(struct joolnlhdr *hdr)
 	return -EINVAL;
 }
 
-int request_handle_start(struct genl_info *info, xlator_type xt,
-		struct xlator *jool, bool require_net_admin)
+static int validate_net_admin(void)
 {
-	struct joolnlhdr *hdr;
-	int error;
+	if (capable(CAP_NET_ADMIN))
+		return 0;
 
-	if (require_net_admin && !capable(CAP_NET_ADMIN)) {
-		log_err("CAP_NET_ADMIN capability required. (Maybe try su or sudo?)");
-		return -EPERM;
-	}
+	log_err("CAP_NET_ADMIN capability required. (Maybe try su or sudo?)");
+	return -EPERM;
+}
 
-	if (!info->attrs) {
-		log_err("Userspace request lacks Netlink attributes.");
-		return -EINVAL;
-	}
+static int validate_request(struct joolnlhdr *hdr, xlator_type xt,
+		struct xlator *jool)
+{
+	char *iname;
+	int error;
 
-	hdr = get_jool_hdr(info);
 	if (!hdr) {
 		log_err("Userspace request lacks a Jool header.");
 		return -EINVAL;
@@ -107,9 +105,10 @@ int request_handle_start(struct genl_info *info, xlator_type xt,
 	}
 
 	if (jool) {
-		error = xlator_find_current(get_iname(info), XF_ANY | hdr->xt, jool);
+		iname = (hdr->iname[0] != 0) ? hdr->iname : INAME_DEFAULT;
+		error = xlator_find_current(iname, XF_ANY | hdr->xt, jool);
 		if (error == -ESRCH)
-			log_err("This namespace lacks an instance named '%s'.", get_iname(info));
+			log_err("This namespace lacks an instance named '%s'.", iname);
 		if (error)
 			return error;
 	}
@@ -117,6 +116,51 @@ int request_handle_start(struct genl_info *info, xlator_type xt,
 	return 0;
 }
 
+int request_handle_start(struct genl_info *info, xlator_type xt,
+		struct xlator *jool, bool require_net_admin)
+{
+	int error;
+
+	if (require_net_admin) {
+		error = validate_net_admin();
+		if (error)
+			return error;
+	}
+
+	if (!info->attrs) {
+		log_err("Userspace request lacks Netlink attributes.");
+		return -EINVAL;
+	}
+
+	return validate_request(get_jool_hdr(info), xt, jool);
+}
+
+/*
+ * Dumps don't get a genl_info, so the header has to be dug out of the request
+ * by hand.
+ */
+struct joolnlhdr *get_dump_hdr(struct netlink_callback *cb)
+{
+	if (nlmsg_len(cb->nlh) < GENL_HDRLEN + sizeof(struct joolnlhdr))
+		return NULL;
+	return (struct joolnlhdr *)((u8 *)nlmsg_data(cb->nlh) + GENL_HDRLEN);
+}
+
+/*
+ * request_handle_start()'s counterpart for dumps.
+ */
+int request_dump_start(struct netlink_callback *cb, xlator_type xt,
+		struct xlator *jool)
+{
+	int error;
+
+	error = validate_net_admin();
+	if (error)
+		return error;
+
+	return validate_request(get_dump_hdr(cb), xt, jool);
+}
+
 void request_handle_end(struct xlator *jool)
 {
 	if (jool)
@@ -1,8 +1,10 @@
 #include "mod/common/nl/nl_handler.h"
 
+#include <linux/capability.h>
 #include <linux/mutex.h>
 #include <linux/genetlink.h>
 
+#include "common/event.h"
 #include "common/types.h"
 #include "mod/common/init.h"
 #include "mod/common/linux_version.h"
@@ -12,6 +14,7 @@
 #include "mod/common/nl/atomic_config.h"
 #include "mod/common/nl/bib.h"
 #include "mod/common/nl/denylist4.h"
+#include "mod/common/nl/dump.h"
 #include "mod/common/nl/eam.h"
 #include "mod/common/nl/global.h"
 #include "mod/common/nl/instance.h"
@@ -55,6 +58,14 @@ static struct nla_policy const jool_policy[JNLAR_COUNT] = {
 	[JNLAR_PROTO] = { .type = NLA_U8 },
 	[JNLAR_ATOMIC_INIT] = { .type = NLA_U8 },
 	[JNLAR_ATOMIC_END] = { .type = NLA_BINARY, .len = 0 },
+	[JNLAR_EVENTS] = { .type = NLA_BINARY },
+	[JNLAR_BIB_RECS] = { .type = NLA_BINARY },
+	[JNLAR_SESSION_RECS] = { .type = NLA_BINARY },
+	[JNLAR_FILTER] = { .type = NLA_NESTED },
+	[JNLAR_SESSION_STATS] = { .type = NLA_BINARY },
+	[JNLAR_ADDR_STATS] = { .type = NLA_BINARY },
+	[JNLAR_SUBSCRIBER_LEN] = { .type = NLA_U8 },
+	[JNLAR_IMPORTED] = { .type = NLA_U32 },
 };
 
 #if LINUX_VERSION_AT_LEAST(5, 2, 0, 8, 0)
@@ -184,15 +195,61 @@ static const struct genl_ops ops[] = {
 		.cmd = JNLOP_JOOLD_ACK,
 		.doit = handle_joold_ack,
 		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_BIB_DUMP,
+		.dumpit = handle_bib_dump,
+		.done = jdump_done,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_SESSION_DUMP,
+		.dumpit = handle_session_dump,
+		.done = jdump_done,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_BIB_FIND,
+		.doit = handle_bib_find,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_SESSION_FIND,
+		.doit = handle_session_find,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_SESSION_STATS,
+		.doit = handle_session_stats,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_SESSION_IMPORT,
+		.doit = handle_session_import,
+		JOOL_POLICY
 	}
 };
 
+/*
+ * The events group reveals which IPv6 node held which IPv4 transport address,
+ * so only CAP_NET_ADMIN can listen to it.
+ */
 static struct genl_multicast_group mc_groups[] = {
-	{
+	[JNL_GROUP_JOOLD] = {
 		.name = JOOLNL_MULTICAST_GRP_NAME,
 	},
+	[JNL_GROUP_EVENTS] = {
+		.name = JOOLNL_EVENTS_GRP_NAME,
+#ifdef GENL_MCAST_CAP_NET_ADMIN
+		.flags = GENL_MCAST_CAP_NET_ADMIN,
+#endif
+	},
 };
 
+#ifndef GENL_MCAST_CAP_NET_ADMIN
+/* Older kernels can't enforce the group's flags; do it manually. */
+static int bind_group(struct net *ns, int group)
+{
+	if (group != JNL_GROUP_EVENTS)
+		return 0;
+	return ns_capable(ns->user_ns, CAP_NET_ADMIN) ? 0 : -EPERM;
+}
+#endif
+
 static struct genl_family jool_family = {
 	.hdrsize = sizeof(struct joolnlhdr),
 	/* This is initialized below. See register_family(). */
@@ -206,6 +263,9 @@ static struct genl_family jool_family = {
 #endif
 	.pre_doit = pre_handle_request,
 	.post_doit = post_handle_request,
+#ifndef GENL_MCAST_CAP_NET_ADMIN
+	.mcast_bind = bind_group,
+#endif
 
 	/*
 	 * "module" was added in Linux 3.11 (commit
@@ -10,6 +10,10 @@
 #include <linux/skbuff.h>
 #include <net/genetlink.h>
 
+/* Indexes of the family's multicast groups. */
+#define JNL_GROUP_JOOLD 0
+#define JNL_GROUP_EVENTS 1
+
 int nlhandler_setup(void);
 void nlhandler_teardown(void);
 
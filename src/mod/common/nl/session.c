@@ -1,8 +1,13 @@
 #include "mod/common/nl/session.h"
 
+#include "common/constants.h"
+#include "common/dump.h"
+#include "common/session_stats.h"
 #include "mod/common/log.h"
+#include "mod/common/wkmalloc.h"
 #include "mod/common/xlator.h"
 #include "mod/common/nl/attribute.h"
+#include "mod/common/nl/dump.h"
 #include "mod/common/nl/nl_common.h"
 #include "mod/common/nl/nl_core.h"
 #include "mod/common/db/bib/db.h"
@@ -93,3 +98,309 @@ revert_start:
 	request_handle_end(&jool);
 	return error;
 }
+
+int handle_session_find(struct sk_buff *skb, struct genl_info *info)
+{
+	struct xlator jool;
+	struct jool_response response;
+	struct bib_entry bib;
+	struct session_foreach_offset offset;
+	struct ipv4_transport_addr *offset_ptr;
+	bool has6, has4;
+	int error;
+
+	error = request_handle_start(info, XT_NAT64, &jool, true);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	__log_debug(&jool, "Sending a BIB entry's sessions to userspace.");
+
+	error = jresponse_init(&response, info);
+	if (error)
+		goto revert_start;
+
+	error = jnla_get_bib_key(info->attrs[JNLAR_OPERAND], "Operand", &bib,
+			&has6, &has4);
+	if (error)
+		goto revert_response;
+
+	if (!info->attrs[JNLAR_OFFSET]) {
+		offset_ptr = NULL;
+	} else {
+		error = parse_offset(info->attrs[JNLAR_OFFSET], &offset);
+		if (error)
+			goto revert_response;
+		offset_ptr = &offset.offset.dst;
+		__log_debug(&jool, "Offset: %pI4/%u", &offset_ptr->l3,
+				offset_ptr->l4);
+	}
+
+	error = bib_foreach_bib_session(&jool, bib.l4_proto,
+			has6 ? &bib.addr6 : NULL, &bib.addr4,
+			serialize_session_entry, response.skb, offset_ptr);
+	if (error == -ESRCH) {
+		log_err("The BIB entry wasn't in the database.");
+		goto revert_response;
+	}
+
+	error = jresponse_send_array(&jool, &response, error);
+	if (error)
+		goto revert_response;
+
+	request_handle_end(&jool);
+	return 0;
+
+revert_response:
+	jresponse_cleanup(&response);
+revert_start:
+	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
+
+static void stats_to_be(struct bib_stats const *src, __u8 subscriber_len,
+		struct jool_session_stats *dst)
+{
+	unsigned int i;
+
+	memset(dst, 0, sizeof(*dst));
+	for (i = 0; i < JSS_STATES; i++)
+		dst->states[i] = cpu_to_be32(src->states[i]);
+	for (i = 0; i < JSS_TIMERS; i++)
+		dst->timers[i] = cpu_to_be32(src->timers[i]);
+	for (i = 0; i < JSS_IDLE_BUCKETS; i++)
+		dst->idle[i] = cpu_to_be32(src->idle[i]);
+	for (i = 0; i < JSS_SUBSCRIBER_BUCKETS; i++)
+		dst->subscribers[i] = cpu_to_be32(src->subscribers[i]);
+	dst->subscriber_count = cpu_to_be32(src->subscriber_count);
+	dst->subscriber_len = subscriber_len;
+	dst->has_subscribers = src->has_subscribers;
+	dst->bib_bytes = cpu_to_be32(src->bib_bytes);
+	dst->session_bytes = cpu_to_be32(src->session_bytes);
+}
+
+static int put_addr_stats(struct in_addr const *addr, unsigned int bibs,
+		void *arg)
+{
+	struct jool_addr_stats *rec;
+
+	rec = jdump_reserve(arg, sizeof(*rec));
+	if (!rec)
+		return 1; /* The rest doesn't fit; truncate. */
+
+	rec->addr = *addr;
+	rec->bibs = cpu_to_be32(bibs);
+	return 0;
+}
+
+int handle_session_stats(struct sk_buff *skb, struct genl_info *info)
+{
+	struct xlator jool;
+	struct jool_response response;
+	struct bib_stats stats;
+	struct jool_session_stats out;
+	struct nlattr *recs;
+	l4_protocol proto;
+	__u8 subscriber_len;
+	int error;
+
+	error = request_handle_start(info, XT_NAT64, &jool, true);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	__log_debug(&jool, "Sending session stats to userspace.");
+
+	error = jresponse_init(&response, info);
+	if (error)
+		goto revert_start;
+
+	if (!info->attrs[JNLAR_PROTO]) {
+		log_err("The request is missing a transport protocol.");
+		error = -EINVAL;
+		goto revert_response;
+	}
+	proto = nla_get_u8(info->attrs[JNLAR_PROTO]);
+
+	subscriber_len = info->attrs[JNLAR_SUBSCRIBER_LEN]
+			? nla_get_u8(info->attrs[JNLAR_SUBSCRIBER_LEN])
+			: 64;
+	if (subscriber_len > 128) {
+		log_err("Subscriber prefix length %u is too long.",
+				subscriber_len);
+		error = -EINVAL;
+		goto revert_response;
+	}
+
+	error = bib_stats(jool.nat64.bib, proto, subscriber_len, &stats);
+	if (error)
+		goto revert_response;
+
+	stats_to_be(&stats, subscriber_len, &out);
+	error = nla_put(response.skb, JNLAR_SESSION_STATS, sizeof(out), &out);
+	if (error) {
+		report_put_failure();
+		goto revert_response;
+	}
+
+	/* Its length is fixed once the records are in. */
+	recs = nla_reserve(response.skb, JNLAR_ADDR_STATS, 0);
+	if (!recs) {
+		report_put_failure();
+		error = -EMSGSIZE;
+		goto revert_response;
+	}
+	error = bib_foreach_addr4(jool.nat64.bib, proto, put_addr_stats,
+			response.skb);
+	if (error < 0)
+		goto revert_response;
+	recs->nla_len = skb_tail_pointer(response.skb) - (unsigned char *)recs;
+
+	request_handle_end(&jool);
+	return jresponse_send(&response);
+
+revert_response:
+	jresponse_cleanup(&response);
+revert_start:
+	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
+
+/*
+ * Feeds @attr's session records to bib_import(), BIB_IMPORT_MAX at a time.
+ * The number of sessions that were added is stored in @added.
+ */
+static int import_recs(struct xlator *jool, struct nlattr *attr,
+		__u32 *added)
+{
+	struct jool_session_rec const *rec;
+	struct session_entry *entries;
+	unsigned int total, n;
+	int result;
+
+	if (nla_len(attr) % sizeof(*rec)) {
+		log_err("The session records are truncated.");
+		return -EINVAL;
+	}
+
+	entries = __wkmalloc("Import batch",
+			BIB_IMPORT_MAX * sizeof(*entries), GFP_KERNEL);
+	if (!entries)
+		return -ENOMEM;
+
+	rec = nla_data(attr);
+	total = nla_len(attr) / sizeof(*rec);
+	*added = 0;
+	result = 0;
+
+	while (total > 0) {
+		for (n = 0; n < BIB_IMPORT_MAX && total > 0; n++, total--) {
+			result = jnla_get_session_rec(rec++, &jool->globals,
+					&entries[n]);
+			if (result)
+				goto end;
+		}
+
+		result = bib_import(jool, entries, n);
+		if (result < 0)
+			goto end;
+		*added += result;
+		result = 0;
+	}
+
+end:
+	__wkfree("Import batch", entries);
+	return result;
+}
+
+int handle_session_import(struct sk_buff *skb, struct genl_info *info)
+{
+	struct xlator jool;
+	struct jool_response response;
+	__u32 added;
+	int error;
+
+	error = request_handle_start(info, XT_NAT64, &jool, true);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	__log_debug(&jool, "Importing sessions.");
+
+	if (!info->attrs[JNLAR_SESSION_RECS]) {
+		log_err("The request is missing the session records.");
+		error = -EINVAL;
+		goto revert_start;
+	}
+
+	error = import_recs(&jool, info->attrs[JNLAR_SESSION_RECS], &added);
+	if (error)
+		goto revert_start;
+
+	error = jresponse_init(&response, info);
+	if (error)
+		goto revert_start;
+	error = nla_put_u32(response.skb, JNLAR_IMPORTED, added);
+	if (error) {
+		report_put_failure();
+		jresponse_cleanup(&response);
+		goto revert_start;
+	}
+
+	request_handle_end(&jool);
+	return jresponse_send(&response);
+
+revert_start:
+	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
+
+static int dump_session_entry(struct session_entry const *entry, void *arg)
+{
+	struct jool_session_rec *rec;
+	unsigned long dying_time;
+
+	rec = jdump_reserve(arg, sizeof(*rec));
+	if (!rec)
+		return 1;
+
+	dying_time = entry->update_time + entry->timeout;
+	dying_time = (dying_time > jiffies)
+			? jiffies_to_msecs(dying_time - jiffies)
+			: 0;
+	if (dying_time > MAX_U32)
+		dying_time = MAX_U32;
+
+	rec->src6 = entry->src6.l3;
+	rec->dst6 = entry->dst6.l3;
+	rec->src4 = entry->src4.l3;
+	rec->dst4 = entry->dst4.l3;
+	rec->expiration = cpu_to_be32(dying_time);
+	rec->src6_port = cpu_to_be16(entry->src6.l4);
+	rec->dst6_port = cpu_to_be16(entry->dst6.l4);
+	rec->src4_port = cpu_to_be16(entry->src4.l4);
+	rec->dst4_port = cpu_to_be16(entry->dst4.l4);
+	rec->proto = entry->proto;
+	rec->state = entry->state;
+	rec->timer = entry->timer_type;
+	rec->reserved = 0;
+	return 0;
+}
+
+int handle_session_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct jool_dump *dump;
+	int error;
+
+	dump = jdump_get(skb, cb, &error);
+	if (!dump)
+		return error;
+
+	error = jdump_begin(skb, cb, dump, JNLAR_SESSION_RECS);
+	if (error)
+		return error;
+
+	error = bib_dump_sessions(&dump->jool, dump->proto, &dump->cursor,
+			&dump->filter, dump_session_entry, skb);
+	return jdump_end(skb, dump, error);
+}
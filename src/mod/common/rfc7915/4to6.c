@@ -22,7 +22,7 @@ static int generate_saddr6_nat64(struct xlation *state)
 	struct jool_globals *cfg;
 	struct in_addr tmp;
 
-	cfg = &state->jool.globals;
+	cfg = &state->jool->globals;
 	if (cfg->nat64.src_icmp6errs_better && pkt_is_icmp4_error(&state->in)) {
 		/* Issue #132 behaviour. */
 		tmp.s_addr = pkt_ip4_hdr(&state->in)->saddr;
@@ -37,7 +37,7 @@ static int generate_saddr6_nat64(struct xlation *state)
 
 static verdict xlat46_external_addresses(struct xlation *state)
 {
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		if (generate_saddr6_nat64(state))
 			return drop(state, JSTAT46_SRC);
@@ -51,7 +51,7 @@ static verdict xlat46_external_addresses(struct xlation *state)
 	}
 
 	WARN(1, "xlator type is not SIIT nor NAT64: %u",
-			xlator_get_type(&state->jool));
+			xlator_get_type(state->jool));
 	return drop(state, JSTAT_UNKNOWN);
 }
 
@@ -63,7 +63,7 @@ static verdict xlat46_internal_addresses(struct xlation *state)
 	if (pkt_is_inner(&state->in))
 		return VERDICT_CONTINUE; /* Called from xlat46_icmp_type() */
 
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		state->flowx.v6.inner_src = state->out.tuple.dst.addr6.l3;
 		state->flowx.v6.inner_dst = state->out.tuple.src.addr6.l3;
@@ -82,7 +82,7 @@ static verdict xlat46_internal_addresses(struct xlation *state)
 	}
 
 	WARN(1, "xlator type is not SIIT nor NAT64: %u",
-			xlator_get_type(&state->jool));
+			xlator_get_type(state->jool));
 	return drop(state, JSTAT_UNKNOWN);
 }
 
@@ -93,7 +93,7 @@ static verdict xlat46_tcp_ports(struct xlation *state)
 	struct tcphdr const *hdr;
 
 	flow6 = &state->flowx.v6.flowi;
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		flow6->fl6_sport = cpu_to_be16(state->out.tuple.src.addr6.l4);
 		flow6->fl6_dport = cpu_to_be16(state->out.tuple.dst.addr6.l4);
@@ -117,7 +117,7 @@ static verdict xlat46_udp_ports(struct xlation *state)
 	struct udphdr const *udp;
 
 	flow6 = &state->flowx.v6.flowi;
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		flow6->fl6_sport = cpu_to_be16(state->out.tuple.src.addr6.l4);
 		flow6->fl6_dport = cpu_to_be16(state->out.tuple.dst.addr6.l4);
@@ -256,19 +256,19 @@ static verdict predict_route46(struct xlation *state)
 
 	flow6 = &state->flowx.v6.flowi;
 	log_debug(state, "Routing: %pI6c->%pI6c", &flow6->saddr, &flow6->daddr);
-	state->dst = route6(&state->jool, flow6);
+	state->dst = route6(state->jool, flow6);
 	if (!state->dst)
 		return untranslatable(state, JSTAT_FAILED_ROUTES);
 
 	if (ipv6_addr_any(&flow6->saddr)) { /* empty pool6791v6 */
-		if (WARN(!xlator_is_siit(&state->jool),
+		if (WARN(!xlator_is_siit(state->jool),
 			 "Zero source address on not SIIT!"))
 			goto panic;
 		if (WARN(!pkt_is_icmp4_error(&state->in),
 			 "Zero source on not ICMP error!"))
 			goto panic;
 
-		if (ipv6_dev_get_saddr(state->jool.ns, NULL, &flow6->daddr,
+		if (ipv6_dev_get_saddr(state->jool->ns, NULL, &flow6->daddr,
 				       IPV6_PREFER_SRC_PUBLIC, &flow6->saddr)) {
 			log_warn_once("Can't find a sufficiently scoped primary source address to reach %pI6.",
 					&flow6->daddr);
@@ -528,6 +528,49 @@ fail:
 	return drop(state, JSTAT_ENOMEM);
 }
 
+/*
+ * Returns the number of bytes @skb's head needs to grow (or shrink, if
+ * negative) so its IPv4 header can be replaced by an IPv6 header.
+ */
+static int in_place_delta(struct sk_buff *skb)
+{
+	return (int)sizeof(struct ipv6hdr) - skb_transport_offset(skb);
+}
+
+/*
+ * Can @state->in be translated by rewriting its own headers?
+ *
+ * Only the common case is supported: Unfragmented TCP and UDP, in a packet
+ * nobody else is looking at, with enough headroom for the IPv6 header.
+ * Everything else needs to be translated into a copy.
+ */
+static bool ttp46_can_xlat_in_place(struct xlation *state)
+{
+	struct packet *in = &state->in;
+
+	if (state->is_hairpin)
+		return false;
+	if (skb_shared(in->skb) || skb_cloned(in->skb))
+		return false;
+	if (will_need_frag_hdr(pkt_ip4_hdr(in)))
+		return false;
+	if ((int)skb_headroom(in->skb) < in_place_delta(in->skb))
+		return false;
+
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+		return true;
+	case L4PROTO_UDP:
+		/* Zero checksums might need to be dropped. Let the copy do it. */
+		return pkt_udp_hdr(in)->check != 0;
+	case L4PROTO_ICMP:
+	case L4PROTO_OTHER:
+		break;
+	}
+
+	return false;
+}
+
 static void autofill_dst(struct xlation *state)
 {
 	struct sk_buff *skb;
@@ -691,7 +734,7 @@ static verdict ttp46_alloc_skb(struct xlation *state)
 #else
 	nexthop_mtu = 1500;
 #endif
-	lim = state->jool.globals.lowest_ipv6_mtu;
+	lim = state->jool->globals.lowest_ipv6_mtu;
 	mpl = min(nexthop_mtu, lim);
 	if (mpl < 1280) {
 		result = drop(state, JSTAT46_BAD_MTU);
@@ -714,6 +757,8 @@ static verdict ttp46_alloc_skb(struct xlation *state)
 			result = drop_icmp(state, JSTAT_PKT_TOO_BIG,
 					ICMPERR_FRAG_NEEDED,
 					max(576u, nexthop_mtu - 20u));
+		} else if (ttp46_can_xlat_in_place(state)) {
+			goto in_place;
 		} else {
 			result = allocate_fast(state, in->skb->ignore_df,
 					skb_shinfo(in->skb)->gso_size);
@@ -726,6 +771,9 @@ static verdict ttp46_alloc_skb(struct xlation *state)
 		 */
 		result = allocate_slow(state, mpl);
 
+	} else if (ttp46_can_xlat_in_place(state)) {
+		goto in_place;
+
 	} else {
 		/*
 		 * Dodged a bullet; no need to fragment further, we'll just
@@ -738,6 +786,12 @@ static verdict ttp46_alloc_skb(struct xlation *state)
 		goto fail;
 
 	autofill_dst(state);
+	jstat_inc(state->jool->stats, JSTAT46_COPY);
+	return VERDICT_CONTINUE;
+
+in_place:
+	/* ttp46_xlat_in_place() takes it from here. (Including dst.) */
+	state->in_place = true;
 	return VERDICT_CONTINUE;
 
 fail:
@@ -794,7 +848,7 @@ static bool has_unexpired_src_route(struct iphdr *hdr)
 /**
  * One-liner for creating the Identification field of the IPv6 Fragment header.
  */
-static inline __be32 build_id_field(struct iphdr *hdr4)
+static inline __be32 build_id_field(struct iphdr const *hdr4)
 {
 	return cpu_to_be32(be16_to_cpu(hdr4->id));
 }
@@ -834,16 +888,20 @@ static void autofill_hdr6(struct packet *out)
 	}
 }
 
-static verdict ttcp46_ipv6_common(struct xlation *state)
+/*
+ * @hdr4 is @state->in's IPv4 header. It's received separately because the
+ * in-place translation overrides the original.
+ */
+static verdict ttcp46_ipv6_common(struct xlation *state,
+		struct iphdr const *hdr4)
 {
 	struct packet *in = &state->in;
 	struct packet *out = &state->out;
-	struct iphdr *hdr4 = pkt_ip4_hdr(in);
 	struct ipv6hdr *hdr6 = pkt_ip6_hdr(out);
 	struct frag_hdr *frag_header;
 
 	hdr6->version = 6;
-	if (state->jool.globals.reset_traffic_class) {
+	if (state->jool->globals.reset_traffic_class) {
 		hdr6->priority = 0;
 		hdr6->flow_lbl[0] = 0;
 	} else {
@@ -881,22 +939,16 @@ static verdict ttcp46_ipv6_common(struct xlation *state)
 	return VERDICT_CONTINUE;
 }
 
-/* RFC 7915, section 4.1. */
-static verdict ttp46_ipv6_external(struct xlation *state)
+static verdict xlat46_ipv6_external(struct xlation *state,
+		struct iphdr const *hdr4)
 {
-	struct packet *in = &state->in;
 	struct packet *out = &state->out;
 	struct ipv6hdr *hdr6 = pkt_ip6_hdr(out);
 	verdict result;
 
-	if (pkt_is_outer(in) && has_unexpired_src_route(pkt_ip4_hdr(in))) {
-		log_debug(state, "Packet has an unexpired source route.");
-		return drop_icmp(state, JSTAT46_SRC_ROUTE, ICMPERR_SRC_ROUTE, 0);
-	}
-
 	hdr6->nexthdr = state->flowx.v6.flowi.flowi6_proto;
 
-	result = ttcp46_ipv6_common(state);
+	result = ttcp46_ipv6_common(state, hdr4);
 	if (result != VERDICT_CONTINUE)
 		return result;
 
@@ -915,6 +967,19 @@ static verdict ttp46_ipv6_external(struct xlation *state)
 	return VERDICT_CONTINUE;
 }
 
+/* RFC 7915, section 4.1. */
+static verdict ttp46_ipv6_external(struct xlation *state)
+{
+	struct packet *in = &state->in;
+
+	if (pkt_is_outer(in) && has_unexpired_src_route(pkt_ip4_hdr(in))) {
+		log_debug(state, "Packet has an unexpired source route.");
+		return drop_icmp(state, JSTAT46_SRC_ROUTE, ICMPERR_SRC_ROUTE, 0);
+	}
+
+	return xlat46_ipv6_external(state, pkt_ip4_hdr(in));
+}
+
 static verdict ttp46_ipv6_internal(struct xlation *state)
 {
 	struct packet *in = &state->in;
@@ -924,7 +989,7 @@ static verdict ttp46_ipv6_internal(struct xlation *state)
 
 	hdr6->nexthdr = xlat_nexthdr(pkt_ip4_hdr(in)->protocol);
 
-	result = ttcp46_ipv6_common(state);
+	result = ttcp46_ipv6_common(state, pkt_ip4_hdr(in));
 	if (result != VERDICT_CONTINUE)
 		return result;
 
@@ -960,8 +1025,8 @@ static __be32 icmp6_minimum_mtu(struct xlation *state,
 		 * Got to determine a likely path MTU.
 		 * See RFC 1191 sections 5, 7 and 7.1.
 		 */
-		__u16 *plateaus = state->jool.globals.plateaus.values;
-		__u16 count = state->jool.globals.plateaus.count;
+		__u16 *plateaus = state->jool->globals.plateaus.values;
+		__u16 count = state->jool->globals.plateaus.count;
 		int i;
 
 		for (i = 0; i < count; i++) {
@@ -1363,8 +1428,8 @@ static __sum16 skb_list_csum(struct sk_buff *out, __u8 proto)
  * L4 header. Input and result are folded.
  */
 static __sum16 update_csum_4to6(__sum16 csum16,
-		struct iphdr *in_ip4, void *in_l4_hdr,
-		struct ipv6hdr *out_ip6, void *out_l4_hdr,
+		struct iphdr const *in_ip4, void const *in_l4_hdr,
+		struct ipv6hdr const *out_ip6, void const *out_l4_hdr,
 		size_t l4_hdr_len)
 {
 	__wsum csum, pseudohdr_csum;
@@ -1410,7 +1475,7 @@ static bool can_compute_csum(struct xlation *state)
 	 * don't like it: https://github.com/NICMx/Jool/pull/129
 	 */
 	hdr4 = pkt_ip4_hdr(&state->in);
-	amend_csum0 = state->jool.globals.siit.compute_udp_csum_zero;
+	amend_csum0 = state->jool->globals.siit.compute_udp_csum_zero;
 	if (is_mf_set_ipv4(hdr4) || !amend_csum0) {
 		hdr_udp = pkt_udp_hdr(&state->in);
 		log_debug(state, "Dropping zero-checksum UDP packet: %pI4#%u->%pI4#%u",
@@ -1422,29 +1487,31 @@ static bool can_compute_csum(struct xlation *state)
 	return true;
 }
 
-static verdict ttp46_tcp(struct xlation *state)
+/*
+ * @hdr4 and @tcp_in are @state->in's headers. They're received separately
+ * because the in-place translation overrides the originals.
+ * Assumes the rest of the TCP header has already been copied to @state->out.
+ */
+static void xlat46_tcp(struct xlation *state, struct iphdr const *hdr4,
+		struct tcphdr const *tcp_in)
 {
-	struct packet *in = &state->in;
 	struct packet *out = &state->out;
-	struct tcphdr *tcp_in = pkt_tcp_hdr(in);
 	struct tcphdr *tcp_out = pkt_tcp_hdr(out);
 	struct tcphdr tcp_copy;
 
-	/* Header */
-	memcpy(tcp_out, tcp_in, pkt_l4hdr_len(in));
 	if (xlation_is_nat64(state)) {
 		tcp_out->source = get_src_port46(state);
 		tcp_out->dest = get_dst_port46(state);
 	}
 
 	/* Header.checksum */
-	if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
+	if (state->in.skb->ip_summed != CHECKSUM_PARTIAL) {
 		memcpy(&tcp_copy, tcp_in, sizeof(*tcp_in));
 		tcp_copy.check = 0;
 
 		tcp_out->check = 0;
 		tcp_out->check = update_csum_4to6(tcp_in->check,
-				pkt_ip4_hdr(in), &tcp_copy,
+				hdr4, &tcp_copy,
 				pkt_ip6_hdr(out), tcp_out,
 				sizeof(*tcp_out));
 
@@ -1458,20 +1525,28 @@ static verdict ttp46_tcp(struct xlation *state)
 				&pkt_ip6_hdr(out)->daddr, 0);
 		partialize_skb(out->skb, offsetof(struct tcphdr, check));
 	}
+}
+
+static verdict ttp46_tcp(struct xlation *state)
+{
+	struct packet *in = &state->in;
+	struct tcphdr *tcp_in = pkt_tcp_hdr(in);
+
+	/* Header */
+	memcpy(pkt_tcp_hdr(&state->out), tcp_in, pkt_l4hdr_len(in));
+	xlat46_tcp(state, pkt_ip4_hdr(in), tcp_in);
 
 	return VERDICT_CONTINUE;
 }
 
-static verdict ttp46_udp(struct xlation *state)
+/* Same as xlat46_tcp(), but UDP. */
+static verdict xlat46_udp(struct xlation *state, struct iphdr const *hdr4,
+		struct udphdr const *udp_in)
 {
-	struct packet *in = &state->in;
 	struct packet *out = &state->out;
-	struct udphdr *udp_in = pkt_udp_hdr(in);
 	struct udphdr *udp_out = pkt_udp_hdr(out);
 	struct udphdr udp_copy;
 
-	/* Header */
-	memcpy(udp_out, udp_in, pkt_l4hdr_len(in));
 	if (xlation_is_nat64(state)) {
 		udp_out->source = get_src_port46(state);
 		udp_out->dest = get_dst_port46(state);
@@ -1485,13 +1560,13 @@ static verdict ttp46_udp(struct xlation *state)
 		return drop_icmp(state, JSTAT46_FRAGMENTED_ZERO_CSUM,
 				ICMPERR_FILTER, 0);
 
-	} else if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
+	} else if (state->in.skb->ip_summed != CHECKSUM_PARTIAL) {
 		memcpy(&udp_copy, udp_in, sizeof(*udp_in));
 		udp_copy.check = 0;
 
 		udp_out->check = 0;
 		udp_out->check = update_csum_4to6(udp_in->check,
-				pkt_ip4_hdr(in), &udp_copy,
+				hdr4, &udp_copy,
 				pkt_ip6_hdr(out), udp_out,
 				sizeof(*udp_out));
 
@@ -1513,8 +1588,106 @@ partial:
 	return VERDICT_CONTINUE;
 }
 
+static verdict ttp46_udp(struct xlation *state)
+{
+	struct packet *in = &state->in;
+	struct udphdr *udp_in = pkt_udp_hdr(in);
+
+	/* Header */
+	memcpy(pkt_udp_hdr(&state->out), udp_in, pkt_l4hdr_len(in));
+	return xlat46_udp(state, pkt_ip4_hdr(in), udp_in);
+}
+
+/*
+ * Translates @state->in into @state->out by replacing its IPv4 header with an
+ * IPv6 one. (See ttp46_can_xlat_in_place().)
+ *
+ * The IPv6 header is written right before the (untouched) L4 header, growing
+ * into the headroom as needed. Everything that can fail is done before that.
+ */
+static verdict ttp46_xlat_in_place(struct xlation *state)
+{
+	struct packet *in = &state->in;
+	struct sk_buff *skb = in->skb;
+	struct iphdr hdr4;
+	union {
+		struct tcphdr tcp;
+		struct udphdr udp;
+	} l4hdr;
+	l4_protocol l4_proto;
+	unsigned int l4hdr_len;
+	struct skb_shared_info *shinfo;
+	int delta;
+	verdict result;
+
+	if (has_unexpired_src_route(pkt_ip4_hdr(in))) {
+		log_debug(state, "Packet has an unexpired source route.");
+		result = drop_icmp(state, JSTAT46_SRC_ROUTE, ICMPERR_SRC_ROUTE, 0);
+		goto fail;
+	}
+	if (pkt_ip4_hdr(in)->ttl <= 1) {
+		log_debug(state, "Packet's TTL <= 1.");
+		result = drop_icmp(state, JSTAT46_TTL, ICMPERR_TTL, 0);
+		goto fail;
+	}
+
+	/* Point of no return; @in is about to stop existing. */
+	hdr4 = *pkt_ip4_hdr(in);
+	l4_proto = pkt_l4_proto(in);
+	l4hdr_len = pkt_l4hdr_len(in);
+	if (l4_proto == L4PROTO_TCP)
+		l4hdr.tcp = *pkt_tcp_hdr(in);
+	else
+		l4hdr.udp = *pkt_udp_hdr(in);
+
+	delta = in_place_delta(skb);
+	if (delta > 0)
+		skb_push(skb, delta);
+	else
+		skb_pull(skb, -delta);
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+	skb_set_transport_header(skb, sizeof(struct ipv6hdr));
+
+	pkt_fill(&state->out, skb, L3PROTO_IPV6, l4_proto,
+			NULL, skb_transport_header(skb) + l4hdr_len,
+			pkt_original_pkt(in));
+
+	skb_cleanup_copy(skb);
+	memset(skb->cb, 0, sizeof(skb->cb));
+	/* Same as allocate_fast()'s @ignore_df. */
+	if (!is_df_set(&hdr4))
+		skb->ignore_df = false;
+	skb->protocol = htons(ETH_P_IPV6);
+
+	shinfo = skb_shinfo(skb);
+	if (shinfo->gso_type & SKB_GSO_TCPV4) {
+		shinfo->gso_type &= ~SKB_GSO_TCPV4;
+		shinfo->gso_type |= SKB_GSO_TCPV6;
+	}
+
+	skb_dst_drop(skb);
+	autofill_dst(state);
+
+	/* These cannot fail; the checks above already weeded the bad ones. */
+	xlat46_ipv6_external(state, &hdr4);
+	if (l4_proto == L4PROTO_TCP)
+		xlat46_tcp(state, &hdr4, &l4hdr.tcp);
+	else
+		xlat46_udp(state, &hdr4, &l4hdr.udp);
+
+	jstat_inc(state->jool->stats, JSTAT46_IN_PLACE);
+	return VERDICT_CONTINUE;
+
+fail:
+	dst_release(state->dst);
+	state->dst = NULL;
+	return result;
+}
+
 const struct translation_steps ttp46_steps = {
 	.skb_alloc = ttp46_alloc_skb,
+	.xlat_in_place = ttp46_xlat_in_place,
 	.xlat_outer_l3 = ttp46_ipv6_external,
 	.xlat_inner_l3 = ttp46_ipv6_internal,
 	.xlat_tcp = ttp46_tcp,
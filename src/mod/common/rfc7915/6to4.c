@@ -32,7 +32,7 @@ static verdict xlat64_external_addresses(struct xlation *state)
 {
 	struct flowi4 *flow = &state->flowx.v4.flowi;
 
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		flow->saddr = state->out.tuple.src.addr4.l3.s_addr;
 		flow->daddr = state->out.tuple.dst.addr4.l3.s_addr;
@@ -43,7 +43,7 @@ static verdict xlat64_external_addresses(struct xlation *state)
 	}
 
 	WARN(1, "xlator type is not SIIT nor NAT64: %u",
-			xlator_get_type(&state->jool));
+			xlator_get_type(state->jool));
 	return drop(state, JSTAT_UNKNOWN);
 }
 
@@ -55,7 +55,7 @@ static verdict xlat64_internal_addresses(struct xlation *state)
 	if (pkt_is_inner(&state->in))
 		return VERDICT_CONTINUE; /* Called from xlat64_icmp_type() */
 
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		state->flowx.v4.inner_src = state->out.tuple.dst.addr4.l3;
 		state->flowx.v4.inner_dst = state->out.tuple.src.addr4.l3;
@@ -74,7 +74,7 @@ static verdict xlat64_internal_addresses(struct xlation *state)
 	}
 
 	WARN(1, "xlator type is not SIIT nor NAT64: %u",
-			xlator_get_type(&state->jool));
+			xlator_get_type(state->jool));
 	return drop(state, JSTAT_UNKNOWN);
 }
 
@@ -85,7 +85,7 @@ static verdict xlat64_tcp_ports(struct xlation *state)
 	struct tcphdr const *hdr;
 
 	flow4 = &state->flowx.v4.flowi;
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		flow4->fl4_sport = cpu_to_be16(state->out.tuple.src.addr4.l4);
 		flow4->fl4_dport = cpu_to_be16(state->out.tuple.dst.addr4.l4);
@@ -109,7 +109,7 @@ static verdict xlat64_udp_ports(struct xlation *state)
 	struct udphdr const *udp;
 
 	flow4 = &state->flowx.v4.flowi;
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		flow4->fl4_sport = cpu_to_be16(state->out.tuple.src.addr4.l4);
 		flow4->fl4_dport = cpu_to_be16(state->out.tuple.dst.addr4.l4);
@@ -203,7 +203,7 @@ static verdict compute_flowix64(struct xlation *state)
 	hdr6 = pkt_ip6_hdr(&state->in);
 
 	flow4->flowi4_mark = state->in.skb->mark;
-	flow4->flowi4_tos = xlat_tos(&state->jool.globals, hdr6);
+	flow4->flowi4_tos = xlat_tos(&state->jool->globals, hdr6);
 	flow4->flowi4_scope = RT_SCOPE_UNIVERSE;
 	flow4->flowi4_proto = xlat_proto(hdr6);
 	/*
@@ -254,7 +254,7 @@ static verdict select_any_saddr(struct xlation *state)
 #endif
 
 	rcu_read_lock();
-	for_each_netdev_rcu(state->jool.ns, dev) {
+	for_each_netdev_rcu(state->jool->ns, dev) {
 		in_dev = __in_dev_get_rcu(dev);
 		if (!in_dev)
 			continue;
@@ -307,7 +307,7 @@ static verdict __predict_route64(struct xlation *state)
 		log_debug(state, "Packet is hairpinning; skipping routing.");
 	} else {
 		log_debug(state, "Routing: %pI4->%pI4", &flow4->saddr, &flow4->daddr);
-		state->dst = route4(&state->jool, flow4);
+		state->dst = route4(state->jool, flow4);
 		if (!state->dst)
 			return untranslatable(state, JSTAT_FAILED_ROUTES);
 	}
@@ -427,6 +427,36 @@ static verdict validate_size(struct xlation *state)
 	return drop(state, JSTAT_UNKNOWN);
 }
 
+/*
+ * Can @state->in be translated by rewriting its own headers?
+ *
+ * Only the common case is supported: Unfragmented TCP and UDP, in a packet
+ * nobody else is looking at. Everything else needs to be translated into a
+ * copy.
+ */
+static bool ttp64_can_xlat_in_place(struct xlation const *state)
+{
+	struct packet const *in = &state->in;
+
+	if (state->is_hairpin)
+		return false;
+	if (skb_shared(in->skb) || skb_cloned(in->skb))
+		return false;
+	if (pkt_frag_hdr(in))
+		return false;
+
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+	case L4PROTO_UDP:
+		return true;
+	case L4PROTO_ICMP:
+	case L4PROTO_OTHER:
+		break;
+	}
+
+	return false;
+}
+
 static verdict ttp64_alloc_skb(struct xlation *state)
 {
 	struct packet const *in = &state->in;
@@ -441,6 +471,12 @@ static verdict ttp64_alloc_skb(struct xlation *state)
 	if (result != VERDICT_CONTINUE)
 		goto revert;
 
+	if (ttp64_can_xlat_in_place(state)) {
+		/* ttp64_xlat_in_place() takes it from here. (Including dst.) */
+		state->in_place = true;
+		return VERDICT_CONTINUE;
+	}
+
 	/*
 	 * pskb_copy() is more efficient than allocating a new packet, because
 	 * it shares (not copies) the original's paged data with the copy. This
@@ -511,6 +547,8 @@ static verdict ttp64_alloc_skb(struct xlation *state)
 		skb_dst_set(out, state->dst);
 		state->dst = NULL;
 	}
+
+	jstat_inc(state->jool->stats, JSTAT64_COPY);
 	return VERDICT_CONTINUE;
 
 revert:
@@ -530,7 +568,7 @@ static void generate_ipv4_id(struct xlation const *state, struct iphdr *hdr4,
 	if (hdr_frag) {
 		hdr4->id = cpu_to_be16(be32_to_cpu(hdr_frag->identification));
 	} else {
-		__ip_select_ident(state->jool.ns, hdr4, 1);
+		__ip_select_ident(state->jool->ns, hdr4, 1);
 	}
 }
 
@@ -614,17 +652,9 @@ static bool has_nonzero_segments_left(struct ipv6hdr const *hdr6,
 	return true;
 }
 
-/**
- * Translates @state->in's IPv6 header into @state->out's IPv4 header.
- * Only used for external IPv6 headers. (ie. not enclosed in ICMP errors.)
- * RFC 7915 sections 5.1 and 5.1.1.
- */
-static verdict ttp64_ipv4_external(struct xlation *state)
+static verdict validate_ipv6_external(struct xlation *state)
 {
 	struct ipv6hdr const *hdr6;
-	struct iphdr *hdr4;
-	struct frag_hdr const *hdr_frag;
-	struct flowi4 *flow4;
 	__u32 nonzero_location;
 
 	hdr6 = pkt_ip6_hdr(&state->in);
@@ -639,8 +669,20 @@ static verdict ttp64_ipv4_external(struct xlation *state)
 				ICMPERR_HDR_FIELD, nonzero_location);
 	}
 
+	return VERDICT_CONTINUE;
+}
+
+/*
+ * @hdr6 and @hdr_frag are @state->in's headers. They're received separately
+ * because the in-place translation overrides the originals.
+ */
+static void xlat64_ipv4_external(struct xlation *state,
+		struct ipv6hdr const *hdr6, struct frag_hdr const *hdr_frag)
+{
+	struct iphdr *hdr4;
+	struct flowi4 *flow4;
+
 	hdr4 = pkt_ip4_hdr(&state->out);
-	hdr_frag = pkt_frag_hdr(&state->in);
 	flow4 = &state->flowx.v4.flowi;
 
 	hdr4->version = 4;
@@ -656,7 +698,23 @@ static verdict ttp64_ipv4_external(struct xlation *state)
 	hdr4->daddr = flow4->daddr;
 	hdr4->check = 0;
 	hdr4->check = ip_fast_csum(hdr4, hdr4->ihl);
+}
+
+/**
+ * Translates @state->in's IPv6 header into @state->out's IPv4 header.
+ * Only used for external IPv6 headers. (ie. not enclosed in ICMP errors.)
+ * RFC 7915 sections 5.1 and 5.1.1.
+ */
+static verdict ttp64_ipv4_external(struct xlation *state)
+{
+	verdict result;
 
+	result = validate_ipv6_external(state);
+	if (result != VERDICT_CONTINUE)
+		return result;
+
+	xlat64_ipv4_external(state, pkt_ip6_hdr(&state->in),
+			pkt_frag_hdr(&state->in));
 	return VERDICT_CONTINUE;
 }
 
@@ -673,7 +731,7 @@ static verdict ttp64_ipv4_internal(struct xlation *state)
 
 	hdr4->version = 4;
 	hdr4->ihl = 5;
-	hdr4->tos = xlat_tos(&state->jool.globals, hdr6);
+	hdr4->tos = xlat_tos(&state->jool->globals, hdr6);
 	hdr4->tot_len = cpu_to_be16(get_tot_len_ipv6(in->skb) - pkt_hdrs_len(in)
 			+ pkt_hdrs_len(out));
 	generate_ipv4_id(state, hdr4, hdr_frag);
@@ -1095,29 +1153,31 @@ static __sum16 update_csum_6to4(__sum16 csum16,
 	return csum_fold(csum);
 }
 
-static verdict ttp64_tcp(struct xlation *state)
+/*
+ * @hdr6 and @tcp_in are @state->in's headers. They're received separately
+ * because the in-place translation overrides the originals.
+ * Assumes the rest of the TCP header has already been copied to @state->out.
+ */
+static void xlat64_tcp(struct xlation *state, struct ipv6hdr const *hdr6,
+		struct tcphdr const *tcp_in)
 {
-	struct packet const *in = &state->in;
 	struct packet *out = &state->out;
-	struct tcphdr const *tcp_in = pkt_tcp_hdr(in);
 	struct tcphdr *tcp_out = pkt_tcp_hdr(out);
 	struct tcphdr tcp_copy;
 
-	/* Header */
-	memcpy(tcp_out, tcp_in, pkt_l4hdr_len(in));
 	if (xlation_is_nat64(state)) {
 		tcp_out->source = get_src_port64(state);
 		tcp_out->dest = get_dst_port64(state);
 	}
 
 	/* Header.checksum */
-	if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
+	if (out->skb->ip_summed != CHECKSUM_PARTIAL) {
 		memcpy(&tcp_copy, tcp_in, sizeof(*tcp_in));
 		tcp_copy.check = 0;
 
 		tcp_out->check = 0;
 		tcp_out->check = update_csum_6to4(tcp_in->check,
-				pkt_ip6_hdr(in), &tcp_copy, sizeof(tcp_copy),
+				hdr6, &tcp_copy, sizeof(tcp_copy),
 				pkt_ip4_hdr(out), tcp_out, sizeof(*tcp_out));
 		out->skb->ip_summed = CHECKSUM_NONE;
 
@@ -1127,33 +1187,41 @@ static verdict ttp64_tcp(struct xlation *state)
 				pkt_ip4_hdr(out)->daddr, 0);
 		partialize_skb(out->skb, offsetof(struct tcphdr, check));
 	}
+}
+
+static verdict ttp64_tcp(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct tcphdr const *tcp_in = pkt_tcp_hdr(in);
+
+	/* Header */
+	memcpy(pkt_tcp_hdr(&state->out), tcp_in, pkt_l4hdr_len(in));
+	xlat64_tcp(state, pkt_ip6_hdr(in), tcp_in);
 
 	return VERDICT_CONTINUE;
 }
 
-static verdict ttp64_udp(struct xlation *state)
+/* Same as xlat64_tcp(), but UDP. */
+static void xlat64_udp(struct xlation *state, struct ipv6hdr const *hdr6,
+		struct udphdr const *udp_in)
 {
-	struct packet const *in = &state->in;
 	struct packet *out = &state->out;
-	struct udphdr const *udp_in = pkt_udp_hdr(in);
 	struct udphdr *udp_out = pkt_udp_hdr(out);
 	struct udphdr udp_copy;
 
-	/* Header */
-	memcpy(udp_out, udp_in, pkt_l4hdr_len(in));
 	if (xlation_is_nat64(state)) {
 		udp_out->source = get_src_port64(state);
 		udp_out->dest = get_dst_port64(state);
 	}
 
 	/* Header.checksum */
-	if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
+	if (out->skb->ip_summed != CHECKSUM_PARTIAL) {
 		memcpy(&udp_copy, udp_in, sizeof(*udp_in));
 		udp_copy.check = 0;
 
 		udp_out->check = 0;
 		udp_out->check = update_csum_6to4(udp_in->check,
-				pkt_ip6_hdr(in), &udp_copy, sizeof(udp_copy),
+				hdr6, &udp_copy, sizeof(udp_copy),
 				pkt_ip4_hdr(out), udp_out, sizeof(*udp_out));
 		if (udp_out->check == 0)
 			udp_out->check = CSUM_MANGLED_0;
@@ -1165,12 +1233,97 @@ static verdict ttp64_udp(struct xlation *state)
 				pkt_ip4_hdr(out)->daddr, 0);
 		partialize_skb(out->skb, offsetof(struct udphdr, check));
 	}
+}
+
+static verdict ttp64_udp(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct udphdr const *udp_in = pkt_udp_hdr(in);
+
+	/* Header */
+	memcpy(pkt_udp_hdr(&state->out), udp_in, pkt_l4hdr_len(in));
+	xlat64_udp(state, pkt_ip6_hdr(in), udp_in);
+
+	return VERDICT_CONTINUE;
+}
+
+/*
+ * Translates @state->in into @state->out by replacing its IPv6 header with an
+ * IPv4 one. (See ttp64_can_xlat_in_place().)
+ *
+ * The IPv4 header is shorter, so it's written at the tail of the IPv6 header
+ * area, right before the (untouched) L4 header. Everything that can fail is
+ * done before that.
+ */
+static verdict ttp64_xlat_in_place(struct xlation *state)
+{
+	struct packet *in = &state->in;
+	struct sk_buff *skb = in->skb;
+	struct ipv6hdr hdr6;
+	union {
+		struct tcphdr tcp;
+		struct udphdr udp;
+	} l4hdr;
+	l4_protocol l4_proto;
+	unsigned int l4hdr_len;
+	struct skb_shared_info *shinfo;
+	verdict result;
+
+	result = validate_ipv6_external(state);
+	if (result != VERDICT_CONTINUE) {
+		dst_release(state->dst);
+		state->dst = NULL;
+		return result;
+	}
+
+	/* Point of no return; @in is about to stop existing. */
+	hdr6 = *pkt_ip6_hdr(in);
+	l4_proto = pkt_l4_proto(in);
+	l4hdr_len = pkt_l4hdr_len(in);
+	if (l4_proto == L4PROTO_TCP)
+		l4hdr.tcp = *pkt_tcp_hdr(in);
+	else
+		l4hdr.udp = *pkt_udp_hdr(in);
+
+	skb_pull(skb, skb_transport_offset(skb) - sizeof(struct iphdr));
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+	skb_set_transport_header(skb, sizeof(struct iphdr));
+
+	pkt_fill(&state->out, skb, L3PROTO_IPV4, l4_proto,
+			NULL, skb_transport_header(skb) + l4hdr_len,
+			pkt_original_pkt(in));
+
+	skb_cleanup_copy(skb);
+	memset(skb->cb, 0, sizeof(skb->cb));
+	skb->mark = state->flowx.v4.flowi.flowi4_mark;
+	skb->protocol = htons(ETH_P_IP);
+
+	shinfo = skb_shinfo(skb);
+	if (shinfo->gso_type & SKB_GSO_TCPV6) {
+		shinfo->gso_type &= ~SKB_GSO_TCPV6;
+		shinfo->gso_type |= SKB_GSO_TCPV4;
+	}
+
+	skb_dst_drop(skb);
+	if (state->dst) {
+		skb_dst_set(skb, state->dst);
+		state->dst = NULL;
+	}
+
+	xlat64_ipv4_external(state, &hdr6, NULL);
+	if (l4_proto == L4PROTO_TCP)
+		xlat64_tcp(state, &hdr6, &l4hdr.tcp);
+	else
+		xlat64_udp(state, &hdr6, &l4hdr.udp);
 
+	jstat_inc(state->jool->stats, JSTAT64_IN_PLACE);
 	return VERDICT_CONTINUE;
 }
 
 const struct translation_steps ttp64_steps = {
 	.skb_alloc = ttp64_alloc_skb,
+	.xlat_in_place = ttp64_xlat_in_place,
 	.xlat_outer_l3 = ttp64_ipv4_external,
 	.xlat_inner_l3 = ttp64_ipv4_internal,
 	.xlat_tcp = ttp64_tcp,
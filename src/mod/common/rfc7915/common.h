@@ -32,8 +32,23 @@ struct translation_steps {
 	 *
 	 * There's also the issue that the incoming packet might not have enough
 	 * room for the header length expansion from v4 to v6.
+	 *
+	 * That said, the copy is one of the most expensive things we do per
+	 * packet, so if the incoming packet is writable and simple enough for
+	 * all the validations to be performed before its headers are touched,
+	 * this function instead only routes, and raises @state->in_place.
+	 * @xlat_in_place then takes over.
 	 */
 	skb_alloc_fn skb_alloc;
+	/**
+	 * Translates the incoming packet by rewriting its own headers.
+	 * Only used if @skb_alloc raised @state->in_place.
+	 *
+	 * Either fails before modifying anything, or succeeds. If it succeeds,
+	 * @state->out.skb becomes @state->in.skb, and @state->in can no longer
+	 * be used.
+	 */
+	header_xlat_fn xlat_in_place;
 	/** The function that will translate the external IP header. */
 	header_xlat_fn xlat_outer_l3;
 	/**
@@ -57,7 +57,7 @@ verdict translating_the_packet(struct xlation *state)
 	struct translation_steps const *steps;
 	verdict result;
 
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		log_debug(state, "Step 4: Translating the Packet");
 		break;
@@ -81,6 +81,12 @@ verdict translating_the_packet(struct xlation *state)
 	result = steps->skb_alloc(state);
 	if (result != VERDICT_CONTINUE)
 		return result;
+	if (state->in_place) {
+		result = steps->xlat_in_place(state);
+		if (result != VERDICT_CONTINUE)
+			return result;
+		goto success;
+	}
 	result = steps->xlat_outer_l3(state);
 	if (result != VERDICT_CONTINUE)
 		goto revert;
@@ -90,6 +96,7 @@ verdict translating_the_packet(struct xlation *state)
 			goto revert;
 	}
 
+success:
 	if (xlation_is_nat64(state))
 		log_debug(state, "Done step 4.");
 	return VERDICT_CONTINUE;
@@ -15,7 +15,7 @@ static verdict find_bib(struct xlation *state)
 	if (state->entries.bib_set)
 		return VERDICT_CONTINUE;
 
-	error = bib_find(state->jool.nat64.bib, &state->in.tuple,
+	error = bib_find(state->jool->nat64.bib, &state->in.tuple,
 			&state->entries);
 	if (error) {
 		/*
@@ -35,7 +35,7 @@ static int xlat_addr64(struct xlation *state, struct ipv4_transport_addr *addr4)
 	struct ipv6_transport_addr *d = &state->in.tuple.dst.addr6;
 
 	addr4->l4 = d->l4;
-	return __rfc6052_6to4(&state->jool.globals.pool6.prefix,
+	return __rfc6052_6to4(&state->jool->globals.pool6.prefix,
 			&d->l3, &addr4->l3);
 }
 
@@ -45,7 +45,7 @@ static int xlat_addr46(struct xlation *state, struct ipv6_transport_addr *addr6)
 	struct ipv4_transport_addr *s = &state->in.tuple.src.addr4;
 
 	addr6->l4 = s->l4;
-	return __rfc6052_4to6(&state->jool.globals.pool6.prefix,
+	return __rfc6052_4to6(&state->jool->globals.pool6.prefix,
 			&s->l3, &addr6->l3);
 }
 
@@ -14,7 +14,7 @@ verdict translate_addrs64_siit(struct xlation *state, __be32 *src_out,
 	struct addrxlat_result addr_result;
 
 	/* Dst address. (SRC DEPENDS CON DST, SO WE NEED TO XLAT DST FIRST!) */
-	addr_result = addrxlat_siit64(&state->jool, &hdr6->daddr, &dst, true);
+	addr_result = addrxlat_siit64(state->jool, &hdr6->daddr, &dst, true);
 	if (addr_result.reason) {
 		log_debug(state, "Unable to translate %pI6c: %s", &hdr6->daddr,
 				addr_result.reason);
@@ -33,7 +33,7 @@ verdict translate_addrs64_siit(struct xlation *state, __be32 *src_out,
 	}
 
 	/* Src address. */
-	addr_result = addrxlat_siit64(&state->jool, &hdr6->saddr, &src,
+	addr_result = addrxlat_siit64(state->jool, &hdr6->saddr, &src,
 			!pkt_is_icmp6_error(&state->in));
 	if (addr_result.reason) {
 		log_debug(state, "Unable to translate %pI6c: %s", &hdr6->saddr,
@@ -63,8 +63,8 @@ verdict translate_addrs64_siit(struct xlation *state, __be32 *src_out,
 	 * Why here? It's the only place where we know whether RFC 6052 was
 	 * involved.
 	 */
-	if (state->jool.globals.siit.eam_hairpin_mode == EHM_INTRINSIC) {
-		struct eam_table *eamt = state->jool.siit.eamt;
+	if (state->jool->globals.siit.eam_hairpin_mode == EHM_INTRINSIC) {
+		struct eam_table *eamt = state->jool->siit.eamt;
 		/* Condition set A */
 		if (pkt_is_outer(&state->in) && !pkt_is_icmp6_error(&state->in)
 				&& (dst.entry.method == AXM_RFC6052)
@@ -110,12 +110,12 @@ verdict translate_addrs46_siit(struct xlation *state, struct in6_addr *src_out,
 	struct result_addrxlat46 addr6;
 	struct addrxlat_result addr_result;
 
-	is_hairpin = (state->jool.globals.siit.eam_hairpin_mode == EHM_SIMPLE)
+	is_hairpin = (state->jool->globals.siit.eam_hairpin_mode == EHM_SIMPLE)
 			|| state->is_hairpin;
 
 	/* Dst address. (SRC DEPENDS CON DST, SO WE NEED TO XLAT DST FIRST!) */
 
-	addr_result = addrxlat_siit46(&state->jool, hdr4->daddr, &addr6,
+	addr_result = addrxlat_siit46(state->jool, hdr4->daddr, &addr6,
 			!disable_dst_eam(in, is_hairpin), true);
 	if (addr_result.reason) {
 		log_debug(state, "Unable to translate %pI4: %s", &hdr4->daddr,
@@ -134,7 +134,7 @@ verdict translate_addrs46_siit(struct xlation *state, struct in6_addr *src_out,
 	}
 
 	/* Src address. */
-	addr_result = addrxlat_siit46(&state->jool, hdr4->saddr, &addr6,
+	addr_result = addrxlat_siit46(state->jool, hdr4->saddr, &addr6,
 			!disable_src_eam(in, is_hairpin),
 			!pkt_is_icmp4_error(in));
 	if (addr_result.reason) {
@@ -92,7 +92,7 @@ static verdict succeed(struct xlation *state)
 	 * So let's simplify everything by just joold_add()ing here.
 	 */
 	if (state->entries.session_set)
-		joold_add(&state->jool, &state->entries.session);
+		joold_add(state->jool, &state->entries.session);
 
 	return VERDICT_CONTINUE;
 }
@@ -104,7 +104,7 @@ static int xlat_dst_6to4(struct xlation *state,
 		struct ipv4_transport_addr *dst4)
 {
 	dst4->l4 = state->in.tuple.dst.addr6.l4;
-	return __rfc6052_6to4(&state->jool.globals.pool6.prefix,
+	return __rfc6052_6to4(&state->jool->globals.pool6.prefix,
 			&state->in.tuple.dst.addr6.l3, &dst4->l3);
 }
 
@@ -120,7 +120,7 @@ static int xlat_dst_6to4(struct xlation *state,
 static verdict ipv6_simple(struct xlation *state)
 {
 	struct ipv4_transport_addr dst4;
-	struct mask_domain *masks;
+	struct mask_domain masks;
 	int error;
 	verdict result;
 
@@ -133,13 +133,17 @@ static verdict ipv6_simple(struct xlation *state)
 		return result;
 	}
 
-	error = bib_add6(state, masks, &state->in.tuple, &dst4);
+	error = bib_add6(state, &masks, &state->in.tuple, &dst4);
 
-	mask_domain_put(masks);
+	mask_domain_put(&masks);
 
 	switch (error) {
 	case 0:
 		return succeed(state);
+	case -EDQUOT:
+	case -ENOSPC:
+		/* Already counted. */
+		return VERDICT_DROP;
 	default:
 		/*
 		 * Error msg already printed, but since bib_add6() sprawls
@@ -168,15 +172,15 @@ static verdict ipv4_simple(struct xlation *state)
 	 * We're inheriting this naming quirk from the RFC.
 	 */
 	struct ipv4_transport_addr *dst4 = &state->in.tuple.src.addr4;
-	struct ipv6_transport_addr dst6;
+	struct in6_addr dst6;
 	int error;
 
-	if (__rfc6052_4to6(&state->jool.globals.pool6.prefix,
-			&dst4->l3, &dst6.l3))
+	/* The BIB derives the session's dst6 out of dst4 later. */
+	if (__rfc6052_4to6(&state->jool->globals.pool6.prefix,
+			&dst4->l3, &dst6))
 		return drop(state, JSTAT_UNTRANSLATABLE_DST4);
-	dst6.l4 = dst4->l4;
 
-	error = bib_add4(state, &dst6, &state->in.tuple);
+	error = bib_add4(state, &state->in.tuple);
 
 	switch (error) {
 	case 0:
@@ -188,6 +192,10 @@ static verdict ipv4_simple(struct xlation *state)
 	case -EPERM:
 		log_debug(state, "Packet was blocked by Address-Dependent Filtering.");
 		return drop_icmp(state, JSTAT_ADF, ICMPERR_FILTER, 0);
+	case -EDQUOT:
+	case -ENOSPC:
+		/* Already counted. */
+		return VERDICT_DROP;
 	default:
 		log_debug(state, "Errcode %d while finding a BIB entry.", error);
 		return drop(state, JSTAT_UNKNOWN);
@@ -331,7 +339,7 @@ static enum session_fate tcp_established_state(struct session_entry *session,
 
 static bool handle_rst_during_fin_rcv(struct xlation *state)
 {
-	return state->jool.globals.nat64.handle_rst_during_fin_rcv;
+	return state->jool->globals.nat64.handle_rst_during_fin_rcv;
 }
 
 /**
@@ -438,7 +446,7 @@ static verdict ipv6_tcp(struct xlation *state)
 {
 	struct ipv4_transport_addr dst4;
 	struct collision_cb cb;
-	struct mask_domain *masks;
+	struct mask_domain masks;
 	verdict result;
 
 	if (xlat_dst_6to4(state, &dst4))
@@ -452,9 +460,9 @@ static verdict ipv6_tcp(struct xlation *state)
 
 	cb.cb = tcp_state_machine;
 	cb.arg = state;
-	result = bib_add_tcp6(state, masks, &dst4, &cb);
+	result = bib_add_tcp6(state, &masks, &dst4, &cb);
 
-	mask_domain_put(masks);
+	mask_domain_put(&masks);
 
 	return (result == VERDICT_CONTINUE) ? succeed(state) : result;
 }
@@ -469,7 +477,7 @@ static verdict ipv4_tcp(struct xlation *state)
 	struct collision_cb cb;
 	verdict result;
 
-	if (__rfc6052_4to6(&state->jool.globals.pool6.prefix,
+	if (__rfc6052_4to6(&state->jool->globals.pool6.prefix,
 			&dst4->l3, &dst6.l3))
 		return drop(state, JSTAT_UNTRANSLATABLE_DST4);
 	dst6.l4 = dst4->l4;
@@ -482,7 +490,7 @@ static verdict ipv4_tcp(struct xlation *state)
 }
 
 #define pool6_contains(state, addr) \
-	prefix6_contains(&(state)->jool.globals.pool6.prefix, addr)
+	prefix6_contains(&(state)->jool->globals.pool6.prefix, addr)
 
 /**
  * filtering_and_updating - Main F&U routine. Decides if "skb" should be
@@ -517,7 +525,7 @@ verdict filtering_and_updating(struct xlation *state)
 		break;
 	case L3PROTO_IPV4:
 		/* Get rid of unexpected packets */
-		if (!pool4db_contains(state->jool.nat64.pool4, state->jool.ns,
+		if (!pool4db_contains(state->jool->nat64.pool4, state->jool->ns,
 				in->tuple.l4_proto, &in->tuple.dst.addr4)) {
 			log_debug(state, "Packet does not belong to pool4.");
 			return untranslatable(state, JSTAT_POOL4_MISMATCH);
@@ -564,7 +572,7 @@ verdict filtering_and_updating(struct xlation *state)
 	case L4PROTO_ICMP:
 		switch (pkt_l3_proto(in)) {
 		case L3PROTO_IPV6:
-			if (state->jool.globals.nat64.drop_icmp6_info) {
+			if (state->jool->globals.nat64.drop_icmp6_info) {
 				log_debug(state, "Packet is ICMPv6 info (ping); dropping due to policy.");
 				return drop(state, JSTAT_ICMP6_FILTER);
 			}
@@ -28,7 +28,7 @@ bool is_hairpin_nat64(struct xlation *state)
 	 * for its node. It might take a miracle for these packets to exist,
 	 * but hey, why the hell not.
 	 */
-	return pool4db_contains(state->jool.nat64.pool4, state->jool.ns,
+	return pool4db_contains(state->jool->nat64.pool4, state->jool->ns,
 			state->out.tuple.l4_proto, &state->out.tuple.dst.addr4);
 }
 
@@ -47,7 +47,7 @@ verdict handling_hairpinning_nat64(struct xlation *old)
 
 	log_debug(old, "Step 5: Handling Hairpinning...");
 
-	new = xlation_create(&old->jool);
+	new = xlation_create(old->jool);
 	if (!new)
 		return VERDICT_DROP;
 	new->in = old->out;
@@ -17,7 +17,7 @@ verdict handling_hairpinning_siit(struct xlation *old)
 
 	log_debug(old, "Packet is hairpinning. U-turning...");
 
-	new = xlation_create(&old->jool);
+	new = xlation_create(old->jool);
 	if (!new)
 		return VERDICT_DROP;
 	new->in = old->out;
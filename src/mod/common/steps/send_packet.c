@@ -20,7 +20,7 @@ static verdict __sendpkt_send(struct xlation *state, struct sk_buff *out)
 	/* skb_log(out, "Translated packet"); */
 
 	/* Implicit kfree_skb(out) here. */
-	error = dst_output(state->jool.ns, NULL, out);
+	error = dst_output(state->jool->ns, NULL, out);
 	if (error) {
 		log_debug(state, "dst_output() returned errcode %d.", error);
 		return drop(state, JSTAT_DST_OUTPUT);
@@ -1,67 +1,76 @@
 #include "mod/common/timer.h"
 
-#include "mod/common/linux_version.h"
-#include "mod/common/xlator.h"
+#include "mod/common/evlog.h"
 #include "mod/common/joold.h"
 #include "mod/common/db/bib/db.h"
 
 /*
- * TODO (performance) We don't cancel the timer much at all; it seems like we
- * should be using a hrtimer instead.
- *
- * 	the kernel has two core timer mechanisms. One of those — the
- * 	high-resolution timer (or "hrtimer") — subsystem, is focused on
- * 	near-term events where the timer is expected to run to completion. The
- * 	other subsystem is just called "kernel timers"; it offers less precision
- * 	but is more efficient in situations where the timer will probably be
- * 	canceled before it fires.
- * 		(Jonathan Corbet, 2017)
+ * Sessions expire at most this late. (The database cleans in bounded batches,
+ * so a short period does not translate into long lock holds.)
  */
+#define TIMER_PERIOD msecs_to_jiffies(250)
 
-#define TIMER_PERIOD msecs_to_jiffies(2000)
+static struct workqueue_struct *wq;
 
-static struct timer_list timer;
+static void timer_function(struct work_struct *work)
+{
+	struct jtimer *timer;
+
+	timer = container_of(to_delayed_work(work), struct jtimer, work);
+
+	if (!bib_clean(timer->jool, &timer->cursor)) {
+		/* Slice exhausted; let others run, then resume right away. */
+		queue_delayed_work(wq, &timer->work, 0);
+		return;
+	}
+
+	joold_clean(timer->jool);
+	evlog_flush(timer->jool);
+	queue_delayed_work(wq, &timer->work, TIMER_PERIOD);
+}
+
+/**
+ * This function should be always called *before* other init()s that might
+ * create instances.
+ */
+int jtimer_setup(void)
+{
+	wq = alloc_workqueue("jool_timer", WQ_UNBOUND, 0);
+	return wq ? 0 : -ENOMEM;
+}
 
-static int clean_state(struct xlator *jool, void *args)
+/**
+ * This function should be always called *after* all instances are gone.
+ */
+void jtimer_teardown(void)
 {
-	bib_clean(jool);
-	joold_clean(jool);
-	return 0;
+	destroy_workqueue(wq);
 }
 
-static void timer_function(
-#if LINUX_VERSION_AT_LEAST(4, 15, 0, 8, 0)
-		struct timer_list *arg
-#else
-		unsigned long arg
-#endif
-		)
+/**
+ * Prepares @timer to clean @jool. Does not start it.
+ */
+void jtimer_init(struct jtimer *timer, struct xlator *jool)
 {
-	xlator_foreach(XT_NAT64, clean_state, NULL, NULL);
-	mod_timer(&timer, jiffies + TIMER_PERIOD);
+	timer->jool = jool;
+	timer->cursor = 0;
+	INIT_DEFERRABLE_WORK(&timer->work, timer_function);
 }
 
 /**
- * This function should be always called *after* other init()s.
+ * Starts cleaning periodically. @timer must outlive the cleaning, so
+ * jtimer_stop() it before releasing it or its xlator.
  */
-int jtimer_setup(void)
+void jtimer_start(struct jtimer *timer)
 {
-#if LINUX_VERSION_AT_LEAST(4, 15, 0, 8, 0)
-	timer_setup(&timer, timer_function, 0);
-#else
-	init_timer(&timer);
-	timer.function = timer_function;
-	timer.expires = 0;
-	timer.data = 0;
-#endif
-	mod_timer(&timer, jiffies + TIMER_PERIOD);
-	return 0;
+	queue_delayed_work(wq, &timer->work, TIMER_PERIOD);
 }
 
 /**
- * This function should be always called *before* other destroy()s.
+ * Waits for any ongoing cleanup to finish, and prevents further ones.
+ * Can sleep.
  */
-void jtimer_teardown(void)
+void jtimer_stop(struct jtimer *timer)
 {
-	del_timer_sync(&timer);
+	cancel_delayed_work_sync(&timer->work);
 }
@@ -3,15 +3,30 @@
 
 /**
  * @file
- * An all-purpose timer used to trigger some of Jool's events. Always runs, as
- * long as Jool is modprobed. At time of writing, this induces session and
- * fragment expiration.
+ * Periodic cleanup of NAT64 state. At time of writing, this induces session
+ * expiration, joold flushing and event log flushing.
  *
- * Why don't the session and fragment code manage their own timers?
- * Because that's more code and I don't see how it would improve anything.
+ * Every NAT64 instance gets its own deferrable work item, which runs on an
+ * unbound workqueue (so the instances spread across CPUs) and cleans in
+ * bounded slices (so a large database cannot hog a CPU).
  */
 
+#include <linux/workqueue.h>
+#include "mod/common/xlator.h"
+
+struct jtimer {
+	struct delayed_work work;
+	/** The instance this timer cleans. Not referenced. */
+	struct xlator *jool;
+	/** Where the current cleaning pass left off. (See bib_clean().) */
+	unsigned int cursor;
+};
+
 int jtimer_setup(void);
 void jtimer_teardown(void);
 
+void jtimer_init(struct jtimer *timer, struct xlator *jool);
+void jtimer_start(struct jtimer *timer);
+void jtimer_stop(struct jtimer *timer);
+
 #endif /* SRC_MOD_NAT64_TIMER_H_ */
@@ -1,57 +1,144 @@
 #include "mod/common/translation_state.h"
 
+#include <linux/bottom_half.h>
+#include <linux/percpu.h>
 #include "mod/common/wkmalloc.h"
 
+/*
+ * Maximum number of translations a single CPU can have in flight at the same
+ * time: The one started by the hook, and the one started by hairpinning.
+ */
+#define XLATION_POOL_DEPTH 2
+
+/*
+ * Preallocated translation states, so the packet path does not have to hit the
+ * slab allocator.
+ *
+ * Translations are strictly nested (a hairpin translation always ends before
+ * its parent does), so the pool is used as a stack.
+ */
+struct xlation_pool {
+	struct xlation states[XLATION_POOL_DEPTH];
+	unsigned int used;
+};
+
+static struct xlation_pool __percpu *xlation_pools;
+/* Fallback, in case the nesting ever gets deeper than expected. */
 static struct kmem_cache *xlation_cache;
 
 int xlation_setup(void)
 {
+	xlation_pools = alloc_percpu(struct xlation_pool);
+	if (!xlation_pools)
+		return -ENOMEM;
+
 	xlation_cache = kmem_cache_create("jool_xlations",
 			sizeof(struct xlation), 0, 0, NULL);
-	return xlation_cache? 0 : -ENOMEM;
+	if (!xlation_cache) {
+		free_percpu(xlation_pools);
+		return -ENOMEM;
+	}
+
+	return 0;
 }
 
 void xlation_teardown(void)
 {
 	kmem_cache_destroy(xlation_cache);
+	free_percpu(xlation_pools);
+}
+
+static bool is_pooled(struct xlation_pool *pool, struct xlation *state)
+{
+	return &pool->states[0] <= state
+			&& state < &pool->states[XLATION_POOL_DEPTH];
 }
 
+/*
+ * Resets only the fields the pipeline reads before writing them. (Everything
+ * else is initialized by pkt_init_ipv6(), pkt_init_ipv4() or the hairpinning
+ * code before it's used.) Clearing the whole structure on every packet is a
+ * waste, because it's rather big.
+ */
+static void xlation_reset(struct xlation *state, struct xlator *jool)
+{
+	state->jool = jool;
+	state->in.skb = NULL;
+	state->out.skb = NULL;
+	state->flowx_set = false;
+	state->dst = NULL;
+	state->entries.bib_set = false;
+	state->entries.session_set = false;
+	state->is_hairpin = false;
+	state->in_place = false;
+	state->result.icmp = ICMPERR_NONE;
+	state->result.info = 0;
+}
+
+/**
+ * Returns a translation state from the current CPU's pool.
+ *
+ * Bottom halves remain disabled (and therefore, the thread remains pinned to
+ * the CPU) until the state is returned through xlation_destroy(). This is
+ * usually free, since packets already arrive in softirq context.
+ */
 struct xlation *xlation_create(struct xlator *jool)
 {
+	struct xlation_pool *pool;
 	struct xlation *state;
 
-	state = wkmem_cache_alloc("xlation", xlation_cache, GFP_ATOMIC);
-	if (!state)
-		return NULL;
+	local_bh_disable();
+
+	pool = this_cpu_ptr(xlation_pools);
+	if (likely(pool->used < XLATION_POOL_DEPTH)) {
+		state = &pool->states[pool->used];
+		pool->used++;
+	} else {
+		state = wkmem_cache_alloc("xlation", xlation_cache, GFP_ATOMIC);
+		if (!state) {
+			local_bh_enable();
+			return NULL;
+		}
+	}
 
-	xlation_init(state, jool);
+	xlation_reset(state, jool);
 	return state;
 }
 
 void xlation_init(struct xlation *state, struct xlator *jool)
 {
 	memset(state, 0, sizeof(*state));
-	if (jool)
-		memcpy(&state->jool, jool, sizeof(*jool));
+	state->jool = jool;
 }
 
 void xlation_destroy(struct xlation *state)
 {
+	struct xlation_pool *pool;
+
 	if (state->dst)
 		dst_release(state->dst);
-	wkmem_cache_free("xlation", xlation_cache, state);
+
+	pool = this_cpu_ptr(xlation_pools);
+	if (likely(is_pooled(pool, state))) {
+		WARN_ON(state != &pool->states[pool->used - 1]);
+		pool->used--;
+	} else {
+		wkmem_cache_free("xlation", xlation_cache, state);
+	}
+
+	local_bh_enable();
 }
 
 verdict untranslatable(struct xlation *state, enum jool_stat_id stat)
 {
-	jstat_inc(state->jool.stats, stat);
+	jstat_inc(state->jool->stats, stat);
 	return VERDICT_UNTRANSLATABLE;
 }
 
 verdict untranslatable_icmp(struct xlation *state, enum jool_stat_id stat,
 		enum icmp_errcode icmp, __u32 info)
 {
-	jstat_inc(state->jool.stats, stat);
+	jstat_inc(state->jool->stats, stat);
 	state->result.icmp = icmp;
 	state->result.info = info;
 	return VERDICT_UNTRANSLATABLE;
@@ -59,14 +146,14 @@ verdict untranslatable_icmp(struct xlation *state, enum jool_stat_id stat,
 
 verdict drop(struct xlation *state, enum jool_stat_id stat)
 {
-	jstat_inc(state->jool.stats, stat);
+	jstat_inc(state->jool->stats, stat);
 	return VERDICT_DROP;
 }
 
 verdict drop_icmp(struct xlation *state, enum jool_stat_id stat,
 		enum icmp_errcode icmp, __u32 info)
 {
-	jstat_inc(state->jool.stats, stat);
+	jstat_inc(state->jool->stats, stat);
 	state->result.icmp = icmp;
 	state->result.info = info;
 	return VERDICT_DROP;
@@ -74,6 +161,6 @@ verdict drop_icmp(struct xlation *state, enum jool_stat_id stat,
 
 verdict stolen(struct xlation *state, enum jool_stat_id stat)
 {
-	jstat_inc(state->jool.stats, stat);
+	jstat_inc(state->jool->stats, stat);
 	return VERDICT_STOLEN;
 }
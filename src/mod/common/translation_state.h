@@ -40,8 +40,12 @@ struct xlation {
 	/**
 	 * The instance of Jool that's in charge of carrying out this
 	 * translation.
+	 *
+	 * This is not a copy; it points to the instance database's node, and
+	 * it's only valid as long as the RCU read-side lock (BH flavor) that
+	 * protected its lookup is held.
 	 */
-	struct xlator jool;
+	struct xlator *jool;
 
 	/** The original packet. */
 	struct packet in;
@@ -70,6 +74,12 @@ struct xlation {
 	 */
 	bool is_hairpin;
 
+	/**
+	 * Translate @in by rewriting its headers, instead of into a copy?
+	 * See struct translation_steps.
+	 */
+	bool in_place;
+
 	struct xlation_result result;
 };
 
@@ -89,7 +99,12 @@ verdict drop_icmp(struct xlation *state, enum jool_stat_id stat,
 		enum icmp_errcode icmp, __u32 info);
 verdict stolen(struct xlation *state, enum jool_stat_id stat);
 
-#define xlation_is_siit(state) xlator_is_siit(&(state)->jool)
-#define xlation_is_nat64(state) xlator_is_nat64(&(state)->jool)
+#define xlation_is_siit(state) xlator_is_siit((state)->jool)
+#define xlation_is_nat64(state) xlator_is_nat64((state)->jool)
+/*
+ * Was @in rewritten into @out? If so, they share the skb, and @in can only be
+ * released through @out.
+ */
+#define xlation_is_in_place(state) ((state)->out.skb == (state)->in.skb)
 
 #endif /* SRC_MOD_COMMON_TRANSLATION_STATE_H_ */
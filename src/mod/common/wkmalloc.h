@@ -37,6 +37,19 @@ static inline void __wkfree(const char *name, void *obj)
 
 #define wkfree(type, obj) __wkfree(#type, obj)
 
+/**
+ * __wkfree(), except the memory is released after an RCU grace period.
+ * (@field is @obj's struct rcu_head.)
+ */
+#ifdef JKMEMLEAK
+#define __wkfree_rcu(name, obj, field) do { \
+		wkmalloc_rm(name, obj); \
+		kfree_rcu(obj, field); \
+	} while (0)
+#else
+#define __wkfree_rcu(name, obj, field) kfree_rcu(obj, field)
+#endif
+
 static inline void *wkmem_cache_alloc(const char *name,
 		struct kmem_cache *cache, gfp_t flags)
 {
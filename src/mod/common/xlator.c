@@ -2,15 +2,18 @@
 
 #include <linux/hashtable.h>
 #include <linux/sched.h>
+#include <net/netns/generic.h>
 
 #include "common/types.h"
 #include "common/xlat.h"
 #include "db/global.h"
 #include "mod/common/atomic_config.h"
+#include "mod/common/evlog.h"
 #include "mod/common/joold.h"
 #include "mod/common/kernel_hook.h"
 #include "mod/common/log.h"
 #include "mod/common/rcu.h"
+#include "mod/common/timer.h"
 #include "mod/common/compat_32_64.h"
 #include "mod/common/wkmalloc.h"
 #include "mod/common/db/denylist4.h"
@@ -40,8 +43,9 @@ static struct nf_hook_ops netfilter_hooks[] = {
  */
 struct jool_instance {
 	/**
-	 * The actual xlator. The other modules will actually receive a shallow
-	 * clone of it.
+	 * The actual xlator. Userspace requests receive a shallow clone of it
+	 * (xlator_find()), while packets reference it directly, under RCU
+	 * (xlator_find_rcu() and xlator_find_netfilter()).
 	 *
 	 * TODO (fine) maybe turn this into a const.
 	 */
@@ -51,7 +55,6 @@ struct jool_instance {
 	bool hash_set;
 	u32 hash;
 
-	struct list_head list_hook;
 	/**
 	 * This points to a copy of the netfilter_hooks array.
 	 *
@@ -62,12 +65,48 @@ struct jool_instance {
 	 * This is only set if @jool.flags matches FW_NETFILTER.
 	 */
 	struct nf_hook_ops *nf_ops;
+
+	/** Cleans @jool's state. Only used by NAT64 instances. */
+	struct jtimer timer;
+};
+
+/**
+ * Per-namespace shortcut to the namespace's Netfilter instances, so the hooks
+ * can find them in constant time.
+ */
+struct jool_net {
+	/*
+	 * Indexed by xt_index(). (A namespace can hold one Netfilter instance
+	 * of each type.)
+	 */
+	struct jool_instance __rcu *netfilter[2];
+};
+
+/**
+ * Remembers the instance an iptables rule sends its packets to, so the packet
+ * path doesn't have to look it up by name.
+ */
+struct jool_target {
+	/* Not referenced; the rule cannot outlive its namespace. */
+	struct net *ns;
+	xlator_flags flags;
+	char iname[INAME_MAX_SIZE];
+	/* NULL if the instance does not exist (yet). */
+	struct jool_instance __rcu *instance;
+
+	struct list_head list_hook;
 };
 
 static DEFINE_HASHTABLE(instances, 6); /* The identifier is (ns, xt, iname). */
-static struct list_head __rcu *netfilter_instances;
+static LIST_HEAD(targets);
 static DEFINE_MUTEX(lock);
 
+static unsigned int jool_net_id;
+static struct pernet_operations jool_net_ops = {
+	.id = &jool_net_id,
+	.size = sizeof(struct jool_net),
+};
+
 static void (*defrag_enable)(struct net *ns);
 
 static u32 get_hash(struct net *ns, xlator_type xt, char const *iname)
@@ -111,8 +150,69 @@ static struct jool_instance *find_instance(struct net *ns, xlator_type xt,
 	return NULL;
 }
 
+static unsigned int xt_index(struct xlator const *jool)
+{
+	return xlator_is_nat64(jool) ? 1 : 0;
+}
+
+/**
+ * Requires the mutex to be locked.
+ */
+static void set_netfilter_instance(struct xlator *jool,
+		struct jool_instance *instance)
+{
+	struct jool_net *jnet;
+
+	jnet = net_generic(jool->ns, jool_net_id);
+	rcu_assign_pointer(jnet->netfilter[xt_index(jool)], instance);
+}
+
+static bool target_matches(struct jool_target *target, struct xlator *jool)
+{
+	return (target->ns == jool->ns)
+			&& (xlator_flags2xt(target->flags) & jool->flags)
+			&& (xlator_flags2xf(target->flags) & jool->flags)
+			&& (strcmp(target->iname, jool->iname) == 0);
+}
+
+/**
+ * Updates the iptables rules that point to @jool's name, so they point to
+ * @instance instead. (Which can be NULL.)
+ *
+ * Requires the mutex to be locked.
+ */
+static void set_target_instance(struct xlator *jool,
+		struct jool_instance *instance)
+{
+	struct jool_target *target;
+
+	list_for_each_entry(target, &targets, list_hook)
+		if (target_matches(target, jool))
+			rcu_assign_pointer(target->instance, instance);
+}
+
+/**
+ * Unpublishes @instance from the packet path shortcuts.
+ *
+ * Requires the mutex to be locked.
+ */
+static void unlink_instance(struct jool_instance *instance)
+{
+	if (xlator_is_netfilter(&instance->jool))
+		set_netfilter_instance(&instance->jool, NULL);
+	else
+		set_target_instance(&instance->jool, NULL);
+}
+
 static void destroy_jool_instance(struct jool_instance *instance, bool unhook)
 {
+	if (xlator_is_nat64(&instance->jool)) {
+		jtimer_stop(&instance->timer);
+		/* (Unless it was handed over to a replacement instance.) */
+		if (instance->jool.nat64.evlog)
+			evlog_stop(instance->jool.nat64.evlog);
+	}
+
 	if (xlator_is_netfilter(&instance->jool)) {
 		if (unhook) {
 			nf_unregister_net_hooks(instance->jool.ns,
@@ -140,6 +240,7 @@ static void xlator_get(struct xlator *jool)
 		pool4db_get(jool->nat64.pool4);
 		bib_get(jool->nat64.bib);
 		joold_get(jool->nat64.joold);
+		evlog_get(jool->nat64.evlog);
 		break;
 	}
 }
@@ -159,8 +260,7 @@ static void __flush_detach(struct net *ns, xlator_type xt,
 		if (instance->jool.ns == ns && (instance->jool.flags & xt)) {
 			hash_del_rcu(&instance->table_hook);
 			hlist_add_head(&instance->table_hook, detached);
-			if (instance->jool.flags & XF_NETFILTER)
-				list_del_rcu(&instance->list_hook);
+			unlink_instance(instance);
 		}
 	}
 }
@@ -227,15 +327,7 @@ EXPORT_SYMBOL_GPL(jool_xlator_flush_batch);
  */
 int xlator_setup(void)
 {
-	struct list_head *list;
-
-	list = __wkmalloc("xlator DB", sizeof(struct list_head), GFP_KERNEL);
-	if (!list)
-		return -ENOMEM;
-	INIT_LIST_HEAD(list);
-	RCU_INIT_POINTER(netfilter_instances, list);
-
-	return 0;
+	return register_pernet_subsys(&jool_net_ops);
 }
 
 void xlator_set_defrag(void (*_defrag_enable)(struct net *ns))
@@ -249,12 +341,9 @@ void xlator_set_defrag(void (*_defrag_enable)(struct net *ns))
  */
 void xlator_teardown(void)
 {
-	struct list_head *ni;
-
 	WARN(!hash_empty(instances), "There are elements in the xlator table after a cleanup.");
-	ni = rcu_dereference_raw(netfilter_instances);
-	WARN(!list_empty(ni), "There are elements in the xlator list after a cleanup.");
-	__wkfree("xlator DB", ni);
+	WARN(!list_empty(&targets), "There are iptables targets left after a cleanup.");
+	unregister_pernet_subsys(&jool_net_ops);
 }
 
 static int init_siit(struct xlator *jool, struct ipv6_prefix *pool6)
@@ -301,17 +390,22 @@ static int init_nat64(struct xlator *jool, struct ipv6_prefix *pool6)
 	jool->nat64.pool4 = pool4db_alloc();
 	if (!jool->nat64.pool4)
 		goto pool4_fail;
-	jool->nat64.bib = bib_alloc();
+	jool->nat64.bib = bib_alloc(jool->flags & XO_BIB_HASH);
 	if (!jool->nat64.bib)
 		goto bib_fail;
 	jool->nat64.joold = joold_alloc();
 	if (!jool->nat64.joold)
 		goto joold_fail;
+	jool->nat64.evlog = evlog_alloc(jool->ns, jool->iname);
+	if (!jool->nat64.evlog)
+		goto evlog_fail;
 
 	jool->is_hairpin = is_hairpin_nat64;
 	jool->handling_hairpinning = handling_hairpinning_nat64;
 	return 0;
 
+evlog_fail:
+	joold_put(jool->nat64.joold);
 joold_fail:
 	bib_put(jool->nat64.bib);
 bib_fail:
@@ -385,6 +479,10 @@ static int basic_add_validations(char *iname, xlator_flags flags,
 		log_err("pool6 is mandatory in NAT64 instances.");
 		return -EINVAL;
 	}
+	if ((flags & XO_BIB_HASH) && !(flags & XT_NAT64)) {
+		log_err("SIIT instances do not have a BIB.");
+		return -EINVAL;
+	}
 
 	return 0;
 }
@@ -426,8 +524,6 @@ static int validate_collision(struct net *ns, char *iname, xlator_flags flags)
  */
 static int __xlator_add(struct jool_instance *new, struct xlator *result)
 {
-	struct list_head *list;
-
 	if (xlator_is_netfilter(&new->jool)) {
 		struct nf_hook_ops *ops;
 		int error;
@@ -453,14 +549,15 @@ static int __xlator_add(struct jool_instance *new, struct xlator *result)
 	}
 
 	hash_add_rcu(instances, &new->table_hook, get_instance_hash(new));
-	if (new->jool.flags & XF_NETFILTER) {
-		list = rcu_dereference_protected(netfilter_instances,
-				lockdep_is_held(&lock));
-		list_add_tail_rcu(&new->list_hook, list);
-	}
+	if (xlator_is_netfilter(&new->jool))
+		set_netfilter_instance(&new->jool, new);
+	else
+		set_target_instance(&new->jool, new);
 
-	if (new->jool.flags & XT_NAT64)
+	if (new->jool.flags & XT_NAT64) {
 		defrag_enable(new->jool.ns);
+		jtimer_start(&new->timer);
+	}
 
 	if (result) {
 		xlator_get(&new->jool);
@@ -512,6 +609,8 @@ int xlator_add(xlator_flags flags, char *iname, struct ipv6_prefix *pool6,
 	instance->hash_set = false;
 	instance->hash = 0;
 	instance->nf_ops = NULL;
+	if (xlator_is_nat64(&instance->jool))
+		jtimer_init(&instance->timer, &instance->jool);
 
 	/* Error roads from now no longer need to free @instance. */
 	/* Error roads from now need to properly destroy @instance. */
@@ -554,8 +653,7 @@ static int __xlator_rm(struct net *ns, char *iname, xlator_type xt)
 	}
 
 	hash_del_rcu(&instance->table_hook);
-	if (instance->jool.flags & XF_NETFILTER)
-		list_del_rcu(&instance->list_hook);
+	unlink_instance(instance);
 
 	mutex_unlock(&lock);
 	synchronize_rcu_bh();
@@ -641,11 +739,22 @@ static int basic_replace_validations(struct xlator *jool)
 	return 0;
 }
 
+/*
+ * The event log's rings are big, so they're only allocated once binary logging
+ * is enabled. Here, rather than on the packet path, so they can be allocated
+ * with GFP_KERNEL.
+ */
+static int prepare_evlog(struct xlator const *jool, struct evlog *evlog)
+{
+	if (!xlator_is_nat64(jool) || !jool->globals.nat64.bib.binary_logging)
+		return 0;
+	return evlog_enable(evlog);
+}
+
 int xlator_replace(struct xlator *jool)
 {
 	struct jool_instance *old;
 	struct jool_instance *new;
-	struct list_head *list;
 	int error;
 
 	error = basic_add_validations(jool->iname, jool->flags,
@@ -665,13 +774,17 @@ int xlator_replace(struct xlator *jool)
 	xlator_get(&new->jool);
 	new->hash_set = false;
 	new->nf_ops = NULL;
+	if (xlator_is_nat64(&new->jool))
+		jtimer_init(&new->timer, &new->jool);
 
 	mutex_lock(&lock);
 
 	old = find_instance(jool->ns, xlator_flags2xt(jool->flags), jool->iname);
 	if (!old) {
 		/* Not found, hence not replacing. Add it instead. */
-		error = __xlator_add(new, NULL);
+		error = prepare_evlog(&new->jool, new->jool.nat64.evlog);
+		if (!error)
+			error = __xlator_add(new, NULL);
 		if (error)
 			destroy_jool_instance(new, false);
 
@@ -689,30 +802,39 @@ int xlator_replace(struct xlator *jool)
 		log_err("Sorry; you can't change a NAT64 instance's pool6 for now.");
 		goto abort;
 	}
+	/* (It's the old event log that survives; see below.) */
+	error = prepare_evlog(&new->jool, old->jool.nat64.evlog);
+	if (error) {
+		mutex_unlock(&lock);
+		destroy_jool_instance(new, false);
+		return error;
+	}
 
 	new->hash_set = old->hash_set;
 	new->hash = old->hash;
 	new->nf_ops = old->nf_ops;
 
 	/*
-	 * The old BIB and joold must survive,
+	 * The old BIB, joold and event log must survive,
 	 * because they shouldn't be reset by atomic configuration.
 	 */
 	if (xlator_is_nat64(&new->jool)) {
 		bib_put(new->jool.nat64.bib);
 		joold_put(new->jool.nat64.joold);
+		evlog_put(new->jool.nat64.evlog);
 		new->jool.nat64.bib = old->jool.nat64.bib;
 		new->jool.nat64.joold = old->jool.nat64.joold;
+		new->jool.nat64.evlog = old->jool.nat64.evlog;
 	}
 
-	hash_del(&old->table_hook);
-	hash_add(instances, &new->table_hook, get_instance_hash(new));
-	if (old->jool.flags & XF_NETFILTER) {
-		list = rcu_dereference_protected(netfilter_instances,
-						lockdep_is_held(&lock));
-		list_del_rcu(&old->list_hook);
-		list_add_rcu(&new->list_hook, list);
-	}
+	hash_del_rcu(&old->table_hook);
+	hash_add_rcu(instances, &new->table_hook, get_instance_hash(new));
+	if (xlator_is_netfilter(&new->jool))
+		set_netfilter_instance(&new->jool, new);
+	else
+		set_target_instance(&new->jool, new);
+	if (xlator_is_nat64(&new->jool))
+		jtimer_start(&new->timer);
 	mutex_unlock(&lock);
 
 	synchronize_rcu_bh();
@@ -720,8 +842,11 @@ int xlator_replace(struct xlator *jool)
 	old->nf_ops = NULL;
 
 	if (xlator_is_nat64(&old->jool)) {
+		/* @old's references are about to die; stop using them. */
+		jtimer_stop(&old->timer);
 		old->jool.nat64.bib = NULL;
 		old->jool.nat64.joold = NULL;
+		old->jool.nat64.evlog = NULL;
 	}
 
 	destroy_jool_instance(old, false);
@@ -757,6 +882,30 @@ int xlator_flush(xlator_type xt)
 	return 0;
 }
 
+static int __xlator_find(struct net *ns, xlator_flags flags, char const *iname,
+		struct jool_instance **result)
+{
+	struct jool_instance *instance;
+	int error;
+
+	/*
+	 * There is at least one caller to this function which cares about error
+	 * code. You need to review it if you want to add or reuse error codes.
+	 */
+	error = basic_validations(iname, true, flags);
+	if (error)
+		return error;
+
+	instance = find_instance(ns, xlator_flags2xt(flags), iname);
+	if (!instance)
+		return -ESRCH;
+	if ((instance->jool.flags & xlator_flags2xf(flags)) == 0)
+		return -ESRCH;
+
+	*result = instance;
+	return 0;
+}
+
 /**
  * Returns the instance from the database that matches @ns, @iname and @flags.
  *
@@ -779,33 +928,40 @@ int xlator_find(struct net *ns, xlator_flags flags, char const *iname,
 	struct jool_instance *instance;
 	int error;
 
-	/*
-	 * There is at least one caller to this function which cares about error
-	 * code. You need to review it if you want to add or reuse error codes.
-	 */
-	error = basic_validations(iname, true, flags);
-	if (error)
-		return error;
-
 	rcu_read_lock_bh();
 
-	instance = find_instance(ns, xlator_flags2xt(flags), iname);
-	if (!instance)
-		goto not_found;
-	if ((instance->jool.flags & xlator_flags2xf(flags)) == 0)
-		goto not_found;
-
-	if (result) {
+	error = __xlator_find(ns, flags, iname, &instance);
+	if (!error && result) {
 		xlator_get(&instance->jool);
 		memcpy(result, &instance->jool, sizeof(*result));
 	}
 
 	rcu_read_unlock_bh();
-	return 0;
+	return error;
+}
 
-not_found:
-	rcu_read_unlock_bh();
-	return -ESRCH;
+/**
+ * Same as xlator_find(), except @result will point to the database's instance
+ * itself; no copies nor references are made.
+ *
+ * The caller must hold rcu_read_lock_bh() for as long as it uses @result, and
+ * must not xlator_put() it. The instance is guaranteed to survive until the
+ * lock is released, because instance removal waits for a grace period before
+ * releasing anything.
+ *
+ * Meant for the packet path, which is not supposed to write on shared memory.
+ */
+int xlator_find_rcu(struct net *ns, xlator_flags flags, char const *iname,
+		struct xlator **result)
+{
+	struct jool_instance *instance;
+	int error;
+
+	error = __xlator_find(ns, flags, iname, &instance);
+	if (!error)
+		*result = &instance->jool;
+
+	return error;
 }
 
 /**
@@ -832,27 +988,102 @@ int xlator_find_current(const char *iname, xlator_flags flags,
 	return error;
 }
 
-int xlator_find_netfilter(struct net *ns, struct xlator *result)
+/**
+ * Returns the Netfilter instance that belongs to @ns.
+ *
+ * Same rules as xlator_find_rcu(): The caller must hold rcu_read_lock_bh()
+ * while it uses @result, and must not xlator_put() it.
+ */
+int xlator_find_netfilter(struct net *ns, struct xlator **result)
 {
-	struct list_head *list;
+	struct jool_net *jnet;
 	struct jool_instance *instance;
+	unsigned int i;
 
-	rcu_read_lock_bh();
-
-	list = rcu_dereference_bh(netfilter_instances);
-	list_for_each_entry_rcu(instance, list, list_hook) {
-		if (ns == instance->jool.ns) {
-			xlator_get(&instance->jool);
-			memcpy(result, &instance->jool, sizeof(*result));
-			rcu_read_unlock_bh();
+	jnet = net_generic(ns, jool_net_id);
+	for (i = 0; i < ARRAY_SIZE(jnet->netfilter); i++) {
+		instance = rcu_dereference_bh(jnet->netfilter[i]);
+		if (instance) {
+			*result = &instance->jool;
 			return 0;
 		}
 	}
 
-	rcu_read_unlock_bh();
 	return -ESRCH;
 }
 
+/**
+ * Creates the object an iptables rule will use to find its instance.
+ * The instance does not need to exist yet; @result will be updated whenever it
+ * is added, replaced or removed.
+ *
+ * Process context only.
+ */
+int xlator_target_create(struct net *ns, xlator_flags flags, char const *iname,
+		struct jool_target **result)
+{
+	struct jool_target *target;
+	struct jool_instance *instance;
+	int error;
+
+	error = basic_validations(iname, false, flags);
+	if (error)
+		return error;
+
+	target = wkmalloc(struct jool_target, GFP_KERNEL);
+	if (!target)
+		return -ENOMEM;
+	target->ns = ns;
+	target->flags = flags;
+	strcpy(target->iname, iname);
+
+	mutex_lock(&lock);
+
+	instance = find_instance(ns, xlator_flags2xt(flags), iname);
+	if (instance && !(instance->jool.flags & xlator_flags2xf(flags)))
+		instance = NULL;
+	RCU_INIT_POINTER(target->instance, instance);
+	list_add(&target->list_hook, &targets);
+
+	mutex_unlock(&lock);
+
+	*result = target;
+	return 0;
+}
+
+/**
+ * Reverts xlator_target_create(). The caller must ensure packets are no longer
+ * using @target.
+ *
+ * Process context only.
+ */
+void xlator_target_destroy(struct jool_target *target)
+{
+	mutex_lock(&lock);
+	list_del(&target->list_hook);
+	mutex_unlock(&lock);
+
+	wkfree(struct jool_target, target);
+}
+
+/**
+ * Returns the instance @target points to.
+ *
+ * Same rules as xlator_find_rcu(): The caller must hold rcu_read_lock_bh()
+ * while it uses @result, and must not xlator_put() it.
+ */
+int xlator_target_find(struct jool_target *target, struct xlator **result)
+{
+	struct jool_instance *instance;
+
+	instance = rcu_dereference_bh(target->instance);
+	if (!instance)
+		return -ESRCH;
+
+	*result = &instance->jool;
+	return 0;
+}
+
 /*
  * I am kref_put()ting and there's no lock.
  * This can be dangerous: http://lwn.net/Articles/93617/
@@ -882,6 +1113,8 @@ void xlator_put(struct xlator *jool)
 			bib_put(jool->nat64.bib);
 		if (jool->nat64.joold)
 			joold_put(jool->nat64.joold);
+		if (jool->nat64.evlog)
+			evlog_put(jool->nat64.evlog);
 		return;
 	}
 
@@ -42,6 +42,7 @@ struct xlator {
 			struct pool4 *pool4;
 			struct bib *bib;
 			struct joold_queue *joold;
+			struct evlog *evlog;
 		} nat64;
 	};
 
@@ -62,6 +63,11 @@ int xlator_flush(xlator_type xt);
 void jool_xlator_flush_net(struct net *ns, xlator_type xt);
 void jool_xlator_flush_batch(struct list_head *net_exit_list, xlator_type xt);
 
+struct jool_target;
+int xlator_target_create(struct net *ns, xlator_flags flags, char const *iname,
+		struct jool_target **result);
+void xlator_target_destroy(struct jool_target *target);
+
 int xlator_init(struct xlator *jool, struct net *ns, char *iname,
 		xlator_flags flags, struct ipv6_prefix *pool6);
 int xlator_replace(struct xlator *jool);
@@ -72,9 +78,15 @@ int xlator_find(struct net *ns, xlator_flags flags, const char *iname,
 		struct xlator *result);
 int xlator_find_current(const char *iname, xlator_flags flags,
 		struct xlator *result);
-int xlator_find_netfilter(struct net *ns, struct xlator *result);
 void xlator_put(struct xlator *instance);
 
+/* Any context (reads, rcu_read_lock_bh() required, no references) */
+
+int xlator_find_rcu(struct net *ns, xlator_flags flags, const char *iname,
+		struct xlator **result);
+int xlator_find_netfilter(struct net *ns, struct xlator **result);
+int xlator_target_find(struct jool_target *target, struct xlator **result);
+
 typedef int (*xlator_foreach_cb)(struct xlator *, void *);
 int xlator_foreach(xlator_type xt, xlator_foreach_cb cb, void *args,
 		struct instance_entry_usr *offset);
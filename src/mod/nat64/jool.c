@@ -43,7 +43,9 @@ static struct xt_target targets[] = {
 		.family     = NFPROTO_IPV6,
 		.target     = target_ipv6,
 		.checkentry = target_checkentry,
+		.destroy    = target_destroy,
 		.targetsize = XT_ALIGN(sizeof(struct target_info)),
+		TARGET_USERSIZE
 		.me         = THIS_MODULE,
 	}, {
 		.name       = IPTABLES_NAT64_MODULE_NAME,
@@ -51,7 +53,9 @@ static struct xt_target targets[] = {
 		.family     = NFPROTO_IPV4,
 		.target     = target_ipv4,
 		.checkentry = target_checkentry,
+		.destroy    = target_destroy,
 		.targetsize = XT_ALIGN(sizeof(struct target_info)),
+		TARGET_USERSIZE
 		.me         = THIS_MODULE,
 	},
 };
@@ -22,7 +22,9 @@ static struct xt_target targets[] = {
 		.family     = NFPROTO_IPV6,
 		.target     = target_ipv6,
 		.checkentry = target_checkentry,
+		.destroy    = target_destroy,
 		.targetsize = XT_ALIGN(sizeof(struct target_info)),
+		TARGET_USERSIZE
 		.me         = THIS_MODULE,
 	}, {
 		.name       = IPTABLES_SIIT_MODULE_NAME,
@@ -30,7 +32,9 @@ static struct xt_target targets[] = {
 		.family     = NFPROTO_IPV4,
 		.target     = target_ipv4,
 		.checkentry = target_checkentry,
+		.destroy    = target_destroy,
 		.targetsize = XT_ALIGN(sizeof(struct target_info)),
+		TARGET_USERSIZE
 		.me         = THIS_MODULE,
 	},
 };
@@ -0,0 +1,167 @@
+#include "usr/argp/checkpoint/file.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+static struct jool_result errno2result(char const *action, char const *path)
+{
+	int error = errno;
+	return result_from_error(error, "Cannot %s '%s': %s", action, path,
+			strerror(error));
+}
+
+__u64 ckpt_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return ((__u64)now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+struct jool_result ckpt_open(struct ckpt_writer *writer, char const *path,
+		__u64 time)
+{
+	struct ckpt_hdr hdr;
+
+	writer->path = path;
+	writer->count = 0;
+	writer->file = fopen(path, "wb");
+	if (!writer->file)
+		return errno2result("open", path);
+
+	memcpy(hdr.magic, CKPT_MAGIC, sizeof(hdr.magic));
+	hdr.version = htonl(CKPT_VERSION);
+	hdr.rec_size = htonl(sizeof(struct jool_session_rec));
+	hdr.reserved = 0;
+	hdr.time = htobe64(time);
+	if (fwrite(&hdr, sizeof(hdr), 1, writer->file) != 1) {
+		fclose(writer->file);
+		writer->file = NULL;
+		return errno2result("write", path);
+	}
+
+	return result_success();
+}
+
+struct jool_result ckpt_write(struct ckpt_writer *writer,
+		struct jool_session_rec const *rec)
+{
+	if (fwrite(rec, sizeof(*rec), 1, writer->file) != 1)
+		return errno2result("write", writer->path);
+	writer->count++;
+	return result_success();
+}
+
+struct jool_result ckpt_close(struct ckpt_writer *writer)
+{
+	int error;
+
+	if (!writer->file)
+		return result_success();
+
+	error = fclose(writer->file);
+	writer->file = NULL;
+	return error ? errno2result("close", writer->path) : result_success();
+}
+
+static struct jool_result read_hdr(FILE *file, char const *path,
+		size_t *rec_size, __u64 *time)
+{
+	struct ckpt_hdr hdr;
+
+	if (fread(&hdr, sizeof(hdr), 1, file) != 1) {
+		if (ferror(file))
+			return errno2result("read", path);
+		goto malformed;
+	}
+	if (memcmp(hdr.magic, CKPT_MAGIC, sizeof(hdr.magic)) != 0)
+		goto malformed;
+	if (ntohl(hdr.version) != CKPT_VERSION) {
+		return result_from_error(-EINVAL,
+				"'%s' is a version %u checkpoint; I only know version %u.",
+				path, ntohl(hdr.version), CKPT_VERSION);
+	}
+
+	*rec_size = ntohl(hdr.rec_size);
+	if (*rec_size < sizeof(struct jool_session_rec))
+		goto malformed;
+	if (*rec_size > sizeof(struct jool_session_rec) + CKPT_MAX_TRAILER) {
+		return result_from_error(-EINVAL,
+				"'%s' has %zu-byte records; I only know up to %zu.",
+				path, *rec_size,
+				sizeof(struct jool_session_rec) + CKPT_MAX_TRAILER);
+	}
+	*time = be64toh(hdr.time);
+	return result_success();
+
+malformed:
+	return result_from_error(-EINVAL, "'%s' is not a session checkpoint.",
+			path);
+}
+
+/**
+ * Loads all of @path's records into a new array, which the caller has to
+ * free().
+ */
+struct jool_result ckpt_read(char const *path, struct jool_session_rec **recs,
+		unsigned int *count, __u64 *time)
+{
+	FILE *file;
+	size_t rec_size = 0;
+	struct jool_session_rec *array;
+	unsigned int len, capacity;
+	unsigned char *buffer;
+	struct jool_result result;
+
+	file = fopen(path, "rb");
+	if (!file)
+		return errno2result("open", path);
+
+	result = read_hdr(file, path, &rec_size, time);
+	if (result.error)
+		goto end;
+
+	buffer = malloc(rec_size);
+	if (!buffer) {
+		result = result_from_enomem();
+		goto end;
+	}
+
+	array = NULL;
+	len = 0;
+	capacity = 0;
+	while (fread(buffer, rec_size, 1, file) == 1) {
+		if (len == capacity) {
+			struct jool_session_rec *tmp;
+			capacity = capacity ? (2 * capacity) : 4096;
+			tmp = realloc(array, capacity * sizeof(*array));
+			if (!tmp) {
+				result = result_from_enomem();
+				goto fail;
+			}
+			array = tmp;
+		}
+		memcpy(&array[len++], buffer, sizeof(*array));
+	}
+	if (ferror(file)) {
+		result = errno2result("read", path);
+		goto fail;
+	}
+
+	free(buffer);
+	*recs = array;
+	*count = len;
+	result = result_success();
+	goto end;
+
+fail:
+	free(array);
+	free(buffer);
+end:
+	fclose(file);
+	return result;
+}
@@ -0,0 +1,52 @@
+#ifndef SRC_USR_ARGP_CHECKPOINT_FILE_H_
+#define SRC_USR_ARGP_CHECKPOINT_FILE_H_
+
+/*
+ * Session table checkpoints. (`jool session export` and `jool session import`.)
+ *
+ * A checkpoint starts with a struct ckpt_hdr, followed by raw struct
+ * jool_session_recs (still in network byte order). Their expirations are
+ * relative to the header's timestamp.
+ */
+
+#include <stdio.h>
+#include "common/dump.h"
+#include "usr/util/result.h"
+
+#define CKPT_MAGIC "JCKP"
+#define CKPT_VERSION 1
+/*
+ * Maximum number of bytes a record can have beyond the struct jool_session_rec
+ * this version knows. (Larger records are assumed to be garbage.)
+ */
+#define CKPT_MAX_TRAILER 256
+
+struct ckpt_hdr {
+	char magic[4];
+	__be32 version;
+	/* sizeof(struct jool_session_rec), so readers can skip unknown trailers. */
+	__be32 rec_size;
+	__be32 reserved;
+	/* Milliseconds since the epoch, at the time of the export. */
+	__be64 time;
+};
+
+struct ckpt_writer {
+	char const *path;
+	FILE *file;
+	unsigned int count;
+};
+
+/* Milliseconds since the epoch. */
+__u64 ckpt_now(void);
+
+struct jool_result ckpt_open(struct ckpt_writer *writer, char const *path,
+		__u64 time);
+struct jool_result ckpt_write(struct ckpt_writer *writer,
+		struct jool_session_rec const *rec);
+struct jool_result ckpt_close(struct ckpt_writer *writer);
+
+struct jool_result ckpt_read(char const *path, struct jool_session_rec **recs,
+		unsigned int *count, __u64 *time);
+
+#endif /* SRC_USR_ARGP_CHECKPOINT_FILE_H_ */
@@ -0,0 +1,129 @@
+#include "usr/argp/events/file.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+static struct evfile_cfg cfg;
+static FILE *file;
+static size_t file_size;
+
+static struct jool_result errno2result(char const *action, char const *path)
+{
+	int error = errno;
+	return result_from_error(error, "Cannot %s '%s': %s", action, path,
+			strerror(error));
+}
+
+static struct jool_result __open(void)
+{
+	struct evfile_hdr hdr;
+
+	file = fopen(cfg.path, "wb");
+	if (!file)
+		return errno2result("open", cfg.path);
+
+	memcpy(hdr.magic, EVFILE_MAGIC, sizeof(hdr.magic));
+	hdr.version = htonl(EVFILE_VERSION);
+	hdr.event_size = htonl(sizeof(struct jool_event));
+	if (fwrite(&hdr, sizeof(hdr), 1, file) != 1) {
+		fclose(file);
+		file = NULL;
+		return errno2result("write", cfg.path);
+	}
+
+	file_size = sizeof(hdr);
+	return result_success();
+}
+
+/* "path" + "." + up to 10 digits + null character */
+static char *rotated_name(unsigned int index)
+{
+	size_t len;
+	char *result;
+
+	len = strlen(cfg.path) + 12;
+	result = malloc(len);
+	if (result)
+		snprintf(result, len, "%s.%u", cfg.path, index);
+	return result;
+}
+
+/* path.(n-1) -> path.n, ..., path -> path.1 */
+static struct jool_result rotate(void)
+{
+	char *older, *newer;
+	unsigned int i;
+
+	fclose(file);
+	file = NULL;
+
+	if (cfg.count == 0)
+		return __open(); /* Just truncate. */
+
+	for (i = cfg.count; i > 1; i--) {
+		older = rotated_name(i);
+		newer = rotated_name(i - 1);
+		if (!older || !newer) {
+			free(older);
+			free(newer);
+			return result_from_enomem();
+		}
+		/* It's fine if path.(i-1) doesn't exist yet. */
+		rename(newer, older);
+		free(older);
+		free(newer);
+	}
+
+	older = rotated_name(1);
+	if (!older)
+		return result_from_enomem();
+	if (rename(cfg.path, older)) {
+		free(older);
+		return errno2result("rotate", cfg.path);
+	}
+	free(older);
+
+	return __open();
+}
+
+struct jool_result evfile_open(struct evfile_cfg const *_cfg)
+{
+	cfg = *_cfg;
+	return __open();
+}
+
+struct jool_result evfile_write(struct jool_event const *events,
+		unsigned int count)
+{
+	struct jool_result result;
+	size_t len;
+
+	len = count * sizeof(struct jool_event);
+
+	if (cfg.max_size && file_size + len > cfg.max_size
+			&& file_size > sizeof(struct evfile_hdr)) {
+		result = rotate();
+		if (result.error)
+			return result;
+	}
+
+	if (fwrite(events, sizeof(struct jool_event), count, file) != count)
+		return errno2result("write", cfg.path);
+	/* Whoever is tailing the file shouldn't have to wait for stdio. */
+	if (fflush(file))
+		return errno2result("flush", cfg.path);
+
+	file_size += len;
+	return result_success();
+}
+
+void evfile_close(void)
+{
+	if (file) {
+		fclose(file);
+		file = NULL;
+	}
+}
@@ -0,0 +1,37 @@
+#ifndef SRC_USR_ARGP_EVENTS_FILE_H_
+#define SRC_USR_ARGP_EVENTS_FILE_H_
+
+/*
+ * Writes binary events to a rotating set of files.
+ *
+ * Each file starts with a struct evfile_hdr, followed by raw struct
+ * jool_events (still in network byte order).
+ */
+
+#include "common/event.h"
+#include "usr/util/result.h"
+
+#define EVFILE_MAGIC "JEVL"
+#define EVFILE_VERSION 1
+
+struct evfile_hdr {
+	char magic[4];
+	__be32 version;
+	/* sizeof(struct jool_event), so readers can skip unknown trailers. */
+	__be32 event_size;
+};
+
+struct evfile_cfg {
+	char const *path;
+	/* Rotate once the file reaches this many bytes. Zero never rotates. */
+	__u32 max_size;
+	/* Number of rotated files (path.1, path.2, ...) kept around. */
+	unsigned int count;
+};
+
+struct jool_result evfile_open(struct evfile_cfg const *cfg);
+struct jool_result evfile_write(struct jool_event const *events,
+		unsigned int count);
+void evfile_close(void);
+
+#endif /* SRC_USR_ARGP_EVENTS_FILE_H_ */
@@ -0,0 +1,424 @@
+#include "usr/argp/events/ipfix.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "common/types.h"
+#include "usr/argp/log.h"
+
+#define IPFIX_VERSION 10
+#define IPFIX_HDR_LEN 16
+#define IPFIX_SET_HDR_LEN 4
+#define IPFIX_TEMPLATE_SET_ID 2
+/* Keep messages below the usual path MTU; UDP exporters can't fragment. */
+#define IPFIX_MAX_MSG_LEN 1400
+/*
+ * UDP loses templates, and collectors forget them, so they have to be resent
+ * every now and then. (RFC 7011 section 10.3.6.)
+ */
+#define IPFIX_TEMPLATE_PERIOD 60
+
+/* Information Elements; see IANA's IPFIX registry. */
+#define IE_PROTOCOL_IDENTIFIER 4
+#define IE_SOURCE_TRANSPORT_PORT 7
+#define IE_SOURCE_IPV6_ADDRESS 27
+#define IE_POST_NAT_SOURCE_IPV4_ADDRESS 225
+#define IE_POST_NAT_DESTINATION_IPV4_ADDRESS 226
+#define IE_POST_NAPT_SOURCE_TRANSPORT_PORT 227
+#define IE_POST_NAPT_DESTINATION_TRANSPORT_PORT 228
+#define IE_NAT_EVENT 230
+#define IE_OBSERVATION_TIME_MILLISECONDS 323
+#define IE_PORT_RANGE_START 361
+#define IE_PORT_RANGE_END 362
+
+/* natEvent values; see IANA's IPFIX registry. (RFC 8158.) */
+#define NAT_EVENT_NAT64_SESSION_CREATE 4
+#define NAT_EVENT_NAT64_SESSION_DELETE 5
+#define NAT_EVENT_NAT64_BIB_CREATE 8
+#define NAT_EVENT_NAT64_BIB_DELETE 9
+#define NAT_EVENT_PORT_BLOCK_ALLOCATION 14
+#define NAT_EVENT_PORT_BLOCK_DEALLOCATION 15
+
+struct ipfix_field {
+	__u16 id;
+	__u16 len;
+};
+
+struct ipfix_template {
+	__u16 id;
+	struct ipfix_field const *fields;
+	unsigned int field_count;
+};
+
+static struct ipfix_field const bib_fields[] = {
+	{ IE_OBSERVATION_TIME_MILLISECONDS, 8 },
+	{ IE_NAT_EVENT, 1 },
+	{ IE_PROTOCOL_IDENTIFIER, 1 },
+	{ IE_SOURCE_IPV6_ADDRESS, 16 },
+	{ IE_SOURCE_TRANSPORT_PORT, 2 },
+	{ IE_POST_NAT_SOURCE_IPV4_ADDRESS, 4 },
+	{ IE_POST_NAPT_SOURCE_TRANSPORT_PORT, 2 },
+};
+
+static struct ipfix_field const session_fields[] = {
+	{ IE_OBSERVATION_TIME_MILLISECONDS, 8 },
+	{ IE_NAT_EVENT, 1 },
+	{ IE_PROTOCOL_IDENTIFIER, 1 },
+	{ IE_SOURCE_IPV6_ADDRESS, 16 },
+	{ IE_SOURCE_TRANSPORT_PORT, 2 },
+	{ IE_POST_NAT_SOURCE_IPV4_ADDRESS, 4 },
+	{ IE_POST_NAPT_SOURCE_TRANSPORT_PORT, 2 },
+	{ IE_POST_NAT_DESTINATION_IPV4_ADDRESS, 4 },
+	{ IE_POST_NAPT_DESTINATION_TRANSPORT_PORT, 2 },
+};
+
+/*
+ * Blocks are reported by the address of their first transport address. (A
+ * block can only span several addresses if pba-block-size doesn't divide the
+ * pool4 ranges evenly.)
+ */
+static struct ipfix_field const block_fields[] = {
+	{ IE_OBSERVATION_TIME_MILLISECONDS, 8 },
+	{ IE_NAT_EVENT, 1 },
+	{ IE_PROTOCOL_IDENTIFIER, 1 },
+	{ IE_SOURCE_IPV6_ADDRESS, 16 },
+	{ IE_POST_NAT_SOURCE_IPV4_ADDRESS, 4 },
+	{ IE_PORT_RANGE_START, 2 },
+	{ IE_PORT_RANGE_END, 2 },
+};
+
+#define TEMPLATE(_id, _fields) { \
+	.id = _id, \
+	.fields = _fields, \
+	.field_count = sizeof(_fields) / sizeof(_fields[0]), \
+}
+
+static struct ipfix_template const templates[] = {
+	TEMPLATE(256, bib_fields),
+	TEMPLATE(257, session_fields),
+	TEMPLATE(258, block_fields),
+};
+
+#define TEMPLATE_BIB (&templates[0])
+#define TEMPLATE_SESSION (&templates[1])
+#define TEMPLATE_BLOCK (&templates[2])
+#define TEMPLATE_COUNT (sizeof(templates) / sizeof(templates[0]))
+
+static int sk = -1;
+static __u32 domain;
+
+static unsigned char msg[IPFIX_MAX_MSG_LEN];
+static size_t msg_len;
+/* Data records in @msg */
+static __u32 msg_records;
+/* Data records sent so far; the IPFIX sequence number. */
+static __u32 sequence;
+
+/* Offset of the open set's header in @msg; zero if no set is open. */
+static size_t set_offset;
+static __u16 set_id;
+
+static time_t last_templates;
+
+static void put16(__u16 value)
+{
+	value = htons(value);
+	memcpy(msg + msg_len, &value, sizeof(value));
+	msg_len += sizeof(value);
+}
+
+static void put32(__u32 value)
+{
+	value = htonl(value);
+	memcpy(msg + msg_len, &value, sizeof(value));
+	msg_len += sizeof(value);
+}
+
+static void put_raw(void const *value, size_t len)
+{
+	memcpy(msg + msg_len, value, len);
+	msg_len += len;
+}
+
+static void begin_set(__u16 id)
+{
+	set_offset = msg_len;
+	set_id = id;
+	put16(id);
+	put16(0); /* Length; see end_set(). */
+}
+
+static void end_set(void)
+{
+	__u16 len;
+
+	if (!set_offset)
+		return;
+
+	len = htons(msg_len - set_offset);
+	memcpy(msg + set_offset + 2, &len, sizeof(len));
+	set_offset = 0;
+}
+
+static void flush(void)
+{
+	size_t records_len;
+	ssize_t sent;
+
+	end_set();
+	if (msg_len == IPFIX_HDR_LEN)
+		return;
+
+	records_len = msg_len;
+	msg_len = 0;
+	put16(IPFIX_VERSION);
+	put16(records_len);
+	put32(time(NULL));
+	put32(sequence);
+	put32(domain);
+
+	sent = send(sk, msg, records_len, 0);
+	if (sent < 0) {
+		/* Best effort; the collector might just be restarting. */
+		pr_warn("Could not send IPFIX message: %s", strerror(errno));
+	}
+
+	sequence += msg_records;
+	msg_records = 0;
+	msg_len = IPFIX_HDR_LEN;
+}
+
+static size_t record_len(struct ipfix_template const *template)
+{
+	size_t result = 0;
+	unsigned int i;
+
+	for (i = 0; i < template->field_count; i++)
+		result += template->fields[i].len;
+	return result;
+}
+
+static void add_templates(void)
+{
+	struct ipfix_template const *template;
+	size_t len;
+	unsigned int i, f;
+
+	len = IPFIX_SET_HDR_LEN;
+	for (i = 0; i < TEMPLATE_COUNT; i++)
+		len += 4 + 4 * templates[i].field_count;
+
+	end_set();
+	if (msg_len + len > IPFIX_MAX_MSG_LEN)
+		flush();
+
+	begin_set(IPFIX_TEMPLATE_SET_ID);
+	for (i = 0; i < TEMPLATE_COUNT; i++) {
+		template = &templates[i];
+		put16(template->id);
+		put16(template->field_count);
+		for (f = 0; f < template->field_count; f++) {
+			put16(template->fields[f].id);
+			put16(template->fields[f].len);
+		}
+	}
+	end_set();
+
+	last_templates = time(NULL);
+}
+
+static __u8 nat_event(struct jool_event const *event)
+{
+	switch (event->type) {
+	case JEV_BIB_ADD:
+		return NAT_EVENT_NAT64_BIB_CREATE;
+	case JEV_BIB_RM:
+		return NAT_EVENT_NAT64_BIB_DELETE;
+	case JEV_SESSION_ADD:
+		return NAT_EVENT_NAT64_SESSION_CREATE;
+	case JEV_SESSION_RM:
+		return NAT_EVENT_NAT64_SESSION_DELETE;
+	case JEV_BLOCK_ADD:
+		return NAT_EVENT_PORT_BLOCK_ALLOCATION;
+	case JEV_BLOCK_RM:
+		return NAT_EVENT_PORT_BLOCK_DEALLOCATION;
+	}
+
+	return 0;
+}
+
+/* From the IPv6 side's point of view, since that's the source we report. */
+static __u8 ip_protocol(struct jool_event const *event)
+{
+	switch (event->proto) {
+	case L4PROTO_TCP:
+		return IPPROTO_TCP;
+	case L4PROTO_UDP:
+		return IPPROTO_UDP;
+	case L4PROTO_ICMP:
+		return IPPROTO_ICMPV6;
+	}
+
+	return 0;
+}
+
+static void put_field(__u16 id, struct jool_event const *event)
+{
+	__u8 byte;
+
+	switch (id) {
+	case IE_OBSERVATION_TIME_MILLISECONDS:
+		put_raw(&event->time, sizeof(event->time));
+		return;
+	case IE_NAT_EVENT:
+		byte = nat_event(event);
+		put_raw(&byte, sizeof(byte));
+		return;
+	case IE_PROTOCOL_IDENTIFIER:
+		byte = ip_protocol(event);
+		put_raw(&byte, sizeof(byte));
+		return;
+	case IE_SOURCE_IPV6_ADDRESS:
+		put_raw(&event->src6, sizeof(event->src6));
+		return;
+	case IE_SOURCE_TRANSPORT_PORT:
+		put_raw(&event->src6_port, sizeof(event->src6_port));
+		return;
+	case IE_POST_NAT_SOURCE_IPV4_ADDRESS:
+		put_raw(&event->src4, sizeof(event->src4));
+		return;
+	case IE_POST_NAPT_SOURCE_TRANSPORT_PORT:
+	case IE_PORT_RANGE_START:
+		put_raw(&event->src4_port, sizeof(event->src4_port));
+		return;
+	case IE_POST_NAT_DESTINATION_IPV4_ADDRESS:
+		put_raw(&event->dst4, sizeof(event->dst4));
+		return;
+	case IE_POST_NAPT_DESTINATION_TRANSPORT_PORT:
+	case IE_PORT_RANGE_END:
+		put_raw(&event->dst4_port, sizeof(event->dst4_port));
+		return;
+	}
+}
+
+static struct ipfix_template const *event2template(
+		struct jool_event const *event)
+{
+	switch (event->type) {
+	case JEV_BIB_ADD:
+	case JEV_BIB_RM:
+		return TEMPLATE_BIB;
+	case JEV_SESSION_ADD:
+	case JEV_SESSION_RM:
+		return TEMPLATE_SESSION;
+	case JEV_BLOCK_ADD:
+	case JEV_BLOCK_RM:
+		return TEMPLATE_BLOCK;
+	}
+
+	return NULL; /* JEV_SESSION_STATE, and whatever comes from the future */
+}
+
+static void add_record(struct ipfix_template const *template,
+		struct jool_event const *event)
+{
+	size_t len;
+	unsigned int i;
+
+	len = record_len(template);
+
+	if (set_offset && set_id == template->id) {
+		if (msg_len + len > IPFIX_MAX_MSG_LEN) {
+			flush();
+			begin_set(template->id);
+		}
+	} else {
+		end_set();
+		if (msg_len + IPFIX_SET_HDR_LEN + len > IPFIX_MAX_MSG_LEN)
+			flush();
+		begin_set(template->id);
+	}
+
+	for (i = 0; i < template->field_count; i++)
+		put_field(template->fields[i].id, event);
+	msg_records++;
+}
+
+struct jool_result evipfix_open(struct evipfix_cfg const *cfg)
+{
+	struct addrinfo hints = { 0 };
+	struct addrinfo *addrs, *addr;
+	int error;
+
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = IPPROTO_UDP;
+
+	error = getaddrinfo(cfg->address, cfg->port, &hints, &addrs);
+	if (error) {
+		return result_from_error(
+			-EINVAL,
+			"Cannot resolve IPFIX collector '%s#%s': %s",
+			cfg->address, cfg->port, gai_strerror(error)
+		);
+	}
+
+	for (addr = addrs; addr; addr = addr->ai_next) {
+		sk = socket(addr->ai_family, addr->ai_socktype,
+				addr->ai_protocol);
+		if (sk < 0)
+			continue;
+		if (connect(sk, addr->ai_addr, addr->ai_addrlen) == 0)
+			break;
+		close(sk);
+		sk = -1;
+	}
+
+	freeaddrinfo(addrs);
+	if (sk < 0) {
+		return result_from_error(
+			-EINVAL,
+			"Cannot open a socket towards IPFIX collector '%s#%s'.",
+			cfg->address, cfg->port
+		);
+	}
+
+	domain = cfg->domain;
+	msg_len = IPFIX_HDR_LEN;
+	msg_records = 0;
+	sequence = 0;
+	set_offset = 0;
+	last_templates = 0;
+	return result_success();
+}
+
+struct jool_result evipfix_write(struct jool_event const *events,
+		unsigned int count)
+{
+	struct ipfix_template const *template;
+	unsigned int i;
+
+	if (time(NULL) - last_templates >= IPFIX_TEMPLATE_PERIOD)
+		add_templates();
+
+	for (i = 0; i < count; i++) {
+		template = event2template(&events[i]);
+		if (template)
+			add_record(template, &events[i]);
+	}
+
+	flush();
+	return result_success();
+}
+
+void evipfix_close(void)
+{
+	if (sk >= 0) {
+		close(sk);
+		sk = -1;
+	}
+}
@@ -0,0 +1,28 @@
+#ifndef SRC_USR_ARGP_EVENTS_IPFIX_H_
+#define SRC_USR_ARGP_EVENTS_IPFIX_H_
+
+/*
+ * Exports binary events to an IPFIX collector (RFC 7011), over UDP, using the
+ * NAT Information Elements from RFC 8158.
+ *
+ * TCP state changes have no NAT event counterpart, so they are not exported.
+ */
+
+#include "common/event.h"
+#include "usr/util/result.h"
+
+#define EVIPFIX_DEFAULT_PORT "4739"
+
+struct evipfix_cfg {
+	char const *address;
+	char const *port;
+	/* Observation Domain ID */
+	__u32 domain;
+};
+
+struct jool_result evipfix_open(struct evipfix_cfg const *cfg);
+struct jool_result evipfix_write(struct jool_event const *events,
+		unsigned int count);
+void evipfix_close(void);
+
+#endif /* SRC_USR_ARGP_EVENTS_IPFIX_H_ */
@@ -21,6 +21,7 @@
 #include "usr/argp/wargp/bib.h"
 #include "usr/argp/wargp/denylist4.h"
 #include "usr/argp/wargp/eamt.h"
+#include "usr/argp/wargp/events.h"
 #include "usr/argp/wargp/file.h"
 #include "usr/argp/wargp/global.h"
 #include "usr/argp/wargp/instance.h"
@@ -206,6 +207,11 @@ static struct cmd_option bib_ops[] = {
 			.xt = XT_NAT64,
 			.handler = handle_bib_display,
 			.handle_autocomplete = autocomplete_bib_display,
+		}, {
+			.label = "find",
+			.xt = XT_NAT64,
+			.handler = handle_bib_find,
+			.handle_autocomplete = autocomplete_bib_find,
 		}, {
 			.label = ADD,
 			.xt = XT_NAT64,
@@ -216,6 +222,11 @@ static struct cmd_option bib_ops[] = {
 			.xt = XT_NAT64,
 			.handler = handle_bib_remove,
 			.handle_autocomplete = autocomplete_bib_remove,
+		}, {
+			.label = "subscriber",
+			.xt = XT_NAT64,
+			.handler = handle_bib_subscriber,
+			.handle_autocomplete = autocomplete_bib_subscriber,
 		},
 		{ 0 },
 };
@@ -226,6 +237,26 @@ static struct cmd_option session_ops[] = {
 			.xt = XT_NAT64,
 			.handler = handle_session_display,
 			.handle_autocomplete = autocomplete_session_display,
+		}, {
+			.label = "find",
+			.xt = XT_NAT64,
+			.handler = handle_session_find,
+			.handle_autocomplete = autocomplete_session_find,
+		}, {
+			.label = "stats",
+			.xt = XT_NAT64,
+			.handler = handle_session_stats,
+			.handle_autocomplete = autocomplete_session_stats,
+		}, {
+			.label = "export",
+			.xt = XT_NAT64,
+			.handler = handle_session_export,
+			.handle_autocomplete = autocomplete_session_export,
+		}, {
+			.label = "import",
+			.xt = XT_NAT64,
+			.handler = handle_session_import,
+			.handle_autocomplete = autocomplete_session_import,
 		}, {
 			.label = "follow",
 			.xt = XT_NAT64,
@@ -245,6 +276,16 @@ static struct cmd_option session_ops[] = {
 		{ 0 },
 };
 
+static struct cmd_option events_ops[] = {
+		{
+			.label = "listen",
+			.xt = XT_NAT64,
+			.handler = handle_events_listen,
+			.handle_autocomplete = autocomplete_events_listen,
+		},
+		{ 0 },
+};
+
 static struct cmd_option file_ops[] = {
 		{
 			.label = "handle",
@@ -307,6 +348,10 @@ struct cmd_option tree[] = {
 			.label = "session",
 			.xt = XT_NAT64,
 			.children = session_ops,
+		}, {
+			.label = "events",
+			.xt = XT_NAT64,
+			.children = events_ops,
 		}, {
 			.label = "file",
 			.xt = XT_ANY,
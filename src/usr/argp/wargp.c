@@ -18,6 +18,7 @@ int wargp_parse_string(void *input, int key, char *str);
 int wargp_parse_addr(void *void_field, int key, char *str);
 int wargp_parse_prefix6(void *input, int key, char *str);
 int wargp_parse_prefix4(void *input, int key, char *str);
+int wargp_parse_taddr(void *input, int key, char *str);
 
 struct wargp_type wt_bool = {
 	/* Boolean opts need no argument; absence is false, presence is true. */
@@ -61,6 +62,11 @@ struct wargp_type wt_prefix4 = {
 	.parse = wargp_parse_prefix4,
 };
 
+struct wargp_type wt_taddr = {
+	.arg = "IP6ADDR#PORT IP4ADDR#PORT",
+	.parse = wargp_parse_taddr,
+};
+
 struct wargp_args {
 	struct wargp_option *opts;
 	unsigned char *input;
@@ -164,6 +170,25 @@ int wargp_parse_prefix4(void *void_field, int key, char *str)
 	return 0;
 }
 
+int wargp_parse_taddr(void *void_field, int key, char *str)
+{
+	struct wargp_taddrs *field = void_field;
+	struct jool_result result;
+
+	if (strchr(str, ':')) {
+		field->addr6_set = true;
+		result = str_to_addr6_port(str, &field->addr6);
+		return pr_result(&result);
+	}
+	if (strchr(str, '.')) {
+		field->addr4_set = true;
+		result = str_to_addr4_port(str, &field->addr4);
+		return pr_result(&result);
+	}
+
+	return ARGP_ERR_UNKNOWN;
+}
+
 static int adapt_options(struct argp *argp, struct wargp_option *wopts,
 		struct argp_option **result)
 {
@@ -41,6 +41,7 @@ extern struct wargp_type wt_string;
 extern struct wargp_type wt_addr;
 extern struct wargp_type wt_prefix6;
 extern struct wargp_type wt_prefix4;
+extern struct wargp_type wt_taddr;
 
 struct wargp_option {
 	const char *name;
@@ -82,6 +83,14 @@ struct wargp_prefix4 {
 	struct ipv4_prefix prefix;
 };
 
+/* Up to one transport address of each type. */
+struct wargp_taddrs {
+	bool addr6_set;
+	struct ipv6_transport_addr addr6;
+	bool addr4_set;
+	struct ipv4_transport_addr addr4;
+};
+
 #define ARGP_TCP 't'
 #define ARGP_UDP 'u'
 #define ARGP_ICMP 'i'
@@ -12,11 +12,17 @@
 #include "usr/nl/core.h"
 #include "usr/util/str_utils.h"
 
+#define ARGP_MARK 3000
+#define ARGP_SRC6 3001
+#define ARGP_SRC4 3002
+
 struct display_args {
 	struct wargp_l4proto proto;
 	struct wargp_bool no_headers;
 	struct wargp_bool csv;
 	struct wargp_bool numeric;
+	struct wargp_prefix6 src6;
+	struct wargp_prefix4 src4;
 };
 
 static struct wargp_option display_opts[] = {
@@ -26,6 +32,19 @@ static struct wargp_option display_opts[] = {
 	WARGP_NO_HEADERS(struct display_args, no_headers),
 	WARGP_CSV(struct display_args, csv),
 	WARGP_NUMERIC(struct display_args, numeric),
+	{
+		.name = "src6",
+		.key = ARGP_SRC6,
+		.doc = "Only print the entries whose IPv6 address belongs to this prefix",
+		.offset = offsetof(struct display_args, src6),
+		.type = &wt_prefix6,
+	}, {
+		.name = "src4",
+		.key = ARGP_SRC4,
+		.doc = "Only print the entries whose IPv4 address belongs to this prefix",
+		.offset = offsetof(struct display_args, src4),
+		.type = &wt_prefix4,
+	},
 	{ 0 },
 };
 
@@ -73,7 +92,9 @@ int handle_bib_display(char *iname, int argc, char **argv, void const *arg)
 	if (show_csv_header(dargs.no_headers.value, dargs.csv.value))
 		printf("Protocol,IPv6 Address,IPv6 L4-ID,IPv4 Address,IPv4 L4-ID,Static?\n");
 
-	result = joolnl_bib_foreach(&sk, iname, dargs.proto.proto,
+	result = joolnl_bib_dump(&sk, iname, dargs.proto.proto,
+			dargs.src6.set ? &dargs.src6.prefix : NULL,
+			dargs.src4.set ? &dargs.src4.prefix : NULL,
 			print_entry, &dargs);
 
 	joolnl_teardown(&sk);
@@ -85,40 +106,78 @@ void autocomplete_bib_display(void const *args)
 	print_wargp_opts(display_opts);
 }
 
-struct taddr_tuple {
-	bool addr6_set;
-	struct ipv6_transport_addr addr6;
-	bool addr4_set;
-	struct ipv4_transport_addr addr4;
+struct find_args {
+	struct display_args display;
+	struct wargp_taddrs taddrs;
 };
 
-static int parse_taddr(void *void_field, int key, char *str)
+static struct wargp_option find_opts[] = {
+	WARGP_TCP(struct find_args, display.proto, "Query the TCP table (default)"),
+	WARGP_UDP(struct find_args, display.proto, "Query the UDP table"),
+	WARGP_ICMP(struct find_args, display.proto, "Query the ICMP table"),
+	WARGP_NO_HEADERS(struct find_args, display.no_headers),
+	WARGP_CSV(struct find_args, display.csv),
+	WARGP_NUMERIC(struct find_args, display.numeric),
+	{
+		.name = "Transport address",
+		.key = ARGP_KEY_ARG,
+		.doc = "IPv6 or IPv4 transport address of the BIB entry you want to see",
+		.offset = offsetof(struct find_args, taddrs),
+		.type = &wt_taddr,
+	},
+	{ 0 },
+};
+
+int handle_bib_find(char *iname, int argc, char **argv, void const *arg)
 {
-	struct taddr_tuple *field = void_field;
+	struct find_args fargs = { 0 };
+	struct joolnl_socket sk;
+	struct bib_entry entry;
 	struct jool_result result;
 
-	if (strchr(str, ':')) {
-		field->addr6_set = true;
-		result = str_to_addr6_port(str, &field->addr6);
-		return pr_result(&result);
+	result.error = wargp_parse(find_opts, argc, argv, &fargs);
+	if (result.error)
+		return result.error;
+
+	if (fargs.taddrs.addr6_set == fargs.taddrs.addr4_set) {
+		struct requirement reqs[] = {
+			{ fargs.taddrs.addr6_set || fargs.taddrs.addr4_set,
+					"a transport address" },
+			{ !fargs.taddrs.addr6_set || !fargs.taddrs.addr4_set,
+					"only one transport address" },
+			{ 0 },
+		};
+		return requirement_print(reqs);
 	}
-	if (strchr(str, '.')) {
-		field->addr4_set = true;
-		result = str_to_addr4_port(str, &field->addr4);
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
 		return pr_result(&result);
+
+	result = joolnl_bib_find(&sk, iname,
+			fargs.taddrs.addr6_set ? &fargs.taddrs.addr6 : NULL,
+			&fargs.taddrs.addr4,
+			fargs.display.proto.proto,
+			&entry);
+	if (!result.error) {
+		if (show_csv_header(fargs.display.no_headers.value,
+				fargs.display.csv.value))
+			printf("Protocol,IPv6 Address,IPv6 L4-ID,IPv4 Address,IPv4 L4-ID,Static?\n");
+		print_entry(&entry, &fargs.display);
 	}
 
-	return ARGP_ERR_UNKNOWN;
+	joolnl_teardown(&sk);
+	return pr_result(&result);
+}
+
+void autocomplete_bib_find(void const *args)
+{
+	print_wargp_opts(find_opts);
 }
 
 struct add_args {
 	struct wargp_l4proto proto;
-	struct taddr_tuple taddrs;
-};
-
-struct wargp_type wt_taddr = {
-	.arg = "IP6ADDR#PORT IP4ADDR#PORT",
-	.parse = parse_taddr,
+	struct wargp_taddrs taddrs;
 };
 
 static struct wargp_option add_opts[] = {
@@ -173,7 +232,7 @@ void autocomplete_bib_add(void const *args)
 
 struct rm_args {
 	struct wargp_l4proto proto;
-	struct taddr_tuple taddrs;
+	struct wargp_taddrs taddrs;
 };
 
 static struct wargp_option remove_opts[] = {
@@ -226,3 +285,74 @@ void autocomplete_bib_remove(void const *args)
 {
 	print_wargp_opts(remove_opts);
 }
+
+struct subscriber_args {
+	struct wargp_l4proto proto;
+	__u32 mark;
+	struct wargp_taddrs taddrs;
+};
+
+static struct wargp_option subscriber_opts[] = {
+	WARGP_TCP(struct subscriber_args, proto, "Query the TCP table (default)"),
+	WARGP_UDP(struct subscriber_args, proto, "Query the UDP table"),
+	WARGP_ICMP(struct subscriber_args, proto, "Query the ICMP table"),
+	{
+		.name = "mark",
+		.key = ARGP_MARK,
+		.doc = "Mark of the pool4 entries the transport address belongs to",
+		.offset = offsetof(struct subscriber_args, mark),
+		.type = &wt_u32,
+	}, {
+		.name = "IPv4 transport address",
+		.key = ARGP_KEY_ARG,
+		.doc = "Transport address whose subscriber you want to know",
+		.offset = offsetof(struct subscriber_args, taddrs),
+		.type = &wt_taddr,
+	},
+	{ 0 },
+};
+
+/*
+ * Deterministic mode only. Does not look at the BIB; the subscriber is
+ * computed out of pool4 and the det-* globals.
+ */
+int handle_bib_subscriber(char *iname, int argc, char **argv, void const *arg)
+{
+	struct subscriber_args sargs = { 0 };
+	struct joolnl_socket sk;
+	struct ipv6_prefix prefix;
+	char str[INET6_ADDRSTRLEN];
+	struct jool_result result;
+
+	result.error = wargp_parse(subscriber_opts, argc, argv, &sargs);
+	if (result.error)
+		return result.error;
+
+	if (!sargs.taddrs.addr4_set || sargs.taddrs.addr6_set) {
+		struct requirement reqs[] = {
+			{ sargs.taddrs.addr4_set, "an IPv4 transport address" },
+			{ !sargs.taddrs.addr6_set, "no IPv6 transport addresses" },
+			{ 0 },
+		};
+		return requirement_print(reqs);
+	}
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	result = joolnl_bib_subscriber(&sk, iname, sargs.proto.proto,
+			sargs.mark, &sargs.taddrs.addr4, &prefix);
+	if (!result.error) {
+		inet_ntop(AF_INET6, &prefix.addr, str, sizeof(str));
+		printf("%s/%u\n", str, prefix.len);
+	}
+
+	joolnl_teardown(&sk);
+	return pr_result(&result);
+}
+
+void autocomplete_bib_subscriber(void const *args)
+{
+	print_wargp_opts(subscriber_opts);
+}
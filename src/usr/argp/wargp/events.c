@@ -0,0 +1,258 @@
+#include "usr/argp/wargp/events.h"
+
+#include <endian.h>
+#include <stdio.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "common/session.h"
+#include "usr/nl/core.h"
+#include "usr/nl/events.h"
+#include "usr/argp/log.h"
+#include "usr/argp/userspace-types.h"
+#include "usr/argp/wargp.h"
+#include "usr/argp/xlator_type.h"
+#include "usr/argp/events/file.h"
+#include "usr/argp/events/ipfix.h"
+
+#define DEFAULT_FILE_MAX_SIZE (64 << 20)
+#define DEFAULT_FILE_COUNT 5
+
+struct listen_args {
+	struct wargp_string file_path;
+	__u32 file_max_size;
+	__u32 file_count;
+	struct wargp_string ipfix_addr;
+	struct wargp_string ipfix_port;
+	__u32 ipfix_domain;
+	struct wargp_bool no_headers;
+};
+
+static struct wargp_option listen_opts[] = {
+	{
+		.name = "file.path",
+		.key = 3000,
+		.doc = "Write the events (in binary) to this file, instead of printing them",
+		.offset = offsetof(struct listen_args, file_path),
+		.type = &wt_string,
+	}, {
+		.name = "file.max-size",
+		.key = 3001,
+		.doc = "Rotate the file once it reaches this many bytes (0 = never)",
+		.offset = offsetof(struct listen_args, file_max_size),
+		.type = &wt_u32,
+	}, {
+		.name = "file.count",
+		.key = 3002,
+		.doc = "Number of rotated files to keep",
+		.offset = offsetof(struct listen_args, file_count),
+		.type = &wt_u32,
+	}, {
+		.name = "ipfix.address",
+		.key = 3010,
+		.doc = "Export the events to this IPFIX collector, instead of printing them",
+		.offset = offsetof(struct listen_args, ipfix_addr),
+		.type = &wt_string,
+	}, {
+		.name = "ipfix.port",
+		.key = 3011,
+		.doc = "UDP port of the IPFIX collector",
+		.offset = offsetof(struct listen_args, ipfix_port),
+		.type = &wt_string,
+	}, {
+		.name = "ipfix.domain",
+		.key = 3012,
+		.doc = "IPFIX Observation Domain ID",
+		.offset = offsetof(struct listen_args, ipfix_domain),
+		.type = &wt_u32,
+	},
+	WARGP_NO_HEADERS(struct listen_args, no_headers),
+	{ 0 },
+};
+
+static char const *event_type_to_string(__u8 type)
+{
+	switch (type) {
+	case JEV_BIB_ADD:
+		return "BIB add";
+	case JEV_BIB_RM:
+		return "BIB remove";
+	case JEV_SESSION_ADD:
+		return "Session add";
+	case JEV_SESSION_RM:
+		return "Session remove";
+	case JEV_SESSION_STATE:
+		return "Session state";
+	case JEV_BLOCK_ADD:
+		return "Block add";
+	case JEV_BLOCK_RM:
+		return "Block remove";
+	}
+
+	return "Unknown";
+}
+
+static char const *event_state_to_string(struct jool_event const *event)
+{
+	if (event->proto != L4PROTO_TCP)
+		return "";
+	if (event->type != JEV_SESSION_ADD && event->type != JEV_SESSION_STATE)
+		return "";
+
+	switch (event->state) {
+	case ESTABLISHED:
+		return "ESTABLISHED";
+	case V4_INIT:
+		return "V4_INIT";
+	case V6_INIT:
+		return "V6_INIT";
+	case V4_FIN_RCV:
+		return "V4_FIN_RCV";
+	case V6_FIN_RCV:
+		return "V6_FIN_RCV";
+	case V4_FIN_V6_FIN_RCV:
+		return "V4_FIN_V6_FIN_RCV";
+	case TRANS:
+		return "TRANS";
+	}
+
+	return "UNKNOWN";
+}
+
+static void print_time(__be64 be_time)
+{
+	__u64 msecs;
+	time_t secs;
+	struct tm tm;
+	char buffer[32];
+
+	msecs = be64toh(be_time);
+	secs = msecs / 1000;
+	gmtime_r(&secs, &tm);
+	strftime(buffer, sizeof(buffer), "%Y/%m/%d %H:%M:%S", &tm);
+	printf("%s.%03u", buffer, (unsigned int)(msecs % 1000));
+}
+
+static struct jool_result print_events(struct jool_event const *events,
+		unsigned int count, void *args)
+{
+	struct jool_event const *event;
+	char buffer[INET6_ADDRSTRLEN];
+	bool has_dst4;
+
+	for (event = events; event < events + count; event++) {
+		has_dst4 = event->type != JEV_BIB_ADD
+				&& event->type != JEV_BIB_RM;
+
+		print_time(event->time);
+		printf(",%s,%s,", event_type_to_string(event->type),
+				l4proto_to_string(event->proto));
+		inet_ntop(AF_INET6, &event->src6, buffer, sizeof(buffer));
+		printf("%s,%u,", buffer, ntohs(event->src6_port));
+		inet_ntop(AF_INET, &event->src4, buffer, sizeof(buffer));
+		printf("%s,%u,", buffer, ntohs(event->src4_port));
+		if (has_dst4) {
+			inet_ntop(AF_INET, &event->dst4, buffer, sizeof(buffer));
+			printf("%s,%u,", buffer, ntohs(event->dst4_port));
+		} else {
+			printf(",,");
+		}
+		printf("%s\n", event_state_to_string(event));
+	}
+
+	fflush(stdout);
+	return result_success();
+}
+
+struct sinks {
+	bool file;
+	bool ipfix;
+};
+
+static struct jool_result write_events(struct jool_event const *events,
+		unsigned int count, void *args)
+{
+	struct sinks *sinks = args;
+	struct jool_result result;
+
+	if (sinks->file) {
+		result = evfile_write(events, count);
+		if (result.error)
+			return result;
+	}
+	if (sinks->ipfix) {
+		result = evipfix_write(events, count);
+		if (result.error)
+			return result;
+	}
+
+	return result_success();
+}
+
+int handle_events_listen(char *iname, int argc, char **argv, void const *arg)
+{
+	struct listen_args largs = { 0 };
+	struct sinks sinks;
+	struct evfile_cfg filecfg;
+	struct evipfix_cfg ipfixcfg;
+	struct joolnl_socket sk;
+	struct jool_result result;
+
+	largs.file_max_size = DEFAULT_FILE_MAX_SIZE;
+	largs.file_count = DEFAULT_FILE_COUNT;
+
+	result.error = wargp_parse(listen_opts, argc, argv, &largs);
+	if (result.error)
+		return result.error;
+
+	sinks.file = largs.file_path.value != NULL;
+	sinks.ipfix = largs.ipfix_addr.value != NULL;
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	if (sinks.file) {
+		filecfg.path = largs.file_path.value;
+		filecfg.max_size = largs.file_max_size;
+		filecfg.count = largs.file_count;
+		result = evfile_open(&filecfg);
+		if (result.error)
+			goto end;
+	}
+
+	if (sinks.ipfix) {
+		ipfixcfg.address = largs.ipfix_addr.value;
+		ipfixcfg.port = (largs.ipfix_port.value != NULL)
+				? largs.ipfix_port.value
+				: EVIPFIX_DEFAULT_PORT;
+		ipfixcfg.domain = largs.ipfix_domain;
+		result = evipfix_open(&ipfixcfg);
+		if (result.error)
+			goto end;
+	}
+
+	if (sinks.file || sinks.ipfix) {
+		result = joolnl_events_listen(&sk, iname, write_events, &sinks);
+	} else {
+		if (show_csv_header(largs.no_headers.value, true)) {
+			printf("Time (GMT),Event,Protocol,");
+			printf("IPv6 Address,IPv6 L4-ID,");
+			printf("IPv4 Address,IPv4 L4-ID,");
+			printf("IPv4 Remote Address (or Block End),IPv4 Remote L4-ID,");
+			printf("State\n");
+		}
+		result = joolnl_events_listen(&sk, iname, print_events, NULL);
+	}
+
+end:
+	evipfix_close();
+	evfile_close();
+	joolnl_teardown(&sk);
+	return pr_result(&result);
+}
+
+void autocomplete_events_listen(void const *args)
+{
+	print_wargp_opts(listen_opts);
+}
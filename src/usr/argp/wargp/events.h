@@ -0,0 +1,7 @@
+#ifndef SRC_USR_ARGP_WARGP_EVENTS_H_
+#define SRC_USR_ARGP_WARGP_EVENTS_H_
+
+int handle_events_listen(char *, int, char **, void const *);
+void autocomplete_events_listen(void const *);
+
+#endif /* SRC_USR_ARGP_WARGP_EVENTS_H_ */
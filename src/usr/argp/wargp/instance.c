@@ -16,6 +16,7 @@
 
 #define ARGP_IPTABLES 1000
 #define ARGP_NETFILTER 1001
+#define ARGP_BIB_HASH 1002
 #define ARGP_POOL6 '6'
 
 struct wargp_iname {
@@ -163,6 +164,7 @@ struct add_args {
 	struct wargp_bool iptables;
 	struct wargp_bool netfilter;
 	struct wargp_prefix6 pool6;
+	struct wargp_bool bib_hash;
 };
 
 static struct wargp_option add_opts[] = {
@@ -187,6 +189,12 @@ static struct wargp_option add_opts[] = {
 		.doc = "Prefix that will populate the IPv6 Address Pool",
 		.offset = offsetof(struct add_args, pool6),
 		.type = &wt_prefix6,
+	}, {
+		.name = "bib-hash",
+		.key = ARGP_BIB_HASH,
+		.doc = "Index the BIB with hash tables instead of trees (NAT64 only)",
+		.offset = offsetof(struct add_args, bib_hash),
+		.type = &wt_bool,
 	},
 	{ 0 },
 };
@@ -230,7 +238,8 @@ int handle_instance_add(char *iname, int argc, char **argv, void const *arg)
 
 	xf = aargs.netfilter.value ? XF_NETFILTER : XF_IPTABLES;
 	result = joolnl_instance_add(&sk, xf, iname,
-			aargs.pool6.set ? &aargs.pool6.prefix : NULL);
+			aargs.pool6.set ? &aargs.pool6.prefix : NULL,
+			aargs.bib_hash.value);
 
 	joolnl_teardown(&sk);
 	return pr_result(&result);
@@ -14,16 +14,24 @@
 #include "usr/nl/session.h"
 #include "usr/argp/dns.h"
 #include "usr/argp/log.h"
+#include "usr/argp/requirements.h"
 #include "usr/argp/userspace-types.h"
 #include "usr/argp/wargp.h"
 #include "usr/argp/xlator_type.h"
+#include "usr/argp/checkpoint/file.h"
 #include "usr/argp/joold/modsocket.h"
 
+#define ARGP_SRC6 3001
+#define ARGP_SRC4 3002
+#define ARGP_SUBSCRIBER_LEN 3003
+
 struct display_args {
 	struct wargp_bool no_headers;
 	struct wargp_bool csv;
 	struct wargp_bool numeric;
 	struct wargp_l4proto proto;
+	struct wargp_prefix6 src6;
+	struct wargp_prefix4 src4;
 };
 
 static struct wargp_option display_opts[] = {
@@ -33,6 +41,19 @@ static struct wargp_option display_opts[] = {
 	WARGP_NO_HEADERS(struct display_args, no_headers),
 	WARGP_CSV(struct display_args, csv),
 	WARGP_NUMERIC(struct display_args, numeric),
+	{
+		.name = "src6",
+		.key = ARGP_SRC6,
+		.doc = "Only print the sessions whose IPv6 source address belongs to this prefix",
+		.offset = offsetof(struct display_args, src6),
+		.type = &wt_prefix6,
+	}, {
+		.name = "src4",
+		.key = ARGP_SRC4,
+		.doc = "Only print the sessions whose IPv4 source address belongs to this prefix",
+		.offset = offsetof(struct display_args, src4),
+		.type = &wt_prefix4,
+	},
 	{ 0 },
 };
 
@@ -105,6 +126,20 @@ static struct jool_result handle_display_response(
 	return result_success();
 }
 
+static void print_display_header(struct display_args *dargs)
+{
+	if (!dargs->csv.value) {
+		printf("---------------------------------\n");
+	} else if (show_csv_header(dargs->no_headers.value, dargs->csv.value)) {
+		printf("Protocol,");
+		printf("IPv6 Remote Address,IPv6 Remote L4-ID,");
+		printf("IPv6 Local Address,IPv6 Local L4-ID,");
+		printf("IPv4 Local Address,IPv4 Local L4-ID,");
+		printf("IPv4 Remote Address,IPv4 Remote L4-ID,");
+		printf("Expires in,State\n");
+	}
+}
+
 int handle_session_display(char *iname, int argc, char **argv, void const *arg)
 {
 	struct display_args dargs = { 0 };
@@ -119,18 +154,11 @@ int handle_session_display(char *iname, int argc, char **argv, void const *arg)
 	if (result.error)
 		return pr_result(&result);
 
-	if (!dargs.csv.value) {
-		printf("---------------------------------\n");
-	} else if (show_csv_header(dargs.no_headers.value, dargs.csv.value)) {
-		printf("Protocol,");
-		printf("IPv6 Remote Address,IPv6 Remote L4-ID,");
-		printf("IPv6 Local Address,IPv6 Local L4-ID,");
-		printf("IPv4 Local Address,IPv4 Local L4-ID,");
-		printf("IPv4 Remote Address,IPv4 Remote L4-ID,");
-		printf("Expires in,State\n");
-	}
+	print_display_header(&dargs);
 
-	result = joolnl_session_foreach(&sk, iname, dargs.proto.proto,
+	result = joolnl_session_dump(&sk, iname, dargs.proto.proto,
+			dargs.src6.set ? &dargs.src6.prefix : NULL,
+			dargs.src4.set ? &dargs.src4.prefix : NULL,
 			handle_display_response, &dargs);
 
 	joolnl_teardown(&sk);
@@ -138,6 +166,405 @@ int handle_session_display(char *iname, int argc, char **argv, void const *arg)
 	return pr_result(&result);
 }
 
+struct find_args {
+	struct display_args display;
+	struct wargp_taddrs taddrs;
+};
+
+static struct wargp_option find_opts[] = {
+	WARGP_TCP(struct find_args, display.proto, "Query the TCP table (default)"),
+	WARGP_UDP(struct find_args, display.proto, "Query the UDP table"),
+	WARGP_ICMP(struct find_args, display.proto, "Query the ICMP table"),
+	WARGP_NO_HEADERS(struct find_args, display.no_headers),
+	WARGP_CSV(struct find_args, display.csv),
+	WARGP_NUMERIC(struct find_args, display.numeric),
+	{
+		.name = "Transport address",
+		.key = ARGP_KEY_ARG,
+		.doc = "IPv6 or IPv4 transport address of the BIB entry whose sessions you want to see",
+		.offset = offsetof(struct find_args, taddrs),
+		.type = &wt_taddr,
+	},
+	{ 0 },
+};
+
+int handle_session_find(char *iname, int argc, char **argv, void const *arg)
+{
+	struct find_args fargs = { 0 };
+	struct joolnl_socket sk;
+	struct jool_result result;
+
+	result.error = wargp_parse(find_opts, argc, argv, &fargs);
+	if (result.error)
+		return result.error;
+
+	if (fargs.taddrs.addr6_set == fargs.taddrs.addr4_set) {
+		struct requirement reqs[] = {
+			{ fargs.taddrs.addr6_set || fargs.taddrs.addr4_set,
+					"a transport address" },
+			{ !fargs.taddrs.addr6_set || !fargs.taddrs.addr4_set,
+					"only one transport address" },
+			{ 0 },
+		};
+		return requirement_print(reqs);
+	}
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	print_display_header(&fargs.display);
+
+	result = joolnl_session_find(&sk, iname, fargs.display.proto.proto,
+			fargs.taddrs.addr6_set ? &fargs.taddrs.addr6 : NULL,
+			&fargs.taddrs.addr4,
+			handle_display_response, &fargs.display);
+
+	joolnl_teardown(&sk);
+
+	return pr_result(&result);
+}
+
+struct stats_args {
+	struct wargp_l4proto proto;
+	struct wargp_bool no_headers;
+	struct wargp_bool csv;
+	__u32 subscriber_len;
+
+	struct session_stats_usr stats;
+	bool stats_printed;
+};
+
+static struct wargp_option stats_opts[] = {
+	WARGP_TCP(struct stats_args, proto, "Summarize the TCP table (default)"),
+	WARGP_UDP(struct stats_args, proto, "Summarize the UDP table"),
+	WARGP_ICMP(struct stats_args, proto, "Summarize the ICMP table"),
+	WARGP_NO_HEADERS(struct stats_args, no_headers),
+	WARGP_CSV(struct stats_args, csv),
+	{
+		.name = "subscriber-len",
+		.key = ARGP_SUBSCRIBER_LEN,
+		.doc = "Length of the IPv6 prefix that identifies a subscriber (default 64)",
+		.offset = offsetof(struct stats_args, subscriber_len),
+		.type = &wt_u32,
+	},
+	{ 0 },
+};
+
+static char const *const timer_names[] = {
+	"Established", "Transitory", "SYN4",
+};
+
+static void print_group(struct stats_args *sargs, char const *group)
+{
+	if (!sargs->csv.value)
+		printf("%s:\n", group);
+}
+
+static void print_stat(struct stats_args *sargs, char const *group,
+		char const *label, __u32 value)
+{
+	if (sargs->csv.value)
+		printf("%s,%s,%u\n", group, label, value);
+	else
+		printf("  %s: %u\n", label, value);
+}
+
+static void print_stats(struct stats_args *sargs)
+{
+	static const unsigned int idle_bounds[] = JSS_IDLE_BOUNDS;
+	struct session_stats_usr *stats = &sargs->stats;
+	char group[32];
+	char label[32];
+	unsigned int i;
+
+	if (show_csv_header(sargs->no_headers.value, sargs->csv.value))
+		printf("Group,Label,Value\n");
+
+	if (sargs->proto.proto == L4PROTO_TCP) {
+		print_group(sargs, "State");
+		for (i = 0; i < JSS_STATES; i++)
+			print_stat(sargs, "State", tcp_state_to_string(i),
+					stats->states[i]);
+	}
+
+	print_group(sargs, "Timer");
+	for (i = 0; i < JSS_TIMERS; i++)
+		print_stat(sargs, "Timer", timer_names[i], stats->timers[i]);
+
+	print_group(sargs, "Idle");
+	for (i = 0; i < JSS_IDLE_BUCKETS; i++) {
+		if (i < JSS_IDLE_BUCKETS - 1)
+			snprintf(label, sizeof(label), "<%us", idle_bounds[i]);
+		else
+			snprintf(label, sizeof(label), ">=%us",
+					idle_bounds[i - 1]);
+		print_stat(sargs, "Idle", label, stats->idle[i]);
+	}
+
+	if (stats->has_subscribers) {
+		snprintf(group, sizeof(group), "Subscribers (/%u)",
+				stats->subscriber_len);
+		print_group(sargs, group);
+		print_stat(sargs, group, "Total", stats->subscriber_count);
+		for (i = 0; i < JSS_SUBSCRIBER_BUCKETS; i++) {
+			if (i < JSS_SUBSCRIBER_BUCKETS - 1)
+				snprintf(label, sizeof(label), "%u-%u sessions",
+						1u << i, (2u << i) - 1);
+			else
+				snprintf(label, sizeof(label), "%u+ sessions",
+						1u << i);
+			print_stat(sargs, group, label, stats->subscribers[i]);
+		}
+	}
+
+	print_group(sargs, "Memory");
+	print_stat(sargs, "Memory", "Bytes per BIB entry", stats->bib_bytes);
+	print_stat(sargs, "Memory", "Bytes per session", stats->session_bytes);
+
+	print_group(sargs, "BIB entries per pool4 address");
+	sargs->stats_printed = true;
+}
+
+static struct jool_result handle_addr_stats(struct in_addr const *addr,
+		__u32 bibs, void *args)
+{
+	struct stats_args *sargs = args;
+	char str[INET_ADDRSTRLEN];
+
+	/* The table's stats arrive first. */
+	if (!sargs->stats_printed)
+		print_stats(sargs);
+
+	inet_ntop(AF_INET, addr, str, sizeof(str));
+	print_stat(sargs, "Pool4 address", str, bibs);
+	return result_success();
+}
+
+int handle_session_stats(char *iname, int argc, char **argv, void const *arg)
+{
+	struct stats_args sargs = { 0 };
+	struct joolnl_socket sk;
+	struct jool_result result;
+
+	sargs.subscriber_len = 64;
+
+	result.error = wargp_parse(stats_opts, argc, argv, &sargs);
+	if (result.error)
+		return result.error;
+
+	if (sargs.subscriber_len > 128) {
+		pr_err("--subscriber-len must be at most 128.");
+		return -EINVAL;
+	}
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	result = joolnl_session_stats(&sk, iname, sargs.proto.proto,
+			sargs.subscriber_len, &sargs.stats,
+			handle_addr_stats, &sargs);
+	if (!result.error && !sargs.stats_printed)
+		print_stats(&sargs);
+
+	joolnl_teardown(&sk);
+
+	return pr_result(&result);
+}
+
+struct export_args {
+	struct wargp_string file_name;
+};
+
+static struct wargp_option export_opts[] = {
+	{
+		.name = "File name",
+		.key = ARGP_KEY_ARG,
+		.doc = "Path of the checkpoint file that will be written",
+		.offset = offsetof(struct export_args, file_name),
+		.type = &wt_string,
+	},
+	{ 0 },
+};
+
+static struct jool_result export_session(struct session_entry_usr const *entry,
+		void *args)
+{
+	struct jool_session_rec rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.src6 = entry->src6.l3;
+	rec.src6_port = htons(entry->src6.l4);
+	rec.dst6 = entry->dst6.l3;
+	rec.dst6_port = htons(entry->dst6.l4);
+	rec.src4 = entry->src4.l3;
+	rec.src4_port = htons(entry->src4.l4);
+	rec.dst4 = entry->dst4.l3;
+	rec.dst4_port = htons(entry->dst4.l4);
+	rec.expiration = htonl(entry->dying_time);
+	rec.proto = entry->proto;
+	rec.state = entry->state;
+	rec.timer = entry->timer;
+
+	return ckpt_write(args, &rec);
+}
+
+int handle_session_export(char *iname, int argc, char **argv, void const *arg)
+{
+	static l4_protocol const protos[] = {
+		L4PROTO_TCP, L4PROTO_UDP, L4PROTO_ICMP
+	};
+	struct export_args eargs = { 0 };
+	struct joolnl_socket sk;
+	struct ckpt_writer writer;
+	struct jool_result result, close_result;
+	unsigned int i;
+
+	result.error = wargp_parse(export_opts, argc, argv, &eargs);
+	if (result.error)
+		return result.error;
+
+	if (!eargs.file_name.value) {
+		struct requirement reqs[] = {
+				{ false, "a file name" },
+				{ 0 }
+		};
+		return requirement_print(reqs);
+	}
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	/*
+	 * The expirations are measured after this, so the restored sessions
+	 * can only die a little early. (Never late.)
+	 */
+	result = ckpt_open(&writer, eargs.file_name.value, ckpt_now());
+	if (result.error)
+		goto end;
+
+	for (i = 0; i < sizeof(protos) / sizeof(protos[0]); i++) {
+		result = joolnl_session_dump(&sk, iname, protos[i], NULL, NULL,
+				export_session, &writer);
+		if (result.error)
+			break;
+	}
+
+	close_result = ckpt_close(&writer);
+	if (!result.error)
+		result = close_result;
+	else
+		result_cleanup(&close_result);
+	if (!result.error)
+		printf("Exported %u sessions.\n", writer.count);
+
+end:
+	joolnl_teardown(&sk);
+	return pr_result(&result);
+}
+
+struct import_args {
+	struct wargp_string file_name;
+};
+
+static struct wargp_option import_opts[] = {
+	{
+		.name = "File name",
+		.key = ARGP_KEY_ARG,
+		.doc = "Path of a checkpoint file written by `session export`",
+		.offset = offsetof(struct import_args, file_name),
+		.type = &wt_string,
+	},
+	{ 0 },
+};
+
+static int compare_expiration(void const *a, void const *b)
+{
+	__u32 ea = ntohl(((struct jool_session_rec const *)a)->expiration);
+	__u32 eb = ntohl(((struct jool_session_rec const *)b)->expiration);
+	return (ea > eb) - (ea < eb);
+}
+
+/*
+ * Ages @recs by the time that has passed since the export, and drops the ones
+ * that have already expired. Returns the number of survivors.
+ */
+static unsigned int age_sessions(struct jool_session_rec *recs,
+		unsigned int count, __u64 export_time)
+{
+	__u64 now;
+	__u64 elapsed;
+	__u32 expiration;
+	unsigned int i, survivors;
+
+	now = ckpt_now();
+	elapsed = (now > export_time) ? (now - export_time) : 0;
+
+	survivors = 0;
+	for (i = 0; i < count; i++) {
+		expiration = ntohl(recs[i].expiration);
+		if (expiration <= elapsed)
+			continue;
+		recs[survivors] = recs[i];
+		recs[survivors].expiration = htonl(expiration - elapsed);
+		survivors++;
+	}
+
+	return survivors;
+}
+
+int handle_session_import(char *iname, int argc, char **argv, void const *arg)
+{
+	struct import_args iargs = { 0 };
+	struct joolnl_socket sk;
+	struct jool_session_rec *recs;
+	unsigned int count, survivors;
+	__u64 export_time;
+	__u32 added;
+	struct jool_result result;
+
+	result.error = wargp_parse(import_opts, argc, argv, &iargs);
+	if (result.error)
+		return result.error;
+
+	if (!iargs.file_name.value) {
+		struct requirement reqs[] = {
+				{ false, "a file name" },
+				{ 0 }
+		};
+		return requirement_print(reqs);
+	}
+
+	result = ckpt_read(iargs.file_name.value, &recs, &count, &export_time);
+	if (result.error)
+		return pr_result(&result);
+
+	survivors = age_sessions(recs, count, export_time);
+	/* Lets the kernel append every session to the end of its expirer. */
+	qsort(recs, survivors, sizeof(*recs), compare_expiration);
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		goto end;
+
+	result = joolnl_session_import(&sk, iname, recs, survivors, &added);
+	if (!result.error) {
+		printf("Imported %u sessions.\n", added);
+		if (count != survivors)
+			printf("%u had already expired.\n", count - survivors);
+		if (survivors != added)
+			printf("%u already existed, or collided with existing BIB entries.\n",
+					survivors - added);
+	}
+
+	joolnl_teardown(&sk);
+end:
+	free(recs);
+	return pr_result(&result);
+}
+
 int handle_session_follow(char *iname, int argc, char **argv, void const *arg)
 {
 	int error;
@@ -271,6 +698,26 @@ void autocomplete_session_display(void const *args)
 	print_wargp_opts(display_opts);
 }
 
+void autocomplete_session_find(void const *args)
+{
+	print_wargp_opts(find_opts);
+}
+
+void autocomplete_session_stats(void const *args)
+{
+	print_wargp_opts(stats_opts);
+}
+
+void autocomplete_session_export(void const *args)
+{
+	/* Do nothing; default to autocomplete directory path */
+}
+
+void autocomplete_session_import(void const *args)
+{
+	/* Do nothing; default to autocomplete directory path */
+}
+
 void autocomplete_session_follow(void const *args)
 {
 	/* Nothing needed here. */
@@ -5,11 +5,19 @@
 #include "usr/argp/joold/statsocket.h"
 
 int handle_session_display(char *, int, char **, void const *);
+int handle_session_find(char *, int, char **, void const *);
+int handle_session_stats(char *, int, char **, void const *);
+int handle_session_export(char *, int, char **, void const *);
+int handle_session_import(char *, int, char **, void const *);
 int handle_session_follow(char *, int, char **, void const *);
 int handle_session_proxy(char *, int, char **, void const *);
 int handle_session_advertise(char *, int, char **, void const *);
 
 void autocomplete_session_display(void const *);
+void autocomplete_session_find(void const *);
+void autocomplete_session_stats(void const *);
+void autocomplete_session_export(void const *);
+void autocomplete_session_import(void const *);
 void autocomplete_session_follow(void const *);
 void autocomplete_session_proxy(void const *);
 void autocomplete_session_advertise(void const *);
@@ -1,6 +1,7 @@
 #include <errno.h>
 #include <getopt.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <xtables.h>
@@ -100,7 +101,7 @@ static struct xtables_target targets[] = {
 		.revision      = 0,
 		.family        = PF_INET6,
 		.size          = XT_ALIGN(sizeof(struct target_info)),
-		.userspacesize = XT_ALIGN(sizeof(struct target_info)),
+		.userspacesize = offsetof(struct target_info, cache),
 		.help          = jool_tg_help,
 		.init          = jool_tg_init,
 		.parse         = jool_tg_parse,
@@ -113,7 +114,7 @@ static struct xtables_target targets[] = {
 		.revision      = 0,
 		.family        = PF_INET,
 		.size          = XT_ALIGN(sizeof(struct target_info)),
-		.userspacesize = XT_ALIGN(sizeof(struct target_info)),
+		.userspacesize = offsetof(struct target_info, cache),
 		.help          = jool_tg_help,
 		.init          = jool_tg_init,
 		.parse         = jool_tg_parse,
@@ -290,6 +290,7 @@ struct jool_result nla_get_session(struct nlattr *root, struct session_entry_usr
 		return result;
 	out->proto = nla_get_u8(attrs[JNLASE_PROTO]);
 	out->state = nla_get_u8(attrs[JNLASE_STATE]);
+	out->timer = attrs[JNLASE_TIMER] ? nla_get_u8(attrs[JNLASE_TIMER]) : 0;
 	out->dying_time = nla_get_u32(attrs[JNLASE_EXPIRATION]);
 	return result_success();
 }
@@ -524,6 +525,33 @@ int nla_put_bib(struct nl_msg *msg, int attrtype, struct bib_entry const *entry)
 			entry->l4_proto, entry->is_static);
 }
 
+/* Writes the filter of a BIB or session dump. NULL prefixes are left out. */
+int nla_put_dump_filter(struct nl_msg *msg, int attrtype,
+		struct ipv6_prefix const *src6,
+		struct ipv4_prefix const *src4)
+{
+	struct nlattr *root;
+
+	if (!src6 && !src4)
+		return 0;
+
+	root = jnla_nest_start(msg, attrtype);
+	if (!root)
+		return -NLE_NOMEM;
+
+	if (src6 && nla_put_prefix6(msg, JNLAF_SRC6, src6) < 0)
+		goto nla_put_failure;
+	if (src4 && nla_put_prefix4(msg, JNLAF_SRC4, src4) < 0)
+		goto nla_put_failure;
+
+	nla_nest_end(msg, root);
+	return 0;
+
+nla_put_failure:
+	nla_nest_cancel(msg, root);
+	return -NLE_NOMEM;
+}
+
 int nla_put_session(struct nl_msg *msg, int attrtype, struct session_entry_usr const *entry)
 {
 	struct nlattr *root;
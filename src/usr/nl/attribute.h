@@ -66,6 +66,7 @@ int nla_put_plateaus(struct nl_msg *msg, int attrtype, struct mtu_plateaus const
 int nla_put_eam(struct nl_msg *msg, int attrtype, struct eamt_entry const *entry);
 int nla_put_pool4(struct nl_msg *msg, int attrtype, struct pool4_entry const *entry);
 int nla_put_bib(struct nl_msg *msg, int attrtype, struct bib_entry const *entry);
+int nla_put_dump_filter(struct nl_msg *msg, int attrtype, struct ipv6_prefix const *src6, struct ipv4_prefix const *src4);
 int nla_put_bib_attrs(struct nl_msg *msg, int attrtype,
 		struct ipv6_transport_addr const *addr6,
 		struct ipv4_transport_addr const *addr4,
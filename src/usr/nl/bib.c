@@ -2,8 +2,11 @@
 
 #include <errno.h>
 #include <netlink/genl/genl.h>
+#include "common/dump.h"
 #include "usr/nl/attribute.h"
 #include "usr/nl/common.h"
+#include "usr/nl/global.h"
+#include "usr/nl/pool4.h"
 
 struct foreach_args {
 	joolnl_bib_foreach_cb cb;
@@ -80,6 +83,133 @@ cancel:
 	return joolnl_err_msgsize();
 }
 
+struct dump_args {
+	joolnl_bib_foreach_cb cb;
+	void *args;
+};
+
+static struct jool_result handle_dump_response(struct nl_msg *response,
+		void *arg)
+{
+	struct dump_args *args = arg;
+	struct nlattr *recs;
+	struct jool_bib_rec const *rec;
+	struct bib_entry entry;
+	int count;
+	struct jool_result result;
+
+	recs = nlmsg_find_attr(nlmsg_hdr(response),
+			GENL_HDRLEN + sizeof(struct joolnlhdr),
+			JNLAR_BIB_RECS);
+	if (!recs || (nla_len(recs) % sizeof(*rec))) {
+		return result_from_error(
+			-EINVAL,
+			"The kernel module's BIB dump message is malformed."
+		);
+	}
+
+	rec = nla_data(recs);
+	for (count = nla_len(recs) / sizeof(*rec); count > 0; count--, rec++) {
+		entry.addr6.l3 = rec->src6;
+		entry.addr6.l4 = ntohs(rec->src6_port);
+		entry.addr4.l3 = rec->src4;
+		entry.addr4.l4 = ntohs(rec->src4_port);
+		entry.l4_proto = rec->proto;
+		entry.is_static = rec->is_static;
+
+		result = args->cb(&entry, args->args);
+		if (result.error)
+			return result;
+	}
+
+	return result_success();
+}
+
+/**
+ * Same as joolnl_bib_foreach(), except the table is requested as a single
+ * dump, and @cb is called as the entries arrive. The entries are not sorted.
+ *
+ * If @src6 and/or @src4 are not NULL, the kernel only sends the entries whose
+ * source addresses belong to them.
+ */
+struct jool_result joolnl_bib_dump(struct joolnl_socket *sk, char const *iname,
+	l4_protocol proto,
+	struct ipv6_prefix const *src6, struct ipv4_prefix const *src4,
+	joolnl_bib_foreach_cb cb, void *_args)
+{
+	struct nl_msg *msg;
+	struct dump_args args;
+	struct jool_result result;
+
+	args.cb = cb;
+	args.args = _args;
+
+	result = joolnl_alloc_msg(sk, iname, JNLOP_BIB_DUMP, 0, &msg);
+	if (result.error)
+		return result;
+
+	if (nla_put_u8(msg, JNLAR_PROTO, proto) < 0)
+		goto cancel;
+	if (nla_put_dump_filter(msg, JNLAR_FILTER, src6, src4) < 0)
+		goto cancel;
+
+	return joolnl_dump(sk, msg, handle_dump_response, &args);
+
+cancel:
+	nlmsg_free(msg);
+	return joolnl_err_msgsize();
+}
+
+static struct jool_result handle_find_response(struct nl_msg *response,
+		void *result)
+{
+	static struct nla_policy find_policy[JNLAR_COUNT] = {
+		[JNLAR_OPERAND] = { .type = NLA_NESTED },
+	};
+	struct nlattr *attrs[JNLAR_COUNT];
+	struct jool_result jresult;
+
+	jresult = jnla_parse_msg(response, attrs, JNLAR_MAX, find_policy, false);
+	if (jresult.error)
+		return jresult;
+
+	if (!attrs[JNLAR_OPERAND]) {
+		return result_from_error(
+			-ESRCH,
+			"The kernel's response lacks the BIB entry."
+		);
+	}
+
+	return nla_get_bib(attrs[JNLAR_OPERAND], result);
+}
+
+/**
+ * Returns (in @result) the BIB entry whose IPv6 transport address is @a6, or
+ * (if @a6 is NULL) whose IPv4 transport address is @a4.
+ */
+struct jool_result joolnl_bib_find(struct joolnl_socket *sk,
+		char const *iname,
+		struct ipv6_transport_addr const *a6,
+		struct ipv4_transport_addr const *a4,
+		l4_protocol proto,
+		struct bib_entry *result)
+{
+	struct nl_msg *msg;
+	struct jool_result jresult;
+
+	jresult = joolnl_alloc_msg(sk, iname, JNLOP_BIB_FIND, 0, &msg);
+	if (jresult.error)
+		return jresult;
+
+	if (nla_put_bib_attrs(msg, JNLAR_OPERAND, a6, a6 ? NULL : a4, proto,
+			false) < 0) {
+		nlmsg_free(msg);
+		return joolnl_err_msgsize();
+	}
+
+	return joolnl_request(sk, msg, handle_find_response, result);
+}
+
 static struct jool_result __update(struct joolnl_socket *sk, char const *iname,
 		enum joolnl_operation op,
 		struct ipv6_transport_addr const *a6,
@@ -119,3 +249,128 @@ struct jool_result joolnl_bib_rm(struct joolnl_socket *sk,
 {
 	return __update(sk, iname, JNLOP_BIB_RM, a6, a4, proto);
 }
+
+struct subscriber_args {
+	struct det_config det;
+
+	__u32 mark;
+	struct ipv4_transport_addr const *addr;
+	/* Position of @addr in the mark's domain. */
+	__u64 offset;
+	bool found;
+	/* Total transport addresses in the mark's domain. */
+	__u64 taddr_count;
+};
+
+static struct jool_result collect_det_global(
+		struct joolnl_global_meta const *meta, void *value, void *_args)
+{
+	struct subscriber_args *args = _args;
+
+	switch (joolnl_global_meta_id(meta)) {
+	case JNLAG_DET_PREFIX:
+		args->det.prefix = *((struct config_prefix6 *)value);
+		break;
+	case JNLAG_DET_SUBSCRIBER_LEN:
+		args->det.subscriber_len = *((__u8 *)value);
+		break;
+	case JNLAG_DET_BLOCK_SIZE:
+		args->det.block_size = *((__u32 *)value);
+		break;
+	default:
+		break;
+	}
+
+	return result_success();
+}
+
+/*
+ * The kernel hands pool4 over in the same order it uses to lay out the blocks,
+ * so this only needs to add up the ranges that precede the address.
+ */
+static struct jool_result measure_pool4(struct pool4_entry const *entry,
+		void *_args)
+{
+	struct subscriber_args *args = _args;
+	__u32 addr;
+	__u32 first;
+	__u64 addrs;
+	unsigned int ports;
+
+	if (entry->mark != args->mark)
+		return result_success();
+
+	addrs = 1ULL << (32 - entry->range.prefix.len);
+	ports = port_range_count(&entry->range.ports);
+
+	if (!args->found) {
+		addr = ntohl(args->addr->l3.s_addr);
+		first = ntohl(entry->range.prefix.addr.s_addr);
+		if (addr - first < addrs && port_range_contains(
+				&entry->range.ports, args->addr->l4)) {
+			args->offset = args->taddr_count
+					+ (__u64)(addr - first) * ports
+					+ args->addr->l4 - entry->range.ports.min;
+			args->found = true;
+		}
+	}
+
+	args->taddr_count += addrs * ports;
+	return result_success();
+}
+
+/**
+ * Deterministic NAT64 (RFC 7422) reverse lookup: Returns (in @result) the
+ * prefix of the subscriber whose port block contains @a4.
+ *
+ * This is pure arithmetic over pool4 and the det-* globals; no BIB entries or
+ * logs are involved.
+ */
+struct jool_result joolnl_bib_subscriber(struct joolnl_socket *sk,
+		char const *iname, l4_protocol proto, __u32 mark,
+		struct ipv4_transport_addr const *a4, struct ipv6_prefix *result)
+{
+	struct subscriber_args args;
+	unsigned int index_bits;
+	__u64 block;
+	struct jool_result jresult;
+
+	memset(&args, 0, sizeof(args));
+	args.mark = mark;
+	args.addr = a4;
+
+	jresult = joolnl_global_foreach(sk, iname, collect_det_global, &args);
+	if (jresult.error)
+		return jresult;
+	if (!args.det.prefix.set) {
+		return result_from_error(-EINVAL,
+				"Deterministic mode is disabled. (det-prefix is unset.)");
+	}
+	if (!det_validate(&args.det.prefix.prefix, args.det.subscriber_len)) {
+		return result_from_error(-EINVAL,
+				"det-subscriber-length (%u) is incompatible with det-prefix's length (%u).",
+				args.det.subscriber_len,
+				args.det.prefix.prefix.len);
+	}
+
+	jresult = joolnl_pool4_foreach(sk, iname, proto, measure_pool4, &args);
+	if (jresult.error)
+		return jresult;
+	if (!args.found) {
+		return result_from_error(-ESRCH,
+				"The transport address does not belong to mark %u's pool4.",
+				mark);
+	}
+
+	block = args.offset / args.det.block_size;
+	index_bits = args.det.subscriber_len - args.det.prefix.prefix.len;
+	if (block >= args.taddr_count / args.det.block_size
+			|| (index_bits < 32 && block >= (1ULL << index_bits))) {
+		return result_from_error(-ESRCH,
+				"The transport address is not assigned to any subscriber.");
+	}
+
+	det_subscriber_prefix(&args.det.prefix.prefix,
+			args.det.subscriber_len, block, result);
+	return result_success();
+}
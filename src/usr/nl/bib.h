@@ -16,6 +16,25 @@ struct jool_result joolnl_bib_foreach(
 	void *args
 );
 
+struct jool_result joolnl_bib_dump(
+	struct joolnl_socket *sk,
+	char const *iname,
+	l4_protocol proto,
+	struct ipv6_prefix const *src6,
+	struct ipv4_prefix const *src4,
+	joolnl_bib_foreach_cb cb,
+	void *args
+);
+
+struct jool_result joolnl_bib_find(
+	struct joolnl_socket *sk,
+	char const *iname,
+	struct ipv6_transport_addr const *a6,
+	struct ipv4_transport_addr const *a4,
+	l4_protocol proto,
+	struct bib_entry *result
+);
+
 struct jool_result joolnl_bib_add(
 	struct joolnl_socket *sk,
 	char const *iname,
@@ -32,4 +51,13 @@ struct jool_result joolnl_bib_rm(
 	l4_protocol proto
 );
 
+struct jool_result joolnl_bib_subscriber(
+	struct joolnl_socket *sk,
+	char const *iname,
+	l4_protocol proto,
+	__u32 mark,
+	struct ipv4_transport_addr const *a4,
+	struct ipv6_prefix *result
+);
+
 #endif /* SRC_USR_NL_BIB_H_ */
@@ -273,6 +273,108 @@ struct jool_result joolnl_request(struct joolnl_socket *socket,
 	return result_success();
 }
 
+/*
+ * Reads the error code the kernel leaves in NLMSG_DONE when a dump fails
+ * halfway. (libnl would otherwise treat it as a normal ending.)
+ */
+static int dump_finish_handler(struct nl_msg *msg, void *_args)
+{
+	struct response_cb *args = _args;
+	struct nlmsghdr *nhdr;
+	int error;
+
+	nhdr = nlmsg_hdr(msg);
+	if (nlmsg_datalen(nhdr) < (int)sizeof(int))
+		return NL_STOP;
+
+	error = *((int *)nlmsg_data(nhdr));
+	if (error < 0) {
+		args->result = result_from_error(
+			error,
+			"The kernel module aborted the dump: %s",
+			strerror(-error)
+		);
+	}
+
+	return NL_STOP;
+}
+
+/**
+ * Like joolnl_request(), except @msg is sent as a dump request
+ * (NLM_F_DUMP), and @cb is called once for every message of the response,
+ * as they arrive.
+ *
+ * Consumes @msg, even on error.
+ */
+struct jool_result joolnl_dump(struct joolnl_socket *socket,
+		struct nl_msg *msg, joolnl_response_cb cb, void *cb_arg)
+{
+	struct response_cb callback;
+	int error;
+
+	callback.xt = socket->xt;
+	callback.cb = cb;
+	callback.arg = cb_arg;
+	memset(&callback.result, 0, sizeof(callback.result));
+
+	/*
+	 * The dump ends with NLMSG_DONE, which has no Jool header, so the
+	 * handler has to be attached after libnl's own message type
+	 * processing. (Unlike joolnl_request()'s.)
+	 */
+	error = nl_socket_modify_cb(socket->sk, NL_CB_MSG_IN, NL_CB_DEFAULT,
+			NULL, NULL);
+	if (!error)
+		error = nl_socket_modify_cb(socket->sk, NL_CB_VALID,
+				NL_CB_CUSTOM, response_handler, &callback);
+	if (!error)
+		error = nl_socket_modify_cb(socket->sk, NL_CB_FINISH,
+				NL_CB_CUSTOM, dump_finish_handler, &callback);
+	if (error < 0) {
+		nlmsg_free(msg);
+		return result_from_error(
+			error,
+			"Could not register response handler: %s\n",
+			nl_geterror(error)
+		);
+	}
+
+	nlmsg_hdr(msg)->nlmsg_flags |= NLM_F_DUMP;
+	error = nl_send_auto(socket->sk, msg);
+	nlmsg_free(msg);
+	if (error < 0) {
+		callback.result = result_from_error(
+			error,
+			"Could not dispatch the request to kernelspace: %s",
+			nl_geterror(error)
+		);
+		goto end;
+	}
+
+	error = nl_recvmsgs_default(socket->sk);
+	if (error < 0) {
+		if (!((callback.result.flags & JRF_INITIALIZED)
+				&& callback.result.error)) {
+			callback.result = result_from_error(
+				error,
+				"Error receiving the kernel module's response: %s",
+				nl_geterror(error)
+			);
+		}
+		goto end;
+	}
+
+	if (!(callback.result.flags & JRF_INITIALIZED))
+		callback.result = result_success();
+
+end:
+	/* Don't leave dangling pointers to @callback in the socket. */
+	nl_socket_modify_cb(socket->sk, NL_CB_VALID, NL_CB_DEFAULT, NULL, NULL);
+	nl_socket_modify_cb(socket->sk, NL_CB_FINISH, NL_CB_DEFAULT, NULL,
+			NULL);
+	return callback.result;
+}
+
 /**
  * Contract: The result will contain 0 on success, -ESRCH on module likely not
  * modprobed, else -EINVAL.
@@ -0,0 +1,133 @@
+#include "usr/nl/events.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <strings.h>
+#include <netlink/genl/ctrl.h>
+#include <netlink/genl/genl.h>
+
+struct listen_args {
+	char const *iname;
+	joolnl_events_cb cb;
+	void *args;
+	struct jool_result result;
+};
+
+static int events_cb(struct nl_msg *msg, void *arg)
+{
+	struct listen_args *largs = arg;
+	struct nlmsghdr *nhdr;
+	struct genlmsghdr *ghdr;
+	struct joolnlhdr *jhdr;
+	struct nlattr *attr;
+	int rem;
+
+	nhdr = nlmsg_hdr(msg);
+	if (!genlmsg_valid_hdr(nhdr, sizeof(struct joolnlhdr))) {
+		largs->result = result_from_error(
+			-EINVAL,
+			"Kernel sent invalid data: Message too short to contain headers"
+		);
+		return NL_STOP;
+	}
+
+	ghdr = genlmsg_hdr(nhdr);
+	jhdr = genlmsg_user_hdr(ghdr);
+	largs->result = validate_joolnlhdr(jhdr, XT_NAT64);
+	if (largs->result.error)
+		return NL_STOP;
+	if (strcasecmp(jhdr->iname, largs->iname) != 0)
+		return NL_OK; /* Another instance's events. */
+
+	nla_for_each_attr(attr, genlmsg_attrdata(ghdr, sizeof(*jhdr)),
+			genlmsg_attrlen(ghdr, sizeof(*jhdr)), rem) {
+		if (nla_type(attr) != JNLAR_EVENTS)
+			continue;
+		if (nla_len(attr) % sizeof(struct jool_event)) {
+			largs->result = result_from_error(
+				-EINVAL,
+				"Kernel sent invalid data: Event array length (%d) is not a multiple of %zu.",
+				nla_len(attr), sizeof(struct jool_event)
+			);
+			return NL_STOP;
+		}
+
+		largs->result = largs->cb(nla_data(attr),
+				nla_len(attr) / sizeof(struct jool_event),
+				largs->args);
+		if (largs->result.error)
+			return NL_STOP;
+	}
+
+	return NL_OK;
+}
+
+/**
+ * Subscribes @sk to the events multicast group, and hands every batch of
+ * @iname's events to @cb. Only returns on error. (Including @cb's.)
+ *
+ * If the kernel outpaces us, the socket buffer overflows and some events are
+ * lost. This is reported on stderr, but is not considered fatal.
+ */
+struct jool_result joolnl_events_listen(struct joolnl_socket *sk,
+		char const *iname, joolnl_events_cb cb, void *args)
+{
+	struct listen_args largs;
+	int group;
+	int error;
+
+	largs.iname = iname ? iname : "default";
+	largs.cb = cb;
+	largs.args = args;
+	largs.result = result_success();
+
+	/* Multicast messages are not responses to anything. */
+	nl_socket_disable_seq_check(sk->sk);
+
+	error = nl_socket_modify_cb(sk->sk, NL_CB_VALID, NL_CB_CUSTOM,
+			events_cb, &largs);
+	if (error) {
+		return result_from_error(
+			error,
+			"Couldn't modify the socket's callbacks: %s",
+			nl_geterror(error)
+		);
+	}
+
+	group = genl_ctrl_resolve_grp(sk->sk, JOOLNL_FAMILY,
+			JOOLNL_EVENTS_GRP_NAME);
+	if (group < 0) {
+		return result_from_error(
+			group,
+			"Unable to resolve the events multicast group: %s\n"
+			"(Does the kernel module predate binary logging?)",
+			nl_geterror(group)
+		);
+	}
+
+	error = nl_socket_add_membership(sk->sk, group);
+	if (error) {
+		return result_from_error(
+			error,
+			"Can't subscribe to the events multicast group: %s\n"
+			"(Listening requires CAP_NET_ADMIN. Maybe try sudo?)",
+			nl_geterror(error)
+		);
+	}
+
+	do {
+		error = nl_recvmsgs_default(sk->sk);
+		if (largs.result.error)
+			return largs.result;
+		if (error == -NLE_NOMEM) {
+			/* ENOBUFS; the socket overflowed. */
+			fprintf(stderr, "Warning: Events were lost; the kernel is producing them faster than they are being consumed.\n");
+		} else if (error < 0) {
+			return result_from_error(
+				error,
+				"Error receiving events from kernelspace: %s",
+				nl_geterror(error)
+			);
+		}
+	} while (true);
+}
@@ -0,0 +1,21 @@
+#ifndef SRC_USR_NL_EVENTS_H_
+#define SRC_USR_NL_EVENTS_H_
+
+#include "common/event.h"
+#include "usr/nl/core.h"
+
+/*
+ * Receives a batch of events, as sent by the kernel module. They are still in
+ * network byte order.
+ */
+typedef struct jool_result (*joolnl_events_cb)(struct jool_event const *,
+		unsigned int, void *);
+
+struct jool_result joolnl_events_listen(
+	struct joolnl_socket *sk,
+	char const *iname,
+	joolnl_events_cb cb,
+	void *args
+);
+
+#endif /* SRC_USR_NL_EVENTS_H_ */
@@ -149,7 +149,7 @@ struct jool_result joolnl_instance_hello(struct joolnl_socket *sk,
 
 struct jool_result joolnl_instance_add(struct joolnl_socket *sk,
 		xlator_framework xf, char const *iname,
-		struct ipv6_prefix const *pool6)
+		struct ipv6_prefix const *pool6, bool bib_hash)
 {
 	struct nl_msg *msg;
 	struct nlattr *root;
@@ -170,6 +170,8 @@ struct jool_result joolnl_instance_add(struct joolnl_socket *sk,
 	NLA_PUT_U8(msg, JNLAIA_XF, xf);
 	if (nla_put_prefix6(msg, JNLAIA_POOL6, pool6) < 0)
 		goto nla_put_failure;
+	if (bib_hash)
+		NLA_PUT_U8(msg, JNLAIA_BIB_HASH, 1);
 
 	nla_nest_end(msg, root);
 	return joolnl_request(sk, msg, NULL, NULL);
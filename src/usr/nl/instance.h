@@ -24,7 +24,8 @@ struct jool_result joolnl_instance_add(
 	struct joolnl_socket *sk,
 	xlator_framework xf,
 	char const *iname,
-	struct ipv6_prefix const *pool6
+	struct ipv6_prefix const *pool6,
+	bool bib_hash
 );
 
 struct jool_result joolnl_instance_rm(
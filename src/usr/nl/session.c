@@ -1,7 +1,9 @@
 #include "usr/nl/session.h"
 
 #include <errno.h>
+#include <unistd.h>
 #include <netlink/genl/genl.h>
+#include "common/dump.h"
 #include "usr/nl/attribute.h"
 #include "usr/nl/common.h"
 
@@ -80,3 +82,306 @@ cancel:
 	return joolnl_err_msgsize();
 }
 
+
+struct dump_args {
+	joolnl_session_foreach_cb cb;
+	void *args;
+};
+
+static struct jool_result handle_dump_response(struct nl_msg *response,
+		void *arg)
+{
+	struct dump_args *args = arg;
+	struct nlattr *recs;
+	struct jool_session_rec const *rec;
+	struct session_entry_usr entry;
+	int count;
+	struct jool_result result;
+
+	recs = nlmsg_find_attr(nlmsg_hdr(response),
+			GENL_HDRLEN + sizeof(struct joolnlhdr),
+			JNLAR_SESSION_RECS);
+	if (!recs || (nla_len(recs) % sizeof(*rec))) {
+		return result_from_error(
+			-EINVAL,
+			"The kernel module's session dump message is malformed."
+		);
+	}
+
+	rec = nla_data(recs);
+	for (count = nla_len(recs) / sizeof(*rec); count > 0; count--, rec++) {
+		entry.src6.l3 = rec->src6;
+		entry.src6.l4 = ntohs(rec->src6_port);
+		entry.dst6.l3 = rec->dst6;
+		entry.dst6.l4 = ntohs(rec->dst6_port);
+		entry.src4.l3 = rec->src4;
+		entry.src4.l4 = ntohs(rec->src4_port);
+		entry.dst4.l3 = rec->dst4;
+		entry.dst4.l4 = ntohs(rec->dst4_port);
+		entry.proto = rec->proto;
+		entry.state = rec->state;
+		entry.timer = rec->timer;
+		entry.dying_time = ntohl(rec->expiration);
+
+		result = args->cb(&entry, args->args);
+		if (result.error)
+			return result;
+	}
+
+	return result_success();
+}
+
+/**
+ * Same as joolnl_session_foreach(), except the table is requested as a single
+ * dump, and @cb is called as the entries arrive. The entries are not sorted.
+ *
+ * If @src6 and/or @src4 are not NULL, the kernel only sends the sessions whose
+ * source addresses belong to them.
+ */
+struct jool_result joolnl_session_dump(struct joolnl_socket *sk,
+		char const *iname, l4_protocol proto,
+		struct ipv6_prefix const *src6, struct ipv4_prefix const *src4,
+		joolnl_session_foreach_cb cb, void *_args)
+{
+	struct nl_msg *msg;
+	struct dump_args args;
+	struct jool_result result;
+
+	args.cb = cb;
+	args.args = _args;
+
+	result = joolnl_alloc_msg(sk, iname, JNLOP_SESSION_DUMP, 0, &msg);
+	if (result.error)
+		return result;
+
+	if (nla_put_u8(msg, JNLAR_PROTO, proto) < 0)
+		goto cancel;
+	if (nla_put_dump_filter(msg, JNLAR_FILTER, src6, src4) < 0)
+		goto cancel;
+
+	return joolnl_dump(sk, msg, handle_dump_response, &args);
+
+cancel:
+	nlmsg_free(msg);
+	return joolnl_err_msgsize();
+}
+
+/**
+ * Same as joolnl_session_foreach(), except only the sessions of one BIB entry
+ * are requested. The entry is the one whose IPv6 transport address is @a6, or
+ * (if @a6 is NULL) whose IPv4 transport address is @a4.
+ */
+struct jool_result joolnl_session_find(struct joolnl_socket *sk,
+		char const *iname, l4_protocol proto,
+		struct ipv6_transport_addr const *a6,
+		struct ipv4_transport_addr const *a4,
+		joolnl_session_foreach_cb cb, void *_args)
+{
+	struct nl_msg *msg;
+	struct foreach_args args;
+	struct jool_result result;
+	bool first_request;
+
+	args.cb = cb;
+	args.args = _args;
+	args.done = true;
+	memset(&args.last, 0, sizeof(args.last));
+	first_request = true;
+
+	do {
+		result = joolnl_alloc_msg(sk, iname, JNLOP_SESSION_FIND, 0, &msg);
+		if (result.error)
+			return result;
+
+		if (nla_put_bib_attrs(msg, JNLAR_OPERAND, a6, a6 ? NULL : a4,
+				proto, false) < 0)
+			goto cancel;
+
+		if (first_request)
+			first_request = false;
+		else if (nla_put_session(msg, JNLAR_OFFSET, &args.last) < 0)
+			goto cancel;
+
+		result = joolnl_request(sk, msg, handle_foreach_response, &args);
+		if (result.error)
+			return result;
+	} while (!args.done);
+
+	return result_success();
+
+cancel:
+	nlmsg_free(msg);
+	return joolnl_err_msgsize();
+}
+
+struct stats_args {
+	struct session_stats_usr *stats;
+	joolnl_addr_stats_cb cb;
+	void *args;
+};
+
+static void stats_to_host(struct jool_session_stats const *src,
+		struct session_stats_usr *dst)
+{
+	unsigned int i;
+
+	for (i = 0; i < JSS_STATES; i++)
+		dst->states[i] = ntohl(src->states[i]);
+	for (i = 0; i < JSS_TIMERS; i++)
+		dst->timers[i] = ntohl(src->timers[i]);
+	for (i = 0; i < JSS_IDLE_BUCKETS; i++)
+		dst->idle[i] = ntohl(src->idle[i]);
+	for (i = 0; i < JSS_SUBSCRIBER_BUCKETS; i++)
+		dst->subscribers[i] = ntohl(src->subscribers[i]);
+	dst->subscriber_count = ntohl(src->subscriber_count);
+	dst->subscriber_len = src->subscriber_len;
+	dst->has_subscribers = src->has_subscribers;
+	dst->bib_bytes = ntohl(src->bib_bytes);
+	dst->session_bytes = ntohl(src->session_bytes);
+}
+
+static struct jool_result handle_stats_response(struct nl_msg *response,
+		void *arg)
+{
+	struct stats_args *args = arg;
+	struct nlattr *stats;
+	struct nlattr *recs;
+	struct jool_addr_stats const *rec;
+	int count;
+	struct jool_result result;
+
+	stats = nlmsg_find_attr(nlmsg_hdr(response),
+			GENL_HDRLEN + sizeof(struct joolnlhdr),
+			JNLAR_SESSION_STATS);
+	recs = nlmsg_find_attr(nlmsg_hdr(response),
+			GENL_HDRLEN + sizeof(struct joolnlhdr),
+			JNLAR_ADDR_STATS);
+	if (!stats || nla_len(stats) != sizeof(struct jool_session_stats)
+			|| !recs || (nla_len(recs) % sizeof(*rec))) {
+		return result_from_error(
+			-EINVAL,
+			"The kernel module's session stats message is malformed."
+		);
+	}
+
+	stats_to_host(nla_data(stats), args->stats);
+
+	rec = nla_data(recs);
+	for (count = nla_len(recs) / sizeof(*rec); count > 0; count--, rec++) {
+		result = args->cb(&rec->addr, ntohl(rec->bibs), args->args);
+		if (result.error)
+			return result;
+	}
+
+	return result_success();
+}
+
+/**
+ * Asks the kernel module for @proto's aggregate session numbers. (See
+ * common/session_stats.h.) They are written into @stats, and @cb is called
+ * once for every IPv4 address the table has masked with.
+ *
+ * A subscriber is a /@subscriber_len of IPv6 source addresses.
+ */
+struct jool_result joolnl_session_stats(struct joolnl_socket *sk,
+		char const *iname, l4_protocol proto, __u8 subscriber_len,
+		struct session_stats_usr *stats,
+		joolnl_addr_stats_cb cb, void *_args)
+{
+	struct nl_msg *msg;
+	struct stats_args args;
+	struct jool_result result;
+
+	args.stats = stats;
+	args.cb = cb;
+	args.args = _args;
+
+	result = joolnl_alloc_msg(sk, iname, JNLOP_SESSION_STATS, 0, &msg);
+	if (result.error)
+		return result;
+
+	if (nla_put_u8(msg, JNLAR_PROTO, proto) < 0)
+		goto cancel;
+	if (nla_put_u8(msg, JNLAR_SUBSCRIBER_LEN, subscriber_len) < 0)
+		goto cancel;
+
+	return joolnl_request(sk, msg, handle_stats_response, &args);
+
+cancel:
+	nlmsg_free(msg);
+	return joolnl_err_msgsize();
+}
+
+/* Records per import request. Keeps the messages around 56 KB. */
+#define IMPORT_BATCH 1024
+
+static struct jool_result handle_import_response(struct nl_msg *response,
+		void *arg)
+{
+	struct nlattr *attr;
+
+	attr = nlmsg_find_attr(nlmsg_hdr(response),
+			GENL_HDRLEN + sizeof(struct joolnlhdr),
+			JNLAR_IMPORTED);
+	if (!attr || nla_len(attr) < (int)sizeof(__u32)) {
+		return result_from_error(
+			-EINVAL,
+			"The kernel module's session import response is malformed."
+		);
+	}
+
+	*((__u32 *)arg) += nla_get_u32(attr);
+	return result_success();
+}
+
+/**
+ * Adds @recs (which are compact session records, as sent by the session dumps)
+ * to the kernel module's session tables. The BIB entries they need are
+ * created along the way. The number of sessions that were actually added
+ * (the kernel skips the ones that already exist) is stored in @added.
+ *
+ * The records should be sorted by expiration; otherwise each addition costs a
+ * partial walk of its expiration list.
+ */
+struct jool_result joolnl_session_import(struct joolnl_socket *sk,
+		char const *iname, struct jool_session_rec const *recs,
+		unsigned int count, __u32 *added)
+{
+	struct nl_msg *msg;
+	unsigned int n;
+	size_t len, needed;
+	struct jool_result result;
+
+	*added = 0;
+
+	while (count > 0) {
+		n = (count < IMPORT_BATCH) ? count : IMPORT_BATCH;
+		len = n * sizeof(*recs);
+
+		result = joolnl_alloc_msg(sk, iname, JNLOP_SESSION_IMPORT, 0,
+				&msg);
+		if (result.error)
+			return result;
+
+		/* The default message is only one page long. */
+		needed = NLMSG_ALIGN(nlmsg_hdr(msg)->nlmsg_len)
+				+ nla_total_size(len);
+		if (needed > (size_t)getpagesize() && nlmsg_expand(msg, needed) < 0)
+			goto cancel;
+		if (nla_put(msg, JNLAR_SESSION_RECS, len, recs) < 0)
+			goto cancel;
+
+		result = joolnl_request(sk, msg, handle_import_response, added);
+		if (result.error)
+			return result;
+
+		recs += n;
+		count -= n;
+	}
+
+	return result_success();
+
+cancel:
+	nlmsg_free(msg);
+	return joolnl_err_msgsize();
+}
@@ -2,6 +2,8 @@
 #define SRC_USR_NL_SESSION_H_
 
 #include "common/config.h"
+#include "common/dump.h"
+#include "common/session_stats.h"
 #include "usr/nl/core.h"
 
 /**
@@ -19,6 +21,7 @@ struct session_entry_usr {
 	struct ipv4_transport_addr dst4;
 	__u8 proto;
 	__u8 state;
+	__u8 timer;
 	__u32 dying_time;
 };
 
@@ -34,4 +37,59 @@ struct jool_result joolnl_session_foreach(
 	void *args
 );
 
+struct jool_result joolnl_session_dump(
+	struct joolnl_socket *sk,
+	char const *iname,
+	l4_protocol proto,
+	struct ipv6_prefix const *src6,
+	struct ipv4_prefix const *src4,
+	joolnl_session_foreach_cb cb,
+	void *args
+);
+
+struct jool_result joolnl_session_find(
+	struct joolnl_socket *sk,
+	char const *iname,
+	l4_protocol proto,
+	struct ipv6_transport_addr const *a6,
+	struct ipv4_transport_addr const *a4,
+	joolnl_session_foreach_cb cb,
+	void *args
+);
+
+/* Host byte order version of struct jool_session_stats. */
+struct session_stats_usr {
+	__u32 states[JSS_STATES];
+	__u32 timers[JSS_TIMERS];
+	__u32 idle[JSS_IDLE_BUCKETS];
+	__u32 subscribers[JSS_SUBSCRIBER_BUCKETS];
+	__u32 subscriber_count;
+	__u8 subscriber_len;
+	bool has_subscribers;
+	__u32 bib_bytes;
+	__u32 session_bytes;
+};
+
+typedef struct jool_result (*joolnl_addr_stats_cb)(
+	struct in_addr const *addr, __u32 bibs, void *args
+);
+
+struct jool_result joolnl_session_stats(
+	struct joolnl_socket *sk,
+	char const *iname,
+	l4_protocol proto,
+	__u8 subscriber_len,
+	struct session_stats_usr *stats,
+	joolnl_addr_stats_cb cb,
+	void *args
+);
+
+struct jool_result joolnl_session_import(
+	struct joolnl_socket *sk,
+	char const *iname,
+	struct jool_session_rec const *recs,
+	unsigned int count,
+	__u32 *added
+);
+
 #endif /* SRC_USR_NL_SESSION_H_ */
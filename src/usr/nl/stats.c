@@ -21,6 +21,8 @@ static struct joolnl_stat_metadata const jstat_metadatas[] = {
 	DEFINE_STAT(JSTAT_SUCCESS, "Successful translations. (Note: 'Successful translation' does not imply that the packet was actually delivered.)"),
 	DEFINE_STAT(JSTAT_BIB_ENTRIES, "Number of BIB entries currently held in the BIB."),
 	DEFINE_STAT(JSTAT_SESSIONS, "Number of session entries currently held in the BIB."),
+	DEFINE_STAT(JSTAT_BIB_BYTES, "Memory currently held by the BIB entries, in bytes. (Divide by JSTAT_BIB_ENTRIES to get the size of one entry.)"),
+	DEFINE_STAT(JSTAT_SESSION_BYTES, "Memory currently held by the session entries, in bytes. (Divide by JSTAT_SESSIONS to get the size of one session.)"),
 	DEFINE_STAT(JSTAT_ENOMEM, "Memory allocation failures."),
 	DEFINE_STAT(JSTAT_XLATOR_DISABLED, TC "Translator was manually disabled."),
 	DEFINE_STAT(JSTAT_POOL6_UNSET, TC "pool6 was unset."),
@@ -48,6 +50,8 @@ static struct joolnl_stat_metadata const jstat_metadatas[] = {
 	DEFINE_STAT(JSTAT_UNTRANSLATABLE_DST4, TC "IPv4 packet's source address could not be translated with the given pool6."),
 	DEFINE_STAT(JSTAT_6056_F, TC "Unable to hash packet fields; cannot compute source port. (From my reading of the 4.15 kernel, this can only happen due to memory allocation failures, but YMMV.)"),
 	DEFINE_STAT(JSTAT_MASK_DOMAIN_NOT_FOUND, TC "There was no pool4 entry whose protocol and mark matched the incoming IPv6 packet."),
+	DEFINE_STAT(JSTAT_DET_NOT_SUBSCRIBER, TC "Deterministic mode is enabled, but the IPv6 packet's source address did not belong to det-prefix. (Or det-subscriber-length is incompatible with det-prefix.)"),
+	DEFINE_STAT(JSTAT_DET_NO_BLOCK, TC "Deterministic mode is enabled, but pool4 is too small to hold the IPv6 packet's subscriber's port block."),
 	DEFINE_STAT(JSTAT_BIB6_NOT_FOUND, TC "IPv6 packet did not match a BIB entry from the database, and one could not be created."),
 	DEFINE_STAT(JSTAT_BIB4_NOT_FOUND, TC "IPv4 packet did not match a BIB entry from the database."),
 	DEFINE_STAT(JSTAT_SESSION_NOT_FOUND, TC "Packet was an ICMP error, but did not match a session entry from the database. (Which means that the original packet couldn't have been translated.)"),
@@ -91,6 +95,31 @@ static struct joolnl_stat_metadata const jstat_metadatas[] = {
 	DEFINE_STAT(JSTAT_ICMP4ERR_FAILURE, "ICMPv4 errors (created by Jool, not translated) that could not be sent."),
 	DEFINE_STAT(JSTAT_ICMPEXT_BIG, "Illegal ICMP header length. (Exceeds available payload in packet.)"),
 
+	DEFINE_STAT(JSTAT64_IN_PLACE, "IPv6 packets translated by rewriting their own headers."),
+	DEFINE_STAT(JSTAT64_COPY, "IPv6 packets translated into a copy. (Because they were cloned, fragmented, ICMP, etc.)"),
+	DEFINE_STAT(JSTAT46_IN_PLACE, "IPv4 packets translated by rewriting their own headers."),
+	DEFINE_STAT(JSTAT46_COPY, "IPv4 packets translated into a copy. (Because they were cloned, fragmented, ICMP, etc.)"),
+	DEFINE_STAT(JSTAT_BIB_ALLOC_AVOIDED, "BIB entry allocations skipped because the packet's BIB entry already existed."),
+	DEFINE_STAT(JSTAT_SESSION_ALLOC_AVOIDED, "Session allocations skipped because the packet's session already existed."),
+
+	DEFINE_STAT(JSTAT_PBA_ALLOCATED, "Port blocks reserved for IPv6 source addresses. (See pba-block-size.)"),
+	DEFINE_STAT(JSTAT_PBA_RELEASED, "Port blocks returned to pool4 because their last BIB entry died."),
+	DEFINE_STAT(JSTAT_PBA_EXHAUSTED, "IPv6 source addresses that needed a port block, but pool4 had none left. (Their packets were dropped.)"),
+
+	DEFINE_STAT(JSTAT_BIB_QUOTA, "Packets dropped because their subscriber already had max-bibs-per-subscriber BIB entries."),
+	DEFINE_STAT(JSTAT_SESSION_QUOTA, "Packets dropped because their subscriber already had max-sessions-per-subscriber sessions."),
+	DEFINE_STAT(JSTAT_SESSION_EVICTED, "Sessions evicted to make room for new ones, because the instance had max-sessions sessions."),
+	DEFINE_STAT(JSTAT_SESSION_LIMIT, "Packets dropped because the instance had max-sessions sessions, and none of them could be evicted."),
+
+	DEFINE_STAT(JSTAT_EVLOG_QUEUED, "Binary log events queued for userspace. (See logging-binary.)"),
+	DEFINE_STAT(JSTAT_EVLOG_DROPPED, "Binary log events dropped because their CPU's queue was full. (Userspace is not keeping up.)"),
+
+	DEFINE_STAT(JSTAT_EXPIRE_HOLD_10US, "Session expiration batches that held their table lock for less than 10 microseconds."),
+	DEFINE_STAT(JSTAT_EXPIRE_HOLD_100US, "Session expiration batches that held their table lock for 10 to 100 microseconds."),
+	DEFINE_STAT(JSTAT_EXPIRE_HOLD_1MS, "Session expiration batches that held their table lock for 100 microseconds to 1 millisecond."),
+	DEFINE_STAT(JSTAT_EXPIRE_HOLD_10MS, "Session expiration batches that held their table lock for 1 to 10 milliseconds."),
+	DEFINE_STAT(JSTAT_EXPIRE_HOLD_SLOW, "Session expiration batches that held their table lock for 10 milliseconds or more."),
+
 	DEFINE_STAT(JSTAT_JOOLD_EMPTY, "Joold packet not sent; no sessions queued."),
 	DEFINE_STAT(JSTAT_JOOLD_TIMEOUT, "Joold packet sent; ss-flush-deadline reached."),
 	DEFINE_STAT(JSTAT_JOOLD_MISSING_ACK, "Joold packet not sent; still waiting for ACK."),
@@ -1,5 +1,6 @@
 #include <linux/module.h>
 #include "framework/unit_test.h"
+#include "mod/common/address.h"
 #include "mod/common/rfc6052.h"
 #include "mod/common/db/bib/db.h"
 
@@ -149,6 +150,130 @@ static bool test_foreach(void)
 	return success;
 }
 
+struct unit_dump_args {
+	/* Bit i is set once entries[i] has been visited. */
+	unsigned int visited;
+	/* Entries the callback will still accept during this round. */
+	unsigned int budget;
+};
+
+static int dump_cb(struct bib_entry const *bib, void *void_args)
+{
+	struct unit_dump_args *args = void_args;
+	unsigned int i;
+
+	if (args->budget == 0)
+		return 1;
+	args->budget--;
+
+	for (i = 0; i < TEST_BIB_COUNT; i++) {
+		if (taddr4_equals(&entries[i].addr4, &bib->addr4)) {
+			if (args->visited & (1u << i))
+				return -EEXIST;
+			args->visited |= 1u << i;
+			return 0;
+		}
+	}
+
+	return -ESRCH;
+}
+
+/* Dumps are not sorted, but they still have to visit everything once. */
+static bool test_dump(void)
+{
+	struct bib_dump_cursor cursor;
+	struct unit_dump_args args;
+	unsigned int rounds;
+	int error;
+	bool success = true;
+
+	if (!insert_test_bibs())
+		return false;
+
+	memset(&cursor, 0, sizeof(cursor));
+	args.visited = 0;
+	rounds = 0;
+	do {
+		args.budget = 2;
+		error = bib_dump(jool.nat64.bib, L4PROTO_UDP, &cursor, NULL,
+				dump_cb, &args);
+		rounds++;
+	} while (error == 1 && rounds < 2 * TEST_BIB_COUNT);
+
+	success &= ASSERT_INT(0, error, "result");
+	success &= ASSERT_UINT((1u << TEST_BIB_COUNT) - 1, args.visited,
+			"visited");
+
+	/* Dumps that are already over stay over. */
+	args.budget = 2;
+	error = bib_dump(jool.nat64.bib, L4PROTO_UDP, &cursor, NULL, dump_cb,
+			&args);
+	success &= ASSERT_INT(0, error, "extra round result");
+	success &= ASSERT_UINT(2, args.budget, "extra round budget");
+
+	return success;
+}
+
+static bool dump_filtered(struct bib_filter *filter, unsigned int expected,
+		char *name)
+{
+	struct bib_dump_cursor cursor;
+	struct unit_dump_args args;
+	unsigned int rounds;
+	int error;
+	bool success = true;
+
+	memset(&cursor, 0, sizeof(cursor));
+	args.visited = 0;
+	rounds = 0;
+	do {
+		args.budget = 1;
+		error = bib_dump(jool.nat64.bib, L4PROTO_UDP, &cursor, filter,
+				dump_cb, &args);
+		rounds++;
+	} while (error == 1 && rounds < 2 * TEST_BIB_COUNT);
+
+	success &= ASSERT_INT(0, error, "%s result", name);
+	success &= ASSERT_UINT(expected, args.visited, "%s visited", name);
+	return success;
+}
+
+static bool test_dump_filter(void)
+{
+	struct bib_filter filter;
+	bool success = true;
+
+	if (!insert_test_bibs())
+		return false;
+
+	memset(&filter, 0, sizeof(filter));
+	if (str_to_addr6("2001:db8::2", &filter.src6.addr))
+		return false;
+	filter.src6.len = 128;
+	filter.src6_set = true;
+	success &= dump_filtered(&filter, 0xE, "src6");
+
+	memset(&filter, 0, sizeof(filter));
+	if (str_to_addr4("192.0.2.2", &filter.src4.addr))
+		return false;
+	filter.src4.len = 31;
+	filter.src4_set = true;
+	success &= dump_filtered(&filter, 0x1E, "src4");
+
+	if (str_to_addr6("2001:db8::3", &filter.src6.addr))
+		return false;
+	filter.src6.len = 128;
+	filter.src6_set = true;
+	success &= dump_filtered(&filter, 0x10, "both");
+
+	if (str_to_addr6("2001:db8:1::", &filter.src6.addr))
+		return false;
+	filter.src6.len = 48;
+	success &= dump_filtered(&filter, 0, "none");
+
+	return success;
+}
+
 enum session_fate tcp_est_expire_cb(struct session_entry *session, void *arg)
 {
 	return FATE_RM;
@@ -178,6 +303,8 @@ static int bibtable_test_init(void)
 		return -EINVAL;
 
 	test_group_test(&test, test_foreach, "Foreach");
+	test_group_test(&test, test_dump, "Dump");
+	test_group_test(&test, test_dump_filter, "Dump filter");
 
 	return test_group_end(&test);
 }
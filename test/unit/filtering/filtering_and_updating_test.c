@@ -447,7 +447,7 @@ static bool test_icmp(void)
  */
 static bool test_tcp(void)
 {
-	struct xlation state = { .jool = jool };
+	struct xlation state = { .jool = &jool };
 	struct sk_buff *skb;
 	bool success = true;
 
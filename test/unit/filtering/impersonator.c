@@ -1,5 +1,7 @@
 #include "mod/common/dev.h"
+#include "mod/common/evlog.h"
 #include "mod/common/joold.h"
+#include "mod/common/timer.h"
 #include "framework/unit_test.h"
 
 static struct fake {
@@ -26,6 +28,47 @@ void joold_put(struct joold_queue *queue)
 	/* No code. */
 }
 
+struct evlog *evlog_alloc(struct net *ns, char *iname)
+{
+	return (struct evlog *)&dummy;
+}
+
+void evlog_get(struct evlog *evlog)
+{
+	/* No code. */
+}
+
+void evlog_put(struct evlog *evlog)
+{
+	/* No code. */
+}
+
+void evlog_stop(struct evlog *evlog)
+{
+	/* No code. */
+}
+
+void evlog_add(struct xlator *jool, enum jool_event_type type,
+		struct jool_event *event)
+{
+	/* No code. */
+}
+
+void jtimer_init(struct jtimer *timer, struct xlator *jool)
+{
+	/* No code. */
+}
+
+void jtimer_start(struct jtimer *timer)
+{
+	/* No code. */
+}
+
+void jtimer_stop(struct jtimer *timer)
+{
+	/* No code. */
+}
+
 int foreach_ifa(struct net *ns, int (*cb)(struct in_ifaddr *, void const *),
 		void const *args)
 {
@@ -17,3 +17,22 @@ int bib_inject(struct xlator *jool,
 
 	return bib_add_static(jool, entry);
 }
+
+/*
+ * Initializes @jool as a NAT64 instance (plus @flags) whose pool6 is
+ * 64:ff9b::/96.
+ */
+int bib_xlator_init(struct xlator *jool, xlator_flags flags)
+{
+	struct ipv6_prefix pool6;
+
+	/* The database derives the sessions' dst6 out of this. */
+	pool6.addr.s6_addr32[0] = cpu_to_be32(0x0064ff9bu);
+	pool6.addr.s6_addr32[1] = 0;
+	pool6.addr.s6_addr32[2] = 0;
+	pool6.addr.s6_addr32[3] = 0;
+	pool6.len = 96;
+
+	return xlator_init(jool, NULL, INAME_DEFAULT,
+			XF_NETFILTER | XT_NAT64 | flags, &pool6);
+}
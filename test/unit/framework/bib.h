@@ -6,5 +6,6 @@
 int bib_inject(struct xlator *jool,
 		char *addr6, u16 port6, char *addr4, u16 port4,
 		l4_protocol proto, struct bib_entry *entry);
+int bib_xlator_init(struct xlator *jool, xlator_flags flags);
 
 #endif /* _JOOL_UNIT_BIB_H */
@@ -1,3 +1,4 @@
+#include "mod/common/evlog.h"
 #include "mod/common/db/pool4/db.h"
 #include "mod/common/db/bib/pkt_queue.h"
 #include "framework/unit_test.h"
@@ -7,8 +8,8 @@ static struct fake_pktqueue {
 } dummy;
 
 int mask_domain_next(struct mask_domain *masks,
-		struct ipv4_transport_addr *addr,
-		bool *consecutive)
+		mask_domain_find_free_cb find_free, void *arg,
+		struct ipv4_transport_addr *addr)
 {
 	return broken_unit_call(__func__);
 }
@@ -79,3 +80,9 @@ void pktqueue_clean(struct list_head *probes)
 {
 	broken_unit_call(__func__);
 }
+
+void evlog_add(struct xlator *jool, enum jool_event_type type,
+		struct jool_event *event)
+{
+	broken_unit_call(__func__);
+}
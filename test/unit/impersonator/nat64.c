@@ -1,4 +1,6 @@
+#include "mod/common/evlog.h"
 #include "mod/common/joold.h"
+#include "mod/common/timer.h"
 #include "mod/common/db/pool4/db.h"
 #include "mod/common/db/bib/db.h"
 #include "mod/common/steps/compute_outgoing_tuple.h"
@@ -54,6 +56,27 @@ void joold_put(struct joold_queue *queue)
 	fail(__func__);
 }
 
+struct evlog *evlog_alloc(struct net *ns, char *iname)
+{
+	fail(__func__);
+	return NULL;
+}
+
+void evlog_get(struct evlog *evlog)
+{
+	fail(__func__);
+}
+
+void evlog_put(struct evlog *evlog)
+{
+	fail(__func__);
+}
+
+void evlog_stop(struct evlog *evlog)
+{
+	fail(__func__);
+}
+
 struct pool4 *pool4db_alloc(void)
 {
 	fail(__func__);
@@ -70,7 +93,7 @@ void pool4db_put(struct pool4 *pool)
 	fail(__func__);
 }
 
-struct bib *bib_alloc(void)
+struct bib *bib_alloc(bool hashed)
 {
 	fail(__func__);
 	return NULL;
@@ -86,6 +109,21 @@ void bib_put(struct bib *db)
 	fail(__func__);
 }
 
+void jtimer_init(struct jtimer *timer, struct xlator *jool)
+{
+	fail(__func__);
+}
+
+void jtimer_start(struct jtimer *timer)
+{
+	fail(__func__);
+}
+
+void jtimer_stop(struct jtimer *timer)
+{
+	fail(__func__);
+}
+
 bool is_hairpin_nat64(struct xlation *state)
 {
 	fail(__func__);
@@ -21,7 +21,7 @@ int xlator_init(struct xlator *jool, struct net *ns, char *iname,
 	error = globals_init(&jool->globals, XT_NAT64, pool6);
 	if (error)
 		return error;
-	jool->nat64.bib = bib_alloc();
+	jool->nat64.bib = bib_alloc(flags & XO_BIB_HASH);
 
 	return jool->nat64.bib ? 0 : -ENOMEM;
 }
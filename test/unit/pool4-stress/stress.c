@@ -0,0 +1,284 @@
+#include <linux/completion.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/skbuff.h>
+#include <linux/slab.h>
+
+#include "common/constants.h"
+#include "mod/common/dev.h"
+#include "mod/common/rfc6052.h"
+#include "mod/common/translation_state.h"
+#include "mod/common/xlator.h"
+#include "mod/common/db/pool4/db.h"
+#include "mod/common/db/pool4/rfc6056.h"
+#include "mod/common/rfc7915/6to4.h"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("pool4 concurrent connection setup stress test");
+
+/*
+ * Hammers mask_domain_find() + mask_domain_next() + mask_domain_commit() from
+ * one kernel thread per CPU, and reports the aggregate connection setup rate.
+ *
+ * "per-cpu" is the real thing. "shared" additionally reads and bumps a single
+ * module-wide atomic in the same places the ephemeral cursor used to be, so the
+ * difference between both is the cost of the cache line bouncing the per-CPU
+ * cursors got rid of. On a single core, both should be roughly the same; the
+ * gap should widen as the number of threads grows.
+ *
+ * The BIB is not involved; every candidate is assumed to be available.
+ */
+
+static unsigned int ITERATIONS = 1000000;
+module_param(ITERATIONS, uint, 0);
+MODULE_PARM_DESC(ITERATIONS, "Number of simulated connections per thread. Default 1000000.");
+
+static unsigned int THREADS = 0;
+module_param(THREADS, uint, 0);
+MODULE_PARM_DESC(THREADS, "Maximum number of threads (one per CPU). Default is zero, which means every online CPU.");
+
+static struct xlator jool;
+static atomic_t shared_cursor = ATOMIC_INIT(0);
+
+struct stress_thread {
+	struct task_struct *task;
+	bool shared;
+	struct completion *start;
+	struct completion done;
+	u64 ns;
+	unsigned int failures;
+};
+
+/* empty.c dependencies; pool4 is never empty here. */
+
+int foreach_ifa(struct net *ns, int (*cb)(struct in_ifaddr *, void const *),
+		void const *args)
+{
+	return -EINVAL;
+}
+
+int __rfc6052_6to4(struct ipv6_prefix const *prefix, struct in6_addr const *src,
+		struct in_addr *dst)
+{
+	return -EINVAL;
+}
+
+verdict predict_route64(struct xlation *state)
+{
+	return VERDICT_DROP;
+}
+
+static int first_is_free(void *arg, struct in_addr const *addr,
+		unsigned int min, unsigned int max)
+{
+	return min;
+}
+
+static int stress_fn(void *arg)
+{
+	struct stress_thread *thread = arg;
+	struct xlation *state;
+	struct tuple *tuple6;
+	struct mask_domain masks;
+	struct ipv4_transport_addr addr;
+	unsigned int i;
+	u64 start;
+
+	state = kmalloc(sizeof(*state), GFP_KERNEL);
+	if (!state)
+		goto fail;
+	xlation_init(state, &jool);
+	state->in.skb = alloc_skb(0, GFP_KERNEL);
+	if (!state->in.skb)
+		goto fail;
+	state->in.skb->mark = 0;
+
+	tuple6 = &state->in.tuple;
+	tuple6->src.addr6.l3.s6_addr32[0] = cpu_to_be32(0x20010db8u);
+	tuple6->src.addr6.l3.s6_addr32[2] = cpu_to_be32(smp_processor_id());
+	tuple6->dst.addr6.l3.s6_addr32[0] = cpu_to_be32(0x0064ff9bu);
+	tuple6->dst.addr6.l3.s6_addr32[3] = cpu_to_be32(0xc0000201u);
+	tuple6->dst.addr6.l4 = 80;
+	tuple6->l4_proto = L4PROTO_TCP;
+
+	wait_for_completion(thread->start);
+
+	local_bh_disable();
+	start = ktime_get_ns();
+	for (i = 0; i < ITERATIONS; i++) {
+		tuple6->src.addr6.l3.s6_addr32[3] = cpu_to_be32(i >> 4);
+		tuple6->src.addr6.l4 = 1024 + (i & 0xF);
+
+		if (thread->shared)
+			atomic_read(&shared_cursor);
+		if (mask_domain_find(state, &masks) != VERDICT_CONTINUE) {
+			thread->failures++;
+			continue;
+		}
+		if (mask_domain_next(&masks, first_is_free, NULL, &addr))
+			thread->failures++;
+		mask_domain_commit(&masks);
+		if (thread->shared)
+			atomic_add(masks.taddr_counter, &shared_cursor);
+		mask_domain_put(&masks);
+	}
+	thread->ns = ktime_get_ns() - start;
+	local_bh_enable();
+
+	kfree_skb(state->in.skb);
+	kfree(state);
+	complete(&thread->done);
+	return 0;
+
+fail:
+	if (state)
+		kfree(state);
+	thread->failures = ITERATIONS;
+	wait_for_completion(thread->start);
+	complete(&thread->done);
+	return 0;
+}
+
+static int run(char const *name, bool shared, unsigned int thread_count)
+{
+	struct stress_thread *threads;
+	DECLARE_COMPLETION_ONSTACK(start);
+	unsigned int started;
+	unsigned int failures;
+	unsigned int cpu;
+	unsigned int i;
+	u64 ns;
+	int error;
+
+	threads = kcalloc(thread_count, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	started = 0;
+	error = 0;
+	for_each_online_cpu(cpu) {
+		struct stress_thread *thread;
+
+		if (started >= thread_count)
+			break;
+
+		thread = &threads[started];
+		thread->shared = shared;
+		thread->start = &start;
+		init_completion(&thread->done);
+		thread->task = kthread_create(stress_fn, thread,
+				"pool4-stress/%u", cpu);
+		if (IS_ERR(thread->task)) {
+			error = PTR_ERR(thread->task);
+			break;
+		}
+		kthread_bind(thread->task, cpu);
+		wake_up_process(thread->task);
+		started++;
+	}
+
+	complete_all(&start);
+
+	ns = 0;
+	failures = 0;
+	for (i = 0; i < started; i++) {
+		wait_for_completion(&threads[i].done);
+		ns = max(ns, threads[i].ns);
+		failures += threads[i].failures;
+	}
+
+	if (!error) {
+		pr_info("%s, %u threads: %llu connections/s (%u failures)\n",
+				name, started, ns ? div64_u64((u64)started
+				* ITERATIONS * NSEC_PER_SEC, ns) : 0,
+				failures);
+	}
+
+	kfree(threads);
+	return error;
+}
+
+static int add_pool4(void)
+{
+	struct pool4_entry entry;
+
+	entry.mark = 0;
+	entry.iterations = 0;
+	entry.flags = ITERATIONS_SET | ITERATIONS_INFINITE;
+	entry.proto = L4PROTO_TCP;
+	entry.range.prefix.addr.s_addr = cpu_to_be32(0xc0000200u);
+	entry.range.prefix.len = 30;
+	entry.range.ports.min = 1024;
+	entry.range.ports.max = 65535;
+
+	return pool4db_add(jool.nat64.pool4, &entry);
+}
+
+static int pool4_stress_init(void)
+{
+	unsigned int max_threads;
+	unsigned int threads;
+	int error;
+
+	if (!ITERATIONS)
+		return -EINVAL;
+
+	max_threads = num_online_cpus();
+	if (THREADS && THREADS < max_threads)
+		max_threads = THREADS;
+
+	error = rfc6056_setup();
+	if (error)
+		return error;
+
+	memset(&jool, 0, sizeof(jool));
+	jool.globals.nat64.f_args = DEFAULT_F_ARGS;
+	jool.globals.nat64.f_hash = DEFAULT_F_HASH;
+	jool.nat64.pool4 = pool4db_alloc();
+	if (!jool.nat64.pool4) {
+		error = -ENOMEM;
+		goto end;
+	}
+	jool.stats = jstat_alloc();
+	if (!jool.stats) {
+		error = -ENOMEM;
+		goto end;
+	}
+
+	error = add_pool4();
+	if (error)
+		goto end;
+
+	threads = 1;
+	do {
+		error = run("per-cpu", false, threads);
+		if (error)
+			goto end;
+		error = run("shared", true, threads);
+		if (error)
+			goto end;
+		threads = (threads < max_threads)
+				? min(threads << 1, max_threads)
+				: 0;
+	} while (threads);
+	/* Fall through. */
+
+end:
+	if (jool.stats)
+		jstat_put(jool.stats);
+	if (jool.nat64.pool4)
+		pool4db_put(jool.nat64.pool4);
+	rfc6056_teardown();
+	return error;
+}
+
+static void pool4_stress_exit(void)
+{
+	/* No code. */
+}
+
+module_init(pool4_stress_init);
+module_exit(pool4_stress_exit);
@@ -516,6 +516,278 @@ static bool test_flush(void)
 	return success;
 }
 
+static struct pool4_domain *get_snapshot_domain(void)
+{
+	struct pool4_snapshot *snapshot;
+
+	snapshot = rcu_dereference_protected(pool->snapshot, true);
+	return snapshot ? find_domain(&snapshot->tcp, 1) : NULL;
+}
+
+/* Asserts the snapshot agrees with the mark tree. */
+static bool assert_snapshot(void)
+{
+	struct pool4_table *table;
+	struct pool4_domain *domain;
+	unsigned int offset;
+	unsigned int i;
+	bool success = true;
+
+	table = find_by_mark(&pool->tree_mark.tcp, 1);
+	if (!table) {
+		return ASSERT_PTR(NULL, rcu_dereference_protected(
+				pool->snapshot, true), "empty snapshot");
+	}
+
+	domain = get_snapshot_domain();
+	if (!ASSERT_BOOL(true, domain != NULL, "domain exists"))
+		return false;
+
+	success &= ASSERT_UINT(table->taddr_count, domain->taddr_count,
+			"taddr count");
+	success &= ASSERT_UINT(compute_max_iterations(table),
+			domain->max_iterations, "max iterations");
+	if (!ASSERT_UINT(table->sample_count, domain->range_count, "ranges"))
+		return false;
+
+	offset = 0;
+	for (i = 0; i < domain->range_count; i++) {
+		success &= ASSERT_BOOL(true, ipv4_range_equals(
+				first_table_entry(table) + i,
+				&domain->ranges[i]), "range %u", i);
+		success &= ASSERT_UINT(offset, domain->offsets[i],
+				"offset %u", i);
+		offset += port_range_count(&domain->ranges[i].ports);
+	}
+
+	return success;
+}
+
+static bool test_snapshot(void)
+{
+	bool success = true;
+
+	success &= assert_snapshot();
+
+	if (!add_common_samples())
+		return false;
+	success &= assert_snapshot();
+
+	if (!rm(0xc0000210U, 32, 16, 17)) /* Punch a hole in 192.0.2.16 */
+		return false;
+	success &= assert_snapshot();
+
+	pool4db_flush(pool);
+	success &= assert_snapshot();
+
+	return success;
+}
+
+/* Compares find_range() to the linear search it replaced. */
+static bool test_find_range(void)
+{
+	struct pool4_domain *domain;
+	unsigned int offset;
+	unsigned int remaining;
+	unsigned int expected;
+	unsigned int actual;
+	bool success = true;
+
+	if (!add_common_samples())
+		return false;
+	domain = get_snapshot_domain();
+	if (!ASSERT_BOOL(true, domain != NULL, "domain exists"))
+		return false;
+
+	for (offset = 0; offset < domain->taddr_count; offset++) {
+		remaining = offset;
+		for (expected = 0; expected < domain->range_count; expected++) {
+			if (remaining <= port_range_count(
+					&domain->ranges[expected].ports))
+				break;
+			remaining -= port_range_count(
+					&domain->ranges[expected].ports);
+		}
+
+		actual = find_range(domain->offsets, domain->range_count,
+				offset);
+		success &= ASSERT_UINT(expected, actual, "range of %u", offset);
+		success &= ASSERT_UINT(remaining,
+				offset - domain->offsets[actual],
+				"port of %u", offset);
+	}
+
+	return success;
+}
+
+static int det_first_free(void *arg, struct in_addr const *addr,
+		unsigned int min, unsigned int max)
+{
+	return min;
+}
+
+static bool assert_det_block(struct xlation *state, unsigned int subscriber,
+		__u32 first_addr, __u16 first_port,
+		__u32 last_addr, __u16 last_port)
+{
+	struct mask_domain masks;
+	struct ipv4_transport_addr addr;
+	struct ipv4_transport_addr first;
+	unsigned int count;
+	bool success = true;
+
+	state->in.tuple.src.addr6.l3.s6_addr[4] = subscriber;
+	if (!ASSERT_VERDICT(CONTINUE, mask_domain_find(state, &masks),
+			"subscriber %u verdict", subscriber))
+		return false;
+
+	count = 0;
+	while (!mask_domain_next(&masks, det_first_free, NULL, &addr)) {
+		if (count == 0)
+			first = addr;
+		count++;
+	}
+	mask_domain_put(&masks);
+
+	success &= ASSERT_UINT(400, count, "subscriber %u block size",
+			subscriber);
+	success &= ASSERT_BE32(first_addr, first.l3.s_addr, "first addr");
+	success &= ASSERT_UINT(first_port, first.l4, "first port");
+	success &= ASSERT_BE32(last_addr, addr.l3.s_addr, "last addr");
+	success &= ASSERT_UINT(last_port, addr.l4, "last port");
+	return success;
+}
+
+/*
+ * Prepares a deterministic @jool over two pool4 entries (1500 transport
+ * addresses), and a TCP @state from 2001:db8:: that translates through it.
+ * Revert with det_teardown().
+ */
+static bool det_setup(struct xlator *jool, struct xlation *state,
+		unsigned int prefix_len, unsigned int subscriber_len,
+		unsigned int block_size)
+{
+	if (!add(0xc0000201U, 32, 1000, 1999))
+		return false;
+	if (!add(0xc0000202U, 32, 3000, 3499))
+		return false;
+
+	memset(jool, 0, sizeof(*jool));
+	jool->nat64.pool4 = pool;
+	jool->stats = jstat_alloc();
+	if (!jool->stats)
+		return false;
+	jool->globals.nat64.det.prefix.set = true;
+	jool->globals.nat64.det.prefix.prefix.addr.s6_addr32[0] = cpu_to_be32(0x20010db8u);
+	jool->globals.nat64.det.prefix.prefix.len = prefix_len;
+	jool->globals.nat64.det.subscriber_len = subscriber_len;
+	jool->globals.nat64.det.block_size = block_size;
+
+	xlation_init(state, jool);
+	state->in.skb = alloc_skb(0, GFP_KERNEL);
+	if (!state->in.skb) {
+		jstat_put(jool->stats);
+		return false;
+	}
+	state->in.skb->mark = 1;
+	state->in.tuple.l4_proto = L4PROTO_TCP;
+	state->in.tuple.src.addr6.l3.s6_addr32[0] = cpu_to_be32(0x20010db8u);
+	return true;
+}
+
+static void det_teardown(struct xlator *jool, struct xlation *state)
+{
+	kfree_skb(state->in.skb);
+	jstat_put(jool->stats);
+}
+
+static bool test_deterministic(void)
+{
+	struct xlator jool;
+	struct xlation state;
+	struct mask_domain masks;
+	bool success = true;
+
+	if (!det_setup(&jool, &state, 32, 40, 400))
+		return false;
+
+	/* 1500 transport addresses, so 3 blocks of 400 and 300 leftovers. */
+	success &= assert_det_block(&state, 0,
+			0xc0000201U, 1000, 0xc0000201U, 1399);
+	success &= assert_det_block(&state, 1,
+			0xc0000201U, 1400, 0xc0000201U, 1799);
+	success &= assert_det_block(&state, 2,
+			0xc0000201U, 1800, 0xc0000202U, 3199);
+
+	state.in.tuple.src.addr6.l3.s6_addr[4] = 3;
+	success &= ASSERT_VERDICT(DROP, mask_domain_find(&state, &masks),
+			"subscriber without block");
+
+	state.in.tuple.src.addr6.l3.s6_addr32[0] = cpu_to_be32(0x20010db9u);
+	success &= ASSERT_VERDICT(DROP, mask_domain_find(&state, &masks),
+			"not a subscriber");
+
+	det_teardown(&jool, &state);
+	return success;
+}
+
+static bool test_narrow(void)
+{
+	struct xlator jool;
+	struct xlation state;
+	struct mask_domain masks;
+	struct ipv4_transport_addr addr;
+	struct ipv4_transport_addr first;
+	unsigned int count;
+	bool success = true;
+
+	/*
+	 * A single deterministic subscriber whose block is the whole pool is
+	 * the easiest way to get a domain that starts at offset zero.
+	 */
+	if (!det_setup(&jool, &state, 96, 128, 1500))
+		return false;
+
+	if (!ASSERT_VERDICT(CONTINUE, mask_domain_find(&state, &masks),
+			"mask_domain_find()")) {
+		success = false;
+		goto end;
+	}
+
+	/* 1500 transport addresses, so 3 blocks of 400 and 300 leftovers. */
+	success &= ASSERT_UINT(3, mask_domain_block_count(&masks, 400),
+			"block count");
+	success &= ASSERT_UINT(0, mask_domain_block_count(&masks, 0),
+			"block count, no blocks");
+
+	mask_domain_taddr(&masks, 800, &addr);
+	success &= ASSERT_BE32(0xc0000201U, addr.l3.s_addr, "taddr 800 addr");
+	success &= ASSERT_UINT(1800, addr.l4, "taddr 800 port");
+	mask_domain_taddr(&masks, 1199, &addr);
+	success &= ASSERT_BE32(0xc0000202U, addr.l3.s_addr, "taddr 1199 addr");
+	success &= ASSERT_UINT(3199, addr.l4, "taddr 1199 port");
+
+	/* The third block straddles the two entries. */
+	mask_domain_narrow(&masks, 800, 400);
+	count = 0;
+	while (!mask_domain_next(&masks, det_first_free, NULL, &addr)) {
+		if (count == 0)
+			first = addr;
+		count++;
+	}
+	mask_domain_put(&masks);
+
+	success &= ASSERT_UINT(400, count, "narrowed size");
+	success &= ASSERT_BE32(0xc0000201U, first.l3.s_addr, "first addr");
+	success &= ASSERT_UINT(1800, first.l4, "first port");
+	success &= ASSERT_BE32(0xc0000202U, addr.l3.s_addr, "last addr");
+	success &= ASSERT_UINT(3199, addr.l4, "last port");
+
+end:
+	det_teardown(&jool, &state);
+	return success;
+}
+
 static int init(void)
 {
 	pool = pool4db_alloc();
@@ -557,6 +829,10 @@ static int pool4db_test_init(void)
 	test_group_test(&test, test_add, "Add");
 	test_group_test(&test, test_rm, "Rm");
 	test_group_test(&test, test_flush, "Flush");
+	test_group_test(&test, test_snapshot, "Snapshot");
+	test_group_test(&test, test_find_range, "Range search");
+	test_group_test(&test, test_deterministic, "Deterministic mode");
+	test_group_test(&test, test_narrow, "Port blocks");
 
 	return test_group_end(&test);
 }
@@ -0,0 +1,189 @@
+#include <linux/module.h>
+
+#include "framework/unit_test.h"
+#include "mod/common/db/bib/port_map.h"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Port map module test");
+
+static struct port_maps maps;
+
+static void set_range(struct in_addr *addr, unsigned int min, unsigned int max)
+{
+	unsigned int port;
+
+	for (port = min; port <= max; port++)
+		port_map_set(&maps, addr, port);
+}
+
+static void clear_range(struct in_addr *addr, unsigned int min,
+		unsigned int max)
+{
+	unsigned int port;
+
+	for (port = min; port <= max; port++)
+		port_map_clear(&maps, addr, port);
+}
+
+struct foreach_args {
+	unsigned int maps;
+	unsigned int ports;
+};
+
+static int count_map(struct in_addr const *addr, unsigned int ports,
+		void *arg)
+{
+	struct foreach_args *args = arg;
+
+	args->maps++;
+	args->ports += ports;
+	return 0;
+}
+
+static bool assert_maps(unsigned int maps_expected,
+		unsigned int ports_expected, char *test_name)
+{
+	struct foreach_args args = { 0 };
+	bool success = true;
+
+	success &= ASSERT_INT(0, port_maps_foreach(&maps, count_map, &args),
+			"%s: foreach", test_name);
+	success &= ASSERT_UINT(maps_expected, args.maps, "%s: maps",
+			test_name);
+	success &= ASSERT_UINT(ports_expected, args.ports, "%s: ports",
+			test_name);
+	return success;
+}
+
+static bool test_lifecycle(void)
+{
+	struct in_addr addr1 = { .s_addr = cpu_to_be32(0xc0000201u) };
+	struct in_addr addr2 = { .s_addr = cpu_to_be32(0xc0000202u) };
+	bool success = true;
+
+	success &= assert_maps(0, 0, "empty");
+
+	/* Two chunks of the first address, one of the second one. */
+	success &= ASSERT_INT(0, port_map_set(&maps, &addr1, 10), "set 1");
+	success &= ASSERT_INT(0, port_map_set(&maps, &addr1, 60000), "set 2");
+	success &= ASSERT_INT(0, port_map_set(&maps, &addr2, 10), "set 3");
+	success &= ASSERT_INT(0, port_map_set(&maps, &addr2, 10), "set 3 again");
+	success &= assert_maps(2, 3, "populated");
+
+	/* Empty chunk; the map has to survive. */
+	port_map_clear(&maps, &addr1, 60000);
+	success &= assert_maps(2, 2, "one chunk released");
+	success &= ASSERT_INT(60000, port_map_find_free(&maps, &addr1, 60000,
+			65535), "released chunk is free");
+
+	/* Empty maps are released. */
+	port_map_clear(&maps, &addr1, 10);
+	port_map_clear(&maps, &addr1, 10);
+	success &= assert_maps(1, 1, "one map released");
+	port_map_clear(&maps, &addr2, 10);
+	success &= assert_maps(0, 0, "all maps released");
+
+	/* And can come back. */
+	success &= ASSERT_INT(0, port_map_set(&maps, &addr1, 10), "set again");
+	success &= assert_maps(1, 1, "map recreated");
+	success &= ASSERT_INT(11, port_map_find_free(&maps, &addr1, 10, 20),
+			"recreated map is indexed");
+	port_map_clear(&maps, &addr1, 10);
+
+	return success;
+}
+
+static bool test_find_free(void)
+{
+	struct in_addr addr = { .s_addr = cpu_to_be32(0xc0000203u) };
+	bool success = true;
+
+	success &= ASSERT_INT(0, port_map_find_free(&maps, &addr, 0, 65535),
+			"empty");
+	success &= ASSERT_INT(1000, port_map_find_free(&maps, &addr, 1000,
+			2000), "empty, offset");
+
+	/* Same word. */
+	set_range(&addr, 1000, 1002);
+	success &= ASSERT_INT(1003, port_map_find_free(&maps, &addr, 1000,
+			2000), "partial word");
+	success &= ASSERT_INT(999, port_map_find_free(&maps, &addr, 999, 2000),
+			"before the taken ports");
+	success &= ASSERT_INT(-ENOENT, port_map_find_free(&maps, &addr, 1000,
+			1002), "range exhausted");
+
+	/* Several full words in a row, across chunks. */
+	set_range(&addr, 1003, 4999);
+	success &= ASSERT_INT(5000, port_map_find_free(&maps, &addr, 1000,
+			65535), "full words");
+	success &= ASSERT_INT(-ENOENT, port_map_find_free(&maps, &addr, 1000,
+			4999), "full words, exhausted");
+
+	/* Release one in the middle. */
+	port_map_clear(&maps, &addr, 3000);
+	success &= ASSERT_INT(3000, port_map_find_free(&maps, &addr, 1000,
+			65535), "released");
+	success &= ASSERT_INT(5000, port_map_find_free(&maps, &addr, 3001,
+			65535), "after the released one");
+
+	/* Everything. */
+	set_range(&addr, 0, 65535);
+	success &= ASSERT_INT(-ENOENT, port_map_find_free(&maps, &addr, 0,
+			65535), "all taken");
+	port_map_clear(&maps, &addr, 65535);
+	success &= ASSERT_INT(65535, port_map_find_free(&maps, &addr, 0,
+			65535), "last one");
+
+	clear_range(&addr, 0, 65535);
+	success &= assert_maps(0, 0, "cleared");
+
+	return success;
+}
+
+static int init(void)
+{
+	port_maps_init(&maps);
+	return 0;
+}
+
+static void clean(void)
+{
+	port_maps_destroy(&maps);
+}
+
+static int portmap_test_init(void)
+{
+	struct test_group test = {
+		.name = "Port map",
+		.init_fn = init,
+		.clean_fn = clean,
+	};
+
+	int error;
+
+	error = port_map_setup();
+	if (error)
+		return error;
+
+	if (test_group_begin(&test)) {
+		port_map_teardown();
+		return -EINVAL;
+	}
+
+	test_group_test(&test, test_lifecycle, "Lifecycle");
+	test_group_test(&test, test_find_free, "Find free");
+
+	error = test_group_end(&test);
+	rcu_barrier(); /* Wait for the released maps and chunks. */
+	port_map_teardown();
+	return error;
+}
+
+static void portmap_test_exit(void)
+{
+	/* No code. */
+}
+
+module_init(portmap_test_init);
+module_exit(portmap_test_exit);
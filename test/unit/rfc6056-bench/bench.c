@@ -0,0 +1,102 @@
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/timex.h>
+
+#include "common/constants.h"
+#include "mod/common/db/pool4/rfc6056.c"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("RFC 6056 F() benchmark");
+
+/*
+ * Measures the cost of F() (ie. of computing the pool4 offset of a new
+ * connection) with each of the available f-hash implementations.
+ *
+ * Every iteration simulates a different connection (by changing the source
+ * address and port), and the default f-args are used, so the numbers should be
+ * comparable to a new-connection flood.
+ */
+
+static unsigned int ITERATIONS = 1000000;
+module_param(ITERATIONS, uint, 0);
+MODULE_PARM_DESC(ITERATIONS, "Number of simulated connections per test. Default 1000000.");
+
+static int run(char const *name, __u8 f_hash)
+{
+	struct xlator jool;
+	struct xlation state;
+	struct tuple *tuple6;
+	unsigned int result;
+	unsigned int i;
+	cycles_t start_cycles;
+	cycles_t cycles;
+	u64 start_ns;
+	u64 ns;
+	int error;
+
+	memset(&jool, 0, sizeof(jool));
+	jool.globals.nat64.f_args = DEFAULT_F_ARGS;
+	jool.globals.nat64.f_hash = f_hash;
+	xlation_init(&state, &jool);
+
+	tuple6 = &state.in.tuple;
+	tuple6->src.addr6.l3.s6_addr32[0] = cpu_to_be32(0x20010db8u);
+	tuple6->dst.addr6.l3.s6_addr32[0] = cpu_to_be32(0x0064ff9bu);
+	tuple6->dst.addr6.l3.s6_addr32[3] = cpu_to_be32(0xc0000201u);
+	tuple6->dst.addr6.l4 = 53;
+	tuple6->l4_proto = L4PROTO_UDP;
+
+	local_bh_disable();
+	start_ns = ktime_get_ns();
+	start_cycles = get_cycles();
+	for (i = 0; i < ITERATIONS; i++) {
+		tuple6->src.addr6.l3.s6_addr32[3] = cpu_to_be32(i >> 4);
+		tuple6->src.addr6.l4 = 1024 + (i & 0xF);
+		error = rfc6056_f(&state, &result);
+		if (error) {
+			local_bh_enable();
+			pr_err("%s: F() failed: %d\n", name, error);
+			return error;
+		}
+	}
+	cycles = get_cycles() - start_cycles;
+	ns = ktime_get_ns() - start_ns;
+	local_bh_enable();
+
+	pr_info("%s: %llu cycles per connection, %llu connections/s\n", name,
+			(unsigned long long)cycles / ITERATIONS,
+			ns ? div64_u64((u64)ITERATIONS * NSEC_PER_SEC, ns) : 0);
+	return 0;
+}
+
+static int rfc6056_bench_init(void)
+{
+	int error;
+
+	if (!ITERATIONS)
+		return -EINVAL;
+
+	error = rfc6056_setup();
+	if (error)
+		return error;
+
+	error = run("md5", F_HASH_MD5);
+	if (error)
+		goto end;
+	error = run("siphash", F_HASH_SIPHASH);
+	/* Fall through. */
+
+end:
+	rfc6056_teardown();
+	return error;
+}
+
+static void rfc6056_bench_exit(void)
+{
+	/* No code. */
+}
+
+module_init(rfc6056_bench_init);
+module_exit(rfc6056_bench_exit);
@@ -7,16 +7,8 @@ MODULE_LICENSE(JOOL_LICENSE);
 MODULE_AUTHOR("Alberto Leiva");
 MODULE_DESCRIPTION("Port allocator module test.");
 
-static bool test_md5(void)
+static void init_abc_tuple(struct tuple *tuple6)
 {
-	struct xlation state;
-	struct tuple *tuple6;
-	unsigned int result;
-	bool success = true;
-
-	xlation_init(&state, NULL);
-	tuple6 = &state.in.tuple;
-
 	tuple6->src.addr6.l3.s6_addr[0] = 'a';
 	tuple6->src.addr6.l3.s6_addr[1] = 'b';
 	tuple6->src.addr6.l3.s6_addr[2] = 'c';
@@ -50,7 +42,20 @@ static bool test_md5(void)
 	tuple6->dst.addr6.l3.s6_addr[14] = 'E';
 	tuple6->dst.addr6.l3.s6_addr[15] = 'F';
 	tuple6->dst.addr6.l4 = (__force __u16)cpu_to_be16(('G' << 8) | 'H');
-	state.jool.globals.nat64.f_args = 0b1011;
+}
+
+static bool test_md5(void)
+{
+	struct xlator jool;
+	struct xlation state;
+	unsigned int result;
+	bool success = true;
+
+	memset(&jool, 0, sizeof(jool));
+	xlation_init(&state, &jool);
+	init_abc_tuple(&state.in.tuple);
+	jool.globals.nat64.f_args = 0b1011;
+	jool.globals.nat64.f_hash = F_HASH_MD5;
 
 	secret_key[0] = 'I';
 	secret_key[1] = 'J';
@@ -63,18 +68,49 @@ static bool test_md5(void)
 	return success;
 }
 
-static bool f_args_test(void)
+static bool test_siphash(void)
+{
+	struct xlator jool;
+	struct xlation state;
+	unsigned int result;
+	bool success = true;
+
+	memset(&jool, 0, sizeof(jool));
+	xlation_init(&state, &jool);
+	init_abc_tuple(&state.in.tuple);
+	/* Ports excluded, so the input doesn't depend on endianness. */
+	jool.globals.nat64.f_args = 0b1010;
+	jool.globals.nat64.f_hash = F_HASH_SIPHASH;
+
+	/* The key from the SipHash paper's test vectors. */
+	siphash_key.key[0] = 0x0706050403020100ULL;
+	siphash_key.key[1] = 0x0f0e0d0c0b0a0908ULL;
+
+	success &= ASSERT_INT(0, rfc6056_f(&state, &result), "errcode");
+	/*
+	 * SipHash-2-4 of "abc...zABCDEF" followed by 8 zeroes (the ports and
+	 * the padding), truncated to the lower 32 bits.
+	 */
+	success &= ASSERT_UINT(0xdb030c0bu, result, "hash");
+
+	return success;
+}
+
+static bool f_args_test(__u8 f_hash)
 {
+	struct xlator jool;
 	struct xlation state;
 	bool success = true;
 	unsigned int result1;
 	unsigned int result2;
 
-	xlation_init(&state, NULL);
+	memset(&jool, 0, sizeof(jool));
+	xlation_init(&state, &jool);
+	jool.globals.nat64.f_hash = f_hash;
 
 	if (init_tuple6(&state.in.tuple, "1::1", 1111, "2::2", 2222, L4PROTO_TCP))
 		return false;
-	state.jool.globals.nat64.f_args = 0b1111;
+	jool.globals.nat64.f_args = 0b1111;
 
 	success &= ASSERT_INT(0, rfc6056_f(&state, &result1), "result 1");
 	success &= ASSERT_INT(0, rfc6056_f(&state, &result2), "result 2");
@@ -95,7 +131,7 @@ static bool f_args_test(void)
 
 	if (init_tuple6(&state.in.tuple, "1::1", 1111, "2::2", 2222, L4PROTO_TCP))
 		return false;
-	state.jool.globals.nat64.f_args = 0b0010;
+	jool.globals.nat64.f_args = 0b0010;
 
 	success &= ASSERT_INT(0, rfc6056_f(&state, &result1), "result 4");
 	success &= ASSERT_INT(0, rfc6056_f(&state, &result2), "result 5");
@@ -118,6 +154,16 @@ static bool f_args_test(void)
 	return success;
 }
 
+static bool f_args_test_md5(void)
+{
+	return f_args_test(F_HASH_MD5);
+}
+
+static bool f_args_test_siphash(void)
+{
+	return f_args_test(F_HASH_SIPHASH);
+}
+
 static int rfc6056_test_init(void)
 {
 	struct test_group test = {
@@ -130,7 +176,10 @@ static int rfc6056_test_init(void)
 		return -EINVAL;
 
 	test_group_test(&test, test_md5, "MD5 Test");
-	test_group_test(&test, f_args_test, "F() arguments test");
+	test_group_test(&test, test_siphash, "SipHash Test");
+	test_group_test(&test, f_args_test_md5, "F() arguments test (MD5)");
+	test_group_test(&test, f_args_test_siphash,
+			"F() arguments test (SipHash)");
 
 	return test_group_end(&test);
 }
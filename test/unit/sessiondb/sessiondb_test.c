@@ -1,6 +1,7 @@
 #include <linux/module.h>
 #include <linux/printk.h>
 
+#include "framework/bib.h"
 #include "framework/unit_test.h"
 #include "common/constants.h"
 #include "mod/common/rfc6052.h"
@@ -11,16 +12,11 @@ MODULE_AUTHOR("Alberto Leiva Popper");
 MODULE_DESCRIPTION("Session DB module test.");
 
 static struct xlator jool;
+static bool hashed;
 static const l4_protocol PROTO = L4PROTO_UDP;
 static struct session_entry session_instances[16];
 static struct session_entry *sessions[4][4][4][4];
 
-int __rfc6052_4to6(struct ipv6_prefix const *prefix, struct in_addr const *src,
-		struct in6_addr *dst)
-{
-	return broken_unit_call(__func__);
-}
-
 static void init_src6(struct ipv6_transport_addr *addr, __u16 last_byte,
 		__u16 port)
 {
@@ -85,6 +81,30 @@ static bool assert_session(unsigned int la, unsigned int lp,
 			"session %u %u %u %u lookup", la, lp, ra, rp);
 }
 
+static bool assert_bib(unsigned int la, unsigned int lp)
+{
+	struct ipv6_transport_addr src6;
+	struct ipv4_transport_addr src4;
+	struct bib_entry bib;
+	unsigned int ra, rp;
+	int expected;
+	bool success = true;
+
+	expected = -ESRCH;
+	for (ra = 0; ra < 4; ra++)
+		for (rp = 0; rp < 4; rp++)
+			if (sessions[la][lp][ra][rp])
+				expected = 0;
+
+	init_src6(&src6, la, lp);
+	init_src4(&src4, la, lp);
+	success &= ASSERT_INT(expected, bib_find6(jool.nat64.bib, PROTO, &src6,
+			&bib), "bib6 %u %u lookup", la, lp);
+	success &= ASSERT_INT(expected, bib_find4(jool.nat64.bib, PROTO, &src4,
+			&bib), "bib4 %u %u lookup", la, lp);
+	return success;
+}
+
 static bool test_db(void)
 {
 	unsigned int la; /* local addr */
@@ -95,6 +115,7 @@ static bool test_db(void)
 
 	for (la = 0; la < 4; la++) {
 		for (lp = 0; lp < 4; lp++) {
+			success &= assert_bib(la, lp);
 			for (ra = 0; ra < 4; ra++) {
 				for (rp = 0; rp < 4; rp++) {
 					success &= assert_session(la, lp, ra, rp);
@@ -264,8 +285,7 @@ enum session_fate tcp_est_expire_cb(struct session_entry *session, void *arg)
 
 static int init(void)
 {
-	return xlator_init(&jool, NULL, INAME_DEFAULT, XF_NETFILTER | XT_NAT64,
-			NULL);
+	return bib_xlator_init(&jool, hashed ? XO_BIB_HASH : 0);
 }
 
 static void clean(void)
@@ -286,6 +306,8 @@ static int sessiondb_test_init(void)
 		return -EINVAL;
 
 	test_group_test(&test, simple_session, "Single Session");
+	hashed = true;
+	test_group_test(&test, simple_session, "Single Session (hashed BIB)");
 
 	return test_group_end(&test);
 }
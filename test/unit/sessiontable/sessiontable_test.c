@@ -1,4 +1,5 @@
 #include <linux/module.h>
+#include "framework/bib.h"
 #include "framework/unit_test.h"
 #include "common/constants.h"
 #include "mod/common/rfc6052.h"
@@ -12,12 +13,6 @@ static struct xlator jool;
 #define TEST_SESSION_COUNT 9
 static struct session_entry entries[TEST_SESSION_COUNT];
 
-int __rfc6052_4to6(struct ipv6_prefix const *prefix, struct in_addr const *src,
-		struct in6_addr *dst)
-{
-	return broken_unit_call(__func__);
-}
-
 static void init_src6(struct in6_addr *addr, __u16 last_byte)
 {
 	addr->s6_addr32[0] = cpu_to_be32(0x20010db8u);
@@ -273,6 +268,52 @@ static bool test_foreach(void)
 	return success;
 }
 
+static int addr_cb(struct in_addr const *addr, unsigned int bibs, void *arg)
+{
+	unsigned int *counts = arg;
+	__u32 host = be32_to_cpu(addr->s_addr);
+
+	if ((host & 0xffffff00u) != 0xcb007100u || (host & 0xffu) > 3)
+		return -EINVAL;
+	counts[host & 0xffu] = bibs;
+	return 0;
+}
+
+static bool test_stats(void)
+{
+	struct bib_stats stats;
+	unsigned int counts[4] = { 0 };
+	bool success = true;
+
+	if (!insert_test_sessions())
+		return false;
+
+	success &= ASSERT_INT(0, bib_stats(jool.nat64.bib, L4PROTO_UDP, 128,
+			&stats), "/128 result");
+	success &= ASSERT_UINT(9, stats.states[ESTABLISHED], "Established");
+	success &= ASSERT_UINT(9, stats.timers[SESSION_TIMER_EST], "EST timer");
+	success &= ASSERT_UINT(0, stats.timers[SESSION_TIMER_TRANS], "TRANS");
+	success &= ASSERT_UINT(9, stats.idle[0], "Idle");
+	success &= ASSERT_BOOL(true, stats.has_subscribers, "Has subscribers");
+	/* ::1 and ::3 have one session each, ::2 has seven. */
+	success &= ASSERT_UINT(3, stats.subscriber_count, "/128 subscribers");
+	success &= ASSERT_UINT(2, stats.subscribers[0], "/128 bucket 0");
+	success &= ASSERT_UINT(1, stats.subscribers[2], "/128 bucket 2");
+
+	success &= ASSERT_INT(0, bib_stats(jool.nat64.bib, L4PROTO_UDP, 64,
+			&stats), "/64 result");
+	success &= ASSERT_UINT(1, stats.subscriber_count, "/64 subscribers");
+	success &= ASSERT_UINT(1, stats.subscribers[3], "/64 bucket 3");
+
+	success &= ASSERT_INT(0, bib_foreach_addr4(jool.nat64.bib, L4PROTO_UDP,
+			addr_cb, counts), "Addr foreach");
+	success &= ASSERT_UINT(1, counts[1], "203.0.113.1");
+	success &= ASSERT_UINT(3, counts[2], "203.0.113.2");
+	success &= ASSERT_UINT(1, counts[3], "203.0.113.3");
+
+	return success;
+}
+
 enum session_fate tcp_est_expire_cb(struct session_entry *session, void *arg)
 {
 	return FATE_RM;
@@ -280,8 +321,7 @@ enum session_fate tcp_est_expire_cb(struct session_entry *session, void *arg)
 
 static int init(void)
 {
-	return xlator_init(&jool, NULL, INAME_DEFAULT, XF_NETFILTER | XT_NAT64,
-			NULL);
+	return bib_xlator_init(&jool, 0);
 }
 
 static void clean(void)
@@ -302,6 +342,7 @@ static int sessiontable_test_init(void)
 		return -EINVAL;
 
 	test_group_test(&test, test_foreach, "Foreach");
+	test_group_test(&test, test_stats, "Stats");
 
 	return test_group_end(&test);
 }
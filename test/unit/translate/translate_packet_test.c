@@ -15,7 +15,7 @@ MODULE_DESCRIPTION("Translating the Packet module test.");
 
 xlator_type xlator_get_type(struct xlator const *instance)
 {
-	return XT_SIIT;
+	return xlator_is_nat64(instance) ? XT_NAT64 : XT_SIIT;
 }
 
 static bool test_function_has_unexpired_src_route(void)
@@ -136,21 +136,23 @@ static bool test_function_build_id_field(void)
 #define min_mtu(packet, in, out, len) be32_to_cpu(icmp6_minimum_mtu(&state, packet, out, in, len))
 static bool test_function_icmp6_minimum_mtu(void)
 {
+	struct xlator jool;
 	struct xlation state;
 	int i;
 	bool success = true;
 
-	if (globals_init(&state.jool.globals, XT_SIIT, NULL))
+	xlation_init(&state, &jool);
+	if (globals_init(&jool.globals, XT_SIIT, NULL))
 		return false;
 
 	/*
 	 * I'm assuming the default plateaus list has 3 elements or more.
 	 * (so I don't have to reallocate mtu_plateaus)
 	 */
-	state.jool.globals.plateaus.values[0] = 5000;
-	state.jool.globals.plateaus.values[1] = 4000;
-	state.jool.globals.plateaus.values[2] = 500;
-	state.jool.globals.plateaus.count = 2;
+	jool.globals.plateaus.values[0] = 5000;
+	jool.globals.plateaus.values[1] = 4000;
+	jool.globals.plateaus.values[2] = 500;
+	jool.globals.plateaus.count = 2;
 
 	/* Simple tests */
 	success &= ASSERT_UINT(1320, min_mtu(1300, 3000, 3000, 2000), "min(1300, 3000, 3000)");
@@ -347,10 +349,379 @@ static bool test_function_icmp4_minimum_mtu(void)
 	return success;
 }
 
+/*
+ * In-place translation tests.
+ *
+ * These run in NAT64 mode, because it takes the addresses and ports from the
+ * tuple instead of the EAMT.
+ */
+
+static struct xlator nat64;
+
+static int init_nat64(void)
+{
+	memset(&nat64, 0, sizeof(nat64));
+	nat64.ns = &init_net;
+	nat64.flags = XT_NAT64;
+	return globals_init(&nat64.globals, XT_NAT64, NULL);
+}
+
+/*
+ * Turns @skb into what a NIC with checksum offloading would hand over: The L4
+ * checksum only covers the pseudoheader, and the rest is pending.
+ */
+static void partialize_pkt(struct sk_buff *skb, l4_protocol l4_proto)
+{
+	unsigned int len = skb->len - skb_transport_offset(skb);
+	__u8 proto;
+	__sum16 *check;
+
+	if (l4_proto == L4PROTO_TCP) {
+		proto = IPPROTO_TCP;
+		check = &tcp_hdr(skb)->check;
+		partialize_skb(skb, offsetof(struct tcphdr, check));
+	} else {
+		proto = IPPROTO_UDP;
+		check = &udp_hdr(skb)->check;
+		partialize_skb(skb, offsetof(struct udphdr, check));
+	}
+
+	*check = (skb->protocol == htons(ETH_P_IPV6))
+			? ~csum_ipv6_magic(&ipv6_hdr(skb)->saddr,
+					&ipv6_hdr(skb)->daddr, len, proto, 0)
+			: ~csum_tcpudp_magic(ip_hdr(skb)->saddr,
+					ip_hdr(skb)->daddr, len, proto, 0);
+}
+
+/*
+ * 6->4 packets go from 2001:db8::1#1234 to 64:ff9b::203.0.113.5#80.
+ * 4->6 packets are the responses, and arrive through 192.0.2.1#61000.
+ */
+static int create_pkt(l3_protocol l3_proto, l4_protocol l4_proto,
+		bool partial, struct sk_buff **result)
+{
+	struct sk_buff *skb;
+	int error;
+
+	if (l3_proto == L3PROTO_IPV6) {
+		error = (l4_proto == L4PROTO_TCP)
+			? create_skb6_tcp("2001:db8::1", 1234,
+					"64:ff9b::cb00:7105", 80, 100, 32, &skb)
+			: create_skb6_udp("2001:db8::1", 1234,
+					"64:ff9b::cb00:7105", 80, 100, 32, &skb);
+	} else {
+		error = (l4_proto == L4PROTO_TCP)
+			? create_skb4_tcp("203.0.113.5", 80,
+					"192.0.2.1", 61000, 100, 32, &skb)
+			: create_skb4_udp("203.0.113.5", 80,
+					"192.0.2.1", 61000, 100, 32, &skb);
+	}
+	if (error)
+		return error;
+
+	if (partial)
+		partialize_pkt(skb, l4_proto);
+
+	*result = skb;
+	return 0;
+}
+
+/* Prepares @state for the translation of @skb, as the previous steps would. */
+static int init_state(struct xlation *state, struct sk_buff *skb)
+{
+	xlation_init(state, &nat64);
+
+	if (skb->protocol == htons(ETH_P_IPV6)) {
+		if (pkt_init_ipv6(state, skb))
+			return -EINVAL;
+		return init_tuple4(&state->out.tuple, "192.0.2.1", 61000,
+				"203.0.113.5", 80, pkt_l4_proto(&state->in));
+	}
+
+	if (pkt_init_ipv4(state, skb))
+		return -EINVAL;
+	return init_tuple6(&state->out.tuple, "64:ff9b::cb00:7105", 80,
+			"2001:db8::1", 1234, pkt_l4_proto(&state->in));
+}
+
+/*
+ * Compares two outgoing packets. The IPv4 identification is random, so it (and
+ * the header checksum that covers it) is only validated, not compared.
+ */
+static bool assert_same_pkt(struct sk_buff *expected, struct sk_buff *actual)
+{
+	unsigned char *buf_exp;
+	unsigned char *buf_act;
+	struct iphdr *hdr4;
+	bool success = true;
+
+	success &= ASSERT_UINT(expected->len, actual->len, "Length");
+	success &= ASSERT_BE16(be16_to_cpu(expected->protocol),
+			actual->protocol, "Protocol");
+	success &= ASSERT_INT(skb_network_offset(expected),
+			skb_network_offset(actual), "Network header");
+	success &= ASSERT_INT(skb_transport_offset(expected),
+			skb_transport_offset(actual), "Transport header");
+	success &= ASSERT_UINT((unsigned int)expected->ip_summed,
+			(unsigned int)actual->ip_summed, "ip_summed");
+	if (expected->ip_summed == CHECKSUM_PARTIAL) {
+		success &= ASSERT_INT(skb_checksum_start_offset(expected),
+				skb_checksum_start_offset(actual),
+				"csum_start");
+		success &= ASSERT_UINT(expected->csum_offset,
+				actual->csum_offset, "csum_offset");
+	}
+	if (!success)
+		return false;
+
+	buf_exp = kmalloc(expected->len, GFP_ATOMIC);
+	buf_act = kmalloc(actual->len, GFP_ATOMIC);
+	if (!buf_exp || !buf_act) {
+		log_err("Could not allocate the comparison buffers.");
+		success = false;
+		goto end;
+	}
+	if (skb_copy_bits(expected, 0, buf_exp, expected->len)
+			|| skb_copy_bits(actual, 0, buf_act, actual->len)) {
+		log_err("Could not read the packets.");
+		success = false;
+		goto end;
+	}
+
+	if (expected->protocol == htons(ETH_P_IP)) {
+		hdr4 = (struct iphdr *)buf_exp;
+		success &= ASSERT_UINT(0, (unsigned int)ip_fast_csum(hdr4, 5),
+				"Expected IPv4 header checksum");
+		hdr4->id = 0;
+		hdr4->check = 0;
+
+		hdr4 = (struct iphdr *)buf_act;
+		success &= ASSERT_UINT(0, (unsigned int)ip_fast_csum(hdr4, 5),
+				"Actual IPv4 header checksum");
+		hdr4->id = 0;
+		hdr4->check = 0;
+	}
+
+	success &= ASSERT_INT(0, memcmp(buf_exp, buf_act, expected->len),
+			"Packet contents");
+
+end:
+	kfree(buf_exp);
+	kfree(buf_act);
+	return success;
+}
+
+/*
+ * Translates two instances of the same packet: One in place, and the other one
+ * through the copy path. (Which is forced by cloning it.) The results have to
+ * be the same.
+ */
+static bool test_in_place(l3_protocol l3_proto, l4_protocol l4_proto,
+		bool partial)
+{
+	static struct xlation in_place;
+	static struct xlation copy;
+	struct sk_buff *skb_in_place = NULL;
+	struct sk_buff *skb_copy = NULL;
+	struct sk_buff *clone = NULL;
+	bool success = false;
+
+	xlation_init(&in_place, &nat64);
+	xlation_init(&copy, &nat64);
+
+	if (create_pkt(l3_proto, l4_proto, partial, &skb_in_place))
+		goto end;
+	if (create_pkt(l3_proto, l4_proto, partial, &skb_copy))
+		goto end;
+	clone = skb_clone(skb_copy, GFP_ATOMIC);
+	if (!clone)
+		goto end;
+	if (init_state(&in_place, skb_in_place))
+		goto end;
+	if (init_state(&copy, skb_copy))
+		goto end;
+
+	success = true;
+	success &= ASSERT_VERDICT(CONTINUE, translating_the_packet(&in_place),
+			"In-place result");
+	success &= ASSERT_BOOL(true, xlation_is_in_place(&in_place),
+			"In-place packet was rewritten");
+	success &= ASSERT_VERDICT(CONTINUE, translating_the_packet(&copy),
+			"Copy result");
+	success &= ASSERT_BOOL(false, copy.in_place, "Cloned packet was copied");
+	if (success)
+		success = assert_same_pkt(copy.out.skb, in_place.out.skb);
+
+end:
+	/* If it was translated in place, @in_place.out.skb is @skb_in_place. */
+	kfree_skb_list(copy.out.skb);
+	kfree_skb(clone);
+	kfree_skb(skb_copy);
+	kfree_skb(skb_in_place);
+	return success;
+}
+
+static bool test_in_place_64(void)
+{
+	bool success = true;
+
+	success &= test_in_place(L3PROTO_IPV6, L4PROTO_TCP, false);
+	success &= test_in_place(L3PROTO_IPV6, L4PROTO_UDP, false);
+	success &= test_in_place(L3PROTO_IPV6, L4PROTO_TCP, true);
+	success &= test_in_place(L3PROTO_IPV6, L4PROTO_UDP, true);
+
+	return success;
+}
+
+static bool test_in_place_46(void)
+{
+	bool success = true;
+
+	success &= test_in_place(L3PROTO_IPV4, L4PROTO_TCP, false);
+	success &= test_in_place(L3PROTO_IPV4, L4PROTO_UDP, false);
+	success &= test_in_place(L3PROTO_IPV4, L4PROTO_TCP, true);
+	success &= test_in_place(L3PROTO_IPV4, L4PROTO_UDP, true);
+
+	return success;
+}
+
+/* Asserts @skb is not eligible for in-place translation. @skb is consumed. */
+static bool assert_copied(struct sk_buff *skb, char *name)
+{
+	static struct xlation state;
+	verdict result;
+	bool success = true;
+
+	if (init_state(&state, skb)) {
+		kfree_skb(skb);
+		return false;
+	}
+
+	result = (skb->protocol == htons(ETH_P_IPV6))
+			? ttp64_alloc_skb(&state)
+			: ttp46_alloc_skb(&state);
+	success &= ASSERT_VERDICT(CONTINUE, result, "%s: result", name);
+	success &= ASSERT_BOOL(false, state.in_place, "%s: in place", name);
+	success &= ASSERT_BOOL(true, state.out.skb && state.out.skb != skb,
+			"%s: copied", name);
+
+	kfree_skb_list(state.out.skb);
+	kfree_skb(skb);
+	return success;
+}
+
+static bool test_in_place_fallback_cloned(void)
+{
+	struct sk_buff *skb;
+	struct sk_buff *clone;
+	bool success = true;
+
+	if (create_pkt(L3PROTO_IPV6, L4PROTO_TCP, false, &skb))
+		return false;
+	clone = skb_clone(skb, GFP_ATOMIC);
+	if (!clone) {
+		kfree_skb(skb);
+		return false;
+	}
+	success &= assert_copied(skb, "6->4");
+	kfree_skb(clone);
+
+	if (create_pkt(L3PROTO_IPV4, L4PROTO_TCP, false, &skb))
+		return false;
+	clone = skb_clone(skb, GFP_ATOMIC);
+	if (!clone) {
+		kfree_skb(skb);
+		return false;
+	}
+	success &= assert_copied(skb, "4->6");
+	kfree_skb(clone);
+
+	return success;
+}
+
+/*
+ * Inserts a Fragment header (first fragment, more coming) between @skb's IPv6
+ * and layer 4 headers.
+ */
+static void add_frag_hdr(struct sk_buff *skb)
+{
+	struct ipv6hdr *hdr6;
+	struct frag_hdr *hdr_frag;
+
+	skb_push(skb, sizeof(*hdr_frag));
+	memmove(skb->data, skb->data + sizeof(*hdr_frag), sizeof(*hdr6));
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+	skb_set_transport_header(skb, sizeof(*hdr6) + sizeof(*hdr_frag));
+
+	hdr6 = ipv6_hdr(skb);
+	hdr_frag = (struct frag_hdr *)(hdr6 + 1);
+	hdr_frag->nexthdr = hdr6->nexthdr;
+	hdr_frag->reserved = 0;
+	hdr_frag->frag_off = build_ipv6_frag_off_field(0, true);
+	hdr_frag->identification = cpu_to_be32(1234);
+	hdr6->nexthdr = NEXTHDR_FRAGMENT;
+	hdr6->payload_len = cpu_to_be16(skb->len - sizeof(*hdr6));
+}
+
+static bool test_in_place_fallback_fragment(void)
+{
+	struct sk_buff *skb;
+	struct iphdr *hdr4;
+	bool success = true;
+
+	if (create_pkt(L3PROTO_IPV6, L4PROTO_UDP, false, &skb))
+		return false;
+	add_frag_hdr(skb);
+	success &= assert_copied(skb, "6->4");
+
+	if (create_pkt(L3PROTO_IPV4, L4PROTO_UDP, false, &skb))
+		return false;
+	hdr4 = ip_hdr(skb);
+	hdr4->frag_off = build_ipv4_frag_off_field(false, true, 0);
+	hdr4->check = 0;
+	hdr4->check = ip_fast_csum(hdr4, hdr4->ihl);
+	success &= assert_copied(skb, "4->6");
+
+	return success;
+}
+
+static bool test_in_place_fallback_zero_csum(void)
+{
+	struct sk_buff *skb;
+
+	if (create_pkt(L3PROTO_IPV4, L4PROTO_UDP, false, &skb))
+		return false;
+	udp_hdr(skb)->check = 0;
+	return assert_copied(skb, "4->6");
+}
+
+static bool test_in_place_fallback_headroom(void)
+{
+	struct sk_buff *skb;
+	struct sk_buff *tight;
+
+	if (create_pkt(L3PROTO_IPV4, L4PROTO_TCP, false, &skb))
+		return false;
+	tight = skb_copy_expand(skb, 0, 0, GFP_ATOMIC);
+	kfree_skb(skb);
+	if (!tight)
+		return false;
+
+	if (!ASSERT_BOOL(true, (int)skb_headroom(tight) < in_place_delta(tight),
+			"Headroom is insufficient")) {
+		kfree_skb(tight);
+		return false;
+	}
+
+	return assert_copied(tight, "4->6");
+}
+
 static int translate_packet_test_init(void)
 {
 	struct test_group test = {
 		.name = "Translating the Packet",
+		.setup_fn = init_nat64,
 	};
 
 	if (test_group_begin(&test))
@@ -366,6 +737,14 @@ static int translate_packet_test_init(void)
 	test_group_test(&test, test_function_has_nonzero_segments_left, "Segments left indicator function");
 	test_group_test(&test, test_function_icmp4_minimum_mtu, "ICMP4 Minimum MTU function");
 
+	/* In-place translation */
+	test_group_test(&test, test_in_place_64, "In-place 6->4");
+	test_group_test(&test, test_in_place_46, "In-place 4->6");
+	test_group_test(&test, test_in_place_fallback_cloned, "In-place fallback: cloned");
+	test_group_test(&test, test_in_place_fallback_fragment, "In-place fallback: fragment");
+	test_group_test(&test, test_in_place_fallback_zero_csum, "In-place fallback: zero UDP checksum");
+	test_group_test(&test, test_in_place_fallback_headroom, "In-place fallback: headroom");
+
 	return test_group_end(&test);
 }
 
@@ -0,0 +1,137 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/timex.h>
+
+#include "mod/common/translation_state.h"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Translation state allocation benchmark");
+
+/*
+ * Measures the per-packet cost of obtaining and releasing a translation state.
+ *
+ * "slab" is the way it used to be done (kmem_cache_alloc() + memset() +
+ * kmem_cache_free()), "pool" is xlation_create() + xlation_destroy(). The
+ * hairpin variants nest a second state inside of the first one, the way
+ * handling_hairpinning_*() does.
+ */
+
+static unsigned int ITERATIONS = 1000000;
+module_param(ITERATIONS, uint, 0);
+MODULE_PARM_DESC(ITERATIONS, "Number of simulated packets per test. Default 1000000.");
+
+static struct kmem_cache *cache;
+
+static void report(char const *name, cycles_t start, cycles_t end)
+{
+	pr_info("%s: %llu cycles per packet\n", name,
+			(unsigned long long)(end - start) / ITERATIONS);
+}
+
+static int slab_get(unsigned int depth)
+{
+	struct xlation *states[2];
+	unsigned int i;
+
+	for (i = 0; i < depth; i++) {
+		states[i] = kmem_cache_alloc(cache, GFP_ATOMIC);
+		if (!states[i])
+			goto fail;
+		memset(states[i], 0, sizeof(*states[i]));
+	}
+	for (i = depth; i > 0; i--)
+		kmem_cache_free(cache, states[i - 1]);
+	return 0;
+
+fail:
+	for (; i > 0; i--)
+		kmem_cache_free(cache, states[i - 1]);
+	return -ENOMEM;
+}
+
+static int pool_get(unsigned int depth)
+{
+	struct xlation *states[2];
+	unsigned int i;
+
+	for (i = 0; i < depth; i++) {
+		states[i] = xlation_create(NULL);
+		if (!states[i])
+			goto fail;
+	}
+	for (i = depth; i > 0; i--)
+		xlation_destroy(states[i - 1]);
+	return 0;
+
+fail:
+	for (; i > 0; i--)
+		xlation_destroy(states[i - 1]);
+	return -ENOMEM;
+}
+
+static int run(char const *name, int (*fn)(unsigned int), unsigned int depth)
+{
+	cycles_t start;
+	unsigned int i;
+	int error;
+
+	local_bh_disable();
+	start = get_cycles();
+	for (i = 0; i < ITERATIONS; i++) {
+		error = fn(depth);
+		if (error) {
+			local_bh_enable();
+			pr_err("%s: Allocation failed.\n", name);
+			return error;
+		}
+	}
+	report(name, start, get_cycles());
+	local_bh_enable();
+
+	return 0;
+}
+
+static int xlation_bench_init(void)
+{
+	int error;
+
+	if (!ITERATIONS)
+		return -EINVAL;
+
+	cache = kmem_cache_create("jool_xlations_bench",
+			sizeof(struct xlation), 0, 0, NULL);
+	if (!cache)
+		return -ENOMEM;
+	error = xlation_setup();
+	if (error)
+		goto end;
+
+	pr_info("sizeof(struct xlation): %zu\n", sizeof(struct xlation));
+	error = run("slab", slab_get, 1);
+	if (error)
+		goto teardown;
+	error = run("pool", pool_get, 1);
+	if (error)
+		goto teardown;
+	error = run("slab (hairpin)", slab_get, 2);
+	if (error)
+		goto teardown;
+	error = run("pool (hairpin)", pool_get, 2);
+	/* Fall through. */
+
+teardown:
+	xlation_teardown();
+end:
+	kmem_cache_destroy(cache);
+	return error;
+}
+
+static void xlation_bench_exit(void)
+{
+	/* No code. */
+}
+
+module_init(xlation_bench_init);
+module_exit(xlation_bench_exit);